@@ -10,10 +10,18 @@
 #include "codegen.h"
 
 #include <assert.h>
+#include <cpuid.h>
+#include <elf.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/mman.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <map>
+#include <set>
+#include <vector>
 
 #include <llvm/Analysis/Verifier.h>
 #include <llvm/Constants.h>
@@ -26,9 +34,7 @@
 #include <llvm/Target/TargetData.h>
 
 #include "expand_constantexpr.h"
-#include "expand_getelementptr.h"
 #include "expand_varargs.h"
-#include "gen_runtime_helpers_atomic.h"
 #include "runtime_helpers.h"
 
 #define TEMPL(string) string, (sizeof(string) - 1)
@@ -39,9 +45,37 @@
 static const int kPointerSizeBits = 32;
 
 // We always reserve stack space for calling runtime helper functions.
+// FP conversions also use it as scratch space.  Only leaf functions
+// without a frame pointer do without it (see translate_function()).
 // TODO: Only reserve this stack space if it is actually needed.
 static const int kMinCalleeArgsSize = 4 * 3; // 3 arguments
 
+// Switches with at least this many cases are generated as jump tables
+// if at least kMinJumpTableDensity percent of the table's entries
+// would be cases rather than the default.  Other switches are
+// generated as a binary search.
+static const unsigned kMinJumpTableCases = 4;
+static const unsigned kMinJumpTableDensity = 40;
+
+// The stack pointer is kept aligned to this at call sites, as the
+// i386 System V ABI requires.  We assume that our callers do the same,
+// so that on entry to a function, after "pushl %ebp", %ebp is 8 bytes
+// past an aligned address.
+static const int kStackAlignment = 16;
+
+// Passed as the x86 condition code to generate an unconditional jump.
+static const int kJumpAlways = -1;
+
+// memcpy and memset calls with constant lengths of up to
+// kMaxUnrolledMemOpSize bytes are expanded into unrolled moves, or up
+// to kMaxSSEMemOpSize bytes when the host has SSE2.  Up to
+// kMaxRepMemOpSize bytes, they use "rep movsl" and "rep stosl".
+// Larger ones call the host's C library, which picks the best
+// implementation for the host CPU when it starts up.
+static const uint64_t kMaxUnrolledMemOpSize = 32;
+static const uint64_t kMaxSSEMemOpSize = 128; // Fills 8 XMM registers
+static const uint64_t kMaxRepMemOpSize = 4096;
+
 void dump_range_as_code(char *start, char *end) {
   FILE *fp = fopen("tmp_data", "w");
   assert(fp);
@@ -50,14 +84,59 @@ void dump_range_as_code(char *start, char *end) {
   system("objdump -D -b binary -m i386 tmp_data | grep '^ '");
 }
 
-void runtime_log(const char *msg) {
-  fprintf(stderr, "%s\n", msg);
+bool host_has_sse2() {
+  unsigned int eax, ebx, ecx, edx;
+  return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (edx & bit_SSE2) != 0;
 }
 
-// TODO: Remove all uses of unhandled_case()!
-void runtime_unhandled(const char *desc) {
-  fprintf(stderr, "Runtime fatal error: case not handled: %s\n", desc);
-  abort();
+bool host_has_popcnt() {
+  unsigned int eax, ebx, ecx, edx;
+  return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_POPCNT) != 0;
+}
+
+struct HostSymbol {
+  const char *name;
+  uintptr_t addr;
+};
+
+// The functions and data outside the generated code that it refers
+// to.  A translation cache or an object file refers to these by their
+// indexes in this table or by their names, because their addresses
+// can differ between runs.  See load_translation() and
+// write_object_file().
+#define HOST_SYMBOL(name) { #name, (uintptr_t) name }
+static const HostSymbol kHostSymbols[] = {
+  HOST_SYMBOL(runtime_log),
+  HOST_SYMBOL(runtime_unhandled),
+  HOST_SYMBOL(runtime_tls_get),
+  HOST_SYMBOL(runtime_i64_UDiv),
+  HOST_SYMBOL(runtime_i64_URem),
+  HOST_SYMBOL(runtime_i64_SDiv),
+  HOST_SYMBOL(runtime_i64_SRem),
+  HOST_SYMBOL(runtime_i64_UMulOverflow),
+  HOST_SYMBOL(runtime_i64_SMulOverflow),
+  HOST_SYMBOL(runtime_f64_FRem),
+  HOST_SYMBOL(runtime_f32_FRem),
+  HOST_SYMBOL(runtime_u64_to_f64),
+  HOST_SYMBOL(runtime_u64_to_f32),
+  HOST_SYMBOL(runtime_f64_to_u64),
+  HOST_SYMBOL(runtime_f32_to_u64),
+  HOST_SYMBOL(runtime_popcount_table),
+  HOST_SYMBOL(memcpy),
+  HOST_SYMBOL(memmove),
+  HOST_SYMBOL(memset),
+};
+#undef HOST_SYMBOL
+
+// Returns the index of |addr| in kHostSymbols, or -1 if it is not
+// there.
+int get_host_symbol(uintptr_t addr) {
+  for (unsigned i = 0; i < sizeof(kHostSymbols) / sizeof(kHostSymbols[0]);
+       ++i) {
+    if (kHostSymbols[i].addr == addr)
+      return i;
+  }
+  return -1;
 }
 
 bool is_i64(llvm::Type *ty) {
@@ -70,6 +149,16 @@ bool is_i64(llvm::Type *ty) {
   return false;
 }
 
+// Returns whether values of type |ty| occupy two 32-bit words.  These
+// are i64 and double, which are moved around in two parts.
+bool is_64bit(llvm::Type *ty) {
+  return is_i64(ty) || ty->isDoubleTy();
+}
+
+bool is_fp(llvm::Type *ty) {
+  return ty->isFloatTy() || ty->isDoubleTy();
+}
+
 void expand_constant(llvm::Constant *val, llvm::TargetData *data_layout,
                      llvm::GlobalValue **result_global,
                      uint64_t *result_offset,
@@ -84,7 +173,7 @@ void expand_constant(llvm::Constant *val, llvm::TargetData *data_layout,
     assert(*result_offset == cval->getZExtValue());
   } else if (llvm::ConstantFP *cval = llvm::dyn_cast<llvm::ConstantFP>(val)) {
     llvm::APInt data = cval->getValueAPF().bitcastToAPInt();
-    assert(data.getBitWidth() == 64);
+    assert(data.getBitWidth() == 32 || data.getBitWidth() == 64);
     *result_global = NULL;
     *result_offset = data.getZExtValue();
   } else if (llvm::isa<llvm::ConstantPointerNull>(val)) {
@@ -143,24 +232,139 @@ enum X86ArithOpcode {
   X86ArithCmp,
 };
 
+// The "/digit" opcode extensions of the shift instructions.
+enum X86ShiftOpcode {
+  X86ShiftShl = 4,
+  X86ShiftShr = 5,
+  X86ShiftSar = 7,
+};
+
+enum {
+  REG_EAX = 0,
+  REG_ECX,
+  REG_EDX,
+  REG_EBX,
+  REG_ESP,
+  REG_EBP,
+  REG_ESI,
+  REG_EDI,
+};
+
+// Returns k if |value| is 2^k, or -1 otherwise.
+int log2_exact(uint32_t value) {
+  if (value == 0 || (value & (value - 1)) != 0)
+    return -1;
+  int k = 0;
+  while ((1u << k) != value)
+    ++k;
+  return k;
+}
+
+// Used in place of a register number in MemOperand for an absent
+// base or index register.
+const int kNoReg = -1;
+
+// A memory operand of the form disp(%base_reg,%index_reg,scale).  If
+// |global| is non-NULL, its address is added to the displacement.
+struct MemOperand {
+  int base_reg;
+  int index_reg;
+  int scale;
+  int32_t disp;
+  llvm::GlobalValue *global;
+  // Whether |disp| is an address in the data segment, such as that of
+  // a constant pool entry.
+  bool data_addr;
+};
+
+// Returns the memory operand offset(%esp).
+MemOperand esp_mem(int offset) {
+  MemOperand mem = { REG_ESP, kNoReg, 1, offset, NULL };
+  return mem;
+}
+
+// Second bytes (after 0x0f) of the scalar SSE2 instructions that we
+// use.  The prefix from get_sse_prefix() selects the float or double
+// form.
+enum SSEOpcode {
+  SSEMovLoad = 0x10, // movss/movsd mem, %xmm
+  SSEMovStore = 0x11, // movss/movsd %xmm, mem
+  SSECvtIntToFP = 0x2a, // cvtsi2ss/cvtsi2sd
+  SSECvtFPToInt = 0x2c, // cvttss2si/cvttsd2si (truncating)
+  SSEAdd = 0x58,
+  SSEMul = 0x59,
+  SSECvtFPToFP = 0x5a, // cvtss2sd/cvtsd2ss
+  SSESub = 0x5c,
+  SSEDiv = 0x5e,
+};
+
+// Returns the prefix that selects the form of an SSE instruction that
+// operates on (or, for conversions, from) |type|.
+int get_sse_prefix(llvm::Type *type) {
+  assert(is_fp(type));
+  return type->isDoubleTy() ? 0xf2 : 0xf3;
+}
+
+// A part of the generated code and data that a translation cache
+// stores, and the place in the cache file that it is stored at.
+struct ImageRegion {
+  uint32_t addr;
+  uint32_t size;
+  uint32_t prot;
+  uint32_t file_offset;
+};
+
 class DataBuffer {
-  char *buf_;
-  char *buf_end_;
+  // A buffer is a list of chunks, each of which is mapped separately.
+  // Chunks never move, so we know the absolute address of a global
+  // variable or function (for example) at the point we generate it,
+  // before we finish generating all code and data.  An object (such
+  // as a function's code) must not straddle two chunks: see
+  // reserve() and translate_function().
+  struct Chunk {
+    char *start;
+    char *end;
+    // How far the chunk was filled when we moved on to the next one.
+    // For the last chunk, see current_.
+    char *used_end;
+  };
+  std::vector<Chunk> chunks_;
   char *current_;
+  int prot_;
+  // The usual size of a chunk: see CodeGenOptions::buffer_chunk_size.
+  size_t chunk_size_;
+
+  // Each chunk is followed by a page that we don't use, so that the
+  // end of one chunk is never the start of another, and a position
+  // in the buffer tells us which chunk it is in.
+  void add_chunk(size_t size) {
+    size_t page_size = getpagesize();
+    size = (size + page_size - 1) & ~(page_size - 1);
+    char *start = (char *) mmap(NULL, size + page_size, prot_,
+                                MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    assert(start != MAP_FAILED);
+    if (!chunks_.empty())
+      chunks_.back().used_end = current_;
+    Chunk chunk = { start, start + size, start };
+    chunks_.push_back(chunk);
+    current_ = start;
+  }
+
+  void unmap_chunk(const Chunk &chunk) {
+    munmap(chunk.start, chunk.end - chunk.start + getpagesize());
+  }
+
+  void remove_last_chunk() {
+    unmap_chunk(chunks_.back());
+    chunks_.pop_back();
+    assert(!chunks_.empty());
+    current_ = chunks_.back().used_end;
+  }
 
 public:
-  DataBuffer(int prot) {
-    // TODO: Use an expandable buffer.
-    // For now, allocating a large buffer means that we know the
-    // absolute address of a global variable (for example) at the
-    // point we generate it, before we finish generating all code and
-    // data.  This means we don't need to implement full relocations
-    // yet.
-    int size = 16 * 1024 * 1024; // 16MB
-    buf_ = (char *) mmap(NULL, size, prot, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-    assert(buf_ != MAP_FAILED);
-    buf_end_ = buf_ + size;
-    current_ = buf_;
+  DataBuffer(int prot, size_t chunk_size):
+      prot_(prot), chunk_size_(chunk_size) {
+    add_chunk(chunk_size_);
   }
 
   char *get_current_pos() {
@@ -168,12 +372,43 @@ public:
   }
 
   char *put_alloc_space(size_t size) {
+    reserve(size);
     char *alloced = current_;
-    assert(current_ + size < buf_end_);
     current_ += size;
     return alloced;
   }
 
+  // Ensures that the next |size| bytes that are written are
+  // contiguous, by starting a new chunk if the current chunk does not
+  // have room for them.
+  void reserve(size_t size) {
+    if (current_ + size > chunks_.back().end)
+      add_chunk(std::max(size, chunk_size_));
+  }
+
+  // Starts a new chunk for an object that did not fit in the rest of
+  // the current chunk, after rewinding to the object's start.  If the
+  // object was at the start of the current chunk, the chunk is too
+  // small for it, so it is replaced with one twice as big.
+  void start_new_chunk() {
+    Chunk &chunk = chunks_.back();
+    size_t size = chunk_size_;
+    if (current_ == chunk.start) {
+      size = 2 * (chunk.end - chunk.start);
+      unmap_chunk(chunk);
+      chunks_.pop_back();
+      if (!chunks_.empty())
+        current_ = chunks_.back().used_end;
+    }
+    add_chunk(size);
+  }
+
+  // Returns whether the bytes from |pos| up to the current position
+  // are contiguous.
+  bool is_contiguous_since(char *pos) {
+    return chunks_.back().start <= pos && pos <= current_;
+  }
+
   void put_bytes(const char *data, size_t size) {
     memcpy(put_alloc_space(size), data, size);
   }
@@ -181,15 +416,90 @@ public:
   void put_uint32(uint32_t val) {
     *(uint32_t *) put_alloc_space(sizeof(val)) = val;
   }
+
+  void align(size_t alignment) {
+    size_t padding = ((alignment - (uintptr_t) current_ % alignment) %
+                      alignment);
+    // A new chunk starts on a page boundary, so it needs no padding.
+    if (current_ + padding > chunks_.back().end) {
+      add_chunk(chunk_size_);
+    } else {
+      put_alloc_space(padding);
+    }
+  }
+
+  // Discard everything that was written after |pos|, including any
+  // chunks that were started after it.
+  void rewind_to(char *pos) {
+    while (!is_contiguous_since(pos))
+      remove_last_chunk();
+    current_ = pos;
+  }
+
+  bool contains(void *addr) {
+    for (unsigned i = 0; i < chunks_.size(); ++i) {
+      if (chunks_[i].start <= addr && addr < chunks_[i].end)
+        return true;
+    }
+    return false;
+  }
+
+  // Returns whether |addr| is in the part of the buffer that has been
+  // written so far.
+  bool is_allocated(void *addr) {
+    for (unsigned i = 0; i < chunks_.size(); ++i) {
+      char *used_end = (i + 1 == chunks_.size() ?
+                        current_ : chunks_[i].used_end);
+      if (chunks_[i].start <= addr && addr < used_end)
+        return true;
+    }
+    return false;
+  }
+
+  // Unmaps the pages at the end of each chunk that have not been
+  // written, apart from the unused page that follows the chunk.  We
+  // can still write more afterwards, but it will go in a new chunk.
+  void release_unused() {
+    size_t page_size = getpagesize();
+    for (unsigned i = 0; i < chunks_.size(); ++i) {
+      Chunk &chunk = chunks_[i];
+      char *used_end = i + 1 == chunks_.size() ? current_ : chunk.used_end;
+      char *new_end = (char *) (((uintptr_t) used_end + page_size - 1) &
+                                ~(page_size - 1));
+      if (new_end < chunk.end) {
+        munmap(new_end + page_size, chunk.end - new_end);
+        chunk.end = new_end;
+      }
+    }
+  }
+
+  // Adds the parts of the chunks that have been written so far to
+  // |regions|.
+  void get_image_regions(std::vector<ImageRegion> *regions) {
+    for (unsigned i = 0; i < chunks_.size(); ++i) {
+      char *used_end = (i + 1 == chunks_.size() ?
+                        current_ : chunks_[i].used_end);
+      if (used_end == chunks_[i].start)
+        continue;
+      ImageRegion region = { (uint32_t) chunks_[i].start,
+                             (uint32_t) (used_end - chunks_[i].start),
+                             (uint32_t) prot_, 0 };
+      regions->push_back(region);
+    }
+  }
 };
 
 class CodeBuf : public DataBuffer {
 public:
   CodeBuf(llvm::TargetData *data_layout_arg, CodeGenOptions *options_arg):
-      DataBuffer(PROT_READ | PROT_WRITE | PROT_EXEC),
-      data_segment(PROT_READ | PROT_WRITE),
+      DataBuffer(PROT_READ | PROT_WRITE | PROT_EXEC,
+                 options_arg->buffer_chunk_size),
+      data_segment(PROT_READ | PROT_WRITE, options_arg->buffer_chunk_size),
       data_layout(data_layout_arg),
-      options(options_arg) {
+      options(options_arg),
+      have_sse2(host_has_sse2()),
+      have_popcnt(host_has_popcnt()),
+      next_bb(NULL) {
   }
 
   void put_code(const char *data, size_t size) {
@@ -204,6 +514,10 @@ public:
     // TODO: We could cache this mapping so that we don't have to
     // chase down the reference chain each time an aliased value is
     // used.
+    std::map<llvm::Value*,llvm::Value*>::iterator redundant =
+      redundant_values.find(inst);
+    if (redundant != redundant_values.end())
+      return redundant->second;
     if (llvm::isa<llvm::BitCastInst>(inst) ||
         llvm::isa<llvm::TruncInst>(inst) ||
         llvm::isa<llvm::PtrToIntInst>(inst) ||
@@ -224,10 +538,20 @@ public:
     return NULL;
   }
 
+  // Copy |str| to the data segment, so that it is kept with the
+  // code that uses it, and return its address.
+  uint32_t put_data_string(const char *str) {
+    size_t size = strlen(str) + 1;
+    char *addr = data_segment.put_alloc_space(size);
+    memcpy(addr, str, size);
+    data_segment.align(4);
+    return (uint32_t) addr;
+  }
+
   void put_log_message(const char *msg) {
     // pushl $desc
     put_byte(0x68);
-    put_uint32((uint32_t) strdup(msg));
+    put_data_addr(put_data_string(msg));
     put_direct_call((uintptr_t) runtime_log);
     // addl $4, %esp
     put_byte(0x81);
@@ -237,15 +561,17 @@ public:
 
   // TODO: Remove all uses of unhandled_case()!
   void unhandled_case(const char *desc) {
-    fprintf(stderr, "Warning: not handled: %s\n", desc);
+    // Don't repeat the warning when regenerating a function's code.
+    if (!regenerating_code)
+      fprintf(stderr, "Warning: not handled: %s\n", desc);
     // pushl $desc
     put_byte(0x68);
-    put_uint32((uint32_t) strdup(desc));
+    put_data_addr(put_data_string(desc));
     put_direct_call((uintptr_t) runtime_unhandled);
   }
 
   void check_offset_in_value(llvm::Type *ty, int offset) {
-    if (is_i64(ty)) {
+    if (is_64bit(ty)) {
       assert(offset == 0 || offset == 4);
     } else {
       assert(offset == 0);
@@ -278,14 +604,18 @@ public:
       } else {
         put_uint32(offset);
       }
+    } else if (static_allocas.count(value) == 1) {
+      // leal offset(%ebp), %reg
+      put_lea(reg, static_alloca_mem(value));
     } else if (llvm::isa<llvm::Instruction>(value) ||
                llvm::isa<llvm::Argument>(value)) {
-      assert(stackslots.count(value) == 1);
-      int ebp_offset = stackslots[value] + offset_in_value;
-      // movl ebp_offset(%ebp), %reg
-      put_byte(0x8b);
-      put_byte(0x85 | (reg << 3));
-      put_uint32(ebp_offset);
+      if (value_regs.count(value) == 1) {
+        assert(offset_in_value == 0);
+        put_mov_reg_reg(reg, value_regs[value]);
+      } else {
+        assert(stackslots.count(value) == 1);
+        read_reg_from_frame(reg, stackslots[value] + offset_in_value);
+      }
     } else {
       assert(!"Unknown value type");
     }
@@ -293,7 +623,7 @@ public:
 
   // Generate code to put |value| into |reg|.
   void move_to_reg(int reg, llvm::Value *value) {
-    assert(!is_i64(value->getType()));
+    assert(!is_64bit(value->getType()));
     move_part_to_reg(reg, value, 0);
   }
 
@@ -307,41 +637,140 @@ public:
       const char *unhandled = NULL;
       expand_constant(cval, data_layout, &global, &offset, &unhandled);
       assert(!unhandled);
-      // Put constant in data segment.
-      // TODO: We could intern these constants, or avoid taking their
-      // address to start with.
+      // TODO: We could avoid taking the constant's address to start
+      // with.
       assert(!global);
-      char *addr = data_segment.get_current_pos();
-      data_segment.put_bytes((char *) &offset, sizeof(offset));
       // movl $INT32, %reg
       put_byte(0xb8 | reg);
-      put_uint32((uint32_t) addr);
+      put_data_addr((uint32_t) get_constant_pool_entry(offset));
     } else if (llvm::isa<llvm::Instruction>(value) ||
                llvm::isa<llvm::Argument>(value)) {
+      // Values that live in registers do not have an address.
+      assert(value_regs.count(value) == 0);
+      assert(static_allocas.count(value) == 0);
       assert(stackslots.count(value) == 1);
-      int ebp_offset = stackslots[value];
-      // leal ebp_offset(%ebp), %reg
-      put_byte(0x8d);
-      put_byte(0x85 | (reg << 3));
-      put_uint32(ebp_offset);
+      put_lea(reg, frame_mem(stackslots[value]));
     } else {
       assert(!"Unknown value type");
     }
   }
 
-  void write_reg_to_ebp_offset(int reg, int stack_offset) {
-    // movl %reg, stack_offset(%ebp)
+  // Returns the address of an 8-byte constant in the data segment
+  // that holds |value|.  Constants are interned, so each value is
+  // stored once however often it is used.  A 32-bit constant is in
+  // the entry's first 4 bytes.
+  char *get_constant_pool_entry(uint64_t value) {
+    std::map<uint64_t,char*>::iterator found = constant_pool.find(value);
+    if (found != constant_pool.end())
+      return found->second;
+    data_segment.align(sizeof(value));
+    char *addr = data_segment.put_alloc_space(sizeof(value));
+    memcpy(addr, &value, sizeof(value));
+    constant_pool[value] = addr;
+    return addr;
+  }
+
+  // Discard everything written to the data segment after |pos|,
+  // including constant pool entries.
+  void rewind_data_to(char *pos) {
+    data_segment.rewind_to(pos);
+    // Later chunks can be at lower addresses, so we can't compare
+    // entries' addresses with |pos|.
+    for (std::map<uint64_t,char*>::iterator entry = constant_pool.begin();
+         entry != constant_pool.end(); ) {
+      if (!data_segment.is_allocated(entry->second)) {
+        constant_pool.erase(entry++);
+      } else {
+        ++entry;
+      }
+    }
+  }
+
+  // Returns a memory operand that holds the value of |value|, which
+  // must not be kept in a register.  Constants are put in the
+  // constant pool.
+  MemOperand value_mem(llvm::Value *value) {
+    while (llvm::Value *alias = get_aliased_value(value))
+      value = alias;
+    if (llvm::Constant *cval = llvm::dyn_cast<llvm::Constant>(value)) {
+      llvm::GlobalValue *global;
+      uint64_t offset;
+      const char *unhandled = NULL;
+      expand_constant(cval, data_layout, &global, &offset, &unhandled);
+      assert(!unhandled);
+      assert(!global);
+      MemOperand mem = { kNoReg, kNoReg, 1,
+                         (int32_t) get_constant_pool_entry(offset), NULL,
+                         true };
+      return mem;
+    }
+    assert(value_regs.count(value) == 0);
+    assert(static_allocas.count(value) == 0);
+    assert(stackslots.count(value) == 1);
+    return frame_mem(stackslots[value]);
+  }
+
+  // Returns the memory operand for the memory allocated by the static
+  // alloca |value|.
+  MemOperand static_alloca_mem(llvm::Value *value) {
+    return frame_mem(static_allocas[value]);
+  }
+
+  // Returns the memory operand for |ebp_offset| in the current
+  // function's frame.  Frame offsets are relative to where %ebp
+  // points after the prolog's "pushl %ebp; movl %esp, %ebp", but
+  // when the frame pointer is omitted, we address the frame relative
+  // to %esp instead.  Then |frame_size| bytes are subtracted from
+  // %esp in place of the prolog, and anything that we have pushed
+  // since moves the frame further from %esp.
+  MemOperand frame_mem(int ebp_offset) {
+    if (!omit_frame_pointer) {
+      MemOperand mem = { REG_EBP, kNoReg, 1, ebp_offset, NULL };
+      return mem;
+    }
+    return esp_mem(ebp_offset + frame_size - 4 + esp_push_depth);
+  }
+
+  // Returns the memory operand for |offset| bytes into the stack
+  // space that we reserve for callees' arguments, which is also used
+  // as scratch space.
+  MemOperand callees_args_mem(int offset) {
+    uses_callees_args_area = true;
+    return esp_mem(offset);
+  }
+
+  void read_reg_from_frame(int reg, int ebp_offset) {
+    // movl ebp_offset(%ebp), %reg
+    put_byte(0x8b);
+    put_modrm_mem(reg, frame_mem(ebp_offset));
+  }
+
+  void write_reg_to_frame(int reg, int ebp_offset) {
+    // movl %reg, ebp_offset(%ebp)
     put_byte(0x89);
-    put_byte(0x85 | (reg << 3));
-    put_uint32(stack_offset);
+    put_modrm_mem(reg, frame_mem(ebp_offset));
+  }
+
+  void read_reg_from_esp_offset(int reg, int stack_offset) {
+    // movl stack_offset(%esp), %reg
+    put_byte(0x8b);
+    put_modrm_mem(reg, callees_args_mem(stack_offset));
   }
 
   void write_reg_to_esp_offset(int reg, int stack_offset) {
     // movl %reg, stack_offset(%esp)
     put_byte(0x89);
-    put_byte(0x84 | (reg << 3));
-    put_byte(0x24);
-    put_uint32(stack_offset);
+    put_modrm_mem(reg, callees_args_mem(stack_offset));
+  }
+
+  void put_push_reg(int reg) {
+    put_byte(0x50 | reg); // pushl %reg
+    esp_push_depth += 4;
+  }
+
+  void put_pop_reg(int reg) {
+    put_byte(0x58 | reg); // popl %reg
+    esp_push_depth -= 4;
   }
 
   // Generate code to write |reg| to the 32-bit portion of the stack
@@ -349,22 +778,68 @@ public:
   // move_part_to_reg().
   void spill_part(int reg, llvm::Instruction *inst, int offset_in_value) {
     check_offset_in_value(inst->getType(), offset_in_value);
-    write_reg_to_ebp_offset(reg, stackslots[inst] + offset_in_value);
+    if (value_regs.count(inst) == 1) {
+      assert(offset_in_value == 0);
+      put_mov_reg_reg(value_regs[inst], reg);
+    } else {
+      write_reg_to_frame(reg, stackslots[inst] + offset_in_value);
+    }
   }
 
   // Generate code to write |reg| to the stack slot for |inst|.  This
   // is the reverse of move_to_reg().
   void spill(int reg, llvm::Instruction *inst) {
-    assert(!is_i64(inst->getType()));
+    assert(!is_64bit(inst->getType()));
     spill_part(reg, inst, 0);
   }
 
+  // Record that the 32-bit value at |loc| in the code is the address
+  // of the host function or data at |addr|, or the offset of |addr|
+  // relative to the end of the value if |relative| is true.
+  void add_host_reloc(uint32_t *loc, uintptr_t addr, bool relative) {
+    int symbol = get_host_symbol(addr);
+    if (symbol == -1) {
+      // Only lazy stubs refer to anything else, and their code is
+      // never cached.
+      assert(options->lazy_compilation);
+      return;
+    }
+    HostReloc reloc = { (uint32_t) loc, symbol, relative };
+    host_relocs.push_back(reloc);
+  }
+
+  // Record that the 32-bit value at |loc| refers to |target| in the
+  // code or data segment, either as an address (possibly with an
+  // offset) or, if |relative| is true, as an offset relative to the
+  // end of the value.  These are resolved already, but an object file
+  // needs relocations for them.  See write_object_file().
+  void add_image_reloc(uint32_t *loc, uint32_t target, bool relative,
+                       llvm::GlobalValue *global = NULL) {
+    ImageReloc reloc = { (uint32_t) loc, target, relative, global };
+    image_relocs.push_back(reloc);
+  }
+
+  // Put the address |addr| in the data segment into the code.
+  void put_data_addr(uint32_t addr) {
+    add_image_reloc((uint32_t *) get_current_pos(), addr, false);
+    put_uint32(addr);
+  }
+
   void put_direct_call(uintptr_t func_addr) {
+    uses_callees_args_area = true;
     // Direct 32-bit call.
     put_byte(0xe8);
+    add_host_reloc((uint32_t *) get_current_pos(), func_addr, true);
     put_uint32(func_addr - ((uintptr_t) get_current_pos() + sizeof(uint32_t)));
   }
 
+  void put_indirect_call(int reg) {
+    uses_callees_args_area = true;
+    // call *%reg
+    put_byte(0xff);
+    put_modrm_reg_reg(reg, 2);
+  }
+
   void put_ret() {
     put_byte(0xc3);
   }
@@ -378,6 +853,10 @@ public:
       llvm::IntegerType *inttype = llvm::cast<llvm::IntegerType>(type);
       bits = inttype->getBitWidth();
     }
+    put_sized_opcode_bits(bits, opcode_base);
+  }
+
+  void put_sized_opcode_bits(int bits, int opcode_base) {
     assert(bits == 8 || bits == 16 || bits == 32);
     if (bits == 16) {
       put_byte(0x66); // DATA16 prefix
@@ -393,12 +872,209 @@ public:
     put_byte((3 << 6) | (reg2 << 3) | reg1);
   }
 
+  // Generate the ModRM byte, SIB byte and displacement for |mem|, with
+  // |reg| (or an opcode extension) in the ModRM byte's reg field.
+  void put_modrm_mem(int reg, const MemOperand &mem) {
+    int mod;
+    int base_reg = mem.base_reg;
+    if (base_reg == kNoReg) {
+      // With mod=00, an %ebp base encodes "no base, 32-bit
+      // displacement".
+      mod = 0;
+      base_reg = REG_EBP;
+    } else if (mem.global || mem.data_addr) {
+      mod = 2;
+    } else if (mem.disp == 0 && base_reg != REG_EBP) {
+      // %ebp with no displacement would mean "no base" (see above),
+      // so %ebp always needs a displacement.
+      mod = 0;
+    } else if (mem.disp == (int8_t) mem.disp) {
+      mod = 1;
+    } else {
+      mod = 2;
+    }
+    if (mem.index_reg == kNoReg && base_reg != REG_ESP) {
+      put_byte((mod << 6) | (reg << 3) | base_reg);
+    } else {
+      // An r/m field of %esp means a SIB byte follows, in which an
+      // index field of %esp means "no index".
+      int index_reg = mem.index_reg;
+      if (index_reg == kNoReg)
+        index_reg = REG_ESP;
+      else
+        assert(index_reg != REG_ESP);
+      int scale_bits = log2_exact(mem.scale);
+      assert(scale_bits >= 0 && scale_bits <= 3);
+      put_byte((mod << 6) | (reg << 3) | REG_ESP);
+      put_byte((scale_bits << 6) | (index_reg << 3) | base_reg);
+    }
+    if (mod == 1) {
+      put_byte(mem.disp);
+    } else if (mod == 2 || mem.base_reg == kNoReg) {
+      if (mem.global) {
+        put_global_reloc(mem.global, mem.disp);
+      } else {
+        if (mem.data_addr)
+          add_image_reloc((uint32_t *) get_current_pos(), mem.disp, false);
+        put_uint32(mem.disp);
+      }
+    }
+  }
+
+  void put_lea(int dest_reg, const MemOperand &mem) {
+    // leal mem, %dest_reg
+    put_byte(0x8d);
+    put_modrm_mem(dest_reg, mem);
+  }
+
+  // Generate the SSE instruction "0x0f |opcode|", preceded by
+  // |prefix| if it is non-zero.
+  void put_sse_opcode(int prefix, int opcode) {
+    // Don't generate code that would fault on an old CPU.
+    if (!have_sse2)
+      unhandled_case("SSE2 instruction on a CPU without SSE2");
+    if (prefix)
+      put_byte(prefix);
+    put_byte(0x0f);
+    put_byte(opcode);
+  }
+
+  // Generate an SSE instruction with register |reg| (an XMM register,
+  // or a general register for a conversion to an integer) as one
+  // operand and |mem| as the other.
+  void put_sse_op_mem(int prefix, int opcode, int reg, const MemOperand &mem) {
+    put_sse_opcode(prefix, opcode);
+    put_modrm_mem(reg, mem);
+  }
+
+  // Generate an SSE instruction with |reg| in the ModRM reg field and
+  // |rm_reg| in its r/m field.
+  void put_sse_op_reg(int prefix, int opcode, int reg, int rm_reg) {
+    put_sse_opcode(prefix, opcode);
+    put_modrm_reg_reg(rm_reg, reg);
+  }
+
+  // Returns the register holding the float |value|, or -1 if it is in
+  // memory.  A float can only be in a register if it is a bitcast of
+  // an i32 value.
+  int get_fp_value_reg(llvm::Value *value) {
+    while (llvm::Value *alias = get_aliased_value(value))
+      value = alias;
+    std::map<llvm::Value*,int>::iterator found = value_regs.find(value);
+    return found == value_regs.end() ? -1 : found->second;
+  }
+
+  // Generate an SSE instruction with |reg| as one operand and the
+  // float or double |value| as the other.  |value| is used in memory
+  // unless it is in a general register, in which case it is copied to
+  // %xmm1 first.
+  void put_sse_op_value(int prefix, int opcode, int reg, llvm::Value *value) {
+    int value_reg = get_fp_value_reg(value);
+    if (value_reg >= 0) {
+      assert(reg != 1);
+      move_fp_to_xmm(1, value);
+      put_sse_op_reg(prefix, opcode, reg, 1);
+    } else {
+      put_sse_op_mem(prefix, opcode, reg, value_mem(value));
+    }
+  }
+
+  // Generate code to put the float or double |value| into
+  // %xmm<xmm_reg>.
+  void move_fp_to_xmm(int xmm_reg, llvm::Value *value) {
+    int value_reg = get_fp_value_reg(value);
+    if (value_reg >= 0) {
+      // movd %value_reg, %xmm_reg
+      put_sse_op_reg(0x66, 0x6e, xmm_reg, value_reg);
+    } else {
+      put_sse_op_mem(get_sse_prefix(value->getType()), SSEMovLoad, xmm_reg,
+                     value_mem(value));
+    }
+  }
+
+  // Generate code to write %xmm<xmm_reg> to the stack slot for the
+  // float or double |inst|.
+  void spill_fp(int xmm_reg, llvm::Instruction *inst) {
+    put_sse_op_mem(get_sse_prefix(inst->getType()), SSEMovStore, xmm_reg,
+                   value_mem(inst));
+  }
+
+  // Generate "fld<size> mem" or "fstp<size> mem" for a float or
+  // double, which moves it onto or off the x87 register stack.
+  void put_x87_load(llvm::Type *type, const MemOperand &mem) {
+    put_byte(type->isDoubleTy() ? 0xdd : 0xd9);
+    put_modrm_mem(0, mem);
+  }
+
+  void put_x87_store_pop(llvm::Type *type, const MemOperand &mem) {
+    put_byte(type->isDoubleTy() ? 0xdd : 0xd9);
+    put_modrm_mem(3, mem);
+  }
+
+  // Generate code to push the float or double |value| onto the x87
+  // register stack.  This uses the stack space that we reserve for
+  // callees' arguments if |value| is in a general register.
+  void put_x87_load_value(llvm::Value *value) {
+    int value_reg = get_fp_value_reg(value);
+    if (value_reg >= 0) {
+      write_reg_to_esp_offset(value_reg, 0);
+      put_x87_load(value->getType(), callees_args_mem(0));
+    } else {
+      put_x87_load(value->getType(), value_mem(value));
+    }
+  }
+
+  void put_mov_reg_reg(int dest_reg, int src_reg) {
+    if (dest_reg == src_reg)
+      return;
+    // movl %src_reg, %dest_reg
+    put_byte(0x89);
+    put_modrm_reg_reg(dest_reg, src_reg);
+  }
+
   void put_arith_reg_reg(X86ArithOpcode arith_opcode,
                          int dest_reg, int src_reg) {
     put_byte((arith_opcode << 3) | (0 << 1) | 1); // Opcode
     put_modrm_reg_reg(dest_reg, src_reg);
   }
 
+  // Generate "OP $imm, %reg", using the sign-extended 8-bit form of
+  // the immediate where it fits.
+  void put_arith_reg_imm(X86ArithOpcode arith_opcode, int reg, uint32_t imm) {
+    if ((int32_t) imm == (int8_t) imm) {
+      put_byte(0x83);
+      put_modrm_reg_reg(reg, arith_opcode);
+      put_byte(imm);
+    } else if (reg == REG_EAX) {
+      put_byte((arith_opcode << 3) | 5); // Short form for %eax
+      put_uint32(imm);
+    } else {
+      put_byte(0x81);
+      put_modrm_reg_reg(reg, arith_opcode);
+      put_uint32(imm);
+    }
+  }
+
+  // Generate "imull $imm, %reg, %reg".
+  void put_imul_reg_imm(int reg, uint32_t imm) {
+    if ((int32_t) imm == (int8_t) imm) {
+      put_byte(0x6b);
+      put_modrm_reg_reg(reg, reg);
+      put_byte(imm);
+    } else {
+      put_byte(0x69);
+      put_modrm_reg_reg(reg, reg);
+      put_uint32(imm);
+    }
+  }
+
+  void put_shift_reg_imm(X86ShiftOpcode shift_opcode, int reg, int amount) {
+    // shl/shr/sar $amount, %reg
+    put_byte(0xc1);
+    put_modrm_reg_reg(reg, shift_opcode);
+    put_byte(amount);
+  }
+
   void extend_to_i32(int reg, bool sign_extend, int src_size) {
     if (src_size == 32)
       return;
@@ -420,25 +1096,62 @@ public:
       }
       return;
     }
-    assert(src_size == 8 || src_size == 16);
+    put_movx_opcode(sign_extend, src_size);
+    put_modrm_reg_reg(reg, reg);
+  }
 
+  // Generate the opcode of movzx or movsx (in Intel syntax) from an
+  // operand of |src_size| bits.  The ModRM byte must follow.
+  void put_movx_opcode(bool sign_extend, int src_size) {
+    assert(src_size == 8 || src_size == 16);
     put_byte(0x0f); // First opcode
     if (sign_extend) {
-      // movsx (in Intel syntax)
+      // movsx
       if (src_size == 8) {
         put_byte(0xbe);
       } else {
         put_byte(0xbf);
       }
     } else {
-      // movzx (in Intel syntax)
+      // movzx
       if (src_size == 8) {
         put_byte(0xb6);
       } else {
         put_byte(0xb7);
       }
     }
-    put_modrm_reg_reg(reg, reg);
+  }
+
+  // Returns whether the 32-bit register or stack slot that holds
+  // |value| is known to be zero-extended (or sign-extended, if
+  // |sign_extend| is set) from the value's own size.  See
+  // find_extended_values().
+  bool is_extended(llvm::Value *value, bool sign_extend) {
+    // Redundant copies have the values of their originals, but other
+    // aliases, such as truncations, do not have the same size.
+    while (llvm::Value *alias = get_aliased_value(value)) {
+      if (alias->getType() != value->getType())
+        break;
+      value = alias;
+    }
+    if (llvm::ConstantInt *cval = llvm::dyn_cast<llvm::ConstantInt>(value)) {
+      // Constants are zero-extended when moved to a register but
+      // sign-extended when used as immediates, so we only know how a
+      // constant is extended when both agree.
+      return !cval->isNegative();
+    }
+    if (sign_extend)
+      return sign_extended_values.count(value) != 0;
+    return zero_extended_values.count(value) != 0;
+  }
+
+  // Generate code to extend |reg|, which holds |value|, from
+  // |src_size| bits to 32 bits, unless it is known to be extended
+  // already.
+  void extend_value_to_i32(int reg, llvm::Value *value, bool sign_extend,
+                           int src_size) {
+    if (!is_extended(value, sign_extend))
+      extend_to_i32(reg, sign_extend, src_size);
   }
 
   void make_label(llvm::BasicBlock *bb) {
@@ -451,11 +1164,66 @@ public:
     jump_relocs.push_back(JumpReloc((uint32_t *) get_current_pos(), dest));
   }
 
+  // A jump to a label, recorded by put_jump().
+  struct JumpSite {
+    uint32_t end; // Address of the end of the jump instruction
+    llvm::BasicBlock *dest;
+  };
+
+  // Returns whether a jump recorded by an earlier pass over the
+  // current function could have used an 8-bit offset.
+  bool is_short_jump(const JumpSite &site) {
+    assert(prev_labels.count(site.dest) == 1);
+    int32_t offset = prev_labels[site.dest] - site.end;
+    return offset >= -128 && offset <= 127;
+  }
+
+  // Generate a jump to |dest|, which is conditional on |x86_cond|
+  // unless that is kJumpAlways.  We use the 2-byte form of the jump
+  // if the previous pass over the function found that the jump's
+  // offset fits in 8 bits.  See translate_function().
+  void put_jump(int x86_cond, llvm::BasicBlock *dest) {
+    unsigned index = jumps.size();
+    bool use_short = index < prev_jumps.size() &&
+                     is_short_jump(prev_jumps[index]);
+    if (use_short) {
+      if (x86_cond == kJumpAlways) {
+        put_byte(0xeb); // jmp <label> (8-bit)
+      } else {
+        put_byte(0x70 | x86_cond); // jCC <label> (8-bit)
+      }
+      put_byte(0); // Placeholder
+      short_jump_relocs.push_back(
+          ShortJumpReloc((uint8_t *) get_current_pos(), dest));
+    } else {
+      if (x86_cond == kJumpAlways) {
+        put_byte(0xe9); // jmp <label> (32-bit)
+      } else {
+        // jCC <label> (32-bit)
+        put_byte(0x0f);
+        put_byte(0x80 | x86_cond);
+      }
+      direct_jump_offset32(dest);
+    }
+    JumpSite site = { (uint32_t) get_current_pos(), dest };
+    jumps.push_back(site);
+  }
+
   void put_global_reloc(llvm::GlobalValue *dest, int offset) {
     global_relocs.push_back(GlobalReloc((uint32_t *) get_current_pos(), dest));
     put_uint32(offset);
   }
 
+  // Generate a direct call to |dest|, which is a function in the
+  // module that might not have been generated yet.
+  void put_call_reloc(llvm::Function *dest) {
+    uses_callees_args_area = true;
+    // call <func> (32-bit)
+    put_byte(0xe8);
+    call_relocs.push_back(CallReloc((uint32_t *) get_current_pos(), dest));
+    put_uint32(0); // Placeholder
+  }
+
   void apply_jump_relocs() {
     for (std::vector<JumpReloc>::iterator reloc = jump_relocs.begin();
          reloc != jump_relocs.end();
@@ -464,6 +1232,18 @@ public:
       uint32_t target = labels[reloc->second];
       uint32_t *jump_loc = reloc->first;
       jump_loc[-1] = target - (uint32_t) jump_loc;
+      // Jump tables are in the data segment.
+      if (!contains(jump_loc - 1))
+        add_image_reloc(jump_loc - 1, target, true);
+    }
+    for (std::vector<ShortJumpReloc>::iterator reloc =
+           short_jump_relocs.begin();
+         reloc != short_jump_relocs.end();
+         ++reloc) {
+      assert(labels.count(reloc->second) == 1);
+      int32_t offset = labels[reloc->second] - (uint32_t) reloc->first;
+      assert(offset >= -128 && offset <= 127);
+      reloc->first[-1] = offset;
     }
   }
 
@@ -475,58 +1255,253 @@ public:
       uint32_t value = globals[reloc->second];
       uint32_t *addr = reloc->first;
       *addr += value;
+      // This is a function that is implemented by the runtime, such
+      // as llvm.nacl.read.tp.
+      if (get_host_symbol(value) != -1) {
+        add_host_reloc(addr, value, false);
+      } else {
+        add_image_reloc(addr, value, false, reloc->second);
+      }
+    }
+  }
+
+  void apply_call_relocs() {
+    for (std::vector<CallReloc>::iterator reloc = call_relocs.begin();
+         reloc != call_relocs.end();
+         ++reloc) {
+      uint32_t *addr = reloc->first;
+      uint32_t value;
+      if (function_code.count(reloc->second) == 1) {
+        value = function_code[reloc->second];
+      } else {
+        // The function has not been generated yet, so call its stub.
+        assert(globals.count(reloc->second) == 1);
+        value = globals[reloc->second];
+        stub_calls[reloc->second].push_back(addr);
+      }
+      *addr = value - (uint32_t) (addr + 1);
+      // This is a function that is implemented by the runtime, such
+      // as llvm.nacl.read.tp.
+      if (get_host_symbol(value) != -1) {
+        add_host_reloc(addr, value, true);
+      } else {
+        // The callee may be in another chunk of the buffer, which an
+        // object file does not keep at the same distance.
+        add_image_reloc(addr, value, true);
+      }
     }
   }
 
+  // Apply the relocations recorded so far and forget them, so that
+  // code generated later can be relocated in the same way.
+  void apply_relocs() {
+    apply_jump_relocs();
+    apply_global_relocs();
+    apply_call_relocs();
+    jump_relocs.clear();
+    short_jump_relocs.clear();
+    global_relocs.clear();
+    call_relocs.clear();
+  }
+
   DataBuffer data_segment;
+  // Interned constants, mapped to their addresses in the data
+  // segment.  See get_constant_pool_entry().
+  std::map<uint64_t,char*> constant_pool;
 
   // XXX: move somewhere better
   std::map<llvm::Value*,int> stackslots;
+  // Values that the register allocator has placed in registers.
+  // These values do not get stack slots.
+  std::map<llvm::Value*,int> value_regs;
+  // Callee-saved registers used by the current function, paired
+  // with the stack slots that their callers' values are saved in.
+  std::vector<std::pair<int,int> > saved_regs;
+  // Allocas that have fixed places in the frame, mapped to the %ebp
+  // offsets of the memory they allocate.  These values do not get
+  // stack slots.
+  std::map<llvm::Value*,int> static_allocas;
+  // Address computations that are folded into the memory operands of
+  // their users.  These values are never computed on their own and do
+  // not get stack slots.
+  std::set<llvm::Value*> folded_addresses;
+  // Instructions that recompute the value of an earlier instruction
+  // in their block, mapped to that instruction, and the reverse
+  // mapping.  See find_redundant_values().
+  std::map<llvm::Value*,llvm::Value*> redundant_values;
+  std::map<llvm::Value*,std::vector<llvm::Value*> > redundant_copies;
+  // Instructions whose results are unused and that have no side
+  // effects.  These generate no code and do not get stack slots.
+  std::set<llvm::Value*> dead_values;
+  // Values smaller than 32 bits whose registers or stack slots are
+  // known to hold them zero-extended or sign-extended to 32 bits.
+  // See find_extended_values().
+  std::set<llvm::Value*> zero_extended_values;
+  std::set<llvm::Value*> sign_extended_values;
   std::map<llvm::BasicBlock*,uint32_t> labels;
   std::map<llvm::GlobalValue*,uint32_t> globals;
   int frame_vars_size;
   int frame_callees_args_size;
+  // Whether the current function addresses its frame relative to %esp
+  // rather than %ebp.  See frame_mem().
+  bool omit_frame_pointer;
+  // The number of bytes that the prolog subtracts from %esp, after
+  // "pushl %ebp" if the frame pointer is used.
+  int frame_size;
+  // The number of bytes pushed since the prolog, by put_push_reg().
+  int esp_push_depth;
+  // Whether the code generated so far calls anything or uses the
+  // stack space that we reserve for callees' arguments.
+  bool uses_callees_args_area;
 
   llvm::TargetData *data_layout;
   CodeGenOptions *options;
+  // Whether generated code may use SSE2 instructions.
+  bool have_sse2;
+  // Whether generated code may use the popcnt instruction.
+  bool have_popcnt;
 
   typedef std::pair<uint32_t*,llvm::BasicBlock*> JumpReloc;
   std::vector<JumpReloc> jump_relocs;
+  typedef std::pair<uint8_t*,llvm::BasicBlock*> ShortJumpReloc;
+  std::vector<ShortJumpReloc> short_jump_relocs;
+
+  // The block that will be generated after the current one, or NULL.
+  // Jumps to this block can fall through instead.
+  llvm::BasicBlock *next_bb;
+
+  // The jumps generated by the current and the previous passes over
+  // the current function, in order, and the labels from the previous
+  // pass.
+  std::vector<JumpSite> jumps;
+  std::vector<JumpSite> prev_jumps;
+  std::map<llvm::BasicBlock*,uint32_t> prev_labels;
+  // Whether the current function's code has been generated before.
+  bool regenerating_code;
+
+  // A trampoline assigns the phi nodes of |to| for the edge from
+  // |from|, and is generated after the current function's blocks.
+  struct Trampoline {
+    llvm::BasicBlock *from;
+    llvm::BasicBlock *to;
+    // 32-bit relative offsets that should point to the trampoline.
+    std::vector<uint32_t*> jump_locs;
+  };
+  std::vector<Trampoline> trampolines;
 
   typedef std::pair<uint32_t*,llvm::GlobalValue*> GlobalReloc;
   std::vector<GlobalReloc> global_relocs;
+
+  // Relative offsets of direct calls to functions in the module.
+  typedef std::pair<uint32_t*,llvm::Function*> CallReloc;
+  std::vector<CallReloc> call_relocs;
+  // The entry points of the functions that have been generated.
+  // These are the functions' addresses in |globals|, except in lazy
+  // mode, where a function's address is always that of its stub.
+  std::map<llvm::Function*,uint32_t> function_code;
+  // In lazy mode, the direct calls to the stubs of functions that
+  // have not been generated yet.  See translate_lazily().
+  std::map<llvm::Function*,std::vector<uint32_t*> > stub_calls;
+
+  // References to kHostSymbols from the code.  See add_host_reloc().
+  struct HostReloc {
+    uint32_t addr;
+    int32_t symbol;
+    uint32_t relative;
+  };
+  std::vector<HostReloc> host_relocs;
+
+  // References within the code and data.  See add_image_reloc().
+  struct ImageReloc {
+    uint32_t addr;
+    uint32_t target;
+    uint32_t relative;
+    // The global that |target| is the address of, if any.
+    llvm::GlobalValue *global;
+  };
+  std::vector<ImageReloc> image_relocs;
 };
 
-enum {
-  REG_EAX = 0,
-  REG_ECX,
-  REG_EDX,
-  REG_EBX,
-  REG_ESP,
-  REG_EBP,
-  REG_ESI,
-  REG_EDI,
+struct PhiCopy {
+  llvm::PHINode *dest;
+  // The value to copy, or NULL for the temporary that is used to
+  // break cycles, which is held in %ecx (and %edx for 64-bit values).
+  llvm::Value *source;
 };
 
+void put_phi_copy(PhiCopy &copy, CodeBuf &codebuf) {
+  bool is_64 = is_64bit(copy.dest->getType());
+  if (!copy.source) {
+    codebuf.spill_part(REG_ECX, copy.dest, 0);
+    if (is_64)
+      codebuf.spill_part(REG_EDX, copy.dest, 4);
+  } else if (is_64) {
+    codebuf.move_part_to_reg(REG_EAX, copy.source, 0);
+    codebuf.spill_part(REG_EAX, copy.dest, 0);
+    codebuf.move_part_to_reg(REG_EAX, copy.source, 4);
+    codebuf.spill_part(REG_EAX, copy.dest, 4);
+  } else {
+    codebuf.move_to_reg(REG_EAX, copy.source);
+    codebuf.spill(REG_EAX, copy.dest);
+  }
+}
+
+// Generate code to assign the phi nodes of |to_bb| for the edge from
+// |from_bb|.  The phi nodes are assigned in parallel, so a phi node's
+// incoming value may be another phi node of the same block (e.g. for
+// a swap).  We order the copies so that no value is overwritten before
+// it has been read, breaking cycles with a temporary.
+//
+// This only generates moves, so it leaves the flags intact.
 void handle_phi_nodes(llvm::BasicBlock *from_bb,
                       llvm::BasicBlock *to_bb,
-                      CodeBuf &codebuf,
-                      int tmp_reg) {
+                      CodeBuf &codebuf) {
+  std::vector<PhiCopy> copies;
   for (llvm::BasicBlock::InstListType::iterator inst = to_bb->begin();
        inst != to_bb->end();
        ++inst) {
     llvm::PHINode *phi = llvm::dyn_cast<llvm::PHINode>(inst);
     if (!phi)
       break;
+    if (codebuf.dead_values.count(phi))
+      continue;
     llvm::Value *incoming = phi->getIncomingValueForBlock(from_bb);
-    if (is_i64(phi->getType())) {
-      codebuf.move_part_to_reg(tmp_reg, incoming, 0);
-      codebuf.spill_part(tmp_reg, phi, 0);
-      codebuf.move_part_to_reg(tmp_reg, incoming, 4);
-      codebuf.spill_part(tmp_reg, phi, 4);
-    } else {
-      codebuf.move_to_reg(tmp_reg, incoming);
-      codebuf.spill(tmp_reg, phi);
+    while (llvm::Value *alias = codebuf.get_aliased_value(incoming))
+      incoming = alias;
+    if (incoming != phi) {
+      PhiCopy copy = { phi, incoming };
+      copies.push_back(copy);
+    }
+  }
+
+  while (!copies.empty()) {
+    // Find a copy whose destination is not needed by any other copy.
+    bool progress = false;
+    for (unsigned i = 0; i < copies.size(); ) {
+      bool dest_is_read = false;
+      for (unsigned j = 0; j < copies.size(); ++j) {
+        if (j != i && copies[j].source == copies[i].dest)
+          dest_is_read = true;
+      }
+      if (dest_is_read) {
+        ++i;
+      } else {
+        put_phi_copy(copies[i], codebuf);
+        copies.erase(copies.begin() + i);
+        progress = true;
+      }
+    }
+    if (!progress) {
+      // The remaining copies form cycles.  Break one by saving a
+      // destination in the temporary and reading it from there.
+      llvm::PHINode *saved = copies[0].dest;
+      codebuf.move_part_to_reg(REG_ECX, saved, 0);
+      if (is_64bit(saved->getType()))
+        codebuf.move_part_to_reg(REG_EDX, saved, 4);
+      for (unsigned j = 0; j < copies.size(); ++j) {
+        if (copies[j].source == saved)
+          copies[j].source = NULL;
+      }
     }
   }
 }
@@ -534,14 +1509,13 @@ void handle_phi_nodes(llvm::BasicBlock *from_bb,
 void unconditional_jump(llvm::BasicBlock *from_bb,
                         llvm::BasicBlock *to_bb,
                         CodeBuf &codebuf) {
-  handle_phi_nodes(from_bb, to_bb, codebuf, REG_EAX);
-  // jmp <label> (32-bit)
-  codebuf.put_byte(0xe9);
-  codebuf.direct_jump_offset32(to_bb);
+  handle_phi_nodes(from_bb, to_bb, codebuf);
+  if (to_bb != codebuf.next_bb)
+    codebuf.put_jump(kJumpAlways, to_bb);
 }
 
 int get_arg_stack_size(llvm::Type *arg_type) {
-  return is_i64(arg_type) ? 8 : 4;
+  return is_64bit(arg_type) ? 8 : 4;
 }
 
 int get_args_stack_size(llvm::CallInst *call) {
@@ -552,7 +1526,53 @@ int get_args_stack_size(llvm::CallInst *call) {
   return size;
 }
 
-const char *get_instruction_type(llvm::Instruction *inst) {
+// Returns whether |func| uses our internal calling convention, in
+// which the first three 32-bit integer or pointer arguments are
+// passed in %eax, %edx and %ecx, like GCC's regparm(3).  Functions
+// that are internal to the module and whose address is never taken
+// are only called directly by code that we generate, so they can use
+// it.  Other functions may be called from outside, so they take all
+// their arguments on the stack, as the i386 ABI requires.
+bool uses_register_args(llvm::Function *func) {
+  return (!func->isDeclaration() && func->hasLocalLinkage() &&
+          !func->hasAddressTaken() && !func->isVarArg());
+}
+
+// Sets |*regs| to the register that each argument of |func| is
+// passed in, or kNoReg for the arguments that are passed on the stack.
+// Each stack argument is placed after the previous stack argument.
+void get_arg_regs(llvm::Function *func, std::vector<int> *regs) {
+  static const int kArgRegs[] = { REG_EAX, REG_EDX, REG_ECX };
+  unsigned next_reg = 0;
+  bool register_args = uses_register_args(func);
+  for (llvm::Function::ArgumentListType::iterator arg = func->arg_begin();
+       arg != func->arg_end();
+       ++arg) {
+    llvm::Type *type = arg->getType();
+    if (register_args && next_reg < sizeof(kArgRegs) / sizeof(kArgRegs[0]) &&
+        !is_64bit(type) && !is_fp(type)) {
+      regs->push_back(kArgRegs[next_reg++]);
+    } else {
+      regs->push_back(kNoReg);
+    }
+  }
+}
+
+// Returns the address of the host function that |callee| is, such
+// as the memcpy() that expand_mem_intrinsics() generates calls to, or
+// 0 if |callee| is not one of kHostSymbols.
+uintptr_t get_host_function(llvm::Value *callee) {
+  llvm::ConstantExpr *expr = llvm::dyn_cast<llvm::ConstantExpr>(callee);
+  if (!expr || expr->getOpcode() != llvm::Instruction::IntToPtr)
+    return 0;
+  llvm::ConstantInt *addr =
+    llvm::dyn_cast<llvm::ConstantInt>(expr->getOperand(0));
+  if (!addr || get_host_symbol(addr->getZExtValue()) == -1)
+    return 0;
+  return addr->getZExtValue();
+}
+
+const char *get_instruction_type(llvm::Instruction *inst) {
   switch (inst->getOpcode()) {
 #define HANDLE_INST(NUM, OPCODE, CLASS) \
     case llvm::Instruction::OPCODE: return #OPCODE;
@@ -562,11 +1582,2518 @@ const char *get_instruction_type(llvm::Instruction *inst) {
   }
 }
 
+llvm::Value *strip_aliases(llvm::Value *value, CodeBuf &codebuf) {
+  while (llvm::Value *alias = codebuf.get_aliased_value(value))
+    value = alias;
+  return value;
+}
+
+// Returns whether |value| is an integer constant, and if so, sets
+// |*result| to its value sign-extended to 64 bits.
+bool get_constant_int(llvm::Value *value, CodeBuf &codebuf,
+                      uint64_t *result) {
+  llvm::ConstantInt *cval =
+    llvm::dyn_cast<llvm::ConstantInt>(strip_aliases(value, codebuf));
+  if (!cval)
+    return false;
+  *result = cval->getSExtValue();
+  return true;
+}
+
+// Generate "OP <part>, %reg", where <part> is the 32-bit portion of
+// |value| at |offset_in_value|.  A constant is encoded as an immediate
+// operand.  Otherwise, the part is loaded into %ecx.  This does not
+// modify the flags before the operation itself.
+void put_arith_value(X86ArithOpcode arith_opcode, int reg,
+                     llvm::Value *value, int offset_in_value,
+                     CodeBuf &codebuf) {
+  uint64_t imm;
+  if (get_constant_int(value, codebuf, &imm)) {
+    codebuf.put_arith_reg_imm(arith_opcode, reg,
+                              (uint32_t) (imm >> (offset_in_value * 8)));
+  } else {
+    codebuf.move_part_to_reg(REG_ECX, value, offset_in_value);
+    codebuf.put_arith_reg_reg(arith_opcode, reg, REG_ECX);
+  }
+}
+
+// Returns the x86 condition code (as used in the Jcc and SETcc
+// instructions) for an integer comparison.
+int get_x86_cond(llvm::CmpInst::Predicate pred) {
+  switch (pred) {
+    case llvm::CmpInst::ICMP_EQ:
+      return 0x4; // 'e' (equal)
+    case llvm::CmpInst::ICMP_NE:
+      return 0x5; // 'ne' (not equal)
+    // Unsigned comparisons
+    case llvm::CmpInst::ICMP_UGT:
+      return 0x7; // 'a' (above)
+    case llvm::CmpInst::ICMP_UGE:
+      return 0x3; // 'ae' (above or equal)
+    case llvm::CmpInst::ICMP_ULT:
+      return 0x2; // 'b' (below)
+    case llvm::CmpInst::ICMP_ULE:
+      return 0x6; // 'be' (below or equal)
+    // Signed comparisons
+    case llvm::CmpInst::ICMP_SGT:
+      return 0xf; // 'g' (greater)
+    case llvm::CmpInst::ICMP_SGE:
+      return 0xd; // 'ge' (greater or equal)
+    case llvm::CmpInst::ICMP_SLT:
+      return 0xc; // 'l' (less)
+    case llvm::CmpInst::ICMP_SLE:
+      return 0xe; // 'le' (less or equal)
+    default:
+      assert(!"Unknown comparison");
+  }
+  return 0;
+}
+
+// Generate code to compare two 64-bit values, setting the flags.
+// Returns the x86 condition code to test.
+int put_i64_compare(llvm::ICmpInst *op, CodeBuf &codebuf) {
+  llvm::Value *arg1 = op->getOperand(0);
+  llvm::Value *arg2 = op->getOperand(1);
+  llvm::CmpInst::Predicate pred = op->getPredicate();
+  if (pred == llvm::CmpInst::ICMP_EQ || pred == llvm::CmpInst::ICMP_NE) {
+    // The values are equal if both halves XOR to zero.
+    codebuf.move_part_to_reg(REG_EAX, arg1, 0);
+    put_arith_value(X86ArithXor, REG_EAX, arg2, 0, codebuf);
+    codebuf.move_part_to_reg(REG_EDX, arg1, 4);
+    put_arith_value(X86ArithXor, REG_EDX, arg2, 4, codebuf);
+    codebuf.put_arith_reg_reg(X86ArithOr, REG_EAX, REG_EDX);
+    return get_x86_cond(pred);
+  }
+  // A 64-bit subtraction using cmp+sbb leaves flags that are only
+  // correct for the "less than" and "greater or equal" conditions, so
+  // swap the operands for the other comparisons.
+  if (pred == llvm::CmpInst::ICMP_UGT ||
+      pred == llvm::CmpInst::ICMP_ULE ||
+      pred == llvm::CmpInst::ICMP_SGT ||
+      pred == llvm::CmpInst::ICMP_SLE) {
+    std::swap(arg1, arg2);
+    pred = llvm::CmpInst::getSwappedPredicate(pred);
+  }
+  codebuf.move_part_to_reg(REG_EAX, arg1, 0);
+  put_arith_value(X86ArithCmp, REG_EAX, arg2, 0, codebuf);
+  codebuf.move_part_to_reg(REG_EAX, arg1, 4);
+  put_arith_value(X86ArithSbb, REG_EAX, arg2, 4, codebuf);
+  return get_x86_cond(pred);
+}
+
+// Generate code to compare the operands of |op|, setting the flags.
+// Returns the x86 condition code to test.
+int put_icmp(llvm::ICmpInst *op, CodeBuf &codebuf) {
+  llvm::Type *operand_type = op->getOperand(0)->getType();
+  int bits;
+  // TODO: Remove the use of pointer types via a rewrite pass instead.
+  if (llvm::isa<llvm::PointerType>(operand_type)) {
+    bits = kPointerSizeBits;
+  } else {
+    llvm::IntegerType *inttype = llvm::cast<llvm::IntegerType>(operand_type);
+    bits = inttype->getBitWidth();
+  }
+  assert(bits >= 8); // Disallow i1
+  if (bits == 64)
+    return put_i64_compare(op, codebuf);
+
+  // Equality comparisons work with either extension, so use
+  // sign extension if that is what the first operand already has.
+  bool sign_extend = op->isSigned();
+  if (op->isEquality()) {
+    sign_extend = (codebuf.is_extended(op->getOperand(0), true) &&
+                   !codebuf.is_extended(op->getOperand(0), false));
+  }
+
+  uint64_t imm;
+  if (get_constant_int(op->getOperand(1), codebuf, &imm)) {
+    codebuf.move_to_reg(REG_ECX, op->getOperand(0));
+    codebuf.extend_value_to_i32(REG_ECX, op->getOperand(0), sign_extend,
+                                bits);
+    // Extend the constant in the same way as the other operand.
+    if (bits < 32) {
+      if (sign_extend) {
+        imm = (int32_t) (imm << (32 - bits)) >> (32 - bits);
+      } else {
+        imm &= (1 << bits) - 1;
+      }
+    }
+    codebuf.put_arith_reg_imm(X86ArithCmp, REG_ECX, imm);
+    return get_x86_cond(op->getPredicate());
+  }
+
+  codebuf.move_to_reg(REG_ECX, op->getOperand(0));
+  codebuf.move_to_reg(REG_EAX, op->getOperand(1));
+  codebuf.extend_value_to_i32(REG_EAX, op->getOperand(1), sign_extend, bits);
+  codebuf.extend_value_to_i32(REG_ECX, op->getOperand(0), sign_extend, bits);
+  // cmp %eax, %ecx
+  codebuf.put_byte(0x39);
+  codebuf.put_byte(0xc1);
+  return get_x86_cond(op->getPredicate());
+}
+
+// Returns the x86 condition code that tests for the FP comparison
+// |pred| after "ucomisd arg2, arg1", or -1 if there is no single
+// condition code for it.  An unordered result sets ZF, PF and CF, so
+// "a" and "ae" are false for it but "b" and "be" are true.  For the
+// "less than" and unordered "greater than" comparisons, |*swap| is
+// set to say that the operands must be swapped to use these.
+int get_fcmp_x86_cond(llvm::CmpInst::Predicate pred, bool *swap) {
+  *swap = (pred == llvm::CmpInst::FCMP_OLT ||
+           pred == llvm::CmpInst::FCMP_OLE ||
+           pred == llvm::CmpInst::FCMP_UGT ||
+           pred == llvm::CmpInst::FCMP_UGE);
+  if (*swap)
+    pred = llvm::CmpInst::getSwappedPredicate(pred);
+  switch (pred) {
+    case llvm::CmpInst::FCMP_OGT:
+      return 0x7; // 'a' (above)
+    case llvm::CmpInst::FCMP_OGE:
+      return 0x3; // 'ae' (above or equal)
+    case llvm::CmpInst::FCMP_ULT:
+      return 0x2; // 'b' (below)
+    case llvm::CmpInst::FCMP_ULE:
+      return 0x6; // 'be' (below or equal)
+    case llvm::CmpInst::FCMP_ONE:
+      return 0x5; // 'ne' (not equal)
+    case llvm::CmpInst::FCMP_UEQ:
+      return 0x4; // 'e' (equal)
+    case llvm::CmpInst::FCMP_ORD:
+      return 0xb; // 'np' (no parity)
+    case llvm::CmpInst::FCMP_UNO:
+      return 0xa; // 'p' (parity)
+    default:
+      // FCMP_OEQ and FCMP_UNE need two condition codes, and
+      // FCMP_TRUE and FCMP_FALSE need none.
+      return -1;
+  }
+}
+
+// Generate "ucomisd arg2, arg1" (or ucomiss), comparing the two FP
+// values.
+void put_ucomis(llvm::Value *arg1, llvm::Value *arg2, CodeBuf &codebuf) {
+  codebuf.move_fp_to_xmm(0, arg1);
+  codebuf.put_sse_op_value(arg1->getType()->isDoubleTy() ? 0x66 : 0, 0x2e,
+                           0, arg2);
+}
+
+// Generate code to compare the operands of |op|, setting the flags.
+// Returns the x86 condition code to test.  |op|'s predicate must be
+// one that get_fcmp_x86_cond() handles.
+int put_fcmp(llvm::FCmpInst *op, CodeBuf &codebuf) {
+  llvm::Value *arg1 = op->getOperand(0);
+  llvm::Value *arg2 = op->getOperand(1);
+  bool swap;
+  int x86_cond = get_fcmp_x86_cond(op->getPredicate(), &swap);
+  assert(x86_cond >= 0);
+  if (swap)
+    std::swap(arg1, arg2);
+  put_ucomis(arg1, arg2, codebuf);
+  return x86_cond;
+}
+
+// Generate code to compute the i1 result of the FP comparison |op|.
+void translate_fcmp(llvm::FCmpInst *op, CodeBuf &codebuf) {
+  llvm::CmpInst::Predicate pred = op->getPredicate();
+  if (pred == llvm::CmpInst::FCMP_FALSE) {
+    codebuf.put_code(TEMPL("\x31\xd2")); // xorl %edx, %edx
+  } else if (pred == llvm::CmpInst::FCMP_TRUE) {
+    codebuf.put_code(TEMPL("\xb2\x01")); // movb $1, %dl
+  } else if (pred == llvm::CmpInst::FCMP_OEQ) {
+    put_ucomis(op->getOperand(0), op->getOperand(1), codebuf);
+    codebuf.put_code(TEMPL("\x0f\x94\xc2")); // sete %dl
+    codebuf.put_code(TEMPL("\x0f\x9b\xc0")); // setnp %al
+    codebuf.put_code(TEMPL("\x20\xc2")); // andb %al, %dl
+  } else if (pred == llvm::CmpInst::FCMP_UNE) {
+    put_ucomis(op->getOperand(0), op->getOperand(1), codebuf);
+    codebuf.put_code(TEMPL("\x0f\x95\xc2")); // setne %dl
+    codebuf.put_code(TEMPL("\x0f\x9a\xc0")); // setp %al
+    codebuf.put_code(TEMPL("\x08\xc2")); // orb %al, %dl
+  } else {
+    int x86_cond = put_fcmp(op, codebuf);
+    // setCC %dl
+    codebuf.put_byte(0x0f);
+    codebuf.put_byte(0x90 | x86_cond);
+    codebuf.put_byte(0xc2);
+  }
+  codebuf.spill(REG_EDX, op);
+}
+
+// Returns whether |value| is a comparison whose only use is as the
+// condition of the branch or select that immediately follows it.  In
+// that case, the user generates the comparison itself and tests the
+// flags directly, so the i1 result is never stored.
+bool is_fused_compare(llvm::Value *value) {
+  llvm::CmpInst *cmp = llvm::dyn_cast<llvm::CmpInst>(value);
+  if (!cmp || !cmp->hasOneUse())
+    return false;
+  if (llvm::isa<llvm::FCmpInst>(cmp)) {
+    // Only FP comparisons that a single condition code tests can be
+    // fused.
+    bool swap;
+    if (get_fcmp_x86_cond(cmp->getPredicate(), &swap) < 0)
+      return false;
+  }
+  llvm::BasicBlock::iterator next(cmp);
+  ++next;
+  llvm::Instruction *user = llvm::cast<llvm::Instruction>(*cmp->use_begin());
+  if (user != next)
+    return false;
+  if (llvm::BranchInst *branch = llvm::dyn_cast<llvm::BranchInst>(user))
+    return branch->isConditional();
+  if (llvm::SelectInst *select = llvm::dyn_cast<llvm::SelectInst>(user))
+    return select->getCondition() == cmp;
+  return false;
+}
+
+// Generate code to set the flags from the i1 value |cond|.  Returns
+// the x86 condition code that is true when |cond| is true.
+int put_condition_test(llvm::Value *cond, CodeBuf &codebuf) {
+  if (is_fused_compare(cond)) {
+    if (llvm::FCmpInst *fcmp = llvm::dyn_cast<llvm::FCmpInst>(cond))
+      return put_fcmp(fcmp, codebuf);
+    return put_icmp(llvm::cast<llvm::ICmpInst>(cond), codebuf);
+  }
+  codebuf.move_to_reg(REG_EAX, cond);
+  // We must test only the bottom bit of %eax, since the other bits
+  // can contain garbage.
+  codebuf.put_code(TEMPL("\xa8\x01")); // testb $1, %al
+  return 0x5; // 'ne' (not equal)
+}
+
+// Generate code to shift the 64-bit value in %edx:%eax by the
+// constant |amount|, which is less than 64.
+void put_i64_shift_imm(unsigned opcode, int amount, CodeBuf &codebuf) {
+  if (amount >= 32) {
+    // Only one half of the input contributes to the result.
+    if (opcode == llvm::Instruction::Shl) {
+      codebuf.put_mov_reg_reg(REG_EDX, REG_EAX);
+      codebuf.put_shift_reg_imm(X86ShiftShl, REG_EDX, amount - 32);
+      codebuf.put_code(TEMPL("\x31\xc0")); // xorl %eax, %eax
+    } else if (opcode == llvm::Instruction::LShr) {
+      codebuf.put_mov_reg_reg(REG_EAX, REG_EDX);
+      codebuf.put_shift_reg_imm(X86ShiftShr, REG_EAX, amount - 32);
+      codebuf.put_code(TEMPL("\x31\xd2")); // xorl %edx, %edx
+    } else {
+      codebuf.put_mov_reg_reg(REG_EAX, REG_EDX);
+      codebuf.put_shift_reg_imm(X86ShiftSar, REG_EAX, amount - 32);
+      codebuf.put_shift_reg_imm(X86ShiftSar, REG_EDX, 31);
+    }
+  } else if (amount != 0) {
+    if (opcode == llvm::Instruction::Shl) {
+      codebuf.put_code(TEMPL("\x0f\xa4\xc2")); // shldl $amount, %eax, %edx
+      codebuf.put_byte(amount);
+      codebuf.put_shift_reg_imm(X86ShiftShl, REG_EAX, amount);
+    } else {
+      codebuf.put_code(TEMPL("\x0f\xac\xd0")); // shrdl $amount, %edx, %eax
+      codebuf.put_byte(amount);
+      if (opcode == llvm::Instruction::LShr) {
+        codebuf.put_shift_reg_imm(X86ShiftShr, REG_EDX, amount);
+      } else {
+        codebuf.put_shift_reg_imm(X86ShiftSar, REG_EDX, amount);
+      }
+    }
+  }
+}
+
+// Finds a multiplier for unsigned division by |divisor|, which must be
+// between 2 and 2^31 and not a power of two.  If a 32-bit multiplier
+// |*magic| exists such that x / divisor == (x * *magic) >> (32 +
+// *shift) for all 32-bit x, this returns true.  Otherwise it returns
+// false, and |*magic| and |*shift| are for the sequence
+//   t = (x * *magic) >> 32;  q = (((x - t) >> 1) + t) >> *shift
+// (Granlund and Montgomery, "Division by Invariant Integers using
+// Multiplication").
+bool get_udiv_magic(uint32_t divisor, uint32_t *magic, int *shift) {
+  int log2_ceil = 0;
+  while ((1ull << log2_ceil) < divisor)
+    ++log2_ceil;
+  for (int p = 32; p < 32 + log2_ceil; ++p) {
+    uint64_t m = ((1ull << p) + divisor - 1) / divisor;
+    if (m <= 0xffffffff && m * divisor - (1ull << p) <= (1ull << (p - 32))) {
+      *magic = m;
+      *shift = p - 32;
+      return true;
+    }
+  }
+  *magic = (((1ull << log2_ceil) - divisor) << 32) / divisor + 1;
+  *shift = log2_ceil - 1;
+  return false;
+}
+
+// Finds the multiplier and shift for signed division by |divisor|,
+// whose absolute value must be at least 3 and not a power of two
+// (Warren, "Hacker's Delight", section 10-4).
+void get_sdiv_magic(int32_t divisor, int32_t *magic, int *shift) {
+  const uint32_t two31 = 0x80000000;
+  uint32_t abs_divisor = divisor < 0 ? -divisor : divisor;
+  uint32_t t = two31 + ((uint32_t) divisor >> 31);
+  uint32_t abs_nc = t - 1 - t % abs_divisor;
+  int p = 31;
+  uint32_t q1 = two31 / abs_nc;
+  uint32_t r1 = two31 - q1 * abs_nc;
+  uint32_t q2 = two31 / abs_divisor;
+  uint32_t r2 = two31 - q2 * abs_divisor;
+  uint32_t delta;
+  do {
+    ++p;
+    q1 *= 2;
+    r1 *= 2;
+    if (r1 >= abs_nc) {
+      ++q1;
+      r1 -= abs_nc;
+    }
+    q2 *= 2;
+    r2 *= 2;
+    if (r2 >= abs_divisor) {
+      ++q2;
+      r2 -= abs_divisor;
+    }
+    delta = abs_divisor - r2;
+  } while (q1 < delta || (q1 == delta && r1 == 0));
+  *magic = q2 + 1;
+  if (divisor < 0)
+    *magic = -*magic;
+  *shift = p - 32;
+}
+
+// Generate code to multiply %eax by |multiplier| using shifts, lea
+// and add/sub, if there is a short sequence for it.  Otherwise, this
+// returns false without generating any code.
+bool put_mul_eax_by_shifts(uint32_t multiplier, CodeBuf &codebuf) {
+  if (multiplier == 0) {
+    // movl $0, %eax
+    codebuf.put_byte(0xb8);
+    codebuf.put_uint32(0);
+    return true;
+  }
+  int shift = 0;
+  while ((multiplier & (1u << shift)) == 0)
+    ++shift;
+  uint32_t odd = multiplier >> shift;
+  int k;
+  if (odd == 1) {
+    // Nothing to do before the shift.
+  } else if (odd == 3) {
+    codebuf.put_code(TEMPL("\x8d\x04\x40")); // leal (%eax,%eax,2), %eax
+  } else if (odd == 5) {
+    codebuf.put_code(TEMPL("\x8d\x04\x80")); // leal (%eax,%eax,4), %eax
+  } else if (odd == 9) {
+    codebuf.put_code(TEMPL("\x8d\x04\xc0")); // leal (%eax,%eax,8), %eax
+  } else if ((k = log2_exact(odd - 1)) > 0) {
+    // x * (2^k + 1) == (x << k) + x
+    codebuf.put_mov_reg_reg(REG_ECX, REG_EAX);
+    codebuf.put_shift_reg_imm(X86ShiftShl, REG_EAX, k);
+    codebuf.put_arith_reg_reg(X86ArithAdd, REG_EAX, REG_ECX);
+  } else if ((k = log2_exact(odd + 1)) > 0) {
+    // x * (2^k - 1) == (x << k) - x
+    codebuf.put_mov_reg_reg(REG_ECX, REG_EAX);
+    codebuf.put_shift_reg_imm(X86ShiftShl, REG_EAX, k);
+    codebuf.put_arith_reg_reg(X86ArithSub, REG_EAX, REG_ECX);
+  } else {
+    return false;
+  }
+  if (shift != 0)
+    codebuf.put_shift_reg_imm(X86ShiftShl, REG_EAX, shift);
+  return true;
+}
+
+// Generate code to multiply %eax by the constant |multiplier|.
+void put_mul_eax_imm(uint32_t multiplier, CodeBuf &codebuf) {
+  if (put_mul_eax_by_shifts(multiplier, codebuf))
+    return;
+  if (put_mul_eax_by_shifts(-multiplier, codebuf)) {
+    codebuf.put_code(TEMPL("\xf7\xd8")); // negl %eax
+    return;
+  }
+  codebuf.put_imul_reg_imm(REG_EAX, multiplier);
+}
+
+// Generate code for unsigned division or remainder by the constant
+// |divisor|, without using the div instruction.  Returns false if the
+// divisor is zero.
+bool translate_udiv_imm(llvm::BinaryOperator *op, int bits, uint32_t divisor,
+                        CodeBuf &codebuf) {
+  if (divisor == 0)
+    return false;
+  bool is_rem = op->getOpcode() == llvm::Instruction::URem;
+  codebuf.move_to_reg(REG_EAX, op->getOperand(0));
+  int k = log2_exact(divisor);
+  if (k >= 0) {
+    if (is_rem) {
+      // This also clears the bits above |bits|, so no extension is
+      // needed.
+      codebuf.put_arith_reg_imm(X86ArithAnd, REG_EAX, divisor - 1);
+    } else {
+      codebuf.extend_value_to_i32(REG_EAX, op->getOperand(0), false, bits);
+      if (k != 0)
+        codebuf.put_shift_reg_imm(X86ShiftShr, REG_EAX, k);
+    }
+    codebuf.spill(REG_EAX, op);
+    return true;
+  }
+
+  // Compute the quotient in %edx, keeping the dividend in %ecx.
+  codebuf.extend_value_to_i32(REG_EAX, op->getOperand(0), false, bits);
+  codebuf.put_mov_reg_reg(REG_ECX, REG_EAX);
+  if (divisor > 0x80000000) {
+    // The quotient is 0 or 1.
+    codebuf.put_code(TEMPL("\x31\xd2")); // xorl %edx, %edx
+    codebuf.put_arith_reg_imm(X86ArithCmp, REG_ECX, divisor);
+    codebuf.put_code(TEMPL("\x0f\x93\xc2")); // setae %dl
+  } else {
+    uint32_t magic;
+    int shift;
+    bool fits = get_udiv_magic(divisor, &magic, &shift);
+    // movl $magic, %eax
+    codebuf.put_byte(0xb8);
+    codebuf.put_uint32(magic);
+    // %edx:%eax = %eax * %ecx
+    codebuf.put_code(TEMPL("\xf7\xe1")); // mull %ecx
+    if (!fits) {
+      // %edx = (((%ecx - %edx) >> 1) + %edx)
+      codebuf.put_mov_reg_reg(REG_EAX, REG_ECX);
+      codebuf.put_arith_reg_reg(X86ArithSub, REG_EAX, REG_EDX);
+      codebuf.put_shift_reg_imm(X86ShiftShr, REG_EAX, 1);
+      codebuf.put_arith_reg_reg(X86ArithAdd, REG_EDX, REG_EAX);
+    }
+    if (shift != 0)
+      codebuf.put_shift_reg_imm(X86ShiftShr, REG_EDX, shift);
+  }
+  if (is_rem) {
+    codebuf.put_imul_reg_imm(REG_EDX, divisor);
+    codebuf.put_arith_reg_reg(X86ArithSub, REG_ECX, REG_EDX);
+    codebuf.spill(REG_ECX, op);
+  } else {
+    codebuf.spill(REG_EDX, op);
+  }
+  return true;
+}
+
+// Generate code for signed division or remainder by the constant
+// |divisor|, without using the idiv instruction.  Returns false if
+// the divisor is zero or -2^31.
+bool translate_sdiv_imm(llvm::BinaryOperator *op, int bits, int32_t divisor,
+                        CodeBuf &codebuf) {
+  if (divisor == 0 || divisor == (int32_t) 0x80000000)
+    return false;
+  bool is_rem = op->getOpcode() == llvm::Instruction::SRem;
+  uint32_t abs_divisor = divisor < 0 ? -divisor : divisor;
+  codebuf.move_to_reg(REG_EAX, op->getOperand(0));
+  codebuf.extend_value_to_i32(REG_EAX, op->getOperand(0), true, bits);
+  if (abs_divisor == 1) {
+    if (is_rem) {
+      // movl $0, %eax
+      codebuf.put_byte(0xb8);
+      codebuf.put_uint32(0);
+    } else if (divisor < 0) {
+      codebuf.put_code(TEMPL("\xf7\xd8")); // negl %eax
+    }
+    codebuf.spill(REG_EAX, op);
+    return true;
+  }
+  int k = log2_exact(abs_divisor);
+  if (k >= 0) {
+    // Division must round towards zero, so add 2^k - 1 to negative
+    // dividends before shifting.
+    codebuf.put_mov_reg_reg(REG_EDX, REG_EAX);
+    codebuf.put_mov_reg_reg(REG_ECX, REG_EAX);
+    codebuf.put_shift_reg_imm(X86ShiftSar, REG_ECX, 31);
+    codebuf.put_shift_reg_imm(X86ShiftShr, REG_ECX, 32 - k);
+    codebuf.put_arith_reg_reg(X86ArithAdd, REG_EAX, REG_ECX);
+    if (is_rem) {
+      // The remainder is x - ((x + bias) & -2^k).
+      codebuf.put_arith_reg_imm(X86ArithAnd, REG_EAX, -abs_divisor);
+      codebuf.put_arith_reg_reg(X86ArithSub, REG_EDX, REG_EAX);
+      codebuf.spill(REG_EDX, op);
+    } else {
+      codebuf.put_shift_reg_imm(X86ShiftSar, REG_EAX, k);
+      if (divisor < 0)
+        codebuf.put_code(TEMPL("\xf7\xd8")); // negl %eax
+      codebuf.spill(REG_EAX, op);
+    }
+    return true;
+  }
+
+  // Compute the quotient in %edx, keeping the dividend in %ecx.
+  int32_t magic;
+  int shift;
+  get_sdiv_magic(divisor, &magic, &shift);
+  codebuf.put_mov_reg_reg(REG_ECX, REG_EAX);
+  // movl $magic, %eax
+  codebuf.put_byte(0xb8);
+  codebuf.put_uint32(magic);
+  // %edx:%eax = %eax * %ecx
+  codebuf.put_code(TEMPL("\xf7\xe9")); // imull %ecx
+  if (divisor > 0 && magic < 0)
+    codebuf.put_arith_reg_reg(X86ArithAdd, REG_EDX, REG_ECX);
+  if (divisor < 0 && magic > 0)
+    codebuf.put_arith_reg_reg(X86ArithSub, REG_EDX, REG_ECX);
+  if (shift != 0)
+    codebuf.put_shift_reg_imm(X86ShiftSar, REG_EDX, shift);
+  // Add 1 if the quotient is negative, to round towards zero.
+  codebuf.put_mov_reg_reg(REG_EAX, REG_EDX);
+  codebuf.put_shift_reg_imm(X86ShiftShr, REG_EAX, 31);
+  codebuf.put_arith_reg_reg(X86ArithAdd, REG_EDX, REG_EAX);
+  if (is_rem) {
+    codebuf.put_imul_reg_imm(REG_EDX, divisor);
+    codebuf.put_arith_reg_reg(X86ArithSub, REG_ECX, REG_EDX);
+    codebuf.spill(REG_ECX, op);
+  } else {
+    codebuf.spill(REG_EDX, op);
+  }
+  return true;
+}
+
+// Generate code for a 32-bit (or narrower) arithmetic operation whose
+// second operand is the constant |imm|, using the operation's
+// immediate form.  Returns false if the operation has no immediate
+// form.
+bool translate_binop_imm(llvm::BinaryOperator *op, int bits, uint32_t imm,
+                         CodeBuf &codebuf) {
+  X86ArithOpcode arith_opcode;
+  switch (op->getOpcode()) {
+    case llvm::Instruction::Add:
+      arith_opcode = X86ArithAdd;
+      break;
+    case llvm::Instruction::Sub:
+      arith_opcode = X86ArithSub;
+      break;
+    case llvm::Instruction::And:
+      arith_opcode = X86ArithAnd;
+      break;
+    case llvm::Instruction::Or:
+      arith_opcode = X86ArithOr;
+      break;
+    case llvm::Instruction::Xor:
+      arith_opcode = X86ArithXor;
+      break;
+
+    case llvm::Instruction::Shl:
+      codebuf.move_to_reg(REG_EAX, op->getOperand(0));
+      codebuf.put_shift_reg_imm(X86ShiftShl, REG_EAX, imm & 31);
+      codebuf.spill(REG_EAX, op);
+      return true;
+    case llvm::Instruction::LShr:
+      codebuf.move_to_reg(REG_EAX, op->getOperand(0));
+      codebuf.extend_value_to_i32(REG_EAX, op->getOperand(0), false, bits);
+      codebuf.put_shift_reg_imm(X86ShiftShr, REG_EAX, imm & 31);
+      codebuf.spill(REG_EAX, op);
+      return true;
+    case llvm::Instruction::AShr:
+      codebuf.move_to_reg(REG_EAX, op->getOperand(0));
+      codebuf.extend_value_to_i32(REG_EAX, op->getOperand(0), true, bits);
+      codebuf.put_shift_reg_imm(X86ShiftSar, REG_EAX, imm & 31);
+      codebuf.spill(REG_EAX, op);
+      return true;
+
+    case llvm::Instruction::Mul:
+      // The low bits of the product do not depend on the operands'
+      // high bits, so no extension is needed.
+      codebuf.move_to_reg(REG_EAX, op->getOperand(0));
+      put_mul_eax_imm(imm, codebuf);
+      codebuf.spill(REG_EAX, op);
+      return true;
+    case llvm::Instruction::UDiv:
+    case llvm::Instruction::URem:
+      if (bits < 32)
+        imm &= (1 << bits) - 1;
+      return translate_udiv_imm(op, bits, imm, codebuf);
+    case llvm::Instruction::SDiv:
+    case llvm::Instruction::SRem:
+      if (bits < 32)
+        imm = (int32_t) (imm << (32 - bits)) >> (32 - bits);
+      return translate_sdiv_imm(op, bits, imm, codebuf);
+
+    default:
+      return false;
+  }
+  codebuf.move_to_reg(REG_EAX, op->getOperand(0));
+  codebuf.put_arith_reg_imm(arith_opcode, REG_EAX, imm);
+  codebuf.spill(REG_EAX, op);
+  return true;
+}
+
+// Returns whether the non-constant indexes of |gep| are all i32s,
+// which we can use directly as index registers.
+bool has_i32_indexes(llvm::GetElementPtrInst *gep) {
+  for (llvm::GetElementPtrInst::op_iterator op = gep->idx_begin();
+       op != gep->idx_end();
+       ++op) {
+    llvm::Value *index = *op;
+    if (!llvm::isa<llvm::Constant>(index) &&
+        !index->getType()->isIntegerTy(32))
+      return false;
+  }
+  return true;
+}
+
+// The operation that an instruction performs, for finding
+// instructions in a block that compute the same value.
+struct ValueKey {
+  unsigned opcode;
+  llvm::Type *type;
+  unsigned predicate; // For comparisons
+  std::vector<llvm::Value*> operands;
+
+  bool operator<(const ValueKey &other) const {
+    if (opcode != other.opcode)
+      return opcode < other.opcode;
+    if (type != other.type)
+      return type < other.type;
+    if (predicate != other.predicate)
+      return predicate < other.predicate;
+    return operands < other.operands;
+  }
+};
+
+// Returns whether |inst| has no side effects and computes a result
+// that depends only on its operands, so that an identical instruction
+// later in the block computes the same value.
+bool is_pure_operation(llvm::Instruction *inst, CodeBuf &codebuf) {
+  // Aliases are free already, and fused comparisons are computed
+  // by their users, so neither has a value to reuse.
+  if (codebuf.get_aliased_value(inst) || is_fused_compare(inst))
+    return false;
+  return (llvm::isa<llvm::BinaryOperator>(inst) ||
+          llvm::isa<llvm::CastInst>(inst) ||
+          llvm::isa<llvm::CmpInst>(inst) ||
+          llvm::isa<llvm::GetElementPtrInst>(inst) ||
+          llvm::isa<llvm::SelectInst>(inst));
+}
+
+ValueKey get_value_key(llvm::Instruction *inst, CodeBuf &codebuf) {
+  ValueKey key;
+  key.opcode = inst->getOpcode();
+  key.type = inst->getType();
+  key.predicate = 0;
+  if (llvm::CmpInst *cmp = llvm::dyn_cast<llvm::CmpInst>(inst))
+    key.predicate = cmp->getPredicate();
+  for (unsigned i = 0; i < inst->getNumOperands(); ++i)
+    key.operands.push_back(strip_aliases(inst->getOperand(i), codebuf));
+  // "a + b" and "b + a" are the same value.
+  if (inst->isCommutative())
+    std::sort(key.operands.begin(), key.operands.end());
+  return key;
+}
+
+// Finds instructions in |func| that recompute the value of an earlier
+// instruction in the same block: pure operations with the same
+// operands, and loads from the same address with no store, call,
+// other write to memory, or atomic or volatile load in between.
+// These become aliases of the earlier instruction (see
+// get_aliased_value()), so they generate no code and get no stack
+// slots.  The ExpandGetElementPtr and ExpandConstantExpr passes
+// produce a lot of these.
+void find_redundant_values(llvm::Function *func, CodeBuf &codebuf) {
+  codebuf.redundant_values.clear();
+  codebuf.redundant_copies.clear();
+  for (llvm::Function::iterator bb = func->begin();
+       bb != func->end();
+       ++bb) {
+    std::map<ValueKey,llvm::Instruction*> values;
+    std::map<ValueKey,llvm::Instruction*> loads;
+    for (llvm::BasicBlock::InstListType::iterator iter = bb->begin();
+         iter != bb->end();
+         ++iter) {
+      llvm::Instruction *inst = &*iter;
+      std::map<ValueKey,llvm::Instruction*> *table = NULL;
+      if (is_pure_operation(inst, codebuf)) {
+        table = &values;
+      } else if (llvm::LoadInst *load = llvm::dyn_cast<llvm::LoadInst>(inst)) {
+        if (load->isSimple()) {
+          table = &loads;
+        } else {
+          // Loads after an atomic or volatile load must not be moved
+          // before it, so they can't reuse earlier loads.
+          loads.clear();
+        }
+      } else if (inst->mayWriteToMemory()) {
+        // We don't know what this writes to, so forget every load.
+        loads.clear();
+      }
+      if (!table)
+        continue;
+      ValueKey key = get_value_key(inst, codebuf);
+      std::map<ValueKey,llvm::Instruction*>::iterator found =
+        table->find(key);
+      if (found == table->end()) {
+        (*table)[key] = inst;
+      } else {
+        codebuf.redundant_values[inst] = found->second;
+        codebuf.redundant_copies[found->second].push_back(inst);
+      }
+    }
+  }
+}
+
+// Finds the instructions in |func| whose results are not needed.
+// Starting from the instructions that have side effects, we mark the
+// instructions that they use as live, so that unused cycles of phi
+// nodes are dead too.  This must run after find_redundant_values(),
+// because an instruction that is used via a redundant copy of itself
+// is live.
+void find_dead_values(llvm::Function *func, CodeBuf &codebuf) {
+  std::set<llvm::Value*> live;
+  std::vector<llvm::Instruction*> worklist;
+  for (llvm::Function::iterator bb = func->begin();
+       bb != func->end();
+       ++bb) {
+    for (llvm::BasicBlock::InstListType::iterator inst = bb->begin();
+         inst != bb->end();
+         ++inst) {
+      if (llvm::isa<llvm::TerminatorInst>(inst) ||
+          inst->mayHaveSideEffects()) {
+        live.insert(inst);
+        worklist.push_back(inst);
+      }
+    }
+  }
+  while (!worklist.empty()) {
+    llvm::Instruction *inst = worklist.back();
+    worklist.pop_back();
+    std::vector<llvm::Value*> operands(inst->op_begin(), inst->op_end());
+    std::map<llvm::Value*,llvm::Value*>::iterator redundant =
+      codebuf.redundant_values.find(inst);
+    if (redundant != codebuf.redundant_values.end())
+      operands.push_back(redundant->second);
+    for (unsigned i = 0; i < operands.size(); ++i) {
+      llvm::Instruction *operand =
+        llvm::dyn_cast<llvm::Instruction>(operands[i]);
+      if (operand && live.insert(operand).second)
+        worklist.push_back(operand);
+    }
+  }
+
+  codebuf.dead_values.clear();
+  for (llvm::Function::iterator bb = func->begin();
+       bb != func->end();
+       ++bb) {
+    for (llvm::BasicBlock::InstListType::iterator inst = bb->begin();
+         inst != bb->end();
+         ++inst) {
+      if (live.count(inst) == 0)
+        codebuf.dead_values.insert(inst);
+    }
+  }
+}
+
+// Returns the size of the integer type |type| in bits, or 0 if
+// |type| is not an integer type.
+int get_int_bits(llvm::Type *type) {
+  if (llvm::IntegerType *inttype = llvm::dyn_cast<llvm::IntegerType>(type))
+    return inttype->getBitWidth();
+  return 0;
+}
+
+// Returns whether |op| loads an i8 or i16, which is extended to 32
+// bits as it is loaded.
+bool is_narrow_load(llvm::LoadInst *op) {
+  int bits = get_int_bits(op->getType());
+  return bits == 8 || bits == 16;
+}
+
+// Returns whether the narrow load |op| should sign-extend the value
+// it loads rather than zero-extend it, because its users only need
+// it sign-extended.
+bool load_wants_sign_extension(llvm::LoadInst *op, CodeBuf &codebuf) {
+  std::vector<llvm::Value*> values(1, op);
+  std::map<llvm::Value*,std::vector<llvm::Value*> >::iterator copies =
+    codebuf.redundant_copies.find(op);
+  if (copies != codebuf.redundant_copies.end())
+    values.insert(values.end(), copies->second.begin(), copies->second.end());
+  int signed_uses = 0;
+  for (unsigned i = 0; i < values.size(); ++i) {
+    for (llvm::Value::use_iterator use = values[i]->use_begin();
+         use != values[i]->use_end();
+         ++use) {
+      llvm::User *user = *use;
+      if (llvm::ICmpInst *cmp = llvm::dyn_cast<llvm::ICmpInst>(user)) {
+        // Equality comparisons work with either extension.
+        if (cmp->isEquality())
+          continue;
+        if (!cmp->isSigned())
+          return false;
+        ++signed_uses;
+      } else if (llvm::isa<llvm::SExtInst>(user) ||
+                 llvm::isa<llvm::SIToFPInst>(user)) {
+        ++signed_uses;
+      } else if (llvm::BinaryOperator *binop =
+                 llvm::dyn_cast<llvm::BinaryOperator>(user)) {
+        switch (binop->getOpcode()) {
+          case llvm::Instruction::SDiv:
+          case llvm::Instruction::SRem:
+          case llvm::Instruction::AShr:
+            ++signed_uses;
+            break;
+          case llvm::Instruction::UDiv:
+          case llvm::Instruction::URem:
+          case llvm::Instruction::LShr:
+            return false;
+          default:
+            break;
+        }
+      } else if (llvm::isa<llvm::ZExtInst>(user) ||
+                 llvm::isa<llvm::UIToFPInst>(user) ||
+                 llvm::isa<llvm::SwitchInst>(user)) {
+        return false;
+      }
+    }
+  }
+  return signed_uses != 0;
+}
+
+// Sets |*zero_extended| and |*sign_extended| to whether the code
+// generated for |inst|, which produces a value smaller than 32 bits,
+// leaves its result zero-extended or sign-extended to 32 bits, given
+// what is currently known about its operands.
+void get_result_extension(llvm::Instruction *inst, CodeBuf &codebuf,
+                          bool *zero_extended, bool *sign_extended) {
+  *zero_extended = false;
+  *sign_extended = false;
+  if (llvm::isa<llvm::ZExtInst>(inst)) {
+    // The top bit of the result is clear, so both extensions give
+    // the same value.
+    *zero_extended = true;
+    *sign_extended = true;
+  } else if (llvm::isa<llvm::SExtInst>(inst)) {
+    *sign_extended = true;
+  } else if (llvm::BinaryOperator *op =
+             llvm::dyn_cast<llvm::BinaryOperator>(inst)) {
+    llvm::Value *arg1 = op->getOperand(0);
+    llvm::Value *arg2 = op->getOperand(1);
+    switch (op->getOpcode()) {
+      // These extend their operands first, and their results are no
+      // bigger than their operands.
+      case llvm::Instruction::UDiv:
+      case llvm::Instruction::URem:
+      case llvm::Instruction::LShr:
+        *zero_extended = true;
+        break;
+      case llvm::Instruction::SDiv:
+      case llvm::Instruction::SRem:
+      case llvm::Instruction::AShr:
+        *sign_extended = true;
+        break;
+
+      case llvm::Instruction::And:
+        *zero_extended = (codebuf.is_extended(arg1, false) ||
+                          codebuf.is_extended(arg2, false));
+        *sign_extended = (codebuf.is_extended(arg1, true) &&
+                          codebuf.is_extended(arg2, true));
+        break;
+      case llvm::Instruction::Or:
+      case llvm::Instruction::Xor:
+        *zero_extended = (codebuf.is_extended(arg1, false) &&
+                          codebuf.is_extended(arg2, false));
+        *sign_extended = (codebuf.is_extended(arg1, true) &&
+                          codebuf.is_extended(arg2, true));
+        break;
+      default:
+        break;
+    }
+  } else if (llvm::SelectInst *op = llvm::dyn_cast<llvm::SelectInst>(inst)) {
+    *zero_extended = (codebuf.is_extended(op->getTrueValue(), false) &&
+                      codebuf.is_extended(op->getFalseValue(), false));
+    *sign_extended = (codebuf.is_extended(op->getTrueValue(), true) &&
+                      codebuf.is_extended(op->getFalseValue(), true));
+  } else if (llvm::PHINode *phi = llvm::dyn_cast<llvm::PHINode>(inst)) {
+    *zero_extended = true;
+    *sign_extended = true;
+    for (unsigned i = 0; i < phi->getNumIncomingValues(); ++i) {
+      llvm::Value *incoming = phi->getIncomingValue(i);
+      *zero_extended &= codebuf.is_extended(incoming, false);
+      *sign_extended &= codebuf.is_extended(incoming, true);
+    }
+  }
+}
+
+// Finds the values in |func| that are smaller than 32 bits but are
+// known to be zero-extended or sign-extended in their registers or
+// stack slots, so that their users can skip extending them.  Narrow
+// loads extend the values that they load, using whichever extension
+// their users need.  We start by assuming that every other narrow
+// value is extended both ways, and drop these assumptions until they
+// are consistent, so that loops of phi nodes are handled.  This must
+// run after find_dead_values().
+void find_extended_values(llvm::Function *func, CodeBuf &codebuf) {
+  codebuf.zero_extended_values.clear();
+  codebuf.sign_extended_values.clear();
+  std::vector<llvm::Instruction*> narrow_values;
+  for (llvm::Function::iterator bb = func->begin();
+       bb != func->end();
+       ++bb) {
+    for (llvm::BasicBlock::InstListType::iterator iter = bb->begin();
+         iter != bb->end();
+         ++iter) {
+      llvm::Instruction *inst = &*iter;
+      int bits = get_int_bits(inst->getType());
+      if (bits == 0 || bits >= 32 || codebuf.dead_values.count(inst) ||
+          codebuf.get_aliased_value(inst))
+        continue;
+      llvm::LoadInst *load = llvm::dyn_cast<llvm::LoadInst>(inst);
+      if (load && is_narrow_load(load)) {
+        if (load_wants_sign_extension(load, codebuf)) {
+          codebuf.sign_extended_values.insert(load);
+        } else {
+          codebuf.zero_extended_values.insert(load);
+        }
+        continue;
+      }
+      codebuf.zero_extended_values.insert(inst);
+      codebuf.sign_extended_values.insert(inst);
+      narrow_values.push_back(inst);
+    }
+  }
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (unsigned i = 0; i < narrow_values.size(); ++i) {
+      llvm::Instruction *inst = narrow_values[i];
+      bool zero_extended, sign_extended;
+      get_result_extension(inst, codebuf, &zero_extended, &sign_extended);
+      if (!zero_extended && codebuf.zero_extended_values.erase(inst))
+        changed = true;
+      if (!sign_extended && codebuf.sign_extended_values.erase(inst))
+        changed = true;
+    }
+  }
+}
+
+// Returns whether |inst| is an address computation that could be
+// folded into a memory operand: a GEP, an i32 addition, or an i32
+// subtraction, multiplication or left shift by a constant.
+bool is_address_arith(llvm::Instruction *inst, CodeBuf &codebuf) {
+  if (llvm::GetElementPtrInst *gep =
+      llvm::dyn_cast<llvm::GetElementPtrInst>(inst))
+    return has_i32_indexes(gep);
+  if (!inst->getType()->isIntegerTy(32))
+    return false;
+  uint64_t imm;
+  switch (inst->getOpcode()) {
+    case llvm::Instruction::Add:
+      return true;
+    case llvm::Instruction::Sub:
+    case llvm::Instruction::Shl:
+      return get_constant_int(inst->getOperand(1), codebuf, &imm);
+    case llvm::Instruction::Mul:
+      return (get_constant_int(inst->getOperand(0), codebuf, &imm) ||
+              get_constant_int(inst->getOperand(1), codebuf, &imm));
+    default:
+      return false;
+  }
+}
+
+// Returns whether every use of |value| is in |bb| and folds |value|
+// into a memory operand, either as the address of a load, store or
+// atomic operation or via another folded address computation.
+bool has_only_address_uses(llvm::Value *value, llvm::BasicBlock *bb,
+                           CodeBuf &codebuf) {
+  for (llvm::Value::use_iterator use = value->use_begin();
+       use != value->use_end();
+       ++use) {
+    llvm::Instruction *user = llvm::cast<llvm::Instruction>(*use);
+    if (codebuf.dead_values.count(user))
+      continue;
+    if (user->getParent() != bb)
+      return false;
+    if (llvm::isa<llvm::LoadInst>(user))
+      continue;
+    if (llvm::StoreInst *store = llvm::dyn_cast<llvm::StoreInst>(user)) {
+      if (store->getValueOperand() == value)
+        return false;
+      continue;
+    }
+    if (llvm::AtomicRMWInst *rmw = llvm::dyn_cast<llvm::AtomicRMWInst>(user)) {
+      if (rmw->getValOperand() == value)
+        return false;
+      continue;
+    }
+    if (llvm::AtomicCmpXchgInst *cmpxchg =
+        llvm::dyn_cast<llvm::AtomicCmpXchgInst>(user)) {
+      if (cmpxchg->getCompareOperand() == value ||
+          cmpxchg->getNewValOperand() == value)
+        return false;
+      continue;
+    }
+    // A truncated address is not an address.
+    if (llvm::isa<llvm::TruncInst>(user))
+      return false;
+    if (codebuf.get_aliased_value(user)) {
+      if (!has_only_address_uses(user, bb, codebuf))
+        return false;
+      continue;
+    }
+    if (codebuf.folded_addresses.count(user) == 0)
+      return false;
+  }
+  // The uses of instructions that recompute |value| are uses of it.
+  std::map<llvm::Value*,std::vector<llvm::Value*> >::iterator copies =
+    codebuf.redundant_copies.find(value);
+  if (copies != codebuf.redundant_copies.end()) {
+    for (unsigned i = 0; i < copies->second.size(); ++i) {
+      if (!has_only_address_uses(copies->second[i], bb, codebuf))
+        return false;
+    }
+  }
+  return true;
+}
+
+// Finds the address computations in |func| to fold into memory
+// operands.  Users follow their operands within a block, so visiting
+// each block backwards decides about an instruction's users before
+// the instruction itself.
+void find_folded_addresses(llvm::Function *func, CodeBuf &codebuf) {
+  codebuf.folded_addresses.clear();
+  for (llvm::Function::iterator bb = func->begin();
+       bb != func->end();
+       ++bb) {
+    for (llvm::BasicBlock::InstListType::reverse_iterator iter = bb->rbegin();
+         iter != bb->rend();
+         ++iter) {
+      llvm::Instruction *inst = &*iter;
+      if (is_address_arith(inst, codebuf) &&
+          has_only_address_uses(inst, bb, codebuf))
+        codebuf.folded_addresses.insert(inst);
+    }
+  }
+}
+
+// One term of an Address: |value| multiplied by |scale|.
+struct AddressTerm {
+  llvm::Value *value;
+  uint32_t scale;
+};
+
+// An address computed from IR values, as the sum of |terms|, |disp|
+// and the address of |global| (if non-NULL), modulo 2^32.
+struct Address {
+  std::vector<AddressTerm> terms;
+  uint32_t disp;
+  llvm::GlobalValue *global;
+
+  Address(): disp(0), global(NULL) {}
+};
+
+void add_address_arith_terms(llvm::Instruction *inst, uint32_t scale,
+                             Address *addr, CodeBuf &codebuf);
+
+// Adds |value| multiplied by |scale| to |addr|.  Constants go into
+// the displacement, and folded address computations are expanded into
+// their operands.
+void add_address_terms(llvm::Value *value, uint32_t scale, Address *addr,
+                       CodeBuf &codebuf) {
+  value = strip_aliases(value, codebuf);
+  if (codebuf.folded_addresses.count(value) == 1) {
+    add_address_arith_terms(llvm::cast<llvm::Instruction>(value), scale,
+                            addr, codebuf);
+    return;
+  }
+  if (llvm::Constant *cval = llvm::dyn_cast<llvm::Constant>(value)) {
+    llvm::GlobalValue *global;
+    uint64_t offset;
+    const char *unhandled = NULL;
+    expand_constant(cval, codebuf.data_layout, &global, &offset, &unhandled);
+    if (!unhandled && (!global || (scale == 1 && !addr->global))) {
+      addr->disp += offset * scale;
+      if (global)
+        addr->global = global;
+      return;
+    }
+  }
+  for (unsigned i = 0; i < addr->terms.size(); ++i) {
+    if (addr->terms[i].value == value) {
+      addr->terms[i].scale += scale;
+      return;
+    }
+  }
+  AddressTerm term = { value, scale };
+  addr->terms.push_back(term);
+}
+
+// Adds the result of the address computation |inst| (see
+// is_address_arith()) multiplied by |scale| to |addr|.
+void add_address_arith_terms(llvm::Instruction *inst, uint32_t scale,
+                             Address *addr, CodeBuf &codebuf) {
+  uint64_t imm;
+  switch (inst->getOpcode()) {
+    case llvm::Instruction::Add:
+      add_address_terms(inst->getOperand(0), scale, addr, codebuf);
+      add_address_terms(inst->getOperand(1), scale, addr, codebuf);
+      return;
+    case llvm::Instruction::Sub:
+      get_constant_int(inst->getOperand(1), codebuf, &imm);
+      add_address_terms(inst->getOperand(0), scale, addr, codebuf);
+      addr->disp -= imm * scale;
+      return;
+    case llvm::Instruction::Mul:
+      if (get_constant_int(inst->getOperand(1), codebuf, &imm)) {
+        add_address_terms(inst->getOperand(0), scale * imm, addr, codebuf);
+      } else {
+        get_constant_int(inst->getOperand(0), codebuf, &imm);
+        add_address_terms(inst->getOperand(1), scale * imm, addr, codebuf);
+      }
+      return;
+    case llvm::Instruction::Shl:
+      get_constant_int(inst->getOperand(1), codebuf, &imm);
+      add_address_terms(inst->getOperand(0), scale << (imm & 31), addr,
+                        codebuf);
+      return;
+    case llvm::Instruction::GetElementPtr: {
+      llvm::GetElementPtrInst *gep = llvm::cast<llvm::GetElementPtrInst>(inst);
+      add_address_terms(gep->getPointerOperand(), scale, addr, codebuf);
+      llvm::Type *ty = gep->getPointerOperand()->getType();
+      for (llvm::GetElementPtrInst::op_iterator op = gep->idx_begin();
+           op != gep->idx_end();
+           ++op) {
+        llvm::Value *index = *op;
+        if (llvm::StructType *stty = llvm::dyn_cast<llvm::StructType>(ty)) {
+          uint64_t field = llvm::cast<llvm::ConstantInt>(index)->getZExtValue();
+          addr->disp += codebuf.data_layout->getStructLayout(stty)
+                          ->getElementOffset(field) * scale;
+          ty = stty->getElementType(field);
+        } else {
+          ty = llvm::cast<llvm::SequentialType>(ty)->getElementType();
+          uint32_t element_size = codebuf.data_layout->getTypeAllocSize(ty);
+          add_address_terms(index, scale * element_size, addr, codebuf);
+        }
+      }
+      return;
+    }
+    default:
+      assert(!"Unknown address computation");
+  }
+}
+
+// Returns whether |scale| can be encoded in a memory operand.
+bool is_mem_scale(uint32_t scale) {
+  return scale == 1 || scale == 2 || scale == 4 || scale == 8;
+}
+
+// Generate code to put the terms of |addr| into registers, and return
+// the memory operand that addresses it.  Terms that live in registers
+// are used in place.  Others are put in |reg1| and |reg2|, and when a
+// memory operand cannot hold any more registers, its sum so far is
+// computed into one of those with leal.
+MemOperand put_address(Address &addr, int reg1, int reg2, CodeBuf &codebuf) {
+  MemOperand mem = { kNoReg, kNoReg, 1, (int32_t) addr.disp, addr.global };
+  for (unsigned i = 0; i < addr.terms.size(); ++i) {
+    llvm::Value *value = addr.terms[i].value;
+    uint32_t scale = addr.terms[i].scale;
+    if (scale == 0)
+      continue;
+    if (scale == 1 && mem.base_reg == kNoReg &&
+        codebuf.static_allocas.count(value) == 1) {
+      MemOperand frame = codebuf.static_alloca_mem(value);
+      mem.base_reg = frame.base_reg;
+      mem.disp += frame.disp;
+      continue;
+    }
+    if (mem.base_reg == kNoReg && mem.index_reg != kNoReg && mem.scale == 1) {
+      mem.base_reg = mem.index_reg;
+      mem.index_reg = kNoReg;
+    }
+    // A term with a scale that we cannot encode is multiplied out
+    // first, and then added with a scale of 1.
+    bool needs_index = is_mem_scale(scale) && scale != 1;
+    if (mem.index_reg != kNoReg &&
+        (mem.base_reg != kNoReg || needs_index)) {
+      // Free up the index by summing the operand so far into a
+      // register.
+      int dest_reg = reg1;
+      if (mem.base_reg == reg2 || mem.index_reg == reg2)
+        dest_reg = reg2;
+      if (mem.base_reg == reg1 || mem.index_reg == reg1)
+        dest_reg = reg1;
+      MemOperand sum = mem;
+      sum.disp = 0;
+      sum.global = NULL;
+      codebuf.put_lea(dest_reg, sum);
+      mem.base_reg = dest_reg;
+      mem.index_reg = kNoReg;
+      mem.scale = 1;
+    }
+    int reg;
+    if (is_mem_scale(scale) && codebuf.value_regs.count(value) == 1) {
+      reg = codebuf.value_regs[value];
+    } else {
+      reg = (mem.base_reg == reg1 || mem.index_reg == reg1) ? reg2 : reg1;
+      codebuf.move_to_reg(reg, value);
+      if (!is_mem_scale(scale)) {
+        codebuf.put_imul_reg_imm(reg, scale);
+        scale = 1;
+      }
+    }
+    if (scale == 1 && mem.base_reg == kNoReg) {
+      mem.base_reg = reg;
+    } else {
+      mem.index_reg = reg;
+      mem.scale = scale;
+    }
+  }
+  return mem;
+}
+
+// Returns |mem| with |offset| added to its displacement.
+MemOperand mem_offset(MemOperand mem, int32_t offset) {
+  mem.disp += offset;
+  return mem;
+}
+
+// Generate code to compute the address |ptr| for a load or store, and
+// return the memory operand to use.  This may use |reg1| and |reg2|.
+MemOperand get_mem_operand(llvm::Value *ptr, int reg1, int reg2,
+                           CodeBuf &codebuf) {
+  Address addr;
+  add_address_terms(ptr, 1, &addr, codebuf);
+  return put_address(addr, reg1, reg2, codebuf);
+}
+
+// Generate code for a 64-bit arithmetic operation.  The low and high
+// halves of the result are computed in %eax and %edx respectively.
+void translate_i64_binop(llvm::BinaryOperator *op, CodeBuf &codebuf) {
+  llvm::Value *arg1 = op->getOperand(0);
+  llvm::Value *arg2 = op->getOperand(1);
+  X86ArithOpcode lo_opcode;
+  X86ArithOpcode hi_opcode;
+  switch (op->getOpcode()) {
+    case llvm::Instruction::Add:
+      lo_opcode = X86ArithAdd;
+      hi_opcode = X86ArithAdc;
+      break;
+    case llvm::Instruction::Sub:
+      lo_opcode = X86ArithSub;
+      hi_opcode = X86ArithSbb;
+      break;
+    case llvm::Instruction::And:
+      lo_opcode = hi_opcode = X86ArithAnd;
+      break;
+    case llvm::Instruction::Or:
+      lo_opcode = hi_opcode = X86ArithOr;
+      break;
+    case llvm::Instruction::Xor:
+      lo_opcode = hi_opcode = X86ArithXor;
+      break;
+
+    case llvm::Instruction::Mul:
+      // The result is lo1*lo2 + ((hi1*lo2 + lo1*hi2) << 32).
+      codebuf.move_part_to_reg(REG_EAX, arg1, 4);
+      codebuf.move_part_to_reg(REG_EDX, arg2, 0);
+      codebuf.put_code(TEMPL("\x0f\xaf\xc2")); // imull %edx, %eax
+      codebuf.move_part_to_reg(REG_ECX, arg2, 4);
+      codebuf.move_part_to_reg(REG_EDX, arg1, 0);
+      codebuf.put_code(TEMPL("\x0f\xaf\xca")); // imull %edx, %ecx
+      codebuf.put_arith_reg_reg(X86ArithAdd, REG_ECX, REG_EAX);
+      codebuf.move_part_to_reg(REG_EAX, arg1, 0);
+      codebuf.move_part_to_reg(REG_EDX, arg2, 0);
+      // %edx:%eax = %eax * %edx
+      codebuf.put_code(TEMPL("\xf7\xe2")); // mull %edx
+      codebuf.put_arith_reg_reg(X86ArithAdd, REG_EDX, REG_ECX);
+      codebuf.spill_part(REG_EAX, op, 0);
+      codebuf.spill_part(REG_EDX, op, 4);
+      return;
+
+    case llvm::Instruction::Shl:
+    case llvm::Instruction::LShr:
+    case llvm::Instruction::AShr: {
+      codebuf.move_part_to_reg(REG_EAX, arg1, 0);
+      codebuf.move_part_to_reg(REG_EDX, arg1, 4);
+      uint64_t amount;
+      if (get_constant_int(arg2, codebuf, &amount)) {
+        put_i64_shift_imm(op->getOpcode(), amount & 63, codebuf);
+        codebuf.spill_part(REG_EAX, op, 0);
+        codebuf.spill_part(REG_EDX, op, 4);
+        return;
+      }
+      // Only the bottom 6 bits of the shift amount are significant.
+      codebuf.move_part_to_reg(REG_ECX, arg2, 0);
+      // The double-width shift instructions only use the bottom 5
+      // bits of %cl, so shifts of 32 or more need fixing up below.
+      if (op->getOpcode() == llvm::Instruction::Shl) {
+        codebuf.put_code(TEMPL("\x0f\xa5\xc2")); // shldl %cl, %eax, %edx
+        codebuf.put_code(TEMPL("\xd3\xe0")); // shll %cl, %eax
+      } else {
+        codebuf.put_code(TEMPL("\x0f\xad\xd0")); // shrdl %cl, %edx, %eax
+        if (op->getOpcode() == llvm::Instruction::LShr) {
+          codebuf.put_code(TEMPL("\xd3\xea")); // shrl %cl, %edx
+        } else {
+          codebuf.put_code(TEMPL("\xd3\xfa")); // sarl %cl, %edx
+        }
+      }
+      codebuf.put_code(TEMPL("\xf6\xc1\x20")); // testb $32, %cl
+      codebuf.put_byte(0x74); // je <label> (8-bit)
+      uint8_t *jump_dest = (uint8_t *) codebuf.put_alloc_space(1);
+      if (op->getOpcode() == llvm::Instruction::Shl) {
+        codebuf.put_code(TEMPL("\x89\xc2")); // movl %eax, %edx
+        codebuf.put_code(TEMPL("\x31\xc0")); // xorl %eax, %eax
+      } else if (op->getOpcode() == llvm::Instruction::LShr) {
+        codebuf.put_code(TEMPL("\x89\xd0")); // movl %edx, %eax
+        codebuf.put_code(TEMPL("\x31\xd2")); // xorl %edx, %edx
+      } else {
+        codebuf.put_code(TEMPL("\x89\xd0")); // movl %edx, %eax
+        codebuf.put_code(TEMPL("\xc1\xfa\x1f")); // sarl $31, %edx
+      }
+      // Fix up relocation.
+      *jump_dest = codebuf.get_current_pos() - (char *) (jump_dest + 1);
+      codebuf.spill_part(REG_EAX, op, 0);
+      codebuf.spill_part(REG_EDX, op, 4);
+      return;
+    }
+
+    case llvm::Instruction::UDiv:
+    case llvm::Instruction::URem:
+    case llvm::Instruction::SDiv:
+    case llvm::Instruction::SRem: {
+      uint64_t divisor;
+      if ((op->getOpcode() == llvm::Instruction::UDiv ||
+           op->getOpcode() == llvm::Instruction::URem) &&
+          get_constant_int(arg2, codebuf, &divisor) &&
+          divisor != 0 && (divisor & (divisor - 1)) == 0) {
+        // Unsigned division by a power of two is a shift, and the
+        // remainder is a mask.
+        codebuf.move_part_to_reg(REG_EAX, arg1, 0);
+        codebuf.move_part_to_reg(REG_EDX, arg1, 4);
+        if (op->getOpcode() == llvm::Instruction::UDiv) {
+          int amount = 0;
+          while ((1ull << amount) != divisor)
+            ++amount;
+          put_i64_shift_imm(llvm::Instruction::LShr, amount, codebuf);
+        } else {
+          codebuf.put_arith_reg_imm(X86ArithAnd, REG_EAX, divisor - 1);
+          codebuf.put_arith_reg_imm(X86ArithAnd, REG_EDX,
+                                    (divisor - 1) >> 32);
+        }
+        codebuf.spill_part(REG_EAX, op, 0);
+        codebuf.spill_part(REG_EDX, op, 4);
+        return;
+      }
+      // Division goes via a helper function, which takes its first
+      // argument in %edx:%eax and its second argument on the stack.
+      assert(codebuf.frame_callees_args_size >= 8);
+      codebuf.move_part_to_reg(REG_EAX, arg2, 0);
+      codebuf.write_reg_to_esp_offset(REG_EAX, 0);
+      codebuf.move_part_to_reg(REG_EAX, arg2, 4);
+      codebuf.write_reg_to_esp_offset(REG_EAX, 4);
+      codebuf.move_part_to_reg(REG_EAX, arg1, 0);
+      codebuf.move_part_to_reg(REG_EDX, arg1, 4);
+      uintptr_t func;
+      switch (op->getOpcode()) {
+#define MAP(OP) \
+    case llvm::Instruction::OP: \
+      func = (uintptr_t) runtime_i64_##OP; break
+        MAP(UDiv);
+        MAP(URem);
+        MAP(SDiv);
+        MAP(SRem);
+#undef MAP
+        default:
+          assert(!"Unknown binary operator");
+      }
+      codebuf.put_direct_call(func);
+      codebuf.spill_part(REG_EAX, op, 0);
+      codebuf.spill_part(REG_EDX, op, 4);
+      return;
+    }
+
+    default:
+      assert(!"Unknown binary operator");
+  }
+
+  // Note that the movs emitted here leave the carry flag intact
+  // between the two halves.
+  codebuf.move_part_to_reg(REG_EAX, arg1, 0);
+  put_arith_value(lo_opcode, REG_EAX, arg2, 0, codebuf);
+  codebuf.move_part_to_reg(REG_EDX, arg1, 4);
+  put_arith_value(hi_opcode, REG_EDX, arg2, 4, codebuf);
+  codebuf.spill_part(REG_EAX, op, 0);
+  codebuf.spill_part(REG_EDX, op, 4);
+}
+
+// Record that the 32-bit relative offset ending at |loc| should
+// point to the edge from |from_bb| to |dest|.  An edge to a block with
+// phi nodes goes via a trampoline that assigns the phi nodes.  This
+// splits the edge, so that the copies only happen on the edge that is
+// taken.
+void add_edge_offset32(llvm::BasicBlock *from_bb, llvm::BasicBlock *dest,
+                       uint32_t *loc, CodeBuf &codebuf) {
+  if (!llvm::isa<llvm::PHINode>(dest->begin())) {
+    codebuf.jump_relocs.push_back(CodeBuf::JumpReloc(loc, dest));
+    return;
+  }
+  for (unsigned i = 0; i < codebuf.trampolines.size(); ++i) {
+    CodeBuf::Trampoline &trampoline = codebuf.trampolines[i];
+    if (trampoline.from == from_bb && trampoline.to == dest) {
+      trampoline.jump_locs.push_back(loc);
+      return;
+    }
+  }
+  CodeBuf::Trampoline trampoline;
+  trampoline.from = from_bb;
+  trampoline.to = dest;
+  trampoline.jump_locs.push_back(loc);
+  codebuf.trampolines.push_back(trampoline);
+}
+
+// Generate a jump along the edge from |from_bb| to |dest|, which is
+// conditional on |x86_cond| unless that is kJumpAlways.  This is for
+// terminators that can branch to more than one place.
+void put_edge_jump(int x86_cond, llvm::BasicBlock *from_bb,
+                   llvm::BasicBlock *dest, CodeBuf &codebuf) {
+  if (!llvm::isa<llvm::PHINode>(dest->begin())) {
+    codebuf.put_jump(x86_cond, dest);
+    return;
+  }
+  if (x86_cond == kJumpAlways) {
+    codebuf.put_byte(0xe9); // jmp <label> (32-bit)
+  } else {
+    // jCC <label> (32-bit)
+    codebuf.put_byte(0x0f);
+    codebuf.put_byte(0x80 | x86_cond);
+  }
+  codebuf.put_uint32(0); // Placeholder
+  add_edge_offset32(from_bb, dest, (uint32_t *) codebuf.get_current_pos(),
+                    codebuf);
+}
+
+// Generate the current function's trampolines.  They go after all of
+// the function's blocks, to keep them out of the way of the code that
+// falls through from one block to the next.
+void put_trampolines(CodeBuf &codebuf) {
+  codebuf.next_bb = NULL;
+  for (unsigned i = 0; i < codebuf.trampolines.size(); ++i) {
+    CodeBuf::Trampoline &trampoline = codebuf.trampolines[i];
+    uint32_t addr = (uint32_t) codebuf.get_current_pos();
+    unconditional_jump(trampoline.from, trampoline.to, codebuf);
+    for (unsigned j = 0; j < trampoline.jump_locs.size(); ++j) {
+      uint32_t *jump_loc = trampoline.jump_locs[j];
+      jump_loc[-1] = addr - (uint32_t) jump_loc;
+      // Jump tables are in the data segment.
+      if (!codebuf.contains(jump_loc - 1))
+        codebuf.add_image_reloc(jump_loc - 1, addr, true);
+    }
+  }
+  codebuf.trampolines.clear();
+}
+
+struct SwitchCase {
+  uint32_t value; // Zero-extended to 32 bits
+  llvm::BasicBlock *dest;
+};
+
+bool compare_switch_cases(const SwitchCase &a, const SwitchCase &b) {
+  return a.value < b.value;
+}
+
+// Generate a binary search over cases[begin, end) for the value in
+// %eax.
+void put_switch_tree(std::vector<SwitchCase> &cases, int begin, int end,
+                     llvm::BasicBlock *from_bb,
+                     llvm::BasicBlock *default_dest, CodeBuf &codebuf) {
+  if (end - begin <= 3) {
+    for (int i = begin; i < end; ++i) {
+      // cmpl $value, %eax
+      codebuf.put_byte(0x3d);
+      codebuf.put_uint32(cases[i].value);
+      put_edge_jump(0x4, from_bb, cases[i].dest, codebuf); // je
+    }
+    put_edge_jump(kJumpAlways, from_bb, default_dest, codebuf);
+    return;
+  }
+  int mid = (begin + end) / 2;
+  // cmpl $value, %eax
+  codebuf.put_byte(0x3d);
+  codebuf.put_uint32(cases[mid].value);
+  codebuf.put_code(TEMPL("\x0f\x83")); // jae <label> (32-bit)
+  uint32_t *jump_dest =
+    (uint32_t *) codebuf.put_alloc_space(sizeof(uint32_t));
+  put_switch_tree(cases, begin, mid, from_bb, default_dest, codebuf);
+  // Fix up relocation.
+  uintptr_t label = (uintptr_t) codebuf.get_current_pos();
+  *jump_dest = label - (uintptr_t) (jump_dest + 1);
+  put_switch_tree(cases, mid, end, from_bb, default_dest, codebuf);
+}
+
+void translate_switch(llvm::SwitchInst *op, CodeBuf &codebuf) {
+  llvm::IntegerType *inttype = llvm::cast<llvm::IntegerType>(
+      op->getCondition()->getType());
+  int bits = inttype->getBitWidth();
+  assert(bits >= 8); // Disallow i1
+
+  std::vector<SwitchCase> cases;
+  for (llvm::SwitchInst::CaseIt iter = op->case_begin();
+       iter != op->case_end();
+       ++iter) {
+    SwitchCase c = { (uint32_t) iter.getCaseValue()->getZExtValue(),
+                     iter.getCaseSuccessor() };
+    cases.push_back(c);
+  }
+  std::sort(cases.begin(), cases.end(), compare_switch_cases);
+
+  llvm::BasicBlock *bb = op->getParent();
+  codebuf.move_to_reg(REG_EAX, op->getCondition());
+  codebuf.extend_value_to_i32(REG_EAX, op->getCondition(), false, bits);
+  uint64_t range = 0;
+  if (!cases.empty())
+    range = (uint64_t) cases.back().value - cases.front().value + 1;
+  if (cases.size() >= kMinJumpTableCases &&
+      cases.size() * 100 >= range * kMinJumpTableDensity) {
+    uint32_t min_value = cases.front().value;
+    if (min_value != 0) {
+      // subl $min_value, %eax
+      codebuf.put_byte(0x2d);
+      codebuf.put_uint32(min_value);
+    }
+    // cmpl $(range - 1), %eax
+    codebuf.put_byte(0x3d);
+    codebuf.put_uint32(range - 1);
+    put_edge_jump(0x7, bb, op->getDefaultDest(), codebuf); // ja
+
+    // The table entries are relative offsets, in the same form as
+    // jump instructions' offsets, so that they can use jump_relocs.
+    uint32_t *table = (uint32_t *) codebuf.data_segment.put_alloc_space(
+        range * sizeof(uint32_t));
+    std::vector<llvm::BasicBlock*> dests(range, op->getDefaultDest());
+    for (unsigned i = 0; i < cases.size(); ++i)
+      dests[cases[i].value - min_value] = cases[i].dest;
+    for (uint32_t i = 0; i < range; ++i)
+      add_edge_offset32(bb, dests[i], &table[i + 1], codebuf);
+    // leal table+4(,%eax,4), %ecx
+    codebuf.put_code(TEMPL("\x8d\x0c\x85"));
+    codebuf.put_data_addr((uint32_t) &table[1]);
+    codebuf.put_code(TEMPL("\x03\x49\xfc")); // addl -4(%ecx), %ecx
+    codebuf.put_code(TEMPL("\xff\xe1")); // jmp *%ecx
+  } else {
+    put_switch_tree(cases, 0, cases.size(), bb, op->getDefaultDest(),
+                    codebuf);
+  }
+}
+
+// Returns whether we generate |op| inline rather than calling the
+// host's C library.  Its length must be constant.  memmove is only
+// generated inline when all of its data fits in XMM registers.
+bool is_inline_mem_intrinsic(llvm::MemIntrinsic *op, CodeBuf &codebuf) {
+  llvm::ConstantInt *length = llvm::dyn_cast<llvm::ConstantInt>(
+      op->getLength());
+  if (!length || op->isVolatile())
+    return false;
+  uint64_t size = length->getZExtValue();
+  if (llvm::isa<llvm::MemMoveInst>(op)) {
+    return size == 0 || (codebuf.have_sse2 && size >= 4 &&
+                         size <= kMaxSSEMemOpSize);
+  }
+  return size <= kMaxRepMemOpSize;
+}
+
+// Like get_mem_operand(), but the resulting operand uses no scratch
+// register other than |reg|, so |spare_reg| is free afterwards.
+MemOperand get_mem_operand_using(llvm::Value *ptr, int reg, int spare_reg,
+                                 CodeBuf &codebuf) {
+  MemOperand mem = get_mem_operand(ptr, reg, spare_reg, codebuf);
+  if (mem.base_reg == spare_reg || mem.index_reg == spare_reg) {
+    codebuf.put_lea(reg, mem);
+    MemOperand in_reg = { reg, kNoReg, 1, 0, NULL };
+    mem = in_reg;
+  }
+  return mem;
+}
+
+// Generate "movl $count, %ecx; rep <op>", followed by single string
+// operations for the 2-byte and 1-byte remainders of |size|.  |op| is
+// the opcode of movsb or stosb; the next opcode up is movsl or stosl.
+void put_rep_string_op(int op, uint32_t size, CodeBuf &codebuf) {
+  // movl $count, %ecx
+  codebuf.put_byte(0xb8 | REG_ECX);
+  codebuf.put_uint32(size / 4);
+  codebuf.put_byte(0xf3); // REP prefix
+  codebuf.put_byte(op + 1);
+  if (size & 2) {
+    codebuf.put_byte(0x66); // DATA16 prefix
+    codebuf.put_byte(op + 1);
+  }
+  if (size & 1)
+    codebuf.put_byte(op);
+}
+
+// Returns the offset of chunk |index| when |size| bytes are split into
+// chunks of |chunk_size| bytes.  The last chunk ends at |size|, so it
+// may overlap the one before it.
+uint32_t get_chunk_offset(int index, int chunk_size, uint32_t size) {
+  return std::min(index * chunk_size, (int) size - chunk_size);
+}
+
+// Generate code for memcpy or memmove of a constant |size| of bytes.
+void translate_mem_transfer(llvm::MemTransferInst *op, uint32_t size,
+                            CodeBuf &codebuf) {
+  MemOperand src = get_mem_operand_using(op->getRawSource(), REG_EAX,
+                                         REG_ECX, codebuf);
+  MemOperand dest = get_mem_operand_using(op->getRawDest(), REG_EDX,
+                                          REG_ECX, codebuf);
+  if (codebuf.have_sse2 && size >= 4 && size <= kMaxSSEMemOpSize) {
+    // Load all of the data before storing any of it, so that this
+    // works for memmove when the source and destination overlap.
+    int chunk_size = size >= 16 ? 16 : (size >= 8 ? 8 : 4);
+    int chunks = (size + chunk_size - 1) / chunk_size;
+    for (int i = 0; i < chunks; ++i) {
+      if (chunk_size == 16) {
+        codebuf.put_code(TEMPL("\xf3\x0f\x6f")); // movdqu mem, %xmmI
+      } else if (chunk_size == 8) {
+        codebuf.put_code(TEMPL("\xf3\x0f\x7e")); // movq mem, %xmmI
+      } else {
+        codebuf.put_code(TEMPL("\x66\x0f\x6e")); // movd mem, %xmmI
+      }
+      codebuf.put_modrm_mem(i, mem_offset(
+          src, get_chunk_offset(i, chunk_size, size)));
+    }
+    for (int i = 0; i < chunks; ++i) {
+      if (chunk_size == 16) {
+        codebuf.put_code(TEMPL("\xf3\x0f\x7f")); // movdqu %xmmI, mem
+      } else if (chunk_size == 8) {
+        codebuf.put_code(TEMPL("\x66\x0f\xd6")); // movq %xmmI, mem
+      } else {
+        codebuf.put_code(TEMPL("\x66\x0f\x7e")); // movd %xmmI, mem
+      }
+      codebuf.put_modrm_mem(i, mem_offset(
+          dest, get_chunk_offset(i, chunk_size, size)));
+    }
+  } else if (size <= kMaxUnrolledMemOpSize) {
+    assert(llvm::isa<llvm::MemCpyInst>(op));
+    uint32_t offset = 0;
+    while (offset < size) {
+      int part_size = std::min(size - offset, 4u);
+      if (part_size == 3)
+        part_size = 2;
+      // mov<size> offset+src, %ecx
+      codebuf.put_sized_opcode_bits(part_size * 8, 0x8a);
+      codebuf.put_modrm_mem(REG_ECX, mem_offset(src, offset));
+      // mov<size> %ecx, offset+dest
+      codebuf.put_sized_opcode_bits(part_size * 8, 0x88);
+      codebuf.put_modrm_mem(REG_ECX, mem_offset(dest, offset));
+      offset += part_size;
+    }
+  } else {
+    assert(llvm::isa<llvm::MemCpyInst>(op));
+    codebuf.put_lea(REG_EAX, src);
+    codebuf.put_lea(REG_EDX, dest);
+    // %esi and %edi may hold the caller's or our own values.
+    codebuf.put_push_reg(REG_ESI);
+    codebuf.put_push_reg(REG_EDI);
+    codebuf.put_mov_reg_reg(REG_ESI, REG_EAX);
+    codebuf.put_mov_reg_reg(REG_EDI, REG_EDX);
+    put_rep_string_op(0xa4, size, codebuf); // movs
+    codebuf.put_pop_reg(REG_EDI);
+    codebuf.put_pop_reg(REG_ESI);
+  }
+}
+
+// Generate code for memset of a constant |size| of bytes.
+void translate_memset(llvm::MemSetInst *op, uint32_t size, CodeBuf &codebuf) {
+  MemOperand dest = get_mem_operand_using(op->getRawDest(), REG_EDX,
+                                          REG_ECX, codebuf);
+  // Fill %eax with copies of the byte to store.
+  uint64_t imm;
+  if (get_constant_int(op->getValue(), codebuf, &imm)) {
+    // movl $INT32, %eax
+    codebuf.put_byte(0xb8 | REG_EAX);
+    codebuf.put_uint32((imm & 0xff) * 0x01010101);
+  } else {
+    codebuf.move_to_reg(REG_EAX, op->getValue());
+    codebuf.extend_value_to_i32(REG_EAX, op->getValue(), false, 8);
+    codebuf.put_imul_reg_imm(REG_EAX, 0x01010101);
+  }
+  if (codebuf.have_sse2 && size >= 16 && size <= kMaxSSEMemOpSize) {
+    codebuf.put_code(TEMPL("\x66\x0f\x6e\xc0")); // movd %eax, %xmm0
+    // pshufd $0, %xmm0, %xmm0
+    codebuf.put_code(TEMPL("\x66\x0f\x70\xc0\x00"));
+    int chunks = (size + 15) / 16;
+    for (int i = 0; i < chunks; ++i) {
+      codebuf.put_code(TEMPL("\xf3\x0f\x7f")); // movdqu %xmm0, mem
+      codebuf.put_modrm_mem(0, mem_offset(dest, get_chunk_offset(i, 16, size)));
+    }
+  } else if (size <= kMaxUnrolledMemOpSize) {
+    uint32_t offset = 0;
+    while (offset < size) {
+      int part_size = std::min(size - offset, 4u);
+      if (part_size == 3)
+        part_size = 2;
+      // mov<size> %eax, offset+dest
+      codebuf.put_sized_opcode_bits(part_size * 8, 0x88);
+      codebuf.put_modrm_mem(REG_EAX, mem_offset(dest, offset));
+      offset += part_size;
+    }
+  } else {
+    codebuf.put_lea(REG_EDX, dest);
+    codebuf.put_push_reg(REG_EDI);
+    codebuf.put_mov_reg_reg(REG_EDI, REG_EDX);
+    put_rep_string_op(0xaa, size, codebuf); // stos
+    codebuf.put_pop_reg(REG_EDI);
+  }
+}
+
+// Generate code for a memory intrinsic that is_inline_mem_intrinsic()
+// accepted.
+void translate_mem_intrinsic(llvm::MemIntrinsic *op, CodeBuf &codebuf) {
+  uint32_t size = llvm::cast<llvm::ConstantInt>(op->getLength())
+                    ->getZExtValue();
+  if (size == 0)
+    return;
+  if (llvm::MemSetInst *memset_op = llvm::dyn_cast<llvm::MemSetInst>(op)) {
+    translate_memset(memset_op, size, codebuf);
+  } else {
+    translate_mem_transfer(llvm::cast<llvm::MemTransferInst>(op), size,
+                           codebuf);
+  }
+}
+
+// Generate code for an FP arithmetic operation, using scalar SSE2.
+void translate_fp_binop(llvm::BinaryOperator *op, CodeBuf &codebuf) {
+  llvm::Type *type = op->getType();
+  int prefix = get_sse_prefix(type);
+  if (op->getOpcode() == llvm::Instruction::FRem) {
+    // SSE2 has no remainder instruction, so this goes via a helper
+    // function, which takes its arguments on the stack and returns
+    // its result on the x87 stack.
+    int size = type->isDoubleTy() ? 8 : 4;
+    assert(codebuf.frame_callees_args_size >= size * 2);
+    for (int i = 0; i < 2; ++i) {
+      codebuf.move_fp_to_xmm(0, op->getOperand(i));
+      codebuf.put_sse_op_mem(prefix, SSEMovStore, 0,
+                             codebuf.callees_args_mem(size * i));
+    }
+    if (type->isDoubleTy()) {
+      codebuf.put_direct_call((uintptr_t) runtime_f64_FRem);
+    } else {
+      codebuf.put_direct_call((uintptr_t) runtime_f32_FRem);
+    }
+    codebuf.put_x87_store_pop(type, codebuf.value_mem(op));
+    return;
+  }
+  int opcode;
+  switch (op->getOpcode()) {
+    case llvm::Instruction::FAdd: opcode = SSEAdd; break;
+    case llvm::Instruction::FSub: opcode = SSESub; break;
+    case llvm::Instruction::FMul: opcode = SSEMul; break;
+    case llvm::Instruction::FDiv: opcode = SSEDiv; break;
+    default:
+      assert(!"Unknown FP binary operator");
+      return;
+  }
+  codebuf.move_fp_to_xmm(0, op->getOperand(0));
+  codebuf.put_sse_op_value(prefix, opcode, 0, op->getOperand(1));
+  codebuf.spill_fp(0, op);
+}
+
+// Generate code for a conversion to or from an FP type.  SSE2 only
+// converts between FP values and signed 32-bit integers, so the x87
+// instructions, which convert from and to signed 64-bit integers,
+// handle i64 and unsigned i32 values.  Unsigned i64 values go via
+// helper functions.
+void translate_fp_conversion(llvm::CastInst *op, CodeBuf &codebuf) {
+  llvm::Value *arg = op->getOperand(0);
+  llvm::Type *from_type = arg->getType();
+  llvm::Type *to_type = op->getType();
+  switch (op->getOpcode()) {
+    case llvm::Instruction::FPExt:
+    case llvm::Instruction::FPTrunc: {
+      codebuf.move_fp_to_xmm(0, arg);
+      // cvtss2sd/cvtsd2ss %xmm0, %xmm0
+      codebuf.put_sse_op_reg(get_sse_prefix(from_type), SSECvtFPToFP, 0, 0);
+      codebuf.spill_fp(0, op);
+      break;
+    }
+    case llvm::Instruction::SIToFP:
+    case llvm::Instruction::UIToFP: {
+      bool is_signed = op->getOpcode() == llvm::Instruction::SIToFP;
+      int bits = llvm::cast<llvm::IntegerType>(from_type)->getBitWidth();
+      if (bits == 64 && !is_signed) {
+        assert(codebuf.frame_callees_args_size >= 8);
+        for (int offset = 0; offset < 8; offset += 4) {
+          codebuf.move_part_to_reg(REG_EAX, arg, offset);
+          codebuf.write_reg_to_esp_offset(REG_EAX, offset);
+        }
+        if (to_type->isDoubleTy()) {
+          codebuf.put_direct_call((uintptr_t) runtime_u64_to_f64);
+        } else {
+          codebuf.put_direct_call((uintptr_t) runtime_u64_to_f32);
+        }
+        codebuf.put_x87_store_pop(to_type, codebuf.value_mem(op));
+      } else if (bits == 64 || (bits == 32 && !is_signed)) {
+        MemOperand mem;
+        if (bits == 64) {
+          mem = codebuf.value_mem(arg);
+        } else {
+          // Zero-extend to 64 bits.
+          assert(codebuf.frame_callees_args_size >= 8);
+          codebuf.move_to_reg(REG_EAX, arg);
+          codebuf.write_reg_to_esp_offset(REG_EAX, 0);
+          // movl $0, 4(%esp)
+          codebuf.put_byte(0xc7);
+          codebuf.put_modrm_mem(0, codebuf.callees_args_mem(4));
+          codebuf.put_uint32(0);
+          mem = codebuf.callees_args_mem(0);
+        }
+        // fildll mem
+        codebuf.put_byte(0xdf);
+        codebuf.put_modrm_mem(5, mem);
+        codebuf.put_x87_store_pop(to_type, codebuf.value_mem(op));
+      } else {
+        // Smaller integers are extended to 32 bits first, so unsigned
+        // values stay positive.
+        codebuf.move_to_reg(REG_EAX, arg);
+        codebuf.extend_value_to_i32(REG_EAX, arg, is_signed, bits);
+        // cvtsi2ss/cvtsi2sd %eax, %xmm0
+        codebuf.put_sse_op_reg(get_sse_prefix(to_type), SSECvtIntToFP,
+                               0, REG_EAX);
+        codebuf.spill_fp(0, op);
+      }
+      break;
+    }
+    case llvm::Instruction::FPToSI:
+    case llvm::Instruction::FPToUI: {
+      bool is_signed = op->getOpcode() == llvm::Instruction::FPToSI;
+      int bits = llvm::cast<llvm::IntegerType>(to_type)->getBitWidth();
+      if (bits == 64 && !is_signed) {
+        assert(codebuf.frame_callees_args_size >= 8);
+        codebuf.move_fp_to_xmm(0, arg);
+        codebuf.put_sse_op_mem(get_sse_prefix(from_type), SSEMovStore, 0,
+                               codebuf.callees_args_mem(0));
+        if (from_type->isDoubleTy()) {
+          codebuf.put_direct_call((uintptr_t) runtime_f64_to_u64);
+        } else {
+          codebuf.put_direct_call((uintptr_t) runtime_f32_to_u64);
+        }
+        codebuf.spill_part(REG_EAX, op, 0);
+        codebuf.spill_part(REG_EDX, op, 4);
+      } else if (bits == 64 || (bits == 32 && !is_signed)) {
+        // "fistpll" rounds according to the x87 control word, so we
+        // switch it to truncation temporarily, using the stack space
+        // that we reserve for callees' arguments as scratch space.
+        assert(codebuf.frame_callees_args_size >= 12);
+        codebuf.put_x87_load_value(arg);
+        // fnstcw 0(%esp)
+        codebuf.put_byte(0xd9);
+        codebuf.put_modrm_mem(7, codebuf.callees_args_mem(0));
+        // movzwl 0(%esp), %eax
+        codebuf.put_code(TEMPL("\x0f\xb7"));
+        codebuf.put_modrm_mem(REG_EAX, codebuf.callees_args_mem(0));
+        codebuf.put_code(TEMPL("\x80\xcc\x0c")); // orb $0xc, %ah
+        // movw %ax, 2(%esp)
+        codebuf.put_code(TEMPL("\x66\x89"));
+        codebuf.put_modrm_mem(REG_EAX, codebuf.callees_args_mem(2));
+        // fldcw 2(%esp)
+        codebuf.put_byte(0xd9);
+        codebuf.put_modrm_mem(5, codebuf.callees_args_mem(2));
+        // fistpll 4(%esp)
+        codebuf.put_byte(0xdf);
+        codebuf.put_modrm_mem(7, codebuf.callees_args_mem(4));
+        // fldcw 0(%esp)
+        codebuf.put_byte(0xd9);
+        codebuf.put_modrm_mem(5, codebuf.callees_args_mem(0));
+        // An unsigned i32 result is the bottom half of the i64.
+        codebuf.read_reg_from_esp_offset(REG_EAX, 4);
+        if (bits == 64) {
+          codebuf.read_reg_from_esp_offset(REG_EDX, 8);
+          codebuf.spill_part(REG_EAX, op, 0);
+          codebuf.spill_part(REG_EDX, op, 4);
+        } else {
+          codebuf.spill(REG_EAX, op);
+        }
+      } else {
+        // cvttss2si/cvttsd2si arg, %eax
+        codebuf.put_sse_op_value(get_sse_prefix(from_type), SSECvtFPToInt,
+                                 REG_EAX, arg);
+        codebuf.spill(REG_EAX, op);
+      }
+      break;
+    }
+    default:
+      assert(!"Unknown FP conversion");
+  }
+}
+
+// x86 condition codes that select the operand over the old value for
+// an atomicrmw min or max, given flags from comparing the old value
+// with the operand.  These do not depend on ZF, so they also work
+// after a 64-bit comparison done with cmpl/sbbl.
+int get_atomic_minmax_cond(llvm::AtomicRMWInst::BinOp op) {
+  switch (op) {
+    case llvm::AtomicRMWInst::Max: return 0xc; // 'l' (less)
+    case llvm::AtomicRMWInst::Min: return 0xd; // 'ge' (greater or equal)
+    case llvm::AtomicRMWInst::UMax: return 0x2; // 'b' (below)
+    case llvm::AtomicRMWInst::UMin: return 0x3; // 'ae' (above or equal)
+    default:
+      assert(!"Not a min or max operation");
+      return 0;
+  }
+}
+
+// Generate a "jne" back to |loop_start|, for a cmpxchg loop.
+void put_cmpxchg_loop_jump(char *loop_start, CodeBuf &codebuf) {
+  codebuf.put_byte(0x75); // jne rel8
+  int offset = loop_start - (codebuf.get_current_pos() + 1);
+  assert(offset == (int8_t) offset);
+  codebuf.put_byte(offset);
+}
+
+// Generate "<op> esp_offset(%esp), %reg", where |opcode| takes a
+// register and a memory operand.
+void put_op_reg_stack(int opcode, int reg, int esp_offset, CodeBuf &codebuf) {
+  codebuf.put_byte(opcode);
+  codebuf.put_modrm_mem(reg, esp_mem(esp_offset));
+}
+
+// Generate code to compute, in %ecx (and %ebx for the low half of an
+// i64), the new value that atomicrmw |op| stores given the old value.
+// The old value is in %eax (and %edx for the high half of an i64),
+// and the operand has been pushed onto the stack.
+void put_atomicrmw_new_value(llvm::AtomicRMWInst *op, CodeBuf &codebuf) {
+  bool i64 = is_i64(op->getType());
+  int lo_reg = i64 ? REG_EBX : REG_ECX;
+  if (op->getOperation() == llvm::AtomicRMWInst::Xchg) {
+    // movl (%esp), %lo_reg
+    put_op_reg_stack(0x8b, lo_reg, 0, codebuf);
+    if (i64)
+      put_op_reg_stack(0x8b, REG_ECX, 4, codebuf); // movl 4(%esp), %ecx
+    return;
+  }
+  codebuf.put_mov_reg_reg(lo_reg, REG_EAX);
+  if (i64)
+    codebuf.put_mov_reg_reg(REG_ECX, REG_EDX);
+  X86ArithOpcode lo_opcode;
+  X86ArithOpcode hi_opcode;
+  switch (op->getOperation()) {
+    case llvm::AtomicRMWInst::Add:
+      lo_opcode = X86ArithAdd;
+      hi_opcode = X86ArithAdc;
+      break;
+    case llvm::AtomicRMWInst::Sub:
+      lo_opcode = X86ArithSub;
+      hi_opcode = X86ArithSbb;
+      break;
+    case llvm::AtomicRMWInst::And:
+    case llvm::AtomicRMWInst::Nand:
+      lo_opcode = hi_opcode = X86ArithAnd;
+      break;
+    case llvm::AtomicRMWInst::Or:
+      lo_opcode = hi_opcode = X86ArithOr;
+      break;
+    case llvm::AtomicRMWInst::Xor:
+      lo_opcode = hi_opcode = X86ArithXor;
+      break;
+    default: {
+      // Min and max: compare the old value with the operand, and
+      // replace it with the operand if necessary.
+      int bits = llvm::cast<llvm::IntegerType>(op->getType())->getBitWidth();
+      if (bits < 32) {
+        bool sign_extend = (op->getOperation() == llvm::AtomicRMWInst::Max ||
+                            op->getOperation() == llvm::AtomicRMWInst::Min);
+        codebuf.extend_to_i32(REG_ECX, sign_extend, bits);
+      }
+      // cmpl (%esp), %lo_reg
+      put_op_reg_stack((X86ArithCmp << 3) | 3, lo_reg, 0, codebuf);
+      if (i64) {
+        codebuf.put_mov_reg_reg(REG_EDI, REG_EDX);
+        // sbbl 4(%esp), %edi
+        put_op_reg_stack((X86ArithSbb << 3) | 3, REG_EDI, 4, codebuf);
+      }
+      // We could use the CMOV instruction here, but it's not
+      // available on old x86-32 CPUs.  Instead, we jump over the moves
+      // of the operand if the old value is kept.
+      int x86_cond = get_atomic_minmax_cond(op->getOperation());
+      // The jump only skips two moves, so its offset fits in 8 bits.
+      codebuf.put_byte(0x70 | (x86_cond ^ 1)); // jNCC <label> (8-bit)
+      uint8_t *jump_dest = (uint8_t *) codebuf.put_alloc_space(1);
+      // movl (%esp), %lo_reg
+      put_op_reg_stack(0x8b, lo_reg, 0, codebuf);
+      if (i64) {
+        // movl 4(%esp), %ecx
+        put_op_reg_stack(0x8b, REG_ECX, 4, codebuf);
+      }
+      // Fix up relocation.
+      *jump_dest = codebuf.get_current_pos() - (char *) (jump_dest + 1);
+      return;
+    }
+  }
+  // OP (%esp), %lo_reg
+  put_op_reg_stack((lo_opcode << 3) | 3, lo_reg, 0, codebuf);
+  if (i64)
+    put_op_reg_stack((hi_opcode << 3) | 3, REG_ECX, 4, codebuf);
+  if (op->getOperation() == llvm::AtomicRMWInst::Nand) {
+    codebuf.put_byte(0xf7); // notl %lo_reg
+    codebuf.put_modrm_reg_reg(lo_reg, 2);
+    if (i64) {
+      codebuf.put_byte(0xf7); // notl %ecx
+      codebuf.put_modrm_reg_reg(REG_ECX, 2);
+    }
+  }
+}
+
+// Generate code for a 64-bit atomicrmw or cmpxchg, using "lock
+// cmpxchg8b".  That needs %ebx, so it and the other callee-saved
+// registers that we use are saved on the stack around the operation.
+void translate_atomic_i64(llvm::Instruction *inst, CodeBuf &codebuf) {
+  llvm::AtomicRMWInst *rmw = llvm::dyn_cast<llvm::AtomicRMWInst>(inst);
+  llvm::AtomicCmpXchgInst *cmpxchg =
+    llvm::dyn_cast<llvm::AtomicCmpXchgInst>(inst);
+  codebuf.put_push_reg(REG_EBX);
+  codebuf.put_push_reg(REG_ESI);
+  codebuf.put_push_reg(REG_EDI);
+  // Put the address in %esi.
+  MemOperand mem = get_mem_operand(inst->getOperand(0), REG_EAX, REG_ECX,
+                                   codebuf);
+  codebuf.put_lea(REG_ESI, mem);
+  MemOperand esi_mem = { REG_ESI, kNoReg, 1, 0, NULL };
+  // i64 values are never kept in registers, so they are still
+  // available after we have overwritten %ebx, %esi and %edi.
+  if (cmpxchg) {
+    codebuf.move_part_to_reg(REG_EAX, cmpxchg->getCompareOperand(), 0);
+    codebuf.move_part_to_reg(REG_EDX, cmpxchg->getCompareOperand(), 4);
+    codebuf.move_part_to_reg(REG_EBX, cmpxchg->getNewValOperand(), 0);
+    codebuf.move_part_to_reg(REG_ECX, cmpxchg->getNewValOperand(), 4);
+    codebuf.put_code(TEMPL("\xf0\x0f\xc7")); // lock cmpxchg8b mem
+    codebuf.put_modrm_mem(1, esi_mem);
+  } else {
+    for (int offset = 4; offset >= 0; offset -= 4) {
+      codebuf.move_part_to_reg(REG_ECX, rmw->getValOperand(), offset);
+      codebuf.put_push_reg(REG_ECX);
+    }
+    // movl (%esi), %eax
+    codebuf.put_byte(0x8b);
+    codebuf.put_modrm_mem(REG_EAX, esi_mem);
+    // movl 4(%esi), %edx
+    codebuf.put_byte(0x8b);
+    codebuf.put_modrm_mem(REG_EDX, mem_offset(esi_mem, 4));
+    char *loop_start = codebuf.get_current_pos();
+    put_atomicrmw_new_value(rmw, codebuf);
+    codebuf.put_code(TEMPL("\xf0\x0f\xc7")); // lock cmpxchg8b mem
+    codebuf.put_modrm_mem(1, esi_mem);
+    put_cmpxchg_loop_jump(loop_start, codebuf);
+    codebuf.put_code(TEMPL("\x83\xc4\x08")); // addl $8, %esp
+    codebuf.esp_push_depth -= 8;
+  }
+  codebuf.put_pop_reg(REG_EDI);
+  codebuf.put_pop_reg(REG_ESI);
+  codebuf.put_pop_reg(REG_EBX);
+  codebuf.spill_part(REG_EAX, inst, 0);
+  codebuf.spill_part(REG_EDX, inst, 4);
+}
+
+// Generate "lock <op><size> %reg, mem".  |opcode| is the 8-bit form
+// of the instruction, and follows a 0x0f byte if |two_byte|.
+void put_locked_op(int bits, bool two_byte, int opcode, int reg,
+                   const MemOperand &mem, CodeBuf &codebuf) {
+  codebuf.put_byte(0xf0); // LOCK prefix
+  if (bits == 16)
+    codebuf.put_byte(0x66); // DATA16 prefix
+  if (two_byte)
+    codebuf.put_byte(0x0f);
+  codebuf.put_byte(bits == 8 ? opcode : opcode + 1);
+  codebuf.put_modrm_mem(reg, mem);
+}
+
+// Generate code for atomicrmw.  We assume seq_cst ordering, which is
+// what every locked instruction gives us anyway.
+void translate_atomicrmw(llvm::AtomicRMWInst *op, CodeBuf &codebuf) {
+  int bits = llvm::cast<llvm::IntegerType>(op->getType())->getBitWidth();
+  if (bits == 64) {
+    translate_atomic_i64(op, codebuf);
+    return;
+  }
+  if (bits != 8 && bits != 16 && bits != 32) {
+    codebuf.unhandled_case("AtomicRMWInst on unsupported type");
+    return;
+  }
+  MemOperand mem = get_mem_operand_using(op->getPointerOperand(), REG_EDX,
+                                         REG_ECX, codebuf);
+  llvm::AtomicRMWInst::BinOp operation = op->getOperation();
+  X86ArithOpcode arith_opcode = X86ArithAdd;
+  switch (operation) {
+    case llvm::AtomicRMWInst::Sub: arith_opcode = X86ArithSub; break;
+    case llvm::AtomicRMWInst::And: arith_opcode = X86ArithAnd; break;
+    case llvm::AtomicRMWInst::Or: arith_opcode = X86ArithOr; break;
+    case llvm::AtomicRMWInst::Xor: arith_opcode = X86ArithXor; break;
+    default: break;
+  }
+  if (op->use_empty() &&
+      (operation == llvm::AtomicRMWInst::Add ||
+       operation == llvm::AtomicRMWInst::Sub ||
+       operation == llvm::AtomicRMWInst::And ||
+       operation == llvm::AtomicRMWInst::Or ||
+       operation == llvm::AtomicRMWInst::Xor)) {
+    // The old value is not needed, so a locked arithmetic operation
+    // will do.
+    codebuf.move_to_reg(REG_EAX, op->getValOperand());
+    put_locked_op(bits, false, arith_opcode << 3, REG_EAX, mem, codebuf);
+    return;
+  }
+  if (operation == llvm::AtomicRMWInst::Xchg) {
+    codebuf.move_to_reg(REG_EAX, op->getValOperand());
+    // xchg<size> %eax, mem (implicitly locked)
+    codebuf.put_sized_opcode_bits(bits, 0x86);
+    codebuf.put_modrm_mem(REG_EAX, mem);
+  } else if (operation == llvm::AtomicRMWInst::Add ||
+             operation == llvm::AtomicRMWInst::Sub) {
+    codebuf.move_to_reg(REG_EAX, op->getValOperand());
+    if (operation == llvm::AtomicRMWInst::Sub)
+      codebuf.put_code(TEMPL("\xf7\xd8")); // negl %eax
+    // lock xadd<size> %eax, mem
+    put_locked_op(bits, true, 0xc0, REG_EAX, mem, codebuf);
+  } else {
+    // Other operations need a loop that retries until a cmpxchg
+    // succeeds.  The operand is pushed so that %ecx is free.
+    codebuf.move_to_reg(REG_ECX, op->getValOperand());
+    if (bits < 32 && operation != llvm::AtomicRMWInst::And &&
+        operation != llvm::AtomicRMWInst::Nand &&
+        operation != llvm::AtomicRMWInst::Or &&
+        operation != llvm::AtomicRMWInst::Xor) {
+      // Min and max compare all 32 bits.
+      bool sign_extend = (operation == llvm::AtomicRMWInst::Max ||
+                          operation == llvm::AtomicRMWInst::Min);
+      codebuf.extend_value_to_i32(REG_ECX, op->getValOperand(), sign_extend,
+                                  bits);
+    }
+    codebuf.put_push_reg(REG_ECX);
+    // Without a frame pointer, an address in the frame is relative to
+    // %esp, which the push has moved.
+    if (mem.base_reg == REG_ESP)
+      mem.disp += 4;
+    // mov<size> mem, %eax
+    codebuf.put_sized_opcode_bits(bits, 0x8a);
+    codebuf.put_modrm_mem(REG_EAX, mem);
+    char *loop_start = codebuf.get_current_pos();
+    put_atomicrmw_new_value(op, codebuf);
+    // lock cmpxchg<size> %ecx, mem
+    put_locked_op(bits, true, 0xb0, REG_ECX, mem, codebuf);
+    put_cmpxchg_loop_jump(loop_start, codebuf);
+    codebuf.put_pop_reg(REG_ECX);
+  }
+  codebuf.spill(REG_EAX, op);
+}
+
+// Generate code for cmpxchg, which returns the old value.
+void translate_cmpxchg(llvm::AtomicCmpXchgInst *op, CodeBuf &codebuf) {
+  int bits = llvm::cast<llvm::IntegerType>(op->getType())->getBitWidth();
+  if (bits == 64) {
+    translate_atomic_i64(op, codebuf);
+    return;
+  }
+  if (bits != 8 && bits != 16 && bits != 32) {
+    codebuf.unhandled_case("AtomicCmpXchgInst on unsupported type");
+    return;
+  }
+  MemOperand mem = get_mem_operand_using(op->getPointerOperand(), REG_EDX,
+                                         REG_ECX, codebuf);
+  codebuf.move_to_reg(REG_ECX, op->getNewValOperand());
+  codebuf.move_to_reg(REG_EAX, op->getCompareOperand());
+  // lock cmpxchg<size> %ecx, mem
+  put_locked_op(bits, true, 0xb0, REG_ECX, mem, codebuf);
+  codebuf.spill(REG_EAX, op);
+}
+
+// Generate code to count the bits set in the bottom |bits| bits of
+// %eax, leaving the count in %eax.  The other bits of %eax must be
+// zero.  This clobbers %ecx and %edx.
+void put_popcount_eax(int bits, CodeBuf &codebuf) {
+  if (codebuf.have_popcnt) {
+    codebuf.put_code(TEMPL("\xf3\x0f\xb8\xc0")); // popcntl %eax, %eax
+    return;
+  }
+  // Look up each byte in a table instead.
+  MemOperand table = { REG_ECX, kNoReg, 1, (int32_t) runtime_popcount_table,
+                       NULL };
+  codebuf.put_code(TEMPL("\x31\xd2")); // xorl %edx, %edx
+  for (int i = 0; i < bits; i += 8) {
+    if (i != 0)
+      codebuf.put_shift_reg_imm(X86ShiftShr, REG_EAX, 8);
+    codebuf.put_code(TEMPL("\x0f\xb6\xc8")); // movzbl %al, %ecx
+    // movzbl runtime_popcount_table(%ecx), %ecx
+    codebuf.put_code(TEMPL("\x0f\xb6"));
+    codebuf.put_modrm_mem(REG_ECX, table);
+    // The table's address is the last 4 bytes of the instruction.
+    codebuf.add_host_reloc((uint32_t *) (codebuf.get_current_pos() - 4),
+                           (uintptr_t) runtime_popcount_table, false);
+    codebuf.put_arith_reg_reg(X86ArithAdd, REG_EDX, REG_ECX);
+  }
+  codebuf.put_mov_reg_reg(REG_EAX, REG_EDX);
+}
+
+// Returns whether the ctlz or cttz call |op| has a result that is
+// undefined for a zero input, so that we can skip the fixup for it.
+bool is_zero_undef(llvm::IntrinsicInst *op) {
+  llvm::ConstantInt *flag =
+    llvm::dyn_cast<llvm::ConstantInt>(op->getArgOperand(1));
+  return flag && flag->isOne();
+}
+
+// Generate code for the ctpop, ctlz, cttz and bswap intrinsics.  These
+// use popcnt (or a table lookup), bsr, bsf and bswap.  bsr and bsf
+// leave their destination undefined for a zero input, so that case is
+// fixed up unless the intrinsic's result is undefined too.
+void translate_bit_intrinsic(llvm::IntrinsicInst *op, CodeBuf &codebuf) {
+  llvm::Intrinsic::ID id = op->getIntrinsicID();
+  llvm::Value *arg = op->getArgOperand(0);
+  int bits = llvm::cast<llvm::IntegerType>(op->getType())->getBitWidth();
+  if (bits != 8 && bits != 16 && bits != 32 && bits != 64) {
+    codebuf.unhandled_case("Bit manipulation intrinsic on unsupported type");
+    return;
+  }
+  if (id == llvm::Intrinsic::bswap && bits == 8) {
+    codebuf.unhandled_case("bswap on i8");
+    return;
+  }
+  if (bits == 64) {
+    switch (id) {
+      case llvm::Intrinsic::ctpop:
+        // Count the halves separately, using the result's stack slot
+        // to hold the bottom half's count.
+        codebuf.move_part_to_reg(REG_EAX, arg, 0);
+        put_popcount_eax(32, codebuf);
+        codebuf.spill_part(REG_EAX, op, 0);
+        codebuf.move_part_to_reg(REG_EAX, arg, 4);
+        put_popcount_eax(32, codebuf);
+        // addl slot(%ebp), %eax
+        codebuf.put_byte(0x03);
+        codebuf.put_modrm_mem(REG_EAX, codebuf.value_mem(op));
+        break;
+      case llvm::Intrinsic::ctlz:
+        codebuf.move_part_to_reg(REG_EAX, arg, 0);
+        codebuf.put_code(TEMPL("\x0f\xbd\xc0")); // bsrl %eax, %eax
+        if (!is_zero_undef(op)) {
+          codebuf.put_code(TEMPL("\x75\x05")); // jnz +5
+          codebuf.put_code(TEMPL("\xb8\xff\xff\xff\xff")); // movl $-1, %eax
+        }
+        codebuf.move_part_to_reg(REG_ECX, arg, 4);
+        codebuf.put_code(TEMPL("\x0f\xbd\xc9")); // bsrl %ecx, %ecx
+        codebuf.put_code(TEMPL("\x74\x03")); // jz +3
+        codebuf.put_code(TEMPL("\x8d\x41\x20")); // leal 32(%ecx), %eax
+        // %eax now holds the index of the top set bit, or -1.
+        codebuf.put_code(TEMPL("\xf7\xd8")); // negl %eax
+        codebuf.put_arith_reg_imm(X86ArithAdd, REG_EAX, 63);
+        break;
+      case llvm::Intrinsic::cttz:
+        codebuf.move_part_to_reg(REG_ECX, arg, 4);
+        codebuf.put_code(TEMPL("\x0f\xbc\xc9")); // bsfl %ecx, %ecx
+        if (!is_zero_undef(op)) {
+          codebuf.put_code(TEMPL("\x75\x05")); // jnz +5
+          codebuf.put_code(TEMPL("\xb9\x20\x00\x00\x00")); // movl $32, %ecx
+        }
+        codebuf.put_arith_reg_imm(X86ArithAdd, REG_ECX, 32);
+        codebuf.move_part_to_reg(REG_EAX, arg, 0);
+        codebuf.put_code(TEMPL("\x0f\xbc\xc0")); // bsfl %eax, %eax
+        codebuf.put_code(TEMPL("\x75\x02")); // jnz +2
+        codebuf.put_mov_reg_reg(REG_EAX, REG_ECX);
+        break;
+      case llvm::Intrinsic::bswap:
+        codebuf.move_part_to_reg(REG_EDX, arg, 0);
+        codebuf.move_part_to_reg(REG_EAX, arg, 4);
+        codebuf.put_code(TEMPL("\x0f\xc8")); // bswap %eax
+        codebuf.put_code(TEMPL("\x0f\xca")); // bswap %edx
+        codebuf.spill_part(REG_EAX, op, 0);
+        codebuf.spill_part(REG_EDX, op, 4);
+        return;
+      default:
+        assert(!"Unknown bit manipulation intrinsic");
+    }
+    // The counts all fit in the bottom half.
+    codebuf.spill_part(REG_EAX, op, 0);
+    codebuf.put_code(TEMPL("\x31\xd2")); // xorl %edx, %edx
+    codebuf.spill_part(REG_EDX, op, 4);
+    return;
+  }
+
+  codebuf.move_to_reg(REG_EAX, arg);
+  switch (id) {
+    case llvm::Intrinsic::ctpop:
+      codebuf.extend_value_to_i32(REG_EAX, arg, false, bits);
+      put_popcount_eax(bits, codebuf);
+      break;
+    case llvm::Intrinsic::ctlz:
+      codebuf.extend_value_to_i32(REG_EAX, arg, false, bits);
+      codebuf.put_code(TEMPL("\x0f\xbd\xc0")); // bsrl %eax, %eax
+      if (!is_zero_undef(op)) {
+        codebuf.put_code(TEMPL("\x75\x05")); // jnz +5
+        codebuf.put_code(TEMPL("\xb8\xff\xff\xff\xff")); // movl $-1, %eax
+      }
+      // %eax now holds the index of the top set bit, or -1.
+      codebuf.put_code(TEMPL("\xf7\xd8")); // negl %eax
+      codebuf.put_arith_reg_imm(X86ArithAdd, REG_EAX, bits - 1);
+      break;
+    case llvm::Intrinsic::cttz:
+      if (bits < 32) {
+        // Setting the bit above the value gives the right count for
+        // zero without a branch.  Higher bits do not matter.
+        if (!is_zero_undef(op))
+          codebuf.put_arith_reg_imm(X86ArithOr, REG_EAX, 1 << bits);
+        codebuf.put_code(TEMPL("\x0f\xbc\xc0")); // bsfl %eax, %eax
+      } else {
+        codebuf.put_code(TEMPL("\x0f\xbc\xc0")); // bsfl %eax, %eax
+        if (!is_zero_undef(op)) {
+          codebuf.put_code(TEMPL("\x75\x05")); // jnz +5
+          codebuf.put_code(TEMPL("\xb8\x20\x00\x00\x00")); // movl $32, %eax
+        }
+      }
+      break;
+    case llvm::Intrinsic::bswap:
+      if (bits == 16) {
+        codebuf.put_code(TEMPL("\x66\xc1\xc0\x08")); // rolw $8, %ax
+      } else {
+        codebuf.put_code(TEMPL("\x0f\xc8")); // bswap %eax
+      }
+      break;
+    default:
+      assert(!"Unknown bit manipulation intrinsic");
+  }
+  codebuf.spill(REG_EAX, op);
+}
+
+// Generate code for the llvm.*.with.overflow intrinsics, which return
+// a {result, overflow flag} struct in their stack slot.  The flag is
+// taken from OF for signed operations and from CF for unsigned ones,
+// except that a helper function does i64 multiplication.
+void translate_overflow_intrinsic(llvm::IntrinsicInst *op,
+                                  CodeBuf &codebuf) {
+  llvm::Intrinsic::ID id = op->getIntrinsicID();
+  llvm::Value *arg1 = op->getArgOperand(0);
+  llvm::Value *arg2 = op->getArgOperand(1);
+  int bits = llvm::cast<llvm::IntegerType>(arg1->getType())->getBitWidth();
+  bool is_signed = (id == llvm::Intrinsic::sadd_with_overflow ||
+                    id == llvm::Intrinsic::ssub_with_overflow ||
+                    id == llvm::Intrinsic::smul_with_overflow);
+  bool is_sub = (id == llvm::Intrinsic::ssub_with_overflow ||
+                 id == llvm::Intrinsic::usub_with_overflow);
+  bool is_mul = (id == llvm::Intrinsic::smul_with_overflow ||
+                 id == llvm::Intrinsic::umul_with_overflow);
+  if (bits == 64) {
+    if (is_mul) {
+      // A helper function does the multiplication.  It takes its first
+      // argument in %edx:%eax, and its second argument and the address
+      // of the result's flag on the stack.
+      assert(codebuf.frame_callees_args_size >= 12);
+      codebuf.move_part_to_reg(REG_EAX, arg2, 0);
+      codebuf.write_reg_to_esp_offset(REG_EAX, 0);
+      codebuf.move_part_to_reg(REG_EAX, arg2, 4);
+      codebuf.write_reg_to_esp_offset(REG_EAX, 4);
+      llvm::StructType *stty = llvm::cast<llvm::StructType>(op->getType());
+      MemOperand flag = codebuf.value_mem(op);
+      flag.disp +=
+        codebuf.data_layout->getStructLayout(stty)->getElementOffset(1);
+      codebuf.put_lea(REG_EAX, flag);
+      codebuf.write_reg_to_esp_offset(REG_EAX, 8);
+      codebuf.move_part_to_reg(REG_EAX, arg1, 0);
+      codebuf.move_part_to_reg(REG_EDX, arg1, 4);
+      codebuf.put_direct_call(
+          is_signed ? (uintptr_t) runtime_i64_SMulOverflow
+                    : (uintptr_t) runtime_i64_UMulOverflow);
+      MemOperand mem = codebuf.value_mem(op);
+      codebuf.put_byte(0x89); // movl %eax, mem
+      codebuf.put_modrm_mem(REG_EAX, mem);
+      mem.disp += 4;
+      codebuf.put_byte(0x89); // movl %edx, mem
+      codebuf.put_modrm_mem(REG_EDX, mem);
+      return;
+    }
+    // The flags from the top half's adc or sbb give the overflow.
+    codebuf.move_part_to_reg(REG_EAX, arg1, 0);
+    put_arith_value(is_sub ? X86ArithSub : X86ArithAdd,
+                    REG_EAX, arg2, 0, codebuf);
+    codebuf.move_part_to_reg(REG_EDX, arg1, 4);
+    put_arith_value(is_sub ? X86ArithSbb : X86ArithAdc,
+                    REG_EDX, arg2, 4, codebuf);
+  } else if (bits == 8 || bits == 16 || bits == 32) {
+    codebuf.move_to_reg(REG_EAX, arg1);
+    codebuf.move_to_reg(REG_ECX, arg2);
+    if (!is_mul) {
+      // add<size>/sub<size> %ecx, %eax
+      codebuf.put_sized_opcode_bits(bits, is_sub ? 0x28 : 0x00);
+      codebuf.put_modrm_reg_reg(REG_EAX, REG_ECX);
+    } else if (is_signed && bits != 8) {
+      if (bits == 16)
+        codebuf.put_byte(0x66); // DATA16 prefix
+      codebuf.put_code(TEMPL("\x0f\xaf\xc1")); // imul<size> %ecx, %eax
+    } else {
+      // These put the high half of the product in %ah or %edx, and
+      // set OF and CF if it is significant.
+      // imul<size>/mul<size> %ecx
+      codebuf.put_sized_opcode_bits(bits, 0xf6);
+      codebuf.put_modrm_reg_reg(REG_ECX, is_signed ? 5 : 4);
+    }
+  } else {
+    codebuf.unhandled_case("Overflow intrinsic on unsupported type");
+    return;
+  }
+  // seto %cl or setc %cl
+  codebuf.put_byte(0x0f);
+  codebuf.put_byte(is_signed ? 0x90 : 0x92);
+  codebuf.put_modrm_reg_reg(REG_ECX, 0);
+
+  MemOperand mem = codebuf.value_mem(op);
+  codebuf.put_byte(0x89); // movl %eax, mem
+  codebuf.put_modrm_mem(REG_EAX, mem);
+  if (bits == 64) {
+    mem.disp += 4;
+    codebuf.put_byte(0x89); // movl %edx, mem
+    codebuf.put_modrm_mem(REG_EDX, mem);
+  }
+  llvm::StructType *stty = llvm::cast<llvm::StructType>(op->getType());
+  mem = codebuf.value_mem(op);
+  mem.disp += codebuf.data_layout->getStructLayout(stty)->getElementOffset(1);
+  codebuf.put_byte(0x88); // movb %cl, mem
+  codebuf.put_modrm_mem(REG_ECX, mem);
+}
+
+// Generate code for extractvalue.  This only handles reading a field
+// from a struct that is kept in a stack slot, as returned by the
+// overflow intrinsics.
+void translate_extractvalue(llvm::ExtractValueInst *op, CodeBuf &codebuf) {
+  llvm::Value *agg = op->getAggregateOperand();
+  llvm::StructType *stty = llvm::dyn_cast<llvm::StructType>(agg->getType());
+  if (!stty || op->getNumIndices() != 1 ||
+      codebuf.stackslots.count(agg) == 0) {
+    codebuf.unhandled_case("ExtractValue");
+    return;
+  }
+  MemOperand mem = codebuf.value_mem(agg);
+  mem.disp += codebuf.data_layout->getStructLayout(stty)->getElementOffset(
+      *op->idx_begin());
+  int bits = llvm::cast<llvm::IntegerType>(op->getType())->getBitWidth();
+  if (bits == 64) {
+    codebuf.put_byte(0x8b); // movl mem, %eax
+    codebuf.put_modrm_mem(REG_EAX, mem);
+    mem.disp += 4;
+    codebuf.put_byte(0x8b); // movl mem, %edx
+    codebuf.put_modrm_mem(REG_EDX, mem);
+    codebuf.spill_part(REG_EAX, op, 0);
+    codebuf.spill_part(REG_EDX, op, 4);
+    return;
+  }
+  // Avoid reading past the end of the field.
+  if (bits <= 8) {
+    codebuf.put_code(TEMPL("\x0f\xb6")); // movzbl mem, %eax
+  } else if (bits <= 16) {
+    codebuf.put_code(TEMPL("\x0f\xb7")); // movzwl mem, %eax
+  } else {
+    codebuf.put_byte(0x8b); // movl mem, %eax
+  }
+  codebuf.put_modrm_mem(REG_EAX, mem);
+  codebuf.spill(REG_EAX, op);
+}
+
 void translate_instruction(llvm::Instruction *inst, CodeBuf &codebuf) {
+  if (codebuf.folded_addresses.count(inst) == 1) {
+    // Nothing to do: generated by the memory accesses that use it.
+    return;
+  }
+  if (codebuf.redundant_values.count(inst) == 1) {
+    // Nothing to do: the value was computed by an earlier instruction.
+    return;
+  }
+  if (codebuf.dead_values.count(inst) == 1) {
+    // Nothing to do: the value is not used.
+    return;
+  }
   if (llvm::BinaryOperator *op =
       llvm::dyn_cast<llvm::BinaryOperator>(inst)) {
-    if (op->getType()->isDoubleTy()) {
-      codebuf.unhandled_case("FP arithmetic");
+    if (is_fp(op->getType())) {
+      translate_fp_binop(op, codebuf);
       return;
     }
     llvm::IntegerType *inttype = llvm::cast<llvm::IntegerType>(op->getType());
@@ -586,46 +4113,13 @@ void translate_instruction(llvm::Instruction *inst, CodeBuf &codebuf) {
       }
     }
     if (bits == 64) {
-      // Generate function call to helper function.
-      int arg_size = 4;
-      int args_size = arg_size * 3;
-      assert(kMinCalleeArgsSize >= args_size);
-      assert(codebuf.frame_callees_args_size >= args_size);
-      // Argument 1: result pointer
-      codebuf.addr_to_reg(REG_EAX, inst);
-      codebuf.write_reg_to_esp_offset(REG_EAX, arg_size * 0);
-      // Argument 2: pointer to operand
-      codebuf.addr_to_reg(REG_EAX, inst->getOperand(0));
-      codebuf.write_reg_to_esp_offset(REG_EAX, arg_size * 1);
-      // Argument 3: pointer to operand
-      codebuf.addr_to_reg(REG_EAX, inst->getOperand(1));
-      codebuf.write_reg_to_esp_offset(REG_EAX, arg_size * 2);
-
-      uintptr_t func;
-      switch (op->getOpcode()) {
-#define MAP(OP) \
-    case llvm::Instruction::OP: \
-      func = (uintptr_t) runtime_i64_##OP; break
-        MAP(Add);
-        MAP(Sub);
-        MAP(Mul);
-        MAP(UDiv);
-        MAP(URem);
-        MAP(SDiv);
-        MAP(SRem);
-        MAP(And);
-        MAP(Or);
-        MAP(Xor);
-        MAP(Shl);
-        MAP(LShr);
-        MAP(AShr);
-#undef MAP
-        default:
-          assert(!"Unknown binary operator");
-      }
-      codebuf.put_direct_call(func);
+      translate_i64_binop(op, codebuf);
       return;
     }
+    uint64_t imm;
+    if (get_constant_int(op->getOperand(1), codebuf, &imm) &&
+        translate_binop_imm(op, bits, imm, codebuf))
+      return;
 
     codebuf.move_to_reg(REG_EAX, inst->getOperand(0));
     codebuf.move_to_reg(REG_ECX, inst->getOperand(1));
@@ -651,8 +4145,8 @@ void translate_instruction(llvm::Instruction *inst, CodeBuf &codebuf) {
       }
       case llvm::Instruction::UDiv:
       case llvm::Instruction::URem: {
-        codebuf.extend_to_i32(REG_EAX, false, bits);
-        codebuf.extend_to_i32(REG_ECX, false, bits);
+        codebuf.extend_value_to_i32(REG_EAX, op->getOperand(0), false, bits);
+        codebuf.extend_value_to_i32(REG_ECX, op->getOperand(1), false, bits);
         codebuf.put_code(TEMPL("\x31\xd2")); // xorl %edx, %edx
         // %eax = ((%edx << 32) | %eax) / %ecx
         char code[2] = { 0xf7, 0xf1 }; // divl %ecx
@@ -666,8 +4160,8 @@ void translate_instruction(llvm::Instruction *inst, CodeBuf &codebuf) {
       }
       case llvm::Instruction::SDiv:
       case llvm::Instruction::SRem: {
-        codebuf.extend_to_i32(REG_EAX, true, bits);
-        codebuf.extend_to_i32(REG_ECX, true, bits);
+        codebuf.extend_value_to_i32(REG_EAX, op->getOperand(0), true, bits);
+        codebuf.extend_value_to_i32(REG_ECX, op->getOperand(1), true, bits);
         // Fill %edx with sign bit of %eax
         codebuf.put_code(TEMPL("\x99")); // cltd (cdq in Intel syntax)
         // %eax = ((%edx << 32) | %eax) / %ecx
@@ -701,13 +4195,13 @@ void translate_instruction(llvm::Instruction *inst, CodeBuf &codebuf) {
         break;
       }
       case llvm::Instruction::LShr: {
-        codebuf.extend_to_i32(REG_EAX, false, bits);
+        codebuf.extend_value_to_i32(REG_EAX, op->getOperand(0), false, bits);
         codebuf.put_code(TEMPL("\xd3\xe8")); // shr %cl, %eax
         codebuf.spill(REG_EAX, inst);
         break;
       }
       case llvm::Instruction::AShr: {
-        codebuf.extend_to_i32(REG_EAX, true, bits);
+        codebuf.extend_value_to_i32(REG_EAX, op->getOperand(0), true, bits);
         codebuf.put_code(TEMPL("\xd3\xf8")); // sar %cl, %eax
         codebuf.spill(REG_EAX, inst);
         break;
@@ -716,179 +4210,122 @@ void translate_instruction(llvm::Instruction *inst, CodeBuf &codebuf) {
         assert(!"Unknown binary operator");
     }
   } else if (llvm::ICmpInst *op = llvm::dyn_cast<llvm::ICmpInst>(inst)) {
-    llvm::Type *operand_type = op->getOperand(0)->getType();
-    int bits;
-    // TODO: Remove the use of pointer types via a rewrite pass instead.
-    if (llvm::isa<llvm::PointerType>(operand_type)) {
-      bits = kPointerSizeBits;
-    } else {
-      llvm::IntegerType *inttype = llvm::cast<llvm::IntegerType>(operand_type);
-      bits = inttype->getBitWidth();
-    }
-    assert(bits >= 8); // Disallow i1
-    if (bits == 64) {
-      // Generate function call to helper function.
-      int arg_size = 4;
-      int args_size = arg_size * 2;
-      assert(kMinCalleeArgsSize >= args_size);
-      assert(codebuf.frame_callees_args_size >= args_size);
-      // Argument 1: pointer to operand
-      codebuf.addr_to_reg(REG_EAX, inst->getOperand(0));
-      codebuf.write_reg_to_esp_offset(REG_EAX, arg_size * 0);
-      // Argument 2: pointer to operand
-      codebuf.addr_to_reg(REG_EAX, inst->getOperand(1));
-      codebuf.write_reg_to_esp_offset(REG_EAX, arg_size * 1);
-
-      uintptr_t func;
-      switch (op->getPredicate()) {
-#define MAP(OP) \
-    case llvm::CmpInst::OP: \
-      func = (uintptr_t) runtime_i64_##OP; break
-        MAP(ICMP_EQ);
-        MAP(ICMP_NE);
-        MAP(ICMP_UGT);
-        MAP(ICMP_UGE);
-        MAP(ICMP_ULT);
-        MAP(ICMP_ULE);
-        MAP(ICMP_SGT);
-        MAP(ICMP_SGE);
-        MAP(ICMP_SLT);
-        MAP(ICMP_SLE);
-#undef MAP
-        default:
-          assert(!"Unknown binary operator");
-      }
-      codebuf.put_direct_call(func);
-      codebuf.spill(REG_EAX, inst);
+    if (is_fused_compare(op)) {
+      // Nothing to do: generated by the instruction that uses it.
       return;
     }
-
-    codebuf.move_to_reg(REG_ECX, inst->getOperand(0));
-    codebuf.move_to_reg(REG_EAX, inst->getOperand(1));
-    codebuf.extend_to_i32(REG_EAX, op->isSigned(), bits);
-    codebuf.extend_to_i32(REG_ECX, op->isSigned(), bits);
-    int x86_cond;
-    switch (op->getPredicate()) {
-      case llvm::CmpInst::ICMP_EQ:
-        x86_cond = 0x4; // 'e' (equal)
-        break;
-      case llvm::CmpInst::ICMP_NE:
-        x86_cond = 0x5; // 'ne' (not equal)
-        break;
-      // Unsigned comparisons
-      case llvm::CmpInst::ICMP_UGT:
-        x86_cond = 0x7; // 'a' (above)
-        break;
-      case llvm::CmpInst::ICMP_UGE:
-        x86_cond = 0x3; // 'ae' (above or equal)
-        break;
-      case llvm::CmpInst::ICMP_ULT:
-        x86_cond = 0x2; // 'b' (below)
-        break;
-      case llvm::CmpInst::ICMP_ULE:
-        x86_cond = 0x6; // 'be' (below or equal)
-        break;
-      // Signed comparisons
-      case llvm::CmpInst::ICMP_SGT:
-        x86_cond = 0xf; // 'g' (greater)
-        break;
-      case llvm::CmpInst::ICMP_SGE:
-        x86_cond = 0xd; // 'ge' (greater or equal)
-        break;
-      case llvm::CmpInst::ICMP_SLT:
-        x86_cond = 0xc; // 'l' (less)
-        break;
-      case llvm::CmpInst::ICMP_SLE:
-        x86_cond = 0xe; // 'le' (less or equal)
-        break;
-      default:
-        assert(!"Unknown comparison");
-    }
-    // cmp %eax, %ecx
-    codebuf.put_byte(0x39);
-    codebuf.put_byte(0xc1);
+    int x86_cond = put_icmp(op, codebuf);
     // XXX: could store directly in stack slot
     // setCC %dl
     codebuf.put_byte(0x0f);
     codebuf.put_byte(0x90 | x86_cond);
     codebuf.put_byte(0xc2);
     codebuf.spill(REG_EDX, inst);
-  } else if (llvm::LoadInst *op = llvm::dyn_cast<llvm::LoadInst>(inst)) {
-    if (op->getType()->isDoubleTy()) {
-      codebuf.unhandled_case("FP memory load");
+  } else if (llvm::FCmpInst *op = llvm::dyn_cast<llvm::FCmpInst>(inst)) {
+    if (is_fused_compare(op)) {
+      // Nothing to do: generated by the instruction that uses it.
       return;
     }
-    codebuf.move_to_reg(REG_EAX, op->getPointerOperand());
-    if (is_i64(op->getType())) {
-      codebuf.addr_to_reg(REG_EDX, op);
-      codebuf.put_code(TEMPL("\x8b\x08")); // movl (%eax), %ecx
-      codebuf.put_code(TEMPL("\x89\x0a")); // movl %ecx, (%edx)
-      codebuf.put_code(TEMPL("\x8b\x48\x04")); // movl 4(%eax), %ecx
-      codebuf.put_code(TEMPL("\x89\x4a\x04")); // movl %ecx, 4(%edx)
+    translate_fcmp(op, codebuf);
+  } else if (llvm::LoadInst *op = llvm::dyn_cast<llvm::LoadInst>(inst)) {
+    MemOperand mem = get_mem_operand(op->getPointerOperand(), REG_EAX,
+                                     REG_EDX, codebuf);
+    if (is_fp(op->getType())) {
+      // movss/movsd mem, %xmm0
+      codebuf.put_sse_op_mem(get_sse_prefix(op->getType()), SSEMovLoad, 0,
+                             mem);
+      codebuf.spill_fp(0, op);
+    } else if (is_i64(op->getType())) {
+      for (int offset = 0; offset < 8; offset += 4) {
+        // movl offset+mem, %ecx
+        codebuf.put_byte(0x8b);
+        codebuf.put_modrm_mem(REG_ECX, mem_offset(mem, offset));
+        codebuf.spill_part(REG_ECX, op, offset);
+      }
+    } else if (is_narrow_load(op)) {
+      // movzx/movsx mem, %eax
+      bool sign_extend = codebuf.sign_extended_values.count(op) != 0;
+      codebuf.put_movx_opcode(sign_extend, get_int_bits(op->getType()));
+      codebuf.put_modrm_mem(REG_EAX, mem);
+      codebuf.spill(REG_EAX, inst);
     } else {
-      // mov<size> (%eax), %eax
+      // mov<size> mem, %eax
       codebuf.put_sized_opcode(op->getType(), 0x8a);
-      codebuf.put_byte(0x00);
+      codebuf.put_modrm_mem(REG_EAX, mem);
       codebuf.spill(REG_EAX, inst);
     }
   } else if (llvm::StoreInst *op = llvm::dyn_cast<llvm::StoreInst>(inst)) {
-    if (op->getType()->isDoubleTy()) {
-      codebuf.unhandled_case("FP memory store");
-      return;
-    }
-    codebuf.move_to_reg(REG_EDX, op->getPointerOperand());
-    if (is_i64(op->getValueOperand()->getType())) {
-      codebuf.addr_to_reg(REG_EAX, op->getValueOperand());
-      codebuf.put_code(TEMPL("\x8b\x08")); // movl (%eax), %ecx
-      codebuf.put_code(TEMPL("\x89\x0a")); // movl %ecx, (%edx)
-      codebuf.put_code(TEMPL("\x8b\x48\x04")); // movl 4(%eax), %ecx
-      codebuf.put_code(TEMPL("\x89\x4a\x04")); // movl %ecx, 4(%edx)
+    MemOperand mem = get_mem_operand(op->getPointerOperand(), REG_EAX,
+                                     REG_EDX, codebuf);
+    llvm::Type *value_type = op->getValueOperand()->getType();
+    uint64_t imm;
+    if (is_fp(value_type)) {
+      codebuf.move_fp_to_xmm(0, op->getValueOperand());
+      // movss/movsd %xmm0, mem
+      codebuf.put_sse_op_mem(get_sse_prefix(value_type), SSEMovStore, 0,
+                             mem);
+    } else if (get_constant_int(op->getValueOperand(), codebuf, &imm)) {
+      llvm::Type *type = op->getValueOperand()->getType();
+      if (is_i64(type)) {
+        // movl $imm_lo, mem
+        codebuf.put_byte(0xc7);
+        codebuf.put_modrm_mem(0, mem);
+        codebuf.put_uint32(imm);
+        // movl $imm_hi, 4+mem
+        codebuf.put_byte(0xc7);
+        codebuf.put_modrm_mem(0, mem_offset(mem, 4));
+        codebuf.put_uint32(imm >> 32);
+      } else {
+        // mov<size> $imm, mem
+        codebuf.put_sized_opcode(type, 0xc6);
+        codebuf.put_modrm_mem(0, mem);
+        int bits = llvm::cast<llvm::IntegerType>(type)->getBitWidth();
+        if (bits == 8) {
+          codebuf.put_byte(imm);
+        } else if (bits == 16) {
+          codebuf.put_byte(imm);
+          codebuf.put_byte(imm >> 8);
+        } else {
+          codebuf.put_uint32(imm);
+        }
+      }
+    } else if (is_i64(op->getValueOperand()->getType())) {
+      for (int offset = 0; offset < 8; offset += 4) {
+        codebuf.move_part_to_reg(REG_ECX, op->getValueOperand(), offset);
+        // movl %ecx, offset+mem
+        codebuf.put_byte(0x89);
+        codebuf.put_modrm_mem(REG_ECX, mem_offset(mem, offset));
+      }
     } else {
-      codebuf.move_to_reg(REG_EAX, op->getValueOperand());
-      // mov<size> %eax, (%edx)
+      codebuf.move_to_reg(REG_ECX, op->getValueOperand());
+      // mov<size> %ecx, mem
       codebuf.put_sized_opcode(op->getValueOperand()->getType(), 0x88);
-      codebuf.put_byte(0x02);
+      codebuf.put_modrm_mem(REG_ECX, mem);
     }
   } else if (llvm::AtomicRMWInst *op =
              llvm::dyn_cast<llvm::AtomicRMWInst>(inst)) {
-    llvm::IntegerType *inttype = llvm::cast<llvm::IntegerType>(op->getType());
-    if (inttype->getBitWidth() != 32) {
-      codebuf.unhandled_case("AtomicRMWInst on non-i32");
-      return;
-    }
-    // XXX: We assume seq_cst (SequentiallyConsistent).
-    // We also assume a SynchronizationScope of CrossThread.
-    uintptr_t func;
-    switch (op->getOperation()) {
-#define MAP(OP) case llvm::AtomicRMWInst::OP: \
-                  func = (uintptr_t) runtime_atomicrmw_i32_##OP; break;
-      MAP(Xchg)
-      MAP(Add)
-      MAP(Sub)
-      MAP(And)
-      MAP(Nand)
-      MAP(Or)
-      MAP(Xor)
-      MAP(Max)
-      MAP(Min)
-      MAP(UMax)
-      MAP(UMin)
-#undef MAP
-      default:
-        assert(!"Unknown comparison");
+    translate_atomicrmw(op, codebuf);
+  } else if (llvm::AtomicCmpXchgInst *op =
+             llvm::dyn_cast<llvm::AtomicCmpXchgInst>(inst)) {
+    translate_cmpxchg(op, codebuf);
+  } else if (llvm::FenceInst *op = llvm::dyn_cast<llvm::FenceInst>(inst)) {
+    // x86 only reorders loads ahead of earlier stores, so only a
+    // sequentially consistent fence needs an instruction.
+    if (op->getOrdering() == llvm::SequentiallyConsistent) {
+      if (codebuf.have_sse2) {
+        codebuf.put_code(TEMPL("\x0f\xae\xf0")); // mfence
+      } else {
+        // lock orl $0, (%esp)
+        codebuf.put_code(TEMPL("\xf0\x83\x0c\x24\x00"));
+      }
     }
-    // Generate function call to helper function.
-    codebuf.move_to_reg(REG_EAX, op->getPointerOperand());
-    codebuf.move_to_reg(REG_EDX, op->getValOperand());
-    codebuf.put_direct_call(func);
-    codebuf.spill(REG_EAX, inst);
   } else if (llvm::ReturnInst *op
              = llvm::dyn_cast<llvm::ReturnInst>(inst)) {
     if (llvm::Value *result = op->getReturnValue()) {
-      if (result->getType()->isDoubleTy()) {
-        codebuf.addr_to_reg(REG_EAX, result);
-        // fldl (%eax)
-        codebuf.put_code(TEMPL("\xdd\x00"));
+      if (is_fp(result->getType())) {
+        // FP values are returned on the x87 stack, as the i386 ABI
+        // requires.
+        codebuf.put_x87_load_value(result);
       } else if (is_i64(result->getType())) {
         codebuf.move_part_to_reg(REG_EAX, result, 0);
         codebuf.move_part_to_reg(REG_EDX, result, 4);
@@ -897,71 +4334,64 @@ void translate_instruction(llvm::Instruction *inst, CodeBuf &codebuf) {
       }
     }
     // Epilog:
-    codebuf.put_byte(0xc9); // leave
-    // Omit-frame-pointer version:
-    // // addl $frame_size, %esp
-    // codebuf.put_byte(0x81);
-    // codebuf.put_byte(0xc4);
-    // codebuf.put_uint32(codebuf.frame_size);
+    for (unsigned i = 0; i < codebuf.saved_regs.size(); ++i) {
+      codebuf.read_reg_from_frame(codebuf.saved_regs[i].first,
+                                  codebuf.saved_regs[i].second);
+    }
+    if (!codebuf.omit_frame_pointer) {
+      codebuf.put_byte(0xc9); // leave
+    } else if (codebuf.frame_size != 0) {
+      // addl $frame_size, %esp
+      codebuf.put_byte(0x81);
+      codebuf.put_byte(0xc4);
+      codebuf.put_uint32(codebuf.frame_size);
+    }
     codebuf.put_ret();
   } else if (llvm::SelectInst *op = llvm::dyn_cast<llvm::SelectInst>(inst)) {
     // We could use the CMOV instruction here, but it's not available
     // on old x86-32 CPUs.
-    codebuf.move_to_reg(REG_EAX, op->getCondition());
-    codebuf.move_to_reg(REG_ECX, op->getTrueValue());
-    codebuf.put_code(TEMPL("\x84\xc0")); // testb %eax, %eax
+    int x86_cond = put_condition_test(op->getCondition(), codebuf);
+    // The moves do not modify the flags.  A 64-bit value is moved in
+    // two parts, using %edx for the second.
+    bool is_64 = is_64bit(op->getType());
+    codebuf.move_part_to_reg(REG_ECX, op->getTrueValue(), 0);
+    if (is_64)
+      codebuf.move_part_to_reg(REG_EDX, op->getTrueValue(), 4);
 
-    // TODO: Could use 8-bit jump.
-    codebuf.put_code(TEMPL("\x0f\x85")); // jnz <label> (32-bit)
-    uint32_t *jump_dest =
-      (uint32_t *) codebuf.put_alloc_space(sizeof(uint32_t));
+    // The jump only skips two moves, so its offset fits in 8 bits.
+    codebuf.put_byte(0x70 | x86_cond); // jCC <label> (8-bit)
+    uint8_t *jump_dest = (uint8_t *) codebuf.put_alloc_space(1);
 
-    codebuf.move_to_reg(REG_ECX, op->getFalseValue());
+    codebuf.move_part_to_reg(REG_ECX, op->getFalseValue(), 0);
+    if (is_64)
+      codebuf.move_part_to_reg(REG_EDX, op->getFalseValue(), 4);
     // Fix up relocation.
-    uintptr_t label = (uintptr_t) codebuf.get_current_pos();
-    *jump_dest = label - (uintptr_t) (jump_dest + 1);
-    codebuf.spill(REG_ECX, op);
+    *jump_dest = codebuf.get_current_pos() - (char *) (jump_dest + 1);
+    codebuf.spill_part(REG_ECX, op, 0);
+    if (is_64)
+      codebuf.spill_part(REG_EDX, op, 4);
   } else if (llvm::BranchInst *op =
              llvm::dyn_cast<llvm::BranchInst>(inst)) {
-    // TODO: could implement fallthrough to next basic block
     llvm::BasicBlock *bb = inst->getParent();
     if (op->isConditional()) {
-      handle_phi_nodes(bb, op->getSuccessor(0), codebuf, REG_EAX);
-      codebuf.move_to_reg(REG_EAX, op->getCondition());
-      // We must test only the bottom bit of %eax, since the other
-      // bits can contain garbage.
-      codebuf.put_code(TEMPL("\xa8\x01")); // testb $1, %al
-      codebuf.put_code(TEMPL("\x0f\x85")); // jnz <label> (32-bit)
-      codebuf.direct_jump_offset32(op->getSuccessor(0));
-      unconditional_jump(bb, op->getSuccessor(1), codebuf);
+      llvm::BasicBlock *true_bb = op->getSuccessor(0);
+      llvm::BasicBlock *false_bb = op->getSuccessor(1);
+      int x86_cond = put_condition_test(op->getCondition(), codebuf);
+      // If the true block comes next, invert the condition so that we
+      // fall through to it.
+      if (true_bb == codebuf.next_bb && false_bb != codebuf.next_bb) {
+        std::swap(true_bb, false_bb);
+        x86_cond ^= 1;
+      }
+      put_edge_jump(x86_cond, bb, true_bb, codebuf);
+      unconditional_jump(bb, false_bb, codebuf);
     } else {
       assert(op->isUnconditional());
       unconditional_jump(bb, op->getSuccessor(0), codebuf);
     }
   } else if (llvm::SwitchInst *op =
              llvm::dyn_cast<llvm::SwitchInst>(inst)) {
-    llvm::BasicBlock *bb = inst->getParent();
-    llvm::IntegerType *inttype = llvm::cast<llvm::IntegerType>(
-        op->getCondition()->getType());
-    int bits = inttype->getBitWidth();
-    assert(bits >= 8); // Disallow i1
-
-    codebuf.move_to_reg(REG_EAX, op->getCondition());
-    codebuf.extend_to_i32(REG_EAX, false, bits);
-    for (llvm::SwitchInst::CaseIt iter = op->case_begin();
-         iter != op->case_end();
-         ++iter) {
-      handle_phi_nodes(bb, iter.getCaseSuccessor(), codebuf, REG_EDX);
-      codebuf.move_to_reg(REG_ECX, iter.getCaseValue());
-      // cmp %eax, %ecx
-      codebuf.put_byte(0x39);
-      codebuf.put_byte(0xc1);
-      // je <label> (32-bit)
-      codebuf.put_byte(0x0f);
-      codebuf.put_byte(0x84);
-      codebuf.direct_jump_offset32(iter.getCaseSuccessor());
-    }
-    unconditional_jump(bb, op->getDefaultDest(), codebuf);
+    translate_switch(op, codebuf);
   } else if (llvm::isa<llvm::PHINode>(inst)) {
     // Nothing to do: phi nodes are handled by branches.
     // XXX: Someone still needs to validate that phi nodes only
@@ -973,19 +4403,20 @@ void translate_instruction(llvm::Instruction *inst, CodeBuf &codebuf) {
       llvm::cast<llvm::IntegerType>(arg->getType());
     bool sign_extend = llvm::dyn_cast<llvm::SExtInst>(inst);
     codebuf.move_to_reg(REG_EAX, arg);
-    codebuf.extend_to_i32(REG_EAX, sign_extend, from_type->getBitWidth());
+    codebuf.extend_value_to_i32(REG_EAX, arg, sign_extend,
+                                from_type->getBitWidth());
     if (is_i64(inst->getType())) {
       // Same as spill(REG_EAX, inst), without the i64 check.
       int stack_offset = codebuf.stackslots[inst];
-      codebuf.write_reg_to_ebp_offset(REG_EAX, stack_offset);
+      codebuf.write_reg_to_frame(REG_EAX, stack_offset);
       if (sign_extend) {
         // Fill %edx with sign bit of %eax
         codebuf.put_code(TEMPL("\x99")); // cltd (cdq in Intel syntax)
-        codebuf.write_reg_to_ebp_offset(REG_EDX, stack_offset + 4);
+        codebuf.write_reg_to_frame(REG_EDX, stack_offset + 4);
       } else {
         // movl $0, offset(%ebp)
-        codebuf.put_code(TEMPL("\xc7\x85"));
-        codebuf.put_uint32(stack_offset + 4); // Displacement
+        codebuf.put_byte(0xc7);
+        codebuf.put_modrm_mem(0, codebuf.frame_mem(stack_offset + 4));
         codebuf.put_uint32(0); // Immediate
       }
     } else {
@@ -996,23 +4427,55 @@ void translate_instruction(llvm::Instruction *inst, CodeBuf &codebuf) {
     llvm::Intrinsic::ID id = op->getIntrinsicID();
     // TODO: llvm.dbg.value and llvm.dbg.declare should be stripped
     // out in the wire format, and we should disallow use of these.
-    if (id == llvm::Intrinsic::lifetime_start ||
+    if (llvm::MemIntrinsic *mem_op = llvm::dyn_cast<llvm::MemIntrinsic>(op)) {
+      translate_mem_intrinsic(mem_op, codebuf);
+    } else if (id == llvm::Intrinsic::lifetime_start ||
         id == llvm::Intrinsic::lifetime_end ||
         id == llvm::Intrinsic::dbg_value ||
         id == llvm::Intrinsic::dbg_declare) {
       // Ignore.
+    } else if (id == llvm::Intrinsic::ctpop ||
+               id == llvm::Intrinsic::ctlz ||
+               id == llvm::Intrinsic::cttz ||
+               id == llvm::Intrinsic::bswap) {
+      translate_bit_intrinsic(op, codebuf);
+    } else if (id == llvm::Intrinsic::sadd_with_overflow ||
+               id == llvm::Intrinsic::uadd_with_overflow ||
+               id == llvm::Intrinsic::ssub_with_overflow ||
+               id == llvm::Intrinsic::usub_with_overflow ||
+               id == llvm::Intrinsic::smul_with_overflow ||
+               id == llvm::Intrinsic::umul_with_overflow) {
+      translate_overflow_intrinsic(op, codebuf);
     } else {
       std::string desc = "IntrinsicInst: ";
       desc += op->getCalledValue()->getName();
       codebuf.unhandled_case(desc.c_str());
     }
   } else if (llvm::CallInst *op = llvm::dyn_cast<llvm::CallInst>(inst)) {
+    llvm::Value *callee = op->getCalledValue();
+    while (llvm::Value *alias = codebuf.get_aliased_value(callee))
+      callee = alias;
+    llvm::Function *func = llvm::dyn_cast<llvm::Function>(callee);
+    std::vector<int> arg_regs(op->getNumArgOperands(), kNoReg);
+    // A call through a bitcast of |func| can pass a different number
+    // of arguments.  |func| then has its address taken, so it takes
+    // its arguments on the stack, and so do the call's arguments.
+    if (func && (func == op->getCalledValue() ||
+                 (uses_register_args(func) &&
+                  func->arg_size() == op->getNumArgOperands()))) {
+      arg_regs.clear();
+      get_arg_regs(func, &arg_regs);
+      assert(arg_regs.size() == op->getNumArgOperands());
+    }
     // We have already reserved space on the stack to store our
     // callee's argument.
     int stack_offset = 0;
     for (unsigned i = 0; i < op->getNumArgOperands(); ++i) {
       llvm::Value *arg = op->getArgOperand(i);
-      if (is_i64(arg->getType())) {
+      if (arg_regs[i] != kNoReg) {
+        // Moved to its register below, after the stack arguments,
+        // which use %eax and %edx as temporaries.
+      } else if (is_64bit(arg->getType())) {
         codebuf.addr_to_reg(REG_EAX, arg);
         codebuf.put_code(TEMPL("\x8b\x10")); // movl (%eax), %edx
         codebuf.write_reg_to_esp_offset(REG_EDX, stack_offset);
@@ -1025,25 +4488,59 @@ void translate_instruction(llvm::Instruction *inst, CodeBuf &codebuf) {
         stack_offset += 4;
       }
     }
-    // TODO: Optimise to output direct calls too
-    codebuf.move_to_reg(REG_EAX, op->getCalledValue());
-    codebuf.put_code(TEMPL("\xff\xd0")); // call *%eax
-    if (is_i64(op->getType())) {
+    for (unsigned i = 0; i < op->getNumArgOperands(); ++i) {
+      if (arg_regs[i] != kNoReg)
+        codebuf.move_to_reg(arg_regs[i], op->getArgOperand(i));
+    }
+    if (func) {
+      codebuf.put_call_reloc(func);
+    } else if (uintptr_t host_func = get_host_function(callee)) {
+      codebuf.put_direct_call(host_func);
+    } else {
+      codebuf.move_to_reg(REG_EAX, callee);
+      codebuf.put_indirect_call(REG_EAX);
+    }
+    if (op->getType()->isVoidTy()) {
+      // Nothing to store.
+    } else if (is_fp(op->getType())) {
+      codebuf.put_x87_store_pop(op->getType(), codebuf.value_mem(op));
+    } else if (is_i64(op->getType())) {
       codebuf.spill_part(REG_EAX, op, 0);
       codebuf.spill_part(REG_EDX, op, 4);
     } else {
       codebuf.spill(REG_EAX, op);
     }
   } else if (llvm::AllocaInst *op = llvm::dyn_cast<llvm::AllocaInst>(inst)) {
-    // XXX: Handle alignment
+    if (codebuf.static_allocas.count(op) == 1) {
+      // Nothing to do: allocated in the frame by the prolog.
+      return;
+    }
     // XXX: Handle variable sizes
     assert(!op->isArrayAllocation());
-    int size = codebuf.data_layout->getTypeAllocSize(op->getAllocatedType());
+    llvm::Type *type = op->getAllocatedType();
+    int size = codebuf.data_layout->getTypeAllocSize(type);
+    int align = op->getAlignment();
+    if (align == 0)
+      align = codebuf.data_layout->getABITypeAlignment(type);
+    align = std::max(align, 4);
+    // The variable goes above the callees' arguments area, which is
+    // only 4-byte aligned, so leave room to round its address up.
+    size += align - 4;
+    // Keep the stack pointer aligned.
+    size = (size + kStackAlignment - 1) & ~(kStackAlignment - 1);
     // subl $size, %esp
     codebuf.put_byte(0x81);
     codebuf.put_byte(0xec);
     codebuf.put_uint32(size);
-    if (codebuf.frame_callees_args_size != 0) {
+    if (align > 4) {
+      // leal OFFSET+ALIGN-1(%esp), %eax
+      codebuf.put_code(TEMPL("\x8d\x84\x24"));
+      codebuf.put_uint32(codebuf.frame_callees_args_size + align - 1);
+      // andl $-ALIGN, %eax
+      codebuf.put_byte(0x25);
+      codebuf.put_uint32(-align);
+      codebuf.spill(REG_EAX, op);
+    } else if (codebuf.frame_callees_args_size != 0) {
       // leal OFFSET(%esp), %eax
       codebuf.put_code(TEMPL("\x8d\x84\x24"));
       codebuf.put_uint32(codebuf.frame_callees_args_size);
@@ -1052,6 +4549,27 @@ void translate_instruction(llvm::Instruction *inst, CodeBuf &codebuf) {
       // Optimization.
       codebuf.spill(REG_ESP, op);
     }
+  } else if (llvm::GetElementPtrInst *op =
+             llvm::dyn_cast<llvm::GetElementPtrInst>(inst)) {
+    if (!has_i32_indexes(op)) {
+      codebuf.unhandled_case("GetElementPtr with non-i32 index");
+      return;
+    }
+    Address addr;
+    add_address_arith_terms(op, 1, &addr, codebuf);
+    MemOperand mem = put_address(addr, REG_EAX, REG_EDX, codebuf);
+    codebuf.put_lea(REG_EAX, mem);
+    codebuf.spill(REG_EAX, op);
+  } else if (llvm::isa<llvm::FPExtInst>(inst) ||
+             llvm::isa<llvm::FPTruncInst>(inst) ||
+             llvm::isa<llvm::SIToFPInst>(inst) ||
+             llvm::isa<llvm::UIToFPInst>(inst) ||
+             llvm::isa<llvm::FPToSIInst>(inst) ||
+             llvm::isa<llvm::FPToUIInst>(inst)) {
+    translate_fp_conversion(llvm::cast<llvm::CastInst>(inst), codebuf);
+  } else if (llvm::ExtractValueInst *op =
+             llvm::dyn_cast<llvm::ExtractValueInst>(inst)) {
+    translate_extractvalue(op, codebuf);
   } else if (llvm::isa<llvm::UnreachableInst>(inst)) {
     // We don't have to output anything here, but it's better to make
     // the program fail fast than do something undefined by running
@@ -1138,150 +4656,747 @@ void write_global(CodeBuf *codebuf, llvm::Constant *init) {
   }
 }
 
-// Expand memcpy intrinsic to a call to the host's memcpy() function.
-// Same for memset().
-// TODO: Expand this in the original bitcode file.
-void expand_mem_intrinsics(llvm::BasicBlock *bb) {
-  for (llvm::BasicBlock::InstListType::iterator iter = bb->begin();
-       iter != bb->end(); ) {
-    llvm::Instruction *inst = iter++;
-    if (llvm::MemIntrinsic *op = llvm::dyn_cast<llvm::MemIntrinsic>(inst)) {
-      llvm::Module *module = bb->getParent()->getParent();
-      llvm::Type *i8 = llvm::Type::getInt8Ty(module->getContext());
-      // Note that we ignore op->getDestAddressSpace() and
-      // op->getSourceAddressSpace(): we only support one address
-      // space.
-      llvm::Type *i8ptr = i8->getPointerTo();
-      llvm::Type *sizetype = llvm::Type::getInt32Ty(module->getContext());
-      std::vector<llvm::Type*> arg_types;
-      std::vector<llvm::Value*> args;
-      uintptr_t mem_func;
-      if (llvm::MemTransferInst *op =
-          llvm::dyn_cast<llvm::MemTransferInst>(inst)) {
-        arg_types.push_back(i8ptr);
-        arg_types.push_back(i8ptr);
-        arg_types.push_back(sizetype);
-        args.push_back(op->getRawDest());
-        args.push_back(op->getRawSource());
-        if (llvm::isa<llvm::MemCpyInst>(inst)) {
-          mem_func = (uintptr_t) memcpy;
-        } else if (llvm::isa<llvm::MemMoveInst>(inst)) {
-          mem_func = (uintptr_t) memmove;
-        } else {
-          assert(!"Unknown MemTransferInst");
-        }
-      } else if (llvm::MemSetInst *op =
-                 llvm::dyn_cast<llvm::MemSetInst>(inst)) {
-        arg_types.push_back(i8ptr);
-        arg_types.push_back(i8);
-        arg_types.push_back(sizetype);
-        args.push_back(op->getRawDest());
-        args.push_back(op->getValue());
-        mem_func = (uintptr_t) memset;
+// Expand memcpy intrinsic to a call to the host's memcpy() function.
+// Same for memset() and memmove().  Intrinsics that we generate
+// inline (see is_inline_mem_intrinsic()) are left alone.
+// TODO: Expand this in the original bitcode file.
+void expand_mem_intrinsics(llvm::BasicBlock *bb, CodeBuf &codebuf) {
+  for (llvm::BasicBlock::InstListType::iterator iter = bb->begin();
+       iter != bb->end(); ) {
+    llvm::Instruction *inst = iter++;
+    llvm::MemIntrinsic *op = llvm::dyn_cast<llvm::MemIntrinsic>(inst);
+    if (op && !is_inline_mem_intrinsic(op, codebuf)) {
+      llvm::Module *module = bb->getParent()->getParent();
+      llvm::Type *i8 = llvm::Type::getInt8Ty(module->getContext());
+      // Note that we ignore op->getDestAddressSpace() and
+      // op->getSourceAddressSpace(): we only support one address
+      // space.
+      llvm::Type *i8ptr = i8->getPointerTo();
+      llvm::Type *sizetype = llvm::Type::getInt32Ty(module->getContext());
+      std::vector<llvm::Type*> arg_types;
+      std::vector<llvm::Value*> args;
+      uintptr_t mem_func;
+      if (llvm::MemTransferInst *op =
+          llvm::dyn_cast<llvm::MemTransferInst>(inst)) {
+        arg_types.push_back(i8ptr);
+        arg_types.push_back(i8ptr);
+        arg_types.push_back(sizetype);
+        args.push_back(op->getRawDest());
+        args.push_back(op->getRawSource());
+        if (llvm::isa<llvm::MemCpyInst>(inst)) {
+          mem_func = (uintptr_t) memcpy;
+        } else if (llvm::isa<llvm::MemMoveInst>(inst)) {
+          mem_func = (uintptr_t) memmove;
+        } else {
+          assert(!"Unknown MemTransferInst");
+        }
+      } else if (llvm::MemSetInst *op =
+                 llvm::dyn_cast<llvm::MemSetInst>(inst)) {
+        arg_types.push_back(i8ptr);
+        arg_types.push_back(i8);
+        arg_types.push_back(sizetype);
+        args.push_back(op->getRawDest());
+        args.push_back(op->getValue());
+        mem_func = (uintptr_t) memset;
+      } else {
+        assert(!"Unknown memory intrinsic");
+      }
+      // The intrinsics come in variants with i32 and i64 lengths.  We
+      // truncate the i64 down to i32.  We do no checks to see whether
+      // this discards bits!
+      llvm::Value *length = op->getLength();
+      if (length->getType() != sizetype)
+        length = new llvm::TruncInst(op->getLength(), sizetype,
+                                     "length_cast", op);
+      args.push_back(length);
+      llvm::Type *mem_func_type =
+        llvm::PointerType::get(
+            llvm::FunctionType::get(llvm::Type::getVoidTy(module->getContext()),
+                                    arg_types, false), 0);
+      llvm::Value *func = llvm::ConstantExpr::getIntToPtr(
+          llvm::ConstantInt::get(sizetype, mem_func), mem_func_type);
+
+      // TODO: Support volatile operations.  The standard memcpy() is
+      // non-volatile.
+      assert(!op->isVolatile());
+      llvm::Value *new_call =
+        llvm::CallInst::Create(func, args, op->getName(), op);
+      op->replaceAllUsesWith(new_call);
+      op->eraseFromParent();
+    }
+  }
+}
+
+// Live range of a value, in terms of the positions of instructions
+// within the function.  Each value gets a single range, which is
+// conservative for values whose lifetimes have holes in them.
+struct LiveInterval {
+  llvm::Value *value;
+  int start;
+  int end;
+};
+
+bool compare_interval_starts(const LiveInterval &a, const LiveInterval &b) {
+  return a.start < b.start;
+}
+
+// Returns whether |value| is held in a register or stack slot of its
+// own, rather than being computed where it is used or not at all.
+bool needs_storage(llvm::Value *value, CodeBuf &codebuf) {
+  if (llvm::isa<llvm::Argument>(value))
+    return true;
+  llvm::Instruction *inst = llvm::dyn_cast<llvm::Instruction>(value);
+  if (!inst || inst->getType()->isVoidTy())
+    return false;
+  return (!codebuf.get_aliased_value(inst) &&
+          !is_fused_compare(inst) &&
+          codebuf.static_allocas.count(inst) == 0 &&
+          codebuf.folded_addresses.count(inst) == 0 &&
+          codebuf.dead_values.count(inst) == 0);
+}
+
+// Returns whether |value| may be kept in a register.  i64 and FP
+// values always live in stack slots because they are accessed via
+// their addresses.
+bool is_regalloc_candidate(llvm::Value *value, CodeBuf &codebuf) {
+  if (!needs_storage(value, codebuf))
+    return false;
+  llvm::Type *ty = value->getType();
+  if (llvm::isa<llvm::PointerType>(ty))
+    return true;
+  if (llvm::IntegerType *intty = llvm::dyn_cast<llvm::IntegerType>(ty))
+    return intty->getBitWidth() <= 32;
+  return false;
+}
+
+void extend_interval(std::vector<LiveInterval> *intervals,
+                     std::map<llvm::Value*,int> *interval_index,
+                     llvm::Value *value, int pos) {
+  std::map<llvm::Value*,int>::iterator found = interval_index->find(value);
+  if (found == interval_index->end()) {
+    LiveInterval interval = { value, pos, pos };
+    (*interval_index)[value] = intervals->size();
+    intervals->push_back(interval);
+  } else {
+    LiveInterval *interval = &(*intervals)[found->second];
+    interval->start = std::min(interval->start, pos);
+    interval->end = std::max(interval->end, pos);
+  }
+}
+
+// Computes the live intervals of all values in |func| that need
+// storage (see needs_storage()), by numbering the instructions in
+// block order and doing a standard backwards liveness analysis over
+// the blocks.
+//
+// A phi node is treated as being defined at the end of each of its
+// predecessor blocks, because that is where handle_phi_nodes() writes
+// it, and its incoming values are treated as being used there.
+void compute_live_intervals(llvm::Function *func, CodeBuf &codebuf,
+                            std::vector<LiveInterval> *intervals) {
+  typedef std::set<llvm::Value*> ValueSet;
+  std::map<llvm::Value*,int> interval_index;
+  std::vector<llvm::BasicBlock*> blocks;
+  std::map<llvm::BasicBlock*,int> bb_start;
+  std::map<llvm::BasicBlock*,int> bb_end;
+  std::map<llvm::BasicBlock*,ValueSet> uses;
+  std::map<llvm::BasicBlock*,ValueSet> defs;
+  std::map<llvm::BasicBlock*,ValueSet> phis;
+  std::map<llvm::BasicBlock*,ValueSet> edge_uses;
+
+  // Position 0 is the function entry, where arguments are defined.
+  for (llvm::Function::ArgumentListType::iterator arg = func->arg_begin();
+       arg != func->arg_end();
+       ++arg) {
+    extend_interval(intervals, &interval_index, arg, 0);
+  }
+  int pos = 1;
+  for (llvm::Function::iterator bb = func->begin();
+       bb != func->end();
+       ++bb) {
+    blocks.push_back(bb);
+    bb_start[bb] = pos;
+    for (llvm::BasicBlock::InstListType::iterator inst = bb->begin();
+         inst != bb->end();
+         ++inst, ++pos) {
+      if (needs_storage(inst, codebuf))
+        extend_interval(intervals, &interval_index, inst, pos);
+      if (llvm::isa<llvm::PHINode>(inst)) {
+        if (needs_storage(inst, codebuf))
+          phis[bb].insert(inst);
+        continue;
+      }
+      if (codebuf.get_aliased_value(inst) ||
+          codebuf.folded_addresses.count(inst) ||
+          codebuf.dead_values.count(inst))
+        continue;
+      defs[bb].insert(inst);
+      std::vector<llvm::Value*> operands(inst->op_begin(), inst->op_end());
+      for (unsigned i = 0; i < operands.size(); ++i) {
+        llvm::Value *operand = strip_aliases(operands[i], codebuf);
+        // A fused comparison's operands are used by its user.
+        if (is_fused_compare(operand)) {
+          llvm::User *cmp = llvm::cast<llvm::User>(operand);
+          operands.insert(operands.end(), cmp->op_begin(), cmp->op_end());
+          continue;
+        }
+        // Likewise for a folded address computation.
+        if (codebuf.folded_addresses.count(operand)) {
+          llvm::User *addr = llvm::cast<llvm::User>(operand);
+          operands.insert(operands.end(), addr->op_begin(), addr->op_end());
+          continue;
+        }
+        if (!needs_storage(operand, codebuf))
+          continue;
+        extend_interval(intervals, &interval_index, operand, pos);
+        uses[bb].insert(operand);
+      }
+    }
+    bb_end[bb] = pos - 1;
+
+    llvm::TerminatorInst *term = bb->getTerminator();
+    for (unsigned i = 0; i < term->getNumSuccessors(); ++i) {
+      llvm::BasicBlock *succ = term->getSuccessor(i);
+      for (llvm::BasicBlock::InstListType::iterator inst = succ->begin();
+           inst != succ->end();
+           ++inst) {
+        llvm::PHINode *phi = llvm::dyn_cast<llvm::PHINode>(inst);
+        if (!phi)
+          break;
+        if (!needs_storage(phi, codebuf))
+          continue;
+        defs[bb].insert(phi);
+        llvm::Value *incoming = strip_aliases(
+            phi->getIncomingValueForBlock(bb), codebuf);
+        if (needs_storage(incoming, codebuf)) {
+          edge_uses[bb].insert(incoming);
+          uses[bb].insert(incoming);
+        }
+      }
+    }
+  }
+  // Only values defined before the block count as upward-exposed uses.
+  for (unsigned i = 0; i < blocks.size(); ++i) {
+    llvm::BasicBlock *bb = blocks[i];
+    for (llvm::BasicBlock::InstListType::iterator inst = bb->begin();
+         inst != bb->end();
+         ++inst) {
+      if (!llvm::isa<llvm::PHINode>(inst))
+        uses[bb].erase(inst);
+    }
+  }
+
+  std::map<llvm::BasicBlock*,ValueSet> live_in;
+  std::map<llvm::BasicBlock*,ValueSet> live_out;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int i = blocks.size() - 1; i >= 0; --i) {
+      llvm::BasicBlock *bb = blocks[i];
+      ValueSet out = edge_uses[bb];
+      llvm::TerminatorInst *term = bb->getTerminator();
+      for (unsigned j = 0; j < term->getNumSuccessors(); ++j) {
+        ValueSet &succ_in = live_in[term->getSuccessor(j)];
+        out.insert(succ_in.begin(), succ_in.end());
+      }
+      ValueSet in = phis[bb];
+      in.insert(uses[bb].begin(), uses[bb].end());
+      for (ValueSet::iterator val = out.begin(); val != out.end(); ++val) {
+        if (defs[bb].count(*val) == 0)
+          in.insert(*val);
+      }
+      if (in != live_in[bb] || out != live_out[bb]) {
+        live_in[bb] = in;
+        live_out[bb] = out;
+        changed = true;
+      }
+    }
+  }
+
+  for (unsigned i = 0; i < blocks.size(); ++i) {
+    llvm::BasicBlock *bb = blocks[i];
+    ValueSet &in = live_in[bb];
+    for (ValueSet::iterator val = in.begin(); val != in.end(); ++val)
+      extend_interval(intervals, &interval_index, *val, bb_start[bb]);
+    ValueSet &out = live_out[bb];
+    for (ValueSet::iterator val = out.begin(); val != out.end(); ++val)
+      extend_interval(intervals, &interval_index, *val, bb_end[bb]);
+  }
+}
+
+// Assigns registers from |regs| to |intervals| using linear scan
+// (Poletto and Sarkar).  When we run out of registers, the interval
+// that ends last is left in its stack slot.
+void linear_scan(std::vector<LiveInterval> &intervals,
+                 const std::vector<int> &regs,
+                 std::map<llvm::Value*,int> *assigned) {
+  std::stable_sort(intervals.begin(), intervals.end(),
+                   compare_interval_starts);
+  std::vector<int> free_regs(regs.rbegin(), regs.rend());
+  std::vector<LiveInterval*> active;
+  for (unsigned i = 0; i < intervals.size(); ++i) {
+    LiveInterval *current = &intervals[i];
+    // Expire intervals that ended before this one starts.
+    for (unsigned j = 0; j < active.size(); ) {
+      if (active[j]->end < current->start) {
+        free_regs.push_back((*assigned)[active[j]->value]);
+        active.erase(active.begin() + j);
+      } else {
+        ++j;
+      }
+    }
+    if (!free_regs.empty()) {
+      (*assigned)[current->value] = free_regs.back();
+      free_regs.pop_back();
+      active.push_back(current);
+    } else if (!active.empty()) {
+      unsigned spill = 0;
+      for (unsigned j = 1; j < active.size(); ++j) {
+        if (active[j]->end > active[spill]->end)
+          spill = j;
+      }
+      if (active[spill]->end > current->end) {
+        (*assigned)[current->value] = (*assigned)[active[spill]->value];
+        assigned->erase(active[spill]->value);
+        active[spill] = current;
+      }
+    }
+  }
+}
+
+// Returns the size of the stack slot for a value of type |type|.
+int get_stack_slot_size(llvm::Type *type, CodeBuf &codebuf) {
+  // Structs, as returned by the overflow intrinsics.
+  if (llvm::isa<llvm::StructType>(type))
+    return (codebuf.data_layout->getTypeAllocSize(type) + 3) & ~3;
+  return get_arg_stack_size(type);
+}
+
+// Gives stack slots to the instructions in |intervals| that are not
+// kept in registers, growing the frame's variables area, whose size
+// is |*vars_size|.  This is another linear scan: when an interval
+// expires, its slot becomes free for later values of the same size.
+// 8-byte slots, for i64 and double values, are 8-byte aligned.
+void assign_stack_slots(std::vector<LiveInterval> &intervals,
+                        CodeBuf &codebuf, int *vars_size) {
+  std::stable_sort(intervals.begin(), intervals.end(),
+                   compare_interval_starts);
+  std::map<int,std::vector<int> > free_slots; // Indexed by size
+  std::vector<LiveInterval*> active;
+  for (unsigned i = 0; i < intervals.size(); ++i) {
+    LiveInterval *current = &intervals[i];
+    llvm::Value *value = current->value;
+    // Arguments passed on the stack are in the caller's frame, and
+    // values in registers need no slot.
+    if (codebuf.stackslots.count(value) || codebuf.value_regs.count(value))
+      continue;
+    // Expire intervals that ended before this one starts.
+    for (unsigned j = 0; j < active.size(); ) {
+      if (active[j]->end < current->start) {
+        llvm::Value *expired = active[j]->value;
+        int size = get_stack_slot_size(expired->getType(), codebuf);
+        free_slots[size].push_back(codebuf.stackslots[expired]);
+        active.erase(active.begin() + j);
+      } else {
+        ++j;
+      }
+    }
+    int size = get_stack_slot_size(value->getType(), codebuf);
+    std::vector<int> &free = free_slots[size];
+    assert(codebuf.stackslots.count(value) == 0);
+    if (!free.empty()) {
+      codebuf.stackslots[value] = free.back();
+      free.pop_back();
+    } else {
+      *vars_size += size;
+      // %ebp is 8 bytes past a 16-byte aligned address (see
+      // kStackAlignment).
+      if (size == 8) {
+        while (*vars_size % 8 != 0)
+          *vars_size += 4;
+      }
+      codebuf.stackslots[value] = -*vars_size;
+    }
+    active.push_back(current);
+  }
+}
+
+// Orders the blocks of |func| so that each block is followed, where
+// possible, by a successor that it can fall through to.  Without
+// profile information, we assume that the likely successor is the one
+// that the front end placed first, as it normally lays blocks out in
+// source order.  The entry block stays first.
+void compute_block_layout(llvm::Function *func,
+                          std::vector<llvm::BasicBlock*> *layout) {
+  std::map<llvm::BasicBlock*,int> orig_index;
+  for (llvm::Function::iterator bb = func->begin();
+       bb != func->end();
+       ++bb) {
+    int index = orig_index.size();
+    orig_index[bb] = index;
+  }
+  std::set<llvm::BasicBlock*> placed;
+  for (llvm::Function::iterator bb = func->begin();
+       bb != func->end();
+       ++bb) {
+    // Place a chain of blocks starting at |bb|.
+    llvm::BasicBlock *next = bb;
+    while (next && placed.count(next) == 0) {
+      llvm::BasicBlock *current = next;
+      layout->push_back(current);
+      placed.insert(current);
+      next = NULL;
+      llvm::TerminatorInst *term = current->getTerminator();
+      for (unsigned i = 0; i < term->getNumSuccessors(); ++i) {
+        llvm::BasicBlock *succ = term->getSuccessor(i);
+        if (placed.count(succ) == 0 &&
+            (!next || orig_index[succ] < orig_index[next]))
+          next = succ;
+      }
+    }
+  }
+}
+
+// Generate the code for the blocks in |layout|, followed by the
+// trampolines that they use.
+void translate_blocks(std::vector<llvm::BasicBlock*> &layout,
+                      CodeBuf &codebuf) {
+  for (unsigned i = 0; i < layout.size(); ++i) {
+    codebuf.next_bb = i + 1 < layout.size() ? layout[i + 1] : NULL;
+    translate_bb(layout[i], codebuf);
+  }
+  put_trampolines(codebuf);
+}
+
+// A position in the output of a function's code that we can go back
+// to, discarding the code, data and relocations that follow it.
+struct OutputMark {
+  char *code;
+  char *data;
+  size_t jump_relocs_count;
+  size_t short_jump_relocs_count;
+  size_t global_relocs_count;
+  size_t call_relocs_count;
+  size_t host_relocs_count;
+  size_t image_relocs_count;
+};
+
+OutputMark mark_output(CodeBuf &codebuf) {
+  OutputMark mark = { codebuf.get_current_pos(),
+                      codebuf.data_segment.get_current_pos(),
+                      codebuf.jump_relocs.size(),
+                      codebuf.short_jump_relocs.size(),
+                      codebuf.global_relocs.size(),
+                      codebuf.call_relocs.size(),
+                      codebuf.host_relocs.size(),
+                      codebuf.image_relocs.size() };
+  return mark;
+}
+
+// Go back to |mark|, forgetting the labels of the blocks in |layout|.
+void rewind_output(const OutputMark &mark,
+                   std::vector<llvm::BasicBlock*> &layout,
+                   CodeBuf &codebuf) {
+  codebuf.rewind_to(mark.code);
+  codebuf.rewind_data_to(mark.data);
+  codebuf.jump_relocs.resize(mark.jump_relocs_count);
+  codebuf.short_jump_relocs.resize(mark.short_jump_relocs_count);
+  codebuf.global_relocs.resize(mark.global_relocs_count);
+  codebuf.call_relocs.resize(mark.call_relocs_count);
+  codebuf.host_relocs.resize(mark.host_relocs_count);
+  codebuf.image_relocs.resize(mark.image_relocs_count);
+  for (unsigned i = 0; i < layout.size(); ++i)
+    codebuf.labels.erase(layout[i]);
+}
+
+// Generate the prolog of |func|, whose arguments are passed in
+// |arg_regs| (see get_arg_regs()), followed by its blocks in the
+// order given by |layout|.
+void translate_function_code(llvm::Function *func,
+                             std::vector<llvm::BasicBlock*> &layout,
+                             std::vector<int> &arg_regs,
+                             CodeBuf &codebuf) {
+  codebuf.jumps.clear();
+  codebuf.prev_jumps.clear();
+  codebuf.prev_labels.clear();
+  codebuf.esp_push_depth = 0;
+  codebuf.uses_callees_args_area = false;
+
+  // Prolog:
+  if (!codebuf.omit_frame_pointer) {
+    codebuf.put_byte(0x55); // pushl %ebp
+    codebuf.put_code(TEMPL("\x89\xe5")); // movl %esp, %ebp
+  }
+  if (!codebuf.omit_frame_pointer || codebuf.frame_size != 0) {
+    // subl $frame_size, %esp
+    codebuf.put_byte(0x81);
+    codebuf.put_byte(0xec);
+    codebuf.put_uint32(codebuf.frame_size);
+  }
+  for (unsigned i = 0; i < codebuf.saved_regs.size(); ++i) {
+    codebuf.write_reg_to_frame(codebuf.saved_regs[i].first,
+                               codebuf.saved_regs[i].second);
+  }
+  for (llvm::Function::ArgumentListType::iterator arg = func->arg_begin();
+       arg != func->arg_end();
+       ++arg) {
+    int arg_reg = arg_regs[arg->getArgNo()];
+    if (arg_reg != kNoReg) {
+      // The register allocator only uses callee-saved registers,
+      // so this does not overwrite the other arguments' registers.
+      if (codebuf.value_regs.count(arg) == 1) {
+        codebuf.put_mov_reg_reg(codebuf.value_regs[arg], arg_reg);
       } else {
-        assert(!"Unknown memory intrinsic");
+        codebuf.write_reg_to_frame(arg_reg, codebuf.stackslots[arg]);
       }
-      // The intrinsics come in variants with i32 and i64 lengths.  We
-      // truncate the i64 down to i32.  We do no checks to see whether
-      // this discards bits!
-      llvm::Value *length = op->getLength();
-      if (length->getType() != sizetype)
-        length = new llvm::TruncInst(op->getLength(), sizetype,
-                                     "length_cast", op);
-      args.push_back(length);
-      llvm::Type *mem_func_type =
-        llvm::PointerType::get(
-            llvm::FunctionType::get(llvm::Type::getVoidTy(module->getContext()),
-                                    arg_types, false), 0);
-      llvm::Value *func = llvm::ConstantExpr::getIntToPtr(
-          llvm::ConstantInt::get(sizetype, mem_func), mem_func_type);
+    } else if (codebuf.value_regs.count(arg) == 1) {
+      codebuf.read_reg_from_frame(codebuf.value_regs[arg],
+                                  codebuf.stackslots[arg]);
+    }
+  }
 
-      // TODO: Support volatile operations.  The standard memcpy() is
-      // non-volatile.
-      assert(!op->isVolatile());
-      llvm::Value *new_call =
-        llvm::CallInst::Create(func, args, op->getName(), op);
-      op->replaceAllUsesWith(new_call);
-      op->eraseFromParent();
+  if (codebuf.options->trace_logging)
+    codebuf.put_log_message((std::string("func: ") +
+                             std::string(func->getName())).c_str());
+
+  // We generate the blocks in two passes.  The first pass uses
+  // 32-bit offsets for all jumps between blocks, and tells us which
+  // jumps could use 8-bit offsets instead.  The second pass uses
+  // 8-bit offsets for those jumps.  Its code can only be smaller
+  // than the first pass's, so the offsets still fit in 8 bits.
+  OutputMark blocks_start = mark_output(codebuf);
+  translate_blocks(layout, codebuf);
+  // If the code did not fit in the buffer's current chunk, the first
+  // pass's labels don't tell us which jumps are short.
+  // translate_function() generates the function again in a new chunk.
+  if (!codebuf.is_contiguous_since(blocks_start.code))
+    return;
+
+  bool has_short_jumps = false;
+  for (unsigned i = 0; i < layout.size(); ++i)
+    codebuf.prev_labels[layout[i]] = codebuf.labels[layout[i]];
+  for (unsigned i = 0; i < codebuf.jumps.size(); ++i) {
+    if (codebuf.is_short_jump(codebuf.jumps[i]))
+      has_short_jumps = true;
+  }
+  if (has_short_jumps) {
+    rewind_output(blocks_start, layout, codebuf);
+    codebuf.regenerating_code = true;
+    codebuf.prev_jumps.swap(codebuf.jumps);
+    codebuf.jumps.clear();
+    translate_blocks(layout, codebuf);
+  }
+}
+
+// Returns whether |func| has allocas that are not given fixed places
+// in the frame, which move %esp by amounts that we don't know.
+bool has_dynamic_allocas(llvm::Function *func, CodeBuf &codebuf) {
+  for (llvm::Function::iterator bb = func->begin();
+       bb != func->end();
+       ++bb) {
+    for (llvm::BasicBlock::InstListType::iterator inst = bb->begin();
+         inst != bb->end();
+         ++inst) {
+      if (llvm::isa<llvm::AllocaInst>(inst) &&
+          codebuf.static_allocas.count(inst) == 0 &&
+          codebuf.dead_values.count(inst) == 0)
+        return true;
     }
   }
+  return false;
 }
 
-void translate_function(llvm::Function *func, CodeBuf &codebuf) {
+// Rewrites |func| into the forms that translate_function() handles.
+// This changes the module, including constants that are shared
+// between functions, so it must not run in parallel with other
+// functions' translation.
+void expand_function(llvm::Function *func, CodeBuf &codebuf) {
   llvm::FunctionPass *expand_constantexpr = createExpandConstantExprPass();
-  llvm::BasicBlockPass *expand_gep = createExpandGetElementPtrPass();
+  expand_constantexpr->runOnFunction(*func);
+  delete expand_constantexpr;
+  for (llvm::Function::iterator bb = func->begin();
+       bb != func->end();
+       ++bb) {
+    expand_mem_intrinsics(bb, codebuf);
+  }
+}
 
+// Generates the code of |func|, which expand_function() has been run
+// on, and returns its entry point.  This does not change the module.
+uint32_t translate_function(llvm::Function *func, CodeBuf &codebuf) {
   int callees_args_size = kMinCalleeArgsSize;
-  expand_constantexpr->runOnFunction(*func);
+  bool has_calls = false;
   for (llvm::Function::iterator bb = func->begin();
        bb != func->end();
        ++bb) {
-    expand_gep->runOnBasicBlock(*bb);
-    expand_mem_intrinsics(bb);
     for (llvm::BasicBlock::InstListType::iterator inst = bb->begin();
          inst != bb->end();
          ++inst) {
       if (llvm::CallInst *call = llvm::dyn_cast<llvm::CallInst>(inst)) {
         callees_args_size =
           std::max(callees_args_size, get_args_stack_size(call));
+        // Most intrinsics are generated inline.
+        if (!llvm::isa<llvm::IntrinsicInst>(call))
+          has_calls = true;
+      } else if (inst->getOpcode() == llvm::Instruction::FRem) {
+        // The helper function takes two FP arguments.
+        int args_size = 2 * get_arg_stack_size(inst->getType());
+        callees_args_size = std::max(callees_args_size, args_size);
+        has_calls = true;
       }
     }
   }
   codebuf.frame_callees_args_size = callees_args_size;
 
+  // Arguments passed in registers get stack slots in our frame, like
+  // instructions.  See assign_stack_slots().
+  std::vector<int> arg_regs;
+  get_arg_regs(func, &arg_regs);
   int arg_offset = 8; // Skip return address and frame pointer
   for (llvm::Function::ArgumentListType::iterator arg = func->arg_begin();
        arg != func->arg_end();
        ++arg) {
     assert(codebuf.stackslots.count(arg) == 0);
+    if (arg_regs[arg->getArgNo()] != kNoReg)
+      continue;
     codebuf.stackslots[arg] = arg_offset;
     arg_offset += get_arg_stack_size(arg->getType());
   }
 
+  find_redundant_values(func, codebuf);
+  find_dead_values(func, codebuf);
+  find_extended_values(func, codebuf);
+
   int vars_size = 0;
-  for (llvm::Function::iterator bb = func->begin();
-       bb != func->end();
-       ++bb) {
-    for (llvm::BasicBlock::InstListType::iterator inst = bb->begin();
-         inst != bb->end();
+  if (!func->empty()) {
+    // Give constant-sized allocas in the entry block fixed places in
+    // the frame.  Other allocas adjust %esp when they are executed.
+    llvm::BasicBlock *entry = &func->getEntryBlock();
+    for (llvm::BasicBlock::InstListType::iterator inst = entry->begin();
+         inst != entry->end();
          ++inst) {
-      assert(codebuf.stackslots.count(inst) == 0);
-      if (!codebuf.get_aliased_value(inst)) {
-        vars_size += get_arg_stack_size(inst->getType());
-        codebuf.stackslots[inst] = -vars_size;
-      }
+      llvm::AllocaInst *alloca = llvm::dyn_cast<llvm::AllocaInst>(inst);
+      if (!alloca || codebuf.dead_values.count(alloca))
+        continue;
+      llvm::ConstantInt *count =
+        llvm::dyn_cast<llvm::ConstantInt>(alloca->getArraySize());
+      llvm::Type *type = alloca->getAllocatedType();
+      int align = alloca->getAlignment();
+      if (align == 0)
+        align = codebuf.data_layout->getABITypeAlignment(type);
+      if (!count || align > kStackAlignment)
+        continue;
+      align = std::max(align, 4);
+      vars_size += codebuf.data_layout->getTypeAllocSize(type) *
+                   count->getZExtValue();
+      vars_size = (vars_size + 3) & ~3;
+      // %ebp - vars_size must be aligned.  See kStackAlignment.
+      while ((vars_size - 8) % align != 0)
+        vars_size += 4;
+      codebuf.static_allocas[alloca] = -vars_size;
     }
   }
-  codebuf.frame_vars_size = vars_size;
-  int frame_size = codebuf.frame_vars_size + codebuf.frame_callees_args_size;
+  find_folded_addresses(func, codebuf);
 
-  char *function_entry = codebuf.get_current_pos();
-  if (func->empty()) {
-    if (func->getName() == "llvm.nacl.read.tp") {
-      function_entry = (char *) runtime_tls_get;
-    } else {
-      std::string msg = "Function declared but not defined: ";
-      msg += func->getName();
-      codebuf.unhandled_case(msg.c_str());
+  codebuf.omit_frame_pointer = (codebuf.options->omit_frame_pointer &&
+                                !has_dynamic_allocas(func, codebuf));
+  codebuf.saved_regs.clear();
+  std::vector<LiveInterval> intervals;
+  if (!func->empty())
+    compute_live_intervals(func, codebuf, &intervals);
+  if (codebuf.options->register_allocation) {
+    std::vector<LiveInterval> reg_intervals;
+    for (unsigned i = 0; i < intervals.size(); ++i) {
+      if (is_regalloc_candidate(intervals[i].value, codebuf))
+        reg_intervals.push_back(intervals[i]);
     }
-  } else {
-    // Prolog:
-    codebuf.put_byte(0x55); // pushl %ebp
-    codebuf.put_code(TEMPL("\x89\xe5")); // movl %esp, %ebp
-    // subl $frame_size, %esp
-    codebuf.put_byte(0x81);
-    codebuf.put_byte(0xec);
-    codebuf.put_uint32(frame_size);
+    // We only allocate callee-saved registers, so values survive
+    // calls, and %eax/%ecx/%edx remain free for use as temporaries.
+    std::vector<int> regs;
+    regs.push_back(REG_EBX);
+    regs.push_back(REG_ESI);
+    regs.push_back(REG_EDI);
+    if (codebuf.omit_frame_pointer)
+      regs.push_back(REG_EBP);
+    linear_scan(reg_intervals, regs, &codebuf.value_regs);
+
+    std::set<int> used_regs;
+    for (unsigned i = 0; i < reg_intervals.size(); ++i) {
+      if (codebuf.value_regs.count(reg_intervals[i].value))
+        used_regs.insert(codebuf.value_regs[reg_intervals[i].value]);
+    }
+    for (std::set<int>::iterator reg = used_regs.begin();
+         reg != used_regs.end();
+         ++reg) {
+      vars_size += 4;
+      codebuf.saved_regs.push_back(std::make_pair(*reg, -vars_size));
+    }
+  }
+  assign_stack_slots(intervals, codebuf, &vars_size);
+
+  // Pad the frame so that %esp stays aligned.  A leaf function does
+  // not need to be padded.
+  int leaf_vars_size = vars_size;
+  while ((vars_size + callees_args_size + 8) % kStackAlignment != 0)
+    vars_size += 4;
+  codebuf.frame_vars_size = vars_size;
 
-    if (codebuf.options->trace_logging)
-      codebuf.put_log_message((std::string("func: ") +
-                               std::string(func->getName())).c_str());
+  std::vector<llvm::BasicBlock*> layout;
+  if (!func->empty())
+    compute_block_layout(func, &layout);
 
-    for (llvm::Function::iterator bb = func->begin();
-         bb != func->end();
-         ++bb) {
-      translate_bb(bb, codebuf);
+  codebuf.regenerating_code = false;
+  char *function_entry;
+  for (;;) {
+    OutputMark function_start = mark_output(codebuf);
+    function_entry = codebuf.get_current_pos();
+    if (func->empty()) {
+      if (func->getName() == "llvm.nacl.read.tp") {
+        function_entry = (char *) runtime_tls_get;
+      } else {
+        std::string msg = "Function declared but not defined: ";
+        msg += func->getName();
+        codebuf.unhandled_case(msg.c_str());
+      }
+    } else {
+      // Without a frame pointer, a function that does not call
+      // anything only needs stack space for its stack slots, and it
+      // does not need to keep %esp aligned, so a function without
+      // stack slots needs no frame at all.  Other code, such as some
+      // FP conversions, uses the space that we reserve for callees'
+      // arguments, so we only know that a function can do without it
+      // after generating the function.  If it can't, we start again
+      // with a full frame.
+      bool leaf = codebuf.omit_frame_pointer && !has_calls;
+      if (leaf) {
+        OutputMark start = mark_output(codebuf);
+        codebuf.frame_size = leaf_vars_size == 0 ? 0 : leaf_vars_size + 4;
+        translate_function_code(func, layout, arg_regs, codebuf);
+        if (codebuf.uses_callees_args_area) {
+          rewind_output(start, layout, codebuf);
+          codebuf.regenerating_code = true;
+          leaf = false;
+        }
+      }
+      if (!leaf) {
+        codebuf.frame_size = (codebuf.frame_vars_size +
+                              codebuf.frame_callees_args_size);
+        // In place of the saved %ebp, we leave 4 bytes unused, so that
+        // the frame has the same layout and alignment.
+        if (codebuf.omit_frame_pointer)
+          codebuf.frame_size += 4;
+        translate_function_code(func, layout, arg_regs, codebuf);
+      }
     }
+
+    // A function's code must be contiguous, so if it did not fit in
+    // the rest of the buffer's current chunk, we generate it again at
+    // the start of a new chunk.
+    if (codebuf.is_contiguous_since(function_start.code))
+      break;
+    rewind_output(function_start, layout, codebuf);
+    codebuf.regenerating_code = true;
+    codebuf.start_new_chunk();
   }
 
   if (codebuf.options->dump_code) {
@@ -1290,16 +5405,632 @@ void translate_function(llvm::Function *func, CodeBuf &codebuf) {
     dump_range_as_code(function_entry, codebuf.get_current_pos());
   }
 
-  codebuf.globals[func] = (uintptr_t) function_entry;
+  return (uint32_t) function_entry;
+}
 
-  delete expand_constantexpr;
-  delete expand_gep;
+// Called by the stub of |func| on its first call: generates the
+// function's code, and redirects the stub and the direct calls to the
+// stub to the code.  run_program does not support guest threads, so
+// this does not need a lock.  See put_lazy_stub().
+void translate_lazily(CodeBuf *codebuf, llvm::Function *func) {
+  expand_function(func, *codebuf);
+  uint32_t entry = translate_function(func, *codebuf);
+  codebuf->function_code[func] = entry;
+  codebuf->apply_relocs();
+
+  // Replace the offset of the stub's initial jump.
+  uint32_t stub = codebuf->globals[func];
+  uint32_t *stub_jump_offset = (uint32_t *) (stub + 1);
+  *stub_jump_offset = entry - (uint32_t) (stub_jump_offset + 1);
+
+  std::vector<uint32_t*> &calls = codebuf->stub_calls[func];
+  for (unsigned i = 0; i < calls.size(); ++i)
+    *calls[i] = entry - (uint32_t) (calls[i] + 1);
+  codebuf->stub_calls.erase(func);
+}
+
+// An upper bound on the size of a lazy stub, including its padding.
+static const size_t kLazyStubSize = 64;
+
+// Generates a stub that stands in for |func| until the function's
+// code is generated by translate_lazily(), and returns its address.
+// The stub's address is used as the function's address throughout,
+// so that function pointers compare equal however they were taken.
+uint32_t put_lazy_stub(llvm::Function *func, CodeBuf &codebuf) {
+  // Place the offset of the initial jump on a 4-byte boundary, so
+  // that it can be replaced with a single aligned write.
+  codebuf.reserve(kLazyStubSize);
+  codebuf.align(4);
+  codebuf.put_alloc_space(3);
+  uint32_t stub = (uint32_t) codebuf.get_current_pos();
+  // jmp <next instruction> (32-bit), later redirected to the code
+  codebuf.put_byte(0xe9);
+  codebuf.put_uint32(0);
+  // Preserve the arguments passed in registers.  See get_arg_regs().
+  codebuf.put_byte(0x51); // pushl %ecx
+  codebuf.put_byte(0x52); // pushl %edx
+  codebuf.put_byte(0x50); // pushl %eax
+  // subl $8, %esp, which keeps %esp aligned for the call
+  codebuf.put_byte(0x81);
+  codebuf.put_byte(0xec);
+  codebuf.put_uint32(8);
+  // pushl $func
+  codebuf.put_byte(0x68);
+  codebuf.put_uint32((uint32_t) func);
+  // pushl $codebuf
+  codebuf.put_byte(0x68);
+  codebuf.put_uint32((uint32_t) &codebuf);
+  codebuf.put_direct_call((uintptr_t) translate_lazily);
+  // addl $16, %esp
+  codebuf.put_byte(0x81);
+  codebuf.put_byte(0xc4);
+  codebuf.put_uint32(16);
+  codebuf.put_byte(0x58); // popl %eax
+  codebuf.put_byte(0x5a); // popl %edx
+  codebuf.put_byte(0x59); // popl %ecx
+  // Go back to the start of the stub, which now jumps to the code.
+  // jmp <stub> (32-bit)
+  codebuf.put_byte(0xe9);
+  codebuf.put_uint32(stub - ((uint32_t) codebuf.get_current_pos() +
+                             sizeof(uint32_t)));
+  return stub;
+}
+
+// The functions that one thread generates in parallel mode, and the
+// thread's own code generator state.  See translate_in_parallel().
+struct TranslationWorker {
+  pthread_t thread;
+  llvm::TargetData *data_layout;
+  CodeBuf *codebuf;
+  std::vector<llvm::Function*> funcs;
+  // The entry points of |funcs|' code.
+  std::vector<uint32_t> entries;
+};
+
+void *run_translation_worker(void *arg) {
+  TranslationWorker *worker = (TranslationWorker *) arg;
+  for (unsigned i = 0; i < worker->funcs.size(); ++i) {
+    worker->entries.push_back(
+        translate_function(worker->funcs[i], *worker->codebuf));
+  }
+  // Jumps stay within a function, so the worker can apply them.
+  worker->codebuf->apply_jump_relocs();
+  return NULL;
+}
+
+// Generates the functions of |module| on several threads.  Each
+// thread writes its functions' code and data to buffers of its own.
+// The functions are dealt out to the threads in module order, so the
+// code in each buffer does not depend on how the threads are
+// scheduled.  Afterwards, the threads' global and call relocations are
+// moved to |codebuf|, for the caller to apply with the others, and the
+// threads' buffers are added to |regions|.
+void translate_in_parallel(llvm::Module *module, CodeBuf &codebuf,
+                           std::vector<ImageRegion> *regions) {
+  std::vector<TranslationWorker> workers(codebuf.options->translation_threads);
+  unsigned index = 0;
+  for (llvm::Module::FunctionListType::iterator func = module->begin();
+       func != module->end();
+       ++func) {
+    expand_function(func, codebuf);
+    workers[index++ % workers.size()].funcs.push_back(func);
+  }
+
+  for (unsigned i = 0; i < workers.size(); ++i) {
+    // TargetData caches struct layouts, so each thread needs its own.
+    workers[i].data_layout = new llvm::TargetData(module);
+    workers[i].codebuf = new CodeBuf(workers[i].data_layout, codebuf.options);
+    int err = pthread_create(&workers[i].thread, NULL, run_translation_worker,
+                             &workers[i]);
+    assert(err == 0);
+  }
+
+  for (unsigned i = 0; i < workers.size(); ++i) {
+    TranslationWorker &worker = workers[i];
+    int err = pthread_join(worker.thread, NULL);
+    assert(err == 0);
+    for (unsigned j = 0; j < worker.funcs.size(); ++j) {
+      codebuf.globals[worker.funcs[j]] = worker.entries[j];
+      codebuf.function_code[worker.funcs[j]] = worker.entries[j];
+    }
+    codebuf.global_relocs.insert(codebuf.global_relocs.end(),
+                                 worker.codebuf->global_relocs.begin(),
+                                 worker.codebuf->global_relocs.end());
+    codebuf.call_relocs.insert(codebuf.call_relocs.end(),
+                               worker.codebuf->call_relocs.begin(),
+                               worker.codebuf->call_relocs.end());
+    codebuf.host_relocs.insert(codebuf.host_relocs.end(),
+                               worker.codebuf->host_relocs.begin(),
+                               worker.codebuf->host_relocs.end());
+    worker.codebuf->release_unused();
+    worker.codebuf->data_segment.release_unused();
+    worker.codebuf->get_image_regions(regions);
+    worker.codebuf->data_segment.get_image_regions(regions);
+    // The workers' buffers hold the generated code, so they are not
+    // unmapped.
+    delete worker.codebuf;
+    delete worker.data_layout;
+  }
+}
+
+// A translation cache file starts with an ImageHeader, followed by
+// the ImageRegions, the HostRelocs and the symbol table.  Each symbol
+// is an ImageSymbol followed by the symbol's name.  The contents of
+// the regions follow, each starting on a page boundary so that it can
+// be mapped from the file.
+static const char kImageMagic[8] = "PNCLJIT";
+// Change this when the format of the file or the generated code
+// changes in a way that makes existing cache files invalid.
+static const uint32_t kImageVersion = 3;
+
+struct ImageHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t region_count;
+  uint32_t host_reloc_count;
+  uint32_t symbols_size;
+};
+
+struct ImageSymbol {
+  uint32_t value;
+  // The value's index in kHostSymbols, or -1 if it is not a host
+  // symbol.
+  int32_t host_symbol;
+  uint32_t name_size;
+};
+
+std::string get_translation_cache_key(const std::string &input,
+                                      CodeGenOptions *options) {
+  // 64-bit FNV-1a hash of everything that the generated code depends on.
+  std::string key_data = input;
+  uint32_t settings[] = {
+    kImageVersion,
+    options->register_allocation,
+    options->omit_frame_pointer,
+    options->trace_logging,
+    host_has_sse2(),
+    host_has_popcnt(),
+  };
+  key_data.append((const char *) settings, sizeof(settings));
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < key_data.size(); ++i) {
+    hash ^= (uint8_t) key_data[i];
+    hash *= 1099511628211ULL;
+  }
+  char key[17];
+  snprintf(key, sizeof(key), "%016llx", (unsigned long long) hash);
+  return key;
+}
+
+// Writes the generated code and data in |regions|, with the relocations
+// and symbols needed to load them, to the translation cache file
+// |filename|.  Failing to do so is not fatal.
+void save_translation(const char *filename,
+                      std::vector<ImageRegion> &regions,
+                      std::vector<CodeBuf::HostReloc> &host_relocs,
+                      std::map<std::string,uintptr_t> &globals) {
+  std::string symbols;
+  for (std::map<std::string,uintptr_t>::iterator global = globals.begin();
+       global != globals.end();
+       ++global) {
+    ImageSymbol symbol = { global->second, get_host_symbol(global->second),
+                           global->first.size() };
+    symbols.append((const char *) &symbol, sizeof(symbol));
+    symbols.append(global->first);
+  }
+
+  ImageHeader header;
+  memcpy(header.magic, kImageMagic, sizeof(header.magic));
+  header.version = kImageVersion;
+  header.region_count = regions.size();
+  header.host_reloc_count = host_relocs.size();
+  header.symbols_size = symbols.size();
+
+  uint32_t page_size = getpagesize();
+  uint32_t offset = (sizeof(header) +
+                     regions.size() * sizeof(ImageRegion) +
+                     host_relocs.size() * sizeof(CodeBuf::HostReloc) +
+                     symbols.size());
+  for (unsigned i = 0; i < regions.size(); ++i) {
+    offset = (offset + page_size - 1) & ~(page_size - 1);
+    regions[i].file_offset = offset;
+    offset += regions[i].size;
+  }
+
+  // Write to a temporary file first, so that other processes never
+  // see a partly-written cache file.
+  char pid[16];
+  snprintf(pid, sizeof(pid), "%d", (int) getpid());
+  std::string tmp_filename = std::string(filename) + ".tmp" + pid;
+  FILE *fp = fopen(tmp_filename.c_str(), "wb");
+  if (!fp) {
+    fprintf(stderr, "Warning: can't write translation cache file: %s\n",
+            tmp_filename.c_str());
+    return;
+  }
+  bool ok = (fwrite(&header, sizeof(header), 1, fp) == 1 &&
+             fwrite(&regions[0], sizeof(ImageRegion), regions.size(), fp) ==
+               regions.size() &&
+             (host_relocs.empty() ||
+              fwrite(&host_relocs[0], sizeof(CodeBuf::HostReloc),
+                     host_relocs.size(), fp) == host_relocs.size()) &&
+             fwrite(symbols.data(), 1, symbols.size(), fp) == symbols.size());
+  for (unsigned i = 0; ok && i < regions.size(); ++i) {
+    ok = (fseek(fp, regions[i].file_offset, SEEK_SET) == 0 &&
+          fwrite((void *) regions[i].addr, 1, regions[i].size, fp) ==
+            regions[i].size);
+  }
+  if (fclose(fp) != 0)
+    ok = false;
+  if (!ok || rename(tmp_filename.c_str(), filename) != 0) {
+    fprintf(stderr, "Warning: can't write translation cache file: %s\n",
+            filename);
+    unlink(tmp_filename.c_str());
+  }
+}
+
+bool load_translation(const char *filename,
+                      std::map<std::string,uintptr_t> *globals) {
+  FILE *fp = fopen(filename, "rb");
+  if (!fp)
+    return false;
+  ImageHeader header;
+  std::vector<ImageRegion> regions;
+  std::vector<CodeBuf::HostReloc> host_relocs;
+  std::string symbols;
+  bool ok = (fread(&header, sizeof(header), 1, fp) == 1 &&
+             memcmp(header.magic, kImageMagic, sizeof(header.magic)) == 0 &&
+             header.version == kImageVersion &&
+             header.region_count != 0 && header.symbols_size != 0);
+  if (ok) {
+    regions.resize(header.region_count);
+    host_relocs.resize(header.host_reloc_count);
+    symbols.resize(header.symbols_size);
+    ok = (fread(&regions[0], sizeof(ImageRegion), regions.size(), fp) ==
+            regions.size() &&
+          (host_relocs.empty() ||
+           fread(&host_relocs[0], sizeof(CodeBuf::HostReloc),
+                 host_relocs.size(), fp) == host_relocs.size()) &&
+          fread(&symbols[0], 1, symbols.size(), fp) == symbols.size());
+  }
+  for (unsigned i = 0; ok && i < host_relocs.size(); ++i) {
+    ok = (host_relocs[i].symbol >= 0 &&
+          (size_t) host_relocs[i].symbol <
+            sizeof(kHostSymbols) / sizeof(kHostSymbols[0]));
+  }
+
+  // The code and data contain their own addresses, so they must be
+  // mapped at the addresses they were generated at.  If something
+  // else is there already, we give up and generate them again.
+  unsigned mapped = 0;
+  for (; ok && mapped < regions.size(); ++mapped) {
+    ImageRegion &region = regions[mapped];
+    if (region.size == 0)
+      continue;
+    void *addr = mmap((void *) region.addr, region.size, region.prot,
+                      MAP_PRIVATE, fileno(fp), region.file_offset);
+    if (addr != (void *) region.addr) {
+      if (addr != MAP_FAILED)
+        munmap(addr, region.size);
+      ok = false;
+      break;
+    }
+  }
+  fclose(fp);
+  if (!ok) {
+    for (unsigned i = 0; i < mapped; ++i) {
+      if (regions[i].size != 0)
+        munmap((void *) regions[i].addr, regions[i].size);
+    }
+    return false;
+  }
+
+  for (unsigned i = 0; i < host_relocs.size(); ++i) {
+    uint32_t *loc = (uint32_t *) host_relocs[i].addr;
+    uint32_t value = kHostSymbols[host_relocs[i].symbol].addr;
+    if (host_relocs[i].relative) {
+      *loc = value - (uint32_t) (loc + 1);
+    } else {
+      *loc = value;
+    }
+  }
+
+  size_t pos = 0;
+  while (pos < symbols.size()) {
+    ImageSymbol symbol;
+    memcpy(&symbol, &symbols[pos], sizeof(symbol));
+    pos += sizeof(symbol);
+    std::string name = symbols.substr(pos, symbol.name_size);
+    pos += symbol.name_size;
+    (*globals)[name] = (symbol.host_symbol == -1 ?
+                        symbol.value :
+                        kHostSymbols[symbol.host_symbol].addr);
+  }
+  return true;
+}
+
+// Pads |*out| with zeroes to a multiple of |alignment| bytes.
+void pad_to_alignment(std::string *out, size_t alignment) {
+  out->append((alignment - out->size() % alignment) % alignment, '\0');
+}
+
+// A section of an object file that holds code or data, with the
+// relocations for its contents.  The contents are the chunks of a
+// DataBuffer, one after another.
+struct ObjectSection {
+  // The chunks' addresses, and their offsets in |contents|.
+  std::vector<ImageRegion> pieces;
+  std::string contents;
+  std::vector<Elf32_Rel> relocs;
+
+  void add_pieces(DataBuffer &buf) {
+    size_t first = pieces.size();
+    buf.get_image_regions(&pieces);
+    for (unsigned i = first; i < pieces.size(); ++i) {
+      pad_to_alignment(&contents, 16);
+      pieces[i].file_offset = contents.size();
+      contents.append((char *) pieces[i].addr, pieces[i].size);
+    }
+  }
+
+  // Sets |*offset| to the offset in the section of the address |addr|,
+  // and returns whether the section contains |addr|.  If |allow_end|
+  // is true, the end of a piece counts, which is a valid address for
+  // a global or label to have.
+  bool get_offset(uint32_t addr, bool allow_end, uint32_t *offset) {
+    for (unsigned i = 0; i < pieces.size(); ++i) {
+      if (pieces[i].addr <= addr &&
+          (addr < pieces[i].addr + pieces[i].size ||
+           (allow_end && addr == pieces[i].addr + pieces[i].size))) {
+        *offset = addr - pieces[i].addr + pieces[i].file_offset;
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+// Adds a relocation of |type| against the symbol with index |symbol|
+// for the 32-bit value at |loc|, and replaces the value with |addend|.
+void add_object_reloc(ObjectSection *text, ObjectSection *data,
+                      uint32_t loc, int symbol, int type, uint32_t addend) {
+  ObjectSection *section = text;
+  uint32_t offset;
+  if (!text->get_offset(loc, false, &offset)) {
+    section = data;
+    bool found = data->get_offset(loc, false, &offset);
+    assert(found);
+  }
+  memcpy(&section->contents[offset], &addend, sizeof(addend));
+  Elf32_Rel rel = { offset, ELF32_R_INFO(symbol, type) };
+  section->relocs.push_back(rel);
+}
+
+// Returns the index of the symbol |name|, adding an undefined symbol
+// for it if there is no symbol with that name yet.
+int get_object_symbol(const std::string &name,
+                      std::map<std::string,int> *symbol_indexes,
+                      std::vector<Elf32_Sym> *symtab, std::string *strtab) {
+  std::map<std::string,int>::iterator found = symbol_indexes->find(name);
+  if (found != symbol_indexes->end())
+    return found->second;
+  Elf32_Sym sym;
+  memset(&sym, 0, sizeof(sym));
+  sym.st_name = strtab->size();
+  sym.st_info = ELF32_ST_INFO(STB_GLOBAL, STT_NOTYPE);
+  sym.st_shndx = SHN_UNDEF;
+  strtab->append(name.c_str(), name.size() + 1);
+  int index = symtab->size();
+  symtab->push_back(sym);
+  (*symbol_indexes)[name] = index;
+  return index;
+}
+
+// Returns the contents of |items| as bytes.
+template <class T>
+std::string vector_bytes(const std::vector<T> &items) {
+  if (items.empty())
+    return std::string();
+  return std::string((const char *) &items[0], items.size() * sizeof(T));
+}
+
+// Writes the code and data in |codebuf| to |filename| as an ELF
+// relocatable object, with the symbols in |globals|.  References to
+// the code, the data and to runtime functions (see kHostSymbols)
+// become relocations, so the object can be linked with
+// runtime_helpers.o.
+void write_object_file(const char *filename, CodeBuf &codebuf,
+                       std::map<std::string,uintptr_t> &globals) {
+  enum {
+    kTextSection = 1,
+    kDataSection,
+    kRelTextSection,
+    kRelDataSection,
+    kSymtabSection,
+    kStrtabSection,
+    kShstrtabSection,
+    kGnuStackSection,
+    kNumSections
+  };
+  static const char *const kSectionNames[] = {
+    "", ".text", ".data", ".rel.text", ".rel.data", ".symtab", ".strtab",
+    ".shstrtab", ".note.GNU-stack"
+  };
+
+  ObjectSection text;
+  text.add_pieces(codebuf);
+  ObjectSection data;
+  data.add_pieces(codebuf.data_segment);
+
+  // The symbol table starts with the null symbol and the local
+  // symbols for the sections, which relocations within the code and
+  // data refer to.
+  std::vector<Elf32_Sym> symtab;
+  std::string strtab(1, '\0');
+  std::map<std::string,int> symbol_indexes;
+  Elf32_Sym sym;
+  memset(&sym, 0, sizeof(sym));
+  symtab.push_back(sym);
+  sym.st_info = ELF32_ST_INFO(STB_LOCAL, STT_SECTION);
+  sym.st_shndx = kTextSection;
+  symtab.push_back(sym);
+  sym.st_shndx = kDataSection;
+  symtab.push_back(sym);
+  int first_global = symtab.size();
+  for (std::map<std::string,uintptr_t>::iterator global = globals.begin();
+       global != globals.end();
+       ++global) {
+    uint32_t value = global->second;
+    // Functions that the runtime implements, such as
+    // llvm.nacl.read.tp, are referred to by the runtime's names.
+    if (get_host_symbol(value) != -1)
+      continue;
+    memset(&sym, 0, sizeof(sym));
+    sym.st_name = strtab.size();
+    if (text.get_offset(value, true, &sym.st_value)) {
+      sym.st_info = ELF32_ST_INFO(STB_GLOBAL, STT_FUNC);
+      sym.st_shndx = kTextSection;
+    } else if (data.get_offset(value, true, &sym.st_value)) {
+      sym.st_info = ELF32_ST_INFO(STB_GLOBAL, STT_OBJECT);
+      sym.st_shndx = kDataSection;
+    } else {
+      // An extern_weak global that is not defined.
+      assert(value == 0);
+      sym.st_info = ELF32_ST_INFO(STB_WEAK, STT_NOTYPE);
+      sym.st_shndx = SHN_UNDEF;
+    }
+    strtab.append(global->first.c_str(), global->first.size() + 1);
+    symbol_indexes[global->first] = symtab.size();
+    symtab.push_back(sym);
+  }
+
+  for (unsigned i = 0; i < codebuf.image_relocs.size(); ++i) {
+    CodeBuf::ImageReloc &reloc = codebuf.image_relocs[i];
+    uint32_t value = *(uint32_t *) reloc.addr;
+    int symbol;
+    // The target's offset from the symbol.
+    uint32_t offset;
+    if (text.get_offset(reloc.target, true, &offset)) {
+      symbol = kTextSection;
+    } else if (data.get_offset(reloc.target, true, &offset)) {
+      symbol = kDataSection;
+    } else {
+      // An undefined extern_weak global.
+      assert(reloc.global);
+      assert(symbol_indexes.count(reloc.global->getName().str()) == 1);
+      symbol = symbol_indexes[reloc.global->getName().str()];
+      offset = 0;
+    }
+    if (reloc.relative) {
+      add_object_reloc(&text, &data, reloc.addr, symbol, R_386_PC32,
+                       offset - sizeof(uint32_t));
+    } else {
+      add_object_reloc(&text, &data, reloc.addr, symbol, R_386_32,
+                       value - reloc.target + offset);
+    }
+  }
+  for (unsigned i = 0; i < codebuf.host_relocs.size(); ++i) {
+    CodeBuf::HostReloc &reloc = codebuf.host_relocs[i];
+    int symbol = get_object_symbol(kHostSymbols[reloc.symbol].name,
+                                   &symbol_indexes, &symtab, &strtab);
+    if (reloc.relative) {
+      add_object_reloc(&text, &data, reloc.addr, symbol, R_386_PC32,
+                       (uint32_t) -sizeof(uint32_t));
+    } else {
+      add_object_reloc(&text, &data, reloc.addr, symbol, R_386_32, 0);
+    }
+  }
+
+  std::string shstrtab;
+  Elf32_Shdr empty_shdr;
+  memset(&empty_shdr, 0, sizeof(empty_shdr));
+  std::vector<Elf32_Shdr> shdrs(kNumSections, empty_shdr);
+  for (int i = 0; i < kNumSections; ++i) {
+    shdrs[i].sh_name = shstrtab.size();
+    shstrtab.append(kSectionNames[i], strlen(kSectionNames[i]) + 1);
+  }
+
+  std::string contents[kNumSections];
+  contents[kTextSection] = text.contents;
+  shdrs[kTextSection].sh_type = SHT_PROGBITS;
+  shdrs[kTextSection].sh_flags = SHF_ALLOC | SHF_EXECINSTR;
+  shdrs[kTextSection].sh_addralign = 16;
+  contents[kDataSection] = data.contents;
+  shdrs[kDataSection].sh_type = SHT_PROGBITS;
+  shdrs[kDataSection].sh_flags = SHF_ALLOC | SHF_WRITE;
+  shdrs[kDataSection].sh_addralign = 16;
+  contents[kRelTextSection] = vector_bytes(text.relocs);
+  contents[kRelDataSection] = vector_bytes(data.relocs);
+  for (int i = kRelTextSection; i <= kRelDataSection; ++i) {
+    shdrs[i].sh_type = SHT_REL;
+    shdrs[i].sh_link = kSymtabSection;
+    shdrs[i].sh_info = i == kRelTextSection ? kTextSection : kDataSection;
+    shdrs[i].sh_addralign = 4;
+    shdrs[i].sh_entsize = sizeof(Elf32_Rel);
+  }
+  contents[kSymtabSection] = vector_bytes(symtab);
+  shdrs[kSymtabSection].sh_type = SHT_SYMTAB;
+  shdrs[kSymtabSection].sh_link = kStrtabSection;
+  shdrs[kSymtabSection].sh_info = first_global;
+  shdrs[kSymtabSection].sh_addralign = 4;
+  shdrs[kSymtabSection].sh_entsize = sizeof(Elf32_Sym);
+  contents[kStrtabSection] = strtab;
+  shdrs[kStrtabSection].sh_type = SHT_STRTAB;
+  shdrs[kStrtabSection].sh_addralign = 1;
+  contents[kShstrtabSection] = shstrtab;
+  shdrs[kShstrtabSection].sh_type = SHT_STRTAB;
+  shdrs[kShstrtabSection].sh_addralign = 1;
+  // An empty .note.GNU-stack says that the stack need not be
+  // executable.
+  shdrs[kGnuStackSection].sh_type = SHT_PROGBITS;
+  shdrs[kGnuStackSection].sh_addralign = 1;
+
+  std::string out(sizeof(Elf32_Ehdr), '\0');
+  for (int i = 1; i < kNumSections; ++i) {
+    pad_to_alignment(&out, 16);
+    shdrs[i].sh_offset = out.size();
+    shdrs[i].sh_size = contents[i].size();
+    out.append(contents[i]);
+  }
+  pad_to_alignment(&out, 4);
+
+  Elf32_Ehdr ehdr;
+  memset(&ehdr, 0, sizeof(ehdr));
+  memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+  ehdr.e_ident[EI_CLASS] = ELFCLASS32;
+  ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+  ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+  ehdr.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+  ehdr.e_type = ET_REL;
+  ehdr.e_machine = EM_386;
+  ehdr.e_version = EV_CURRENT;
+  ehdr.e_shoff = out.size();
+  ehdr.e_ehsize = sizeof(Elf32_Ehdr);
+  ehdr.e_shentsize = sizeof(Elf32_Shdr);
+  ehdr.e_shnum = kNumSections;
+  ehdr.e_shstrndx = kShstrtabSection;
+  out.replace(0, sizeof(ehdr), (char *) &ehdr, sizeof(ehdr));
+  out.append(vector_bytes(shdrs));
+
+  FILE *fp = fopen(filename, "wb");
+  if (!fp || fwrite(out.data(), 1, out.size(), fp) != out.size() ||
+      fclose(fp) != 0) {
+    fprintf(stderr, "Error: can't write object file: %s\n", filename);
+    exit(1);
+  }
 }
 
 void translate(llvm::Module *module, std::map<std::string,uintptr_t> *globals,
                CodeGenOptions *options) {
-  llvm::TargetData data_layout(module);
-  CodeBuf codebuf(&data_layout, options);
+  // In lazy mode, functions are generated after we return, so the
+  // code generator's state must stay around.  It is never freed.
+  llvm::TargetData *data_layout = new llvm::TargetData(module);
+  CodeBuf *codebuf_ptr =
+    new CodeBuf(data_layout, options->lazy_compilation ?
+                new CodeGenOptions(*options) : options);
+  CodeBuf &codebuf = *codebuf_ptr;
+  // The code and data buffers, for saving to a translation cache.
+  std::vector<ImageRegion> regions;
 
   llvm::ModulePass *expand_varargs = createExpandVarArgsPass();
   expand_varargs->runOnModule(*module);
@@ -1311,9 +6042,12 @@ void translate(llvm::Module *module, std::map<std::string,uintptr_t> *globals,
     assert(!global->isThreadLocal());
     if (global->hasInitializer()) {
       // TODO: handle alignments
-      uint32_t addr = (uint32_t) codebuf.data_segment.get_current_pos();
       size_t size =
-        data_layout.getTypeAllocSize(global->getType()->getElementType());
+        data_layout->getTypeAllocSize(global->getType()->getElementType());
+      // write_global() writes the initializer piece by piece, so make
+      // room for all of it first.
+      codebuf.data_segment.reserve(size);
+      uint32_t addr = (uint32_t) codebuf.data_segment.get_current_pos();
       codebuf.globals[global] = (uint32_t) addr;
       write_global(&codebuf, global->getInitializer());
       assert(codebuf.data_segment.get_current_pos() == (char *) addr + size);
@@ -1332,13 +6066,30 @@ void translate(llvm::Module *module, std::map<std::string,uintptr_t> *globals,
     }
   }
 
-  for (llvm::Module::FunctionListType::iterator func = module->begin();
-       func != module->end();
-       ++func) {
-    translate_function(func, codebuf);
+  // The parallel mode's workers would write their code dumps to the
+  // same file, so dumping code turns it off.  An object file has one
+  // code section and one data section, so it needs a single CodeBuf.
+  if (options->translation_threads > 1 && !options->lazy_compilation &&
+      !options->dump_code && !options->object_file) {
+    translate_in_parallel(module, codebuf, &regions);
+  } else {
+    for (llvm::Module::FunctionListType::iterator func = module->begin();
+         func != module->end();
+         ++func) {
+      if (options->lazy_compilation && !func->empty()) {
+        codebuf.globals[func] = put_lazy_stub(func, codebuf);
+      } else {
+        expand_function(func, codebuf);
+        uint32_t entry = translate_function(func, codebuf);
+        codebuf.globals[func] = entry;
+        codebuf.function_code[func] = entry;
+      }
+    }
   }
-  codebuf.apply_jump_relocs();
-  codebuf.apply_global_relocs();
+  codebuf.apply_relocs();
+  // Code generated by lazy stubs goes in new chunks.
+  codebuf.release_unused();
+  codebuf.data_segment.release_unused();
 
   llvm::verifyModule(*module);
 
@@ -1348,4 +6099,20 @@ void translate(llvm::Module *module, std::map<std::string,uintptr_t> *globals,
        ++global) {
     (*globals)[global->first->getName()] = global->second;
   }
+
+  // Lazy stubs generate code later, so their code can't be cached.
+  if (options->cache_file && !options->lazy_compilation) {
+    codebuf.get_image_regions(&regions);
+    codebuf.data_segment.get_image_regions(&regions);
+    save_translation(options->cache_file, regions, codebuf.host_relocs,
+                     *globals);
+  }
+
+  if (options->object_file && !options->lazy_compilation)
+    write_object_file(options->object_file, codebuf, *globals);
+
+  if (!options->lazy_compilation) {
+    delete codebuf_ptr;
+    delete data_layout;
+  }
 }
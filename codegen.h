@@ -11,20 +11,63 @@
 #define CODEGEN_H_
 
 #include <map>
+#include <string>
 
 #include <llvm/Module.h>
 
 class CodeGenOptions {
 public:
-  CodeGenOptions(): dump_code(false), trace_logging(false) {}
+  CodeGenOptions():
+      dump_code(false), trace_logging(false), register_allocation(false),
+      omit_frame_pointer(false), lazy_compilation(false),
+      translation_threads(1), cache_file(NULL), object_file(NULL),
+      buffer_chunk_size(1024 * 1024) {}
 
   // Output disassembly of each function that is generated, using objdump.
   bool dump_code;
   // Generate code with log messages to trace execution.
   bool trace_logging;
+  // Keep values in callee-saved registers, using a linear scan
+  // register allocator, rather than giving every value a stack slot.
+  bool register_allocation;
+  // Address stack slots relative to %esp rather than %ebp, so that
+  // %ebp can hold values, and give leaf functions smaller frames.
+  bool omit_frame_pointer;
+  // Generate each function's code when it is first called, rather
+  // than generating all of the module's functions up front.
+  bool lazy_compilation;
+  // The number of threads to generate functions on.  This has no
+  // effect with lazy_compilation or dump_code.
+  int translation_threads;
+  // If not NULL, translate() saves the generated code and data to
+  // this translation cache file, for load_translation() to use in
+  // later runs.  This has no effect with lazy_compilation.
+  const char *cache_file;
+  // If not NULL, translate() also writes the generated code and data
+  // to this file as an ELF relocatable object, which can be linked
+  // with runtime_helpers.o.  The module's globals keep their names.
+  // This has no effect with lazy_compilation.
+  const char *object_file;
+  // The usual size of each separately mapped chunk of the code and
+  // data buffers.  Small modules fit in one chunk of each, so they
+  // only take this much address space for each.  A function that does
+  // not fit in the rest of a chunk is regenerated in a new chunk.
+  // Tests make this small to exercise that.
+  size_t buffer_chunk_size;
 };
 
 void translate(llvm::Module *module, std::map<std::string,uintptr_t> *globals,
                CodeGenOptions *options);
 
+// Returns a name for the translation cache file of the module whose
+// bitcode is |input|, when it is generated with |options|.
+std::string get_translation_cache_key(const std::string &input,
+                                      CodeGenOptions *options);
+
+// Maps in the code and data from a translation cache file that
+// translate() saved, and sets |*globals| as translate() does.  Returns
+// false if the file is missing or can't be used.
+bool load_translation(const char *filename,
+                      std::map<std::string,uintptr_t> *globals);
+
 #endif
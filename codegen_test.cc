@@ -7,12 +7,18 @@
 //
 //===----------------------------------------------------------------------===//
 
+#include <elf.h>
 #include <inttypes.h>
+#include <math.h>
+#include <signal.h>
 #include <stdio.h>
 #include <sys/mman.h>
 
+#include <algorithm>
+
 #include <llvm/LLVMContext.h>
 #include <llvm/Support/IRReader.h>
+#include <llvm/Support/MemoryBuffer.h>
 
 #include "arithmetic_test.h"
 #include "codegen.h"
@@ -37,6 +43,168 @@ void my_assert(int64_t val1, int64_t val2, const char *expr1, const char *expr2,
       my_assert(_val1, _val2, #val1, #val2, __FILE__, __LINE__);        \
   } while (0);
 
+#define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
+
+// Checks each atomicrmw operation on a value of type UTYPE (unsigned)
+// or STYPE (signed), using a test function that takes the operation's
+// index as its first argument.  The values are chosen to differ in
+// their signed and unsigned comparisons.
+#define TEST_ATOMICRMW(UTYPE, STYPE, NAME)                              \
+  {                                                                     \
+    UTYPE (*funcp)(int op, UTYPE *ptr, UTYPE val);                      \
+    GET_FUNC(funcp, NAME);                                              \
+    UTYPE old_val = (UTYPE) -3;                                         \
+    UTYPE val = 5;                                                      \
+    UTYPE expected[] = {                                                \
+      val,                                /* xchg */                    \
+      (UTYPE) (old_val + val),            /* add */                     \
+      (UTYPE) (old_val - val),            /* sub */                     \
+      (UTYPE) (old_val & val),            /* and */                     \
+      (UTYPE) ~(old_val & val),           /* nand */                    \
+      (UTYPE) (old_val | val),            /* or */                      \
+      (UTYPE) (old_val ^ val),            /* xor */                     \
+      (UTYPE) std::max((STYPE) old_val, (STYPE) val), /* max */         \
+      (UTYPE) std::min((STYPE) old_val, (STYPE) val), /* min */         \
+      std::max(old_val, val),             /* umax */                    \
+      std::min(old_val, val),             /* umin */                    \
+    };                                                                  \
+    for (unsigned i = 0; i < ARRAY_SIZE(expected); ++i) {               \
+      UTYPE loc = old_val;                                              \
+      ASSERT_EQ(funcp(i, &loc, val), old_val);                          \
+      ASSERT_EQ(loc, expected[i]);                                      \
+    }                                                                   \
+  }
+
+// Reference implementations of the bit manipulation intrinsics, for
+// the bottom |bits| bits of |x|.
+uint64_t ref_ctpop(uint64_t x, int bits) {
+  int count = 0;
+  for (int i = 0; i < bits; ++i)
+    count += (x >> i) & 1;
+  return count;
+}
+
+uint64_t ref_ctlz(uint64_t x, int bits) {
+  int count = 0;
+  for (int i = bits - 1; i >= 0 && ((x >> i) & 1) == 0; --i)
+    ++count;
+  return count;
+}
+
+uint64_t ref_cttz(uint64_t x, int bits) {
+  int count = 0;
+  for (int i = 0; i < bits && ((x >> i) & 1) == 0; ++i)
+    ++count;
+  return count;
+}
+
+uint64_t ref_bswap(uint64_t x, int bits) {
+  uint64_t result = 0;
+  for (int i = 0; i < bits; i += 8)
+    result = (result << 8) | ((x >> i) & 0xff);
+  return result;
+}
+
+// Test the ctpop, ctlz, cttz and bswap intrinsics on UTYPE, using a
+// test function that takes the intrinsic's index as its first
+// argument.  The bswap at index 3 is skipped for i8.
+#define TEST_BIT_INTRINSICS(UTYPE, NAME)                                \
+  {                                                                     \
+    UTYPE (*funcp)(int op, UTYPE a);                                    \
+    GET_FUNC(funcp, NAME);                                              \
+    int bits = sizeof(UTYPE) * 8;                                       \
+    uint64_t values[] = {                                               \
+      0, 1, 2, 0x80, 0x1234, 0x80000000, 0x100000000ULL,                \
+      0x8000000000000000ULL, 0x0123456789abcdefULL, ~0ULL,              \
+    };                                                                  \
+    for (unsigned i = 0; i < ARRAY_SIZE(values); ++i) {                 \
+      UTYPE val = (UTYPE) values[i];                                    \
+      ASSERT_EQ(funcp(0, val), (UTYPE) ref_ctpop(val, bits));           \
+      ASSERT_EQ(funcp(1, val), (UTYPE) ref_ctlz(val, bits));            \
+      ASSERT_EQ(funcp(2, val), (UTYPE) ref_cttz(val, bits));            \
+      if (bits != 8)                                                    \
+        ASSERT_EQ(funcp(3, val), (UTYPE) ref_bswap(val, bits));         \
+      if (val != 0) {                                                   \
+        ASSERT_EQ(funcp(4, val), (UTYPE) ref_ctlz(val, bits));          \
+        ASSERT_EQ(funcp(5, val), (UTYPE) ref_cttz(val, bits));          \
+      }                                                                 \
+    }                                                                   \
+  }
+
+// Returns the top 64 bits of the 128-bit product of |a| and |b|.
+uint64_t ref_mul_high(uint64_t a, uint64_t b) {
+  uint64_t a_lo = (uint32_t) a;
+  uint64_t a_hi = a >> 32;
+  uint64_t b_lo = (uint32_t) b;
+  uint64_t b_hi = b >> 32;
+  uint64_t lo_lo = a_lo * b_lo;
+  uint64_t hi_lo = a_hi * b_lo;
+  uint64_t lo_hi = a_lo * b_hi;
+  uint64_t middle = (lo_lo >> 32) + (uint32_t) hi_lo + (uint32_t) lo_hi;
+  return a_hi * b_hi + (hi_lo >> 32) + (lo_hi >> 32) + (middle >> 32);
+}
+
+// Returns whether the product of the |bits|-bit unsigned values |a|
+// and |b| does not fit in |bits| bits.
+bool ref_umul_overflows(uint64_t a, uint64_t b, int bits) {
+  uint64_t low = a * b;
+  return ref_mul_high(a, b) != 0 || (bits < 64 && low >> bits != 0);
+}
+
+// Returns whether the product of the |bits|-bit signed values |a| and
+// |b| does not fit in |bits| bits.
+bool ref_smul_overflows(int64_t a, int64_t b, int bits) {
+  uint64_t low = (uint64_t) a * (uint64_t) b;
+  // Correct the unsigned product's top half for negative operands.
+  uint64_t high = ref_mul_high(a, b);
+  if (a < 0)
+    high -= b;
+  if (b < 0)
+    high -= a;
+  if (high != ((int64_t) low < 0 ? ~0ull : 0))
+    return true;
+  return (bits < 64 &&
+          ((int64_t) (low << (64 - bits)) >> (64 - bits)) != (int64_t) low);
+}
+
+// Test the arithmetic-with-overflow intrinsics on UTYPE and STYPE,
+// using a test function that takes the intrinsic's index as its
+// first argument.  Only the first |OPS| of sadd, uadd, ssub, usub,
+// smul and umul are tested.
+#define TEST_OVERFLOW(UTYPE, STYPE, NAME, OPS)                          \
+  {                                                                     \
+    uint32_t (*funcp)(int op, UTYPE a, UTYPE b, UTYPE *result);         \
+    GET_FUNC(funcp, NAME);                                              \
+    UTYPE smax = (UTYPE) ~(UTYPE) 0 >> 1;                               \
+    UTYPE values[] = {                                                  \
+      0, 1, 3, smax, (UTYPE) (smax + 1), (UTYPE) -1, (UTYPE) -3,        \
+      (UTYPE) (smax / 3),                                               \
+    };                                                                  \
+    for (unsigned i = 0; i < ARRAY_SIZE(values); ++i) {                 \
+      for (unsigned j = 0; j < ARRAY_SIZE(values); ++j) {               \
+        UTYPE a = values[i];                                            \
+        UTYPE b = values[j];                                            \
+        UTYPE sum = a + b;                                              \
+        UTYPE diff = a - b;                                             \
+        UTYPE product = (UTYPE) ((uint64_t) a * b);                     \
+        UTYPE expected[] = { sum, sum, diff, diff, product, product };  \
+        bool overflow[] = {                                             \
+          (STYPE) ((a ^ sum) & (b ^ sum)) < 0,                          \
+          sum < a,                                                      \
+          (STYPE) ((a ^ b) & (a ^ diff)) < 0,                           \
+          a < b,                                                        \
+          ref_smul_overflows((STYPE) a, (STYPE) b, sizeof(UTYPE) * 8),  \
+          ref_umul_overflows(a, b, sizeof(UTYPE) * 8),                  \
+        };                                                              \
+        for (int op = 0; op < OPS; ++op) {                              \
+          UTYPE result = 0;                                             \
+          ASSERT_EQ(funcp(op, a, b, &result), overflow[op]);            \
+          ASSERT_EQ(result, expected[op]);                              \
+        }                                                               \
+      }                                                                 \
+    }                                                                   \
+  }
+
 int sub_func(int x, int y) {
   printf("sub_func(%i, %i) called\n", x, y);
   return x - y;
@@ -82,7 +250,67 @@ class PageBoundary {
   void *addr_;
 };
 
-void test_features() {
+// Calls |func| with a pointer to a value that is 1 and a pointer to
+// a PROT_NONE page.  Reading the page faults, and the fault handler
+// sets the value to 2 and makes the page readable, so that the read
+// is retried.  This acts like another thread that writes the value
+// just before the page is read.
+static uint32_t *g_fault_value;
+static void *g_fault_page;
+static const int kFaultPageSize = 0x10000; // NaCl-compatible
+
+static void handle_fault(int sig) {
+  *g_fault_value = 2;
+  void *addr = mmap(g_fault_page, kFaultPageSize, PROT_READ,
+                    MAP_ANONYMOUS | MAP_PRIVATE | MAP_FIXED, -1, 0);
+  assert(addr == g_fault_page);
+}
+
+uint32_t call_with_faulting_read(uint32_t (*func)(uint32_t *value,
+                                                  uint32_t *page)) {
+  uint32_t value = 1;
+  g_fault_value = &value;
+  g_fault_page = mmap(NULL, kFaultPageSize, PROT_NONE,
+                      MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  assert(g_fault_page != MAP_FAILED);
+  signal(SIGSEGV, handle_fault);
+  uint32_t result = func(&value, (uint32_t *) g_fault_page);
+  signal(SIGSEGV, SIG_DFL);
+  int rc = munmap(g_fault_page, kFaultPageSize);
+  assert(rc == 0);
+  return result;
+}
+
+// Returns the size of the stack frame that the generated function
+// |func| allocates in its prolog, which has been called at least once
+// (so that, in lazy mode, its code has been generated).
+uint32_t get_frame_size(void *func) {
+  uint8_t *code = (uint8_t *) func;
+  // Follow a lazy stub's jump to the function's code.
+  if (code[0] == 0xe9)
+    code += 5 + *(int32_t *) (code + 1);
+  // pushl %ebp; movl %esp, %ebp
+  if (code[0] == 0x55 && code[1] == 0x89 && code[2] == 0xe5)
+    code += 3;
+  // subl $frame_size, %esp
+  if (code[0] == 0x81 && code[1] == 0xec)
+    return *(uint32_t *) (code + 2);
+  return 0;
+}
+
+int register_pressure_expected(int n) {
+  int a = 1;
+  int b = 2;
+  int c = 3;
+  for (int i = 0; i < n; ++i) {
+    b += a;
+    a += i;
+    c += 123;
+  }
+  return a + b + c;
+}
+
+void test_features(CodeGenOptions *options) {
   llvm::SMDiagnostic err;
   llvm::LLVMContext &context = llvm::getGlobalContext();
   const char *filename = "test.ll";
@@ -93,8 +321,7 @@ void test_features() {
   }
 
   std::map<std::string,uintptr_t> globals;
-  CodeGenOptions options;
-  translate(module, &globals, &options);
+  translate(module, &globals, options);
 
   int (*func)(int arg);
 
@@ -217,6 +444,23 @@ void test_features() {
     ASSERT_EQ(mem[3], 4);
   }
 
+  {
+    void (*funcp)(uint64_t *ptr64, uint32_t *ptr32, uint16_t *ptr16,
+                  uint8_t *ptr8);
+    GET_FUNC(funcp, "test_store_constants");
+    uint64_t cell64 = 0;
+    uint32_t cell32 = 0;
+    uint16_t cells16[] = { 0, 5 };
+    uint8_t cells8[] = { 0, 6 };
+    funcp(&cell64, &cell32, cells16, cells8);
+    ASSERT_EQ(cell64, 0x0123456789abcdef);
+    ASSERT_EQ(cell32, 0xfffffffe);
+    ASSERT_EQ(cells16[0], 0x1234);
+    ASSERT_EQ(cells16[1], 5);
+    ASSERT_EQ(cells8[0], 0xaa);
+    ASSERT_EQ(cells8[1], 6);
+  }
+
   {
     void *(*funcp)(void **ptr);
     GET_FUNC(funcp, "test_load_ptr");
@@ -260,6 +504,28 @@ void test_features() {
   ASSERT_EQ(func(5), 50);
   ASSERT_EQ(func(6), 999);
 
+  GET_FUNC(func, "test_switch_dense");
+  ASSERT_EQ(func(0), 999);
+  ASSERT_EQ(func(9), 999);
+  ASSERT_EQ(func(10), 100);
+  ASSERT_EQ(func(11), 110);
+  ASSERT_EQ(func(12), 120);
+  ASSERT_EQ(func(13), 999);
+  ASSERT_EQ(func(14), 140);
+  ASSERT_EQ(func(15), 999);
+  ASSERT_EQ(func(-1), 999);
+
+  GET_FUNC(func, "test_switch_sparse");
+  ASSERT_EQ(func(0), 999);
+  ASSERT_EQ(func(1), 10);
+  ASSERT_EQ(func(100), 1000);
+  ASSERT_EQ(func(101), 999);
+  ASSERT_EQ(func(1000), 10000);
+  ASSERT_EQ(func(5000), 50000);
+  ASSERT_EQ(func(0x80000000), -10);
+  ASSERT_EQ(func(-1), -20);
+  ASSERT_EQ(func(-2), 999);
+
   GET_FUNC(func, "test_phi");
   ASSERT_EQ(func(99), 123);
   ASSERT_EQ(func(98), 456);
@@ -271,10 +537,45 @@ void test_features() {
     ASSERT_EQ(funcp(98), 456);
   }
 
+  GET_FUNC(func, "test_phi_swap");
+  ASSERT_EQ(func(1), 12);
+  ASSERT_EQ(func(2), 21);
+  ASSERT_EQ(func(3), 12);
+
+  GET_FUNC(func, "test_phi_edge_only");
+  ASSERT_EQ(func(0), 90);
+  ASSERT_EQ(func(200), 0);
+
+  GET_FUNC(func, "test_branch_distances");
+  ASSERT_EQ(func(0), 7);
+  ASSERT_EQ(func(2), 42);
+
   GET_FUNC(func, "test_select");
   ASSERT_EQ(func(99), 123);
   ASSERT_EQ(func(98), 456);
 
+  GET_FUNC(func, "test_fused_compare_phi");
+  ASSERT_EQ(func(0), 0);
+  ASSERT_EQ(func(5), 5);
+
+  {
+    int (*funcp)(uint8_t arg);
+    GET_FUNC(funcp, "test_icmp_constant");
+    ASSERT_EQ(funcp(201), 1);
+    ASSERT_EQ(funcp(255), 1);
+    ASSERT_EQ(funcp(150), 2);
+    ASSERT_EQ(funcp(10), 0);
+  }
+
+  {
+    int (*funcp)(int64_t arg);
+    GET_FUNC(funcp, "test_select_i64_compare");
+    ASSERT_EQ(funcp(-4), 123);
+    ASSERT_EQ(funcp(-5), 456);
+    ASSERT_EQ(funcp(0x100000000), 123);
+    ASSERT_EQ(funcp(-0x100000000), 456);
+  }
+
   {
     int (*funcp)(int (*func)(int arg1, int arg2), int arg1, int arg2);
     GET_FUNC(funcp, "test_call");
@@ -292,12 +593,29 @@ void test_features() {
               0x4010001000);
   }
 
+  GET_FUNC(func, "test_register_pressure");
+  ASSERT_EQ(func(1), register_pressure_expected(1));
+  ASSERT_EQ(func(10), register_pressure_expected(10));
+
   {
     int (*funcp)();
     GET_FUNC(funcp, "test_direct_call");
     ASSERT_EQ(funcp(), 123);
   }
 
+  {
+    int (*funcp)(int arg);
+    GET_FUNC(funcp, "test_direct_call_forward");
+    ASSERT_EQ(funcp(5), 45);
+  }
+
+  {
+    int (*(*funcp)())(int arg);
+    GET_FUNC(funcp, "get_direct_call_target");
+    ASSERT_EQ((uintptr_t) funcp(), globals["direct_call_target"]);
+    ASSERT_EQ(funcp()(7), 21);
+  }
+
   {
     int *(*funcp)();
     GET_FUNC(funcp, "get_global");
@@ -322,6 +640,16 @@ void test_features() {
     ASSERT_EQ((uintptr_t) *ptr, (uintptr_t) NULL);
   }
 
+  {
+    char *(*funcp)();
+    GET_FUNC(funcp, "get_big_global_end");
+    char *end = funcp();
+    ASSERT_EQ((uintptr_t) end, globals["big_global"] + 1572863);
+    ASSERT_EQ(*(uintptr_t *) globals["big_global_end"], (uintptr_t) end);
+    ASSERT_EQ(*end, 0);
+    *end = 1;
+  }
+
   struct MyStruct { uint8_t a; uint32_t b; uint8_t c; };
   {
     struct MyStruct *ptr = (struct MyStruct *) globals["struct_val"];
@@ -369,6 +697,27 @@ void test_features() {
     ASSERT_EQ(funcp(), 125);
   }
 
+  {
+    int (*funcp)();
+    GET_FUNC(funcp, "test_alloca_static");
+    ASSERT_EQ(funcp(), 10);
+  }
+
+  {
+    int (*funcp)(int arg);
+    GET_FUNC(funcp, "test_alloca_dynamic");
+    ASSERT_EQ(funcp(321), 321);
+  }
+
+  {
+    void *(*funcp)();
+    GET_FUNC(funcp, "test_alloca_overaligned");
+    ASSERT_EQ((uintptr_t) funcp() % 64, 0);
+
+    GET_FUNC(funcp, "test_alloca_dynamic_aligned");
+    ASSERT_EQ((uintptr_t) funcp() % 8, 0);
+  }
+
   {
     void (*funcp)();
     GET_FUNC(funcp, "test_lifetime_start_and_end");
@@ -470,6 +819,29 @@ void test_features() {
     ASSERT_EQ(array[-1], 5);
   }
 
+  {
+    int (*funcp)(struct MyStruct *ptr, int index);
+    GET_FUNC(funcp, "test_folded_address_gep");
+    struct MyStruct array[3] = { { 1, 2, 3 }, { 4, 5, 6 }, { 7, 8, 9 } };
+    ASSERT_EQ(funcp(array, 2), 8);
+    ASSERT_EQ(array[2].c, 99);
+    ASSERT_EQ(array[1].c, 6);
+  }
+
+  {
+    int (*funcp)(int index);
+    GET_FUNC(funcp, "test_folded_address_global");
+    ASSERT_EQ(funcp(0), 2);
+    ASSERT_EQ(funcp(2), 6);
+  }
+
+  {
+    int (*funcp)(int i, int j);
+    GET_FUNC(funcp, "test_folded_address_terms");
+    ASSERT_EQ(funcp(1, 3), 1234);
+    ASSERT_EQ(funcp(2, 1), 1234);
+  }
+
   {
     char *(*funcp)();
     GET_FUNC(funcp, "test_bitcast_constantexpr");
@@ -558,6 +930,75 @@ void test_features() {
     ASSERT_EQ(memcmp(dest, comparison, sizeof(comparison)), 0);
   }
 
+  {
+    void (*funcp)(char *dest, char *src);
+    const char *names[] = { "test_memcpy_7", "test_memcpy_23",
+                            "test_memcpy_100", "test_memcpy_1000",
+                            "test_memcpy_5000" };
+    int sizes[] = { 7, 23, 100, 1000, 5000 };
+    static char src[5001];
+    static char dest[5001];
+    for (unsigned i = 0; i < sizeof(src); ++i)
+      src[i] = i * 7;
+    for (unsigned i = 0; i < ARRAY_SIZE(sizes); ++i) {
+      GET_FUNC(funcp, names[i]);
+      memset(dest, 0, sizeof(dest));
+      funcp(dest, src);
+      ASSERT_EQ(memcmp(dest, src, sizes[i]), 0);
+      ASSERT_EQ(dest[sizes[i]], 0);
+    }
+  }
+
+  {
+    void (*funcp)(char *dest, char *src);
+    const char *names[] = { "test_memmove_6", "test_memmove_20",
+                            "test_memmove_100" };
+    int sizes[] = { 6, 20, 100 };
+    char buf[110];
+    char expected[110];
+    for (unsigned i = 0; i < ARRAY_SIZE(sizes); ++i) {
+      GET_FUNC(funcp, names[i]);
+      // Overlapping copies, in both directions.
+      for (unsigned j = 0; j < sizeof(buf); ++j)
+        buf[j] = expected[j] = j;
+      funcp(buf + 3, buf);
+      memmove(expected + 3, expected, sizes[i]);
+      ASSERT_EQ(memcmp(buf, expected, sizeof(buf)), 0);
+      funcp(buf, buf + 5);
+      memmove(expected, expected + 5, sizes[i]);
+      ASSERT_EQ(memcmp(buf, expected, sizeof(buf)), 0);
+    }
+  }
+
+  {
+    void (*funcp)(char *dest, char val);
+    const char *names[] = { "test_memset_7", "test_memset_40",
+                            "test_memset_1000" };
+    int sizes[] = { 7, 40, 1000 };
+    char dest[1001];
+    char comparison[1001];
+    for (unsigned i = 0; i < ARRAY_SIZE(sizes); ++i) {
+      GET_FUNC(funcp, names[i]);
+      memset(dest, 0, sizeof(dest));
+      funcp(dest, -3);
+      memset(comparison, 0, sizeof(comparison));
+      memset(comparison, -3, sizes[i]);
+      ASSERT_EQ(memcmp(dest, comparison, sizeof(comparison)), 0);
+    }
+  }
+
+  {
+    void (*funcp)(char *dest);
+    GET_FUNC(funcp, "test_memset_constant_value");
+    char dest[20];
+    char comparison[20];
+    memset(dest, 0, sizeof(dest));
+    funcp(dest);
+    memset(comparison, 0, sizeof(comparison));
+    memset(comparison, 0xaa, 19);
+    ASSERT_EQ(memcmp(dest, comparison, sizeof(comparison)), 0);
+  }
+
   {
     void *(*funcp)();
     GET_FUNC(funcp, "test_nacl_read_tp");
@@ -582,6 +1023,378 @@ void test_features() {
     ASSERT_EQ(loc, 120);
   }
 
+  TEST_ATOMICRMW(uint8_t, int8_t, "test_atomicrmw_i8");
+  TEST_ATOMICRMW(uint16_t, int16_t, "test_atomicrmw_i16");
+  TEST_ATOMICRMW(uint32_t, int32_t, "test_atomicrmw_i32");
+  TEST_ATOMICRMW(uint64_t, int64_t, "test_atomicrmw_i64");
+
+  {
+    void (*funcp)(uint16_t *ptr16, uint32_t *ptr32);
+    GET_FUNC(funcp, "test_atomicrmw_unused_result");
+    uint16_t loc16 = 0xfffe;
+    uint32_t loc32 = 10;
+    funcp(&loc16, &loc32);
+    ASSERT_EQ(loc16, 1);
+    ASSERT_EQ(loc32, 0x109);
+  }
+  {
+    uint8_t (*funcp)(uint8_t *ptr, uint8_t cmp, uint8_t new_val);
+    GET_FUNC(funcp, "test_cmpxchg_i8");
+    uint8_t loc = 200;
+    ASSERT_EQ(funcp(&loc, 199, 7), 200);
+    ASSERT_EQ(loc, 200);
+    ASSERT_EQ(funcp(&loc, 200, 7), 200);
+    ASSERT_EQ(loc, 7);
+  }
+  {
+    uint32_t (*funcp)(uint32_t *ptr, uint32_t cmp, uint32_t new_val);
+    GET_FUNC(funcp, "test_cmpxchg_i32");
+    uint32_t loc = 123;
+    ASSERT_EQ(funcp(&loc, 124, 456), 123);
+    ASSERT_EQ(loc, 123);
+    ASSERT_EQ(funcp(&loc, 123, 456), 123);
+    ASSERT_EQ(loc, 456);
+  }
+  {
+    uint64_t (*funcp)(uint64_t *ptr, uint64_t cmp, uint64_t new_val);
+    GET_FUNC(funcp, "test_cmpxchg_i64");
+    uint64_t loc = 0x100000001ULL;
+    ASSERT_EQ(funcp(&loc, 1, 5), 0x100000001ULL);
+    ASSERT_EQ(loc, 0x100000001ULL);
+    ASSERT_EQ(funcp(&loc, 0x100000001ULL, 0x500000005ULL), 0x100000001ULL);
+    ASSERT_EQ(loc, 0x500000005ULL);
+  }
+  {
+    uint32_t (*funcp)(uint32_t *ptr);
+    GET_FUNC(funcp, "test_fence");
+    uint32_t loc = 0;
+    ASSERT_EQ(funcp(&loc), 1);
+  }
+
+  {
+    double (*funcp)(int op, double a, double b);
+    GET_FUNC(funcp, "test_fp_arith_double");
+    assert(funcp(0, 1.25, 2.5) == 3.75);
+    assert(funcp(1, 1.25, 2.5) == -1.25);
+    assert(funcp(2, 1.25, 2.5) == 3.125);
+    assert(funcp(3, 1.0, 3.0) == 1.0 / 3.0);
+    assert(funcp(4, 7.5, 2.0) == 1.5);
+    assert(funcp(4, -7.5, 2.0) == -1.5);
+  }
+  {
+    float (*funcp)(int op, float a, float b);
+    GET_FUNC(funcp, "test_fp_arith_float");
+    assert(funcp(0, 1.25, 2.5) == 3.75);
+    assert(funcp(1, 1.25, 2.5) == -1.25);
+    assert(funcp(2, 1.25, 2.5) == 3.125);
+    // Check that this is rounded to float precision.
+    float a = 1, b = 3;
+    float expected = a / b;
+    assert(funcp(3, a, b) == expected);
+    assert(funcp(4, 7.5, 2.0) == 1.5);
+  }
+  {
+    uint32_t (*funcp)(int pred, double a, double b);
+    GET_FUNC(funcp, "test_fcmp");
+    double values[] = { -1, 0, 2.5, NAN };
+    for (unsigned i = 0; i < ARRAY_SIZE(values); ++i) {
+      for (unsigned j = 0; j < ARRAY_SIZE(values); ++j) {
+        double a = values[i];
+        double b = values[j];
+        bool unordered = isnan(a) || isnan(b);
+        // Predicates are numbered using bits for "equal", "greater
+        // than", "less than" and "unordered".
+        for (int pred = 0; pred < 16; ++pred) {
+          bool expected = unordered ? (pred & 8) != 0 :
+                          ((a == b && (pred & 1)) ||
+                           (a > b && (pred & 2)) ||
+                           (a < b && (pred & 4)));
+          ASSERT_EQ(funcp(pred, a, b), expected);
+        }
+      }
+    }
+  }
+  {
+    uint32_t (*funcp)(float a, float b);
+    GET_FUNC(funcp, "test_fcmp_branch");
+    ASSERT_EQ(funcp(1, 2), 1);
+    ASSERT_EQ(funcp(2, 1), 0);
+    ASSERT_EQ(funcp(2, 2), 0);
+    ASSERT_EQ(funcp(NAN, 2), 1);
+  }
+  {
+    double (*funcp)(double a, double b);
+    GET_FUNC(funcp, "test_fcmp_select");
+    assert(funcp(1, 2) == 1);
+    assert(funcp(2, 1) == 1);
+    assert(funcp(-3, 1) == -3);
+  }
+  {
+    double (*funcp)(double a);
+    GET_FUNC(funcp, "test_fp_constant");
+    assert(funcp(2) == 1.0 - (2 * 2.5 + 2.5));
+  }
+  {
+    float (*funcp)(float a);
+    GET_FUNC(funcp, "test_fp_constant_float");
+    assert(funcp(2) == 5);
+  }
+  {
+    void (*funcp)(double *src, double *dest, float *src_f, float *dest_f);
+    GET_FUNC(funcp, "test_fp_load_store");
+    double src = 1.75;
+    double dest = 0;
+    float src_f = -2.5;
+    float dest_f = 0;
+    funcp(&src, &dest, &src_f, &dest_f);
+    assert(dest == 1.75);
+    assert(dest_f == -2.5);
+  }
+  {
+    void (*funcp)(double *dest);
+    GET_FUNC(funcp, "test_fp_store_constant");
+    double dest = 0;
+    funcp(&dest);
+    assert(dest == 0.5);
+  }
+  {
+    float (*funcp)(uint32_t bits);
+    GET_FUNC(funcp, "test_fp_bitcast_from_i32");
+    assert(funcp(0x40000000) == 3); // 2.0f
+  }
+  {
+    uint32_t (*funcp)(float f);
+    GET_FUNC(funcp, "test_fp_bitcast_to_i32");
+    ASSERT_EQ(funcp(2.0), 0x40000000);
+  }
+  {
+    double (*funcp)(int n);
+    GET_FUNC(funcp, "test_fp_phi");
+    assert(funcp(100) == 5050);
+  }
+  {
+    double (*funcp)(double a, double b);
+    GET_FUNC(funcp, "test_fp_call");
+    assert(funcp(1.5, 3) == 4.5 + 3.5);
+  }
+  {
+    double (*funcp)(int8_t a);
+    GET_FUNC(funcp, "test_sitofp_i8");
+    assert(funcp(-100) == -100);
+  }
+  {
+    double (*funcp)(int32_t a);
+    GET_FUNC(funcp, "test_sitofp_i32");
+    assert(funcp(-100000) == -100000);
+  }
+  {
+    double (*funcp)(int64_t a);
+    GET_FUNC(funcp, "test_sitofp_i64");
+    assert(funcp(-0x123456789LL) == -0x123456789LL);
+  }
+  {
+    double (*funcp)(uint8_t a);
+    GET_FUNC(funcp, "test_uitofp_i8");
+    assert(funcp(200) == 200);
+  }
+  {
+    double (*funcp)(uint32_t a);
+    GET_FUNC(funcp, "test_uitofp_i32");
+    assert(funcp(0xfffffff0) == 0xfffffff0);
+  }
+  {
+    double (*funcp)(uint64_t a);
+    GET_FUNC(funcp, "test_uitofp_i64");
+    assert(funcp(0xfffffffffffff000ULL) == 0xfffffffffffff000ULL);
+  }
+  {
+    float (*funcp)(int64_t a);
+    GET_FUNC(funcp, "test_sitofp_i64_float");
+    // This must be rounded only once, to float precision.
+    int64_t val = 0x1000001000000001LL;
+    float expected = val;
+    assert(funcp(val) == expected);
+  }
+  {
+    float (*funcp)(uint64_t a);
+    GET_FUNC(funcp, "test_uitofp_i64_float");
+    uint64_t val = 0x8000010000000001ULL;
+    float expected = val;
+    assert(funcp(val) == expected);
+  }
+  {
+    int32_t (*funcp)(double a);
+    GET_FUNC(funcp, "test_fptosi_i16");
+    ASSERT_EQ(funcp(-1234.9), -1234);
+  }
+  {
+    int32_t (*funcp)(double a);
+    GET_FUNC(funcp, "test_fptosi_i32");
+    // These are truncated, not rounded.
+    ASSERT_EQ(funcp(-100000.9), -100000);
+    ASSERT_EQ(funcp(2.5), 2);
+  }
+  {
+    int64_t (*funcp)(double a);
+    GET_FUNC(funcp, "test_fptosi_i64");
+    ASSERT_EQ(funcp(-12345678901.9), -12345678901LL);
+    ASSERT_EQ(funcp(2.5), 2);
+  }
+  {
+    uint32_t (*funcp)(double a);
+    GET_FUNC(funcp, "test_fptoui_i32");
+    ASSERT_EQ(funcp(4000000000.9), 4000000000U);
+  }
+  {
+    uint64_t (*funcp)(double a);
+    GET_FUNC(funcp, "test_fptoui_i64");
+    ASSERT_EQ(funcp(18000000000000000000.0), 18000000000000000000ULL);
+  }
+  {
+    int32_t (*funcp)(float a);
+    GET_FUNC(funcp, "test_fptosi_float_i32");
+    ASSERT_EQ(funcp(-7.75), -7);
+  }
+  {
+    uint64_t (*funcp)(float a);
+    GET_FUNC(funcp, "test_fptoui_float_i64");
+    // 2^63 + 2^40, which is exact as a float.
+    ASSERT_EQ(funcp(9223373136366403584.0f), 9223373136366403584ULL);
+  }
+  {
+    double (*funcp)(float a);
+    GET_FUNC(funcp, "test_fpext");
+    assert(funcp(0.1f) == (double) 0.1f);
+  }
+  {
+    float (*funcp)(double a);
+    GET_FUNC(funcp, "test_fptrunc");
+    assert(funcp(0.1) == 0.1f);
+  }
+
+  TEST_BIT_INTRINSICS(uint8_t, "test_bit_intrinsics_i8");
+  TEST_BIT_INTRINSICS(uint16_t, "test_bit_intrinsics_i16");
+  TEST_BIT_INTRINSICS(uint32_t, "test_bit_intrinsics_i32");
+  TEST_BIT_INTRINSICS(uint64_t, "test_bit_intrinsics_i64");
+
+  TEST_OVERFLOW(uint8_t, int8_t, "test_overflow_i8", 6);
+  TEST_OVERFLOW(uint16_t, int16_t, "test_overflow_i16", 6);
+  TEST_OVERFLOW(uint32_t, int32_t, "test_overflow_i32", 6);
+  TEST_OVERFLOW(uint64_t, int64_t, "test_overflow_i64", 6);
+
+  {
+    int32_t (*funcp)(int32_t a, int32_t b);
+    GET_FUNC(funcp, "test_redundant_arith");
+    ASSERT_EQ(funcp(10, 3), 2 * 13 * 7);
+  }
+  {
+    uint32_t (*funcp)(uint32_t a, uint32_t cond);
+    GET_FUNC(funcp, "test_redundant_across_blocks");
+    ASSERT_EQ(funcp(5, 0), 30);
+    ASSERT_EQ(funcp(5, 1), 31);
+  }
+  {
+    uint32_t (*funcp)(uint32_t *ptr);
+    GET_FUNC(funcp, "test_redundant_address");
+    uint32_t array[] = { 10, 20 };
+    ASSERT_EQ(funcp(array), 24);
+  }
+  {
+    uint32_t (*funcp)(uint32_t *ptr, uint32_t *other);
+    GET_FUNC(funcp, "test_redundant_loads");
+    uint32_t val = 1;
+    uint32_t other = 0;
+    ASSERT_EQ(funcp(&val, &other), 1 + 1 + 1 + 1000);
+    val = 1;
+    ASSERT_EQ(funcp(&val, &val), 1 + 1 + 100 + 1000);
+  }
+  {
+    uint32_t (*funcp)(uint32_t *ptr, uint32_t *flag);
+    // The second load of *ptr sees the value written before the
+    // flag was read.
+    GET_FUNC(funcp, "test_load_after_atomic_load");
+    ASSERT_EQ(call_with_faulting_read(funcp), 1 + 2 * 10);
+    GET_FUNC(funcp, "test_load_after_volatile_load");
+    ASSERT_EQ(call_with_faulting_read(funcp), 1 + 2 * 10);
+  }
+  {
+    int64_t (*funcp)(int64_t a, int32_t n);
+    GET_FUNC(funcp, "test_stack_slot_sharing");
+    int64_t a = 0x123456789LL;
+    int32_t n = 10;
+    int64_t acc = a;
+    for (int i = 0; i < n; ++i) {
+      int64_t t1 = acc + 1;
+      acc = (int64_t) ((double) (t1 * 3 - acc) * 0.5) + t1;
+    }
+    ASSERT_EQ(funcp(a, n), acc + a * 2 + n);
+
+    // Sharing slots makes the frame smaller than the frame of the
+    // same values when they are all live at once.
+    int64_t (*unshared_funcp)(int64_t a, int32_t n);
+    GET_FUNC(unshared_funcp, "test_stack_slot_no_sharing");
+    unshared_funcp(a, n);
+    assert(get_frame_size((void *) funcp) <
+           get_frame_size((void *) unshared_funcp));
+  }
+  {
+    uint32_t (*funcp)(uint32_t *ptr, uint32_t n);
+    GET_FUNC(funcp, "test_dead_values");
+    uint32_t val = 0;
+    ASSERT_EQ(funcp(&val, 5), 5);
+    ASSERT_EQ(val, 5);
+
+    // The unused values get no stack slots.
+    uint32_t (*removed_funcp)(uint32_t *ptr, uint32_t n);
+    GET_FUNC(removed_funcp, "test_dead_values_removed");
+    ASSERT_EQ(removed_funcp(&val, 5), 5);
+    ASSERT_EQ(get_frame_size((void *) funcp),
+              get_frame_size((void *) removed_funcp));
+  }
+  {
+    uint32_t (*funcp)(const char *str);
+    GET_FUNC(funcp, "test_parse_decimal");
+    ASSERT_EQ(funcp("1234x"), 1234);
+    ASSERT_EQ(funcp("56\xb5"), 56);
+    ASSERT_EQ(funcp(""), 0);
+  }
+  {
+    uint32_t (*funcp)(uint8_t *a, uint16_t *b);
+    GET_FUNC(funcp, "test_narrow_load_unsigned");
+    uint8_t a = 0xf0;
+    uint16_t b = 0xfff0;
+    ASSERT_EQ(funcp(&a, &b), (0xf0 | (0xfff0 / 3)) >> 1);
+  }
+  {
+    int32_t (*funcp)(int8_t *a, int16_t *b, int32_t cond);
+    GET_FUNC(funcp, "test_narrow_load_signed");
+    int8_t a = -7;
+    int16_t b = -300;
+    ASSERT_EQ(funcp(&a, &b, 1), -3);
+    ASSERT_EQ(funcp(&a, &b, 0), -150);
+    a = 5;
+    b = 300;
+    ASSERT_EQ(funcp(&a, &b, 1), 5);
+    ASSERT_EQ(funcp(&a, &b, 0), 300);
+  }
+  {
+    int64_t (*funcp)(int32_t a, int64_t b, int32_t e, int32_t f);
+    GET_FUNC(funcp, "test_register_args");
+    ASSERT_EQ(funcp(1, 0x100000000LL, 3, 4),
+              0x100000000LL + 1000 + 700 + 30 + 4 + 2);
+    ASSERT_EQ(funcp(-2, -5, 6, -1), -5 - 2000 + 700 + 60 - 1 + 2);
+  }
+  {
+    uint32_t (*funcp)(uint32_t n);
+    GET_FUNC(funcp, "test_register_args_recursive");
+    ASSERT_EQ(funcp(100), 5050);
+  }
+  {
+    int32_t (*funcp)(int32_t a, int32_t b);
+    GET_FUNC(funcp, "test_call_bitcast_arity");
+    ASSERT_EQ(funcp(10, 3), 7);
+  }
+
   {
     uint32_t (*funcp)(uint32_t *result1,
                       uint64_t *result2,
@@ -612,10 +1425,8 @@ void test_features() {
   }
 }
 
-#define ARRAY_SIZE(array) (sizeof(array) / sizeof((array)[0]))
-
 void test_arithmetic(const char *filename, struct TestFunc *test_funcs,
-                     const char *test_funcs_name) {
+                     const char *test_funcs_name, CodeGenOptions *options) {
   llvm::SMDiagnostic err;
   llvm::LLVMContext &context = llvm::getGlobalContext();
   llvm::Module *module = llvm::ParseIRFile(filename, err, context);
@@ -625,8 +1436,7 @@ void test_arithmetic(const char *filename, struct TestFunc *test_funcs,
   }
 
   std::map<std::string,uintptr_t> globals;
-  CodeGenOptions options;
-  translate(module, &globals, &options);
+  translate(module, &globals, options);
   struct TestFunc *translated_test_funcs =
     (struct TestFunc *) globals[test_funcs_name];
 
@@ -658,13 +1468,322 @@ void test_arithmetic(const char *filename, struct TestFunc *test_funcs,
   }
 }
 
+// A pseudo-random number generator (xorshift), so that tests that use
+// random numbers are repeatable.
+uint32_t next_random(uint32_t *state) {
+  *state ^= *state << 13;
+  *state ^= *state >> 17;
+  *state ^= *state << 5;
+  return *state;
+}
+
+// Returns the low |bits| bits of |value|, sign-extended.
+int32_t sign_extend_bits(uint32_t value, int bits) {
+  return (int32_t) (value << (32 - bits)) >> (32 - bits);
+}
+
+// A division or remainder by a constant, which the code generator
+// turns into shifts and multiplies.
+struct DivisionTest {
+  bool is_signed;
+  bool remainder;
+  int bits;
+  int32_t divisor; // Sign-extended from |bits|
+};
+
+// Returns the result of |test| for |x|, computed by the host, as
+// the generated function returns it: zero- or sign-extended to 32 bits.
+uint32_t expected_division_result(DivisionTest &test, uint32_t x) {
+  if (test.is_signed) {
+    int32_t a = sign_extend_bits(x, test.bits);
+    int32_t result = test.remainder ? a % test.divisor : a / test.divisor;
+    return sign_extend_bits(result, test.bits);
+  }
+  uint32_t mask = test.bits == 32 ? ~0u : (1u << test.bits) - 1;
+  uint32_t a = x & mask;
+  uint32_t divisor = test.divisor & mask;
+  return test.remainder ? a % divisor : a / divisor;
+}
+
+// Checks division and remainder by many constant divisors, for i8,
+// i16 and i32, against the host's "/" and "%" for random operands.
+void test_division_by_constants(CodeGenOptions *options) {
+  printf("testing division by constants\n");
+  uint32_t random_state = 12345;
+  std::vector<uint32_t> divisors;
+  static const uint32_t kDivisors[] = {
+    1, 2, 3, 5, 6, 7, 9, 10, 11, 12, 13, 25, 60, 100, 125, 641, 1000,
+    7919, 65535, 65536, 65537, 1000000007, 0x7fffffff, 0x80000000,
+    0x80000001, 0xfffffffe, 0xffffffff, (uint32_t) -3, (uint32_t) -7,
+    (uint32_t) -10, (uint32_t) -100, (uint32_t) -641,
+  };
+  divisors.insert(divisors.end(), kDivisors,
+                  kDivisors + ARRAY_SIZE(kDivisors));
+  for (int i = 0; i < 40; ++i) {
+    // Vary the magnitude, since small divisors are the common case.
+    uint32_t divisor = next_random(&random_state);
+    divisors.push_back(divisor >> (next_random(&random_state) % 32));
+  }
+
+  std::vector<DivisionTest> tests;
+  std::string ir;
+  static const int kBits[] = { 8, 16, 32 };
+  for (unsigned i = 0; i < ARRAY_SIZE(kBits); ++i) {
+    for (unsigned j = 0; j < divisors.size(); ++j) {
+      int bits = kBits[i];
+      int32_t divisor = sign_extend_bits(divisors[j], bits);
+      if (divisor == 0)
+        continue;
+      for (int op = 0; op < 4; ++op) {
+        DivisionTest test = { op >= 2, op % 2 == 1, bits, divisor };
+        static const char *const kOpNames[] = {
+          "udiv", "urem", "sdiv", "srem"
+        };
+        char func[400];
+        if (bits == 32) {
+          snprintf(func, sizeof(func),
+                   "define i32 @div%d(i32 %%x) {\n"
+                   "  %%result = %s i32 %%x, %d\n"
+                   "  ret i32 %%result\n"
+                   "}\n",
+                   (int) tests.size(), kOpNames[op], divisor);
+        } else {
+          snprintf(func, sizeof(func),
+                   "define i32 @div%d(i32 %%x) {\n"
+                   "  %%a = trunc i32 %%x to i%d\n"
+                   "  %%result = %s i%d %%a, %d\n"
+                   "  %%ext = %s i%d %%result to i32\n"
+                   "  ret i32 %%ext\n"
+                   "}\n",
+                   (int) tests.size(), bits, kOpNames[op], bits, divisor,
+                   test.is_signed ? "sext" : "zext", bits);
+        }
+        ir += func;
+        tests.push_back(test);
+      }
+    }
+  }
+
+  llvm::SMDiagnostic err;
+  llvm::LLVMContext &context = llvm::getGlobalContext();
+  llvm::Module *module =
+    llvm::ParseIR(llvm::MemoryBuffer::getMemBuffer(ir), err, context);
+  assert(module);
+  std::map<std::string,uintptr_t> globals;
+  translate(module, &globals, options);
+
+  for (unsigned i = 0; i < tests.size(); ++i) {
+    DivisionTest &test = tests[i];
+    char name[20];
+    snprintf(name, sizeof(name), "div%u", i);
+    uint32_t (*funcp)(uint32_t x) = (uint32_t (*)(uint32_t)) globals[name];
+    assert(funcp);
+    uint32_t divisor = test.divisor;
+    uint32_t operands[] = {
+      0, 1, 0x7fffffff, 0x80000000, 0xffffffff,
+      divisor, divisor - 1, divisor + 1, -divisor, divisor * 3 - 1,
+    };
+    for (unsigned j = 0; j < ARRAY_SIZE(operands) + 200; ++j) {
+      uint32_t x = (j < ARRAY_SIZE(operands) ?
+                    operands[j] : next_random(&random_state));
+      // The minimum value divided by -1 overflows.
+      if (test.is_signed && test.divisor == -1 &&
+          sign_extend_bits(x, test.bits) == (int32_t) (~0u << (test.bits - 1)))
+        continue;
+      uint32_t expected = expected_division_result(test, x);
+      uint32_t actual = funcp(x);
+      if (actual != expected) {
+        fprintf(stderr, "%s%s i%d by %d, x=0x%x\n",
+                test.is_signed ? "s" : "u", test.remainder ? "rem" : "div",
+                test.bits, test.divisor, x);
+      }
+      ASSERT_EQ(actual, expected);
+    }
+  }
+}
+
+// Checks code that is spread over many buffer chunks.  With a small
+// options->buffer_chunk_size, functions often don't fit in the rest
+// of a chunk, so they are regenerated in a new one, and the calls
+// between the @chain functions cross chunks.  @big doesn't fit in an
+// empty chunk either, so it is regenerated in chunks of doubling size
+// until it fits.
+void test_chunk_overflow(CodeGenOptions *options) {
+  printf("testing functions that overflow buffer chunks\n");
+  const int kChainLength = 50;
+  const int kBigFunctionAdds = 4000;
+  std::string ir;
+  for (int i = 0; i < kChainLength; ++i) {
+    char func[200];
+    if (i == kChainLength - 1) {
+      snprintf(func, sizeof(func),
+               "define i32 @chain%d(i32 %%x) {\n"
+               "  ret i32 %%x\n"
+               "}\n", i);
+    } else {
+      snprintf(func, sizeof(func),
+               "define i32 @chain%d(i32 %%x) {\n"
+               "  %%r = call i32 @chain%d(i32 %%x)\n"
+               "  %%s = add i32 %%r, 1\n"
+               "  ret i32 %%s\n"
+               "}\n", i, i + 1);
+    }
+    ir += func;
+    if (i == kChainLength / 2) {
+      // @big also calls out, so its call relocations must survive
+      // being discarded and regenerated.
+      ir += "define i32 @big(i32 %x) {\n"
+            "  %v0 = add i32 %x, 3\n";
+      for (int j = 1; j < kBigFunctionAdds; ++j) {
+        char line[60];
+        snprintf(line, sizeof(line), "  %%v%d = add i32 %%v%d, 3\n", j, j - 1);
+        ir += line;
+      }
+      char line[100];
+      snprintf(line, sizeof(line),
+               "  %%r = call i32 @chain0(i32 %%v%d)\n"
+               "  ret i32 %%r\n"
+               "}\n", kBigFunctionAdds - 1);
+      ir += line;
+    }
+  }
+
+  llvm::SMDiagnostic err;
+  llvm::LLVMContext &context = llvm::getGlobalContext();
+  llvm::Module *module =
+    llvm::ParseIR(llvm::MemoryBuffer::getMemBuffer(ir), err, context);
+  assert(module);
+  std::map<std::string,uintptr_t> globals;
+  translate(module, &globals, options);
+
+  int (*funcp)(int x);
+  GET_FUNC(funcp, "chain0");
+  ASSERT_EQ(funcp(5), 5 + kChainLength - 1);
+  GET_FUNC(funcp, "big");
+  ASSERT_EQ(funcp(5), 5 + 3 * kBigFunctionAdds + kChainLength - 1);
+}
+
+// Returns the symbol called |name| in the ELF object |obj|, or NULL.
+Elf32_Sym *find_object_symbol(std::string &obj, const char *name) {
+  Elf32_Ehdr *ehdr = (Elf32_Ehdr *) &obj[0];
+  Elf32_Shdr *shdrs = (Elf32_Shdr *) &obj[ehdr->e_shoff];
+  for (int i = 0; i < ehdr->e_shnum; ++i) {
+    if (shdrs[i].sh_type != SHT_SYMTAB)
+      continue;
+    Elf32_Sym *syms = (Elf32_Sym *) &obj[shdrs[i].sh_offset];
+    const char *strtab = &obj[shdrs[shdrs[i].sh_link].sh_offset];
+    for (unsigned j = 0; j < shdrs[i].sh_size / sizeof(Elf32_Sym); ++j) {
+      if (strcmp(strtab + syms[j].st_name, name) == 0)
+        return &syms[j];
+    }
+  }
+  return NULL;
+}
+
+void test_object_file() {
+  llvm::SMDiagnostic err;
+  llvm::LLVMContext &context = llvm::getGlobalContext();
+  const char *filename = "test.ll";
+  llvm::Module *module = llvm::ParseIRFile(filename, err, context);
+  if (!module) {
+    fprintf(stderr, "failed to read file: %s\n", filename);
+    assert(0);
+  }
+
+  CodeGenOptions options;
+  options.object_file = "test_object.o";
+  std::map<std::string,uintptr_t> globals;
+  translate(module, &globals, &options);
+
+  std::string obj;
+  FILE *fp = fopen(options.object_file, "rb");
+  assert(fp);
+  char buf[4096];
+  size_t got;
+  while ((got = fread(buf, 1, sizeof(buf), fp)) > 0)
+    obj.append(buf, got);
+  fclose(fp);
+
+  Elf32_Ehdr *ehdr = (Elf32_Ehdr *) &obj[0];
+  ASSERT_EQ(memcmp(ehdr->e_ident, ELFMAG, SELFMAG), 0);
+  ASSERT_EQ(ehdr->e_ident[EI_CLASS], ELFCLASS32);
+  ASSERT_EQ(ehdr->e_type, ET_REL);
+  ASSERT_EQ(ehdr->e_machine, EM_386);
+
+  Elf32_Sym *func = find_object_symbol(obj, "test_return");
+  assert(func);
+  ASSERT_EQ(ELF32_ST_TYPE(func->st_info), STT_FUNC);
+  Elf32_Sym *global = find_object_symbol(obj, "global1");
+  assert(global);
+  ASSERT_EQ(ELF32_ST_TYPE(global->st_info), STT_OBJECT);
+  ASSERT_EQ(*(int32_t *) (globals["global1"]), 124);
+  // The code refers to functions outside it, such as the memcpy()
+  // used for memcpy intrinsics, by name.
+  Elf32_Sym *helper = find_object_symbol(obj, "memcpy");
+  assert(helper);
+  ASSERT_EQ(helper->st_shndx, SHN_UNDEF);
+
+  // The code that was generated in memory can still run.
+  int (*funcp)(int arg);
+  GET_FUNC(funcp, "test_return");
+  ASSERT_EQ(funcp(0), 123);
+}
+
 int main() {
   // Turn off stdout buffering to aid debugging.
   setvbuf(stdout, NULL, _IONBF, 0);
 
-  test_features();
-  test_arithmetic("gen_arithmetic_test_c.ll", test_funcs_c, "test_funcs_c");
-  test_arithmetic("gen_arithmetic_test_ll.ll", test_funcs_ll, "test_funcs_ll");
+  CodeGenOptions options;
+  test_features(&options);
+  test_arithmetic("gen_arithmetic_test_c.ll", test_funcs_c, "test_funcs_c",
+                  &options);
+  test_arithmetic("gen_arithmetic_test_ll.ll", test_funcs_ll, "test_funcs_ll",
+                  &options);
+  test_division_by_constants(&options);
+
+  printf("Testing with register allocation...\n");
+  options.register_allocation = true;
+  test_features(&options);
+  test_arithmetic("gen_arithmetic_test_c.ll", test_funcs_c, "test_funcs_c",
+                  &options);
+  test_arithmetic("gen_arithmetic_test_ll.ll", test_funcs_ll, "test_funcs_ll",
+                  &options);
+
+  printf("Testing with frame pointer omission...\n");
+  options.omit_frame_pointer = true;
+  test_features(&options);
+  test_arithmetic("gen_arithmetic_test_c.ll", test_funcs_c, "test_funcs_c",
+                  &options);
+  test_arithmetic("gen_arithmetic_test_ll.ll", test_funcs_ll, "test_funcs_ll",
+                  &options);
+
+  printf("Testing with parallel translation...\n");
+  options.translation_threads = 4;
+  test_features(&options);
+  test_arithmetic("gen_arithmetic_test_c.ll", test_funcs_c, "test_funcs_c",
+                  &options);
+  test_arithmetic("gen_arithmetic_test_ll.ll", test_funcs_ll, "test_funcs_ll",
+                  &options);
+
+  printf("Testing with lazy compilation...\n");
+  options.lazy_compilation = true;
+  test_features(&options);
+  test_arithmetic("gen_arithmetic_test_c.ll", test_funcs_c, "test_funcs_c",
+                  &options);
+  test_arithmetic("gen_arithmetic_test_ll.ll", test_funcs_ll, "test_funcs_ll",
+                  &options);
+
+  printf("Testing with small buffer chunks...\n");
+  CodeGenOptions small_chunks;
+  small_chunks.buffer_chunk_size = 0x1000; // One page
+  test_features(&small_chunks);
+  test_chunk_overflow(&small_chunks);
+  small_chunks.lazy_compilation = true;
+  test_features(&small_chunks);
+  test_chunk_overflow(&small_chunks);
+
+  printf("Testing object file output...\n");
+  test_object_file();
 
   printf("OK\n");
   return 0;
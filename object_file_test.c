@@ -0,0 +1,52 @@
+/*
+ * This is linked with the object file that codegen_test writes for
+ * test.ll (see test_object_file() in codegen_test.cc) and with
+ * runtime_helpers.o.  Calling the object's functions checks that the
+ * object's relocations are correct.
+ */
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+extern int global1;
+extern int *ptr_reloc;
+extern char big_global[];
+extern char *big_global_end;
+
+int *get_global(void);
+char *get_big_global_end(void);
+int test_switch_dense(int arg);
+int direct_call_target(int arg);
+int test_direct_call_forward(int arg);
+int (*get_direct_call_target(void))(int arg);
+void test_memcpy(char *dest, const char *src, int size);
+
+int main(void) {
+  char src[] = "Hello!";
+  char dest[sizeof(src)];
+
+  /* Addresses of data in the code and in the data (R_386_32),
+     including references between chunks of the data segment. */
+  assert(get_global() == &global1);
+  assert(global1 == 124);
+  assert(ptr_reloc == &global1);
+  assert(big_global_end == &big_global[1572863]);
+  assert(get_big_global_end() == big_global_end);
+
+  /* Jump table entries, which are offsets from .data to .text. */
+  assert(test_switch_dense(10) == 100);
+  assert(test_switch_dense(13) == 999);
+  assert(test_switch_dense(14) == 140);
+
+  /* Calls between functions (R_386_PC32) and function pointers. */
+  assert(test_direct_call_forward(5) == 45);
+  assert(get_direct_call_target() == direct_call_target);
+
+  /* Calls to functions outside the object. */
+  test_memcpy(dest, src, sizeof(src));
+  assert(strcmp(dest, src) == 0);
+
+  printf("OK\n");
+  return 0;
+}
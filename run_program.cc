@@ -9,7 +9,9 @@
 
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 
 #include <llvm/LLVMContext.h>
 #include <llvm/Support/IRReader.h>
@@ -199,11 +201,26 @@ struct startup_info {
   Elf32_auxv_t auxv[2];
 };
 
+// Reads the contents of |filename| into |*data|.
+static bool read_file(const char *filename, std::string *data) {
+  FILE *fp = fopen(filename, "rb");
+  if (!fp)
+    return false;
+  char buf[4096];
+  size_t got;
+  while ((got = fread(buf, 1, sizeof(buf), fp)) > 0)
+    data->append(buf, got);
+  bool ok = !ferror(fp);
+  fclose(fp);
+  return ok;
+}
+
 int main(int argc, char **argv) {
   llvm::SMDiagnostic err;
   llvm::LLVMContext &context = llvm::getGlobalContext();
 
   CodeGenOptions options;
+  const char *cache_dir = NULL;
   const char *prog_name = argv[0];
   int arg = 1;
   while (arg < argc) {
@@ -213,6 +230,24 @@ int main(int argc, char **argv) {
     } else if (!strcmp(argv[arg], "--trace")) {
       options.trace_logging = true;
       arg++;
+    } else if (!strcmp(argv[arg], "--regalloc")) {
+      options.register_allocation = true;
+      arg++;
+    } else if (!strcmp(argv[arg], "--omit-frame-pointer")) {
+      options.omit_frame_pointer = true;
+      arg++;
+    } else if (!strcmp(argv[arg], "--lazy")) {
+      options.lazy_compilation = true;
+      arg++;
+    } else if (!strcmp(argv[arg], "--threads") && arg + 1 < argc) {
+      options.translation_threads = atoi(argv[arg + 1]);
+      arg += 2;
+    } else if (!strcmp(argv[arg], "--cache-dir") && arg + 1 < argc) {
+      cache_dir = argv[arg + 1];
+      arg += 2;
+    } else if (!strcmp(argv[arg], "--emit-object") && arg + 1 < argc) {
+      options.object_file = argv[arg + 1];
+      arg += 2;
     } else {
       break;
     }
@@ -223,14 +258,35 @@ int main(int argc, char **argv) {
     return 1;
   }
   const char *filename = argv[arg];
-  llvm::Module *module = llvm::ParseIRFile(filename, err, context);
-  if (!module) {
-    fprintf(stderr, "failed to read file: %s\n", filename);
-    return 1;
+  std::map<std::string,uintptr_t> globals;
+
+  // Look for the translation in the cache, keyed by the contents of
+  // the bitcode file.
+  std::string cache_file;
+  bool cached = false;
+  std::string input;
+  if (cache_dir && !options.lazy_compilation && !options.object_file &&
+      read_file(filename, &input)) {
+    mkdir(cache_dir, 0777);
+    cache_file = (std::string(cache_dir) + "/" +
+                  get_translation_cache_key(input, &options));
+    cached = load_translation(cache_file.c_str(), &globals);
+    if (!cached)
+      options.cache_file = cache_file.c_str();
   }
 
-  std::map<std::string,uintptr_t> globals;
-  translate(module, &globals, &options);
+  if (!cached) {
+    llvm::Module *module = llvm::ParseIRFile(filename, err, context);
+    if (!module) {
+      fprintf(stderr, "failed to read file: %s\n", filename);
+      return 1;
+    }
+    translate(module, &globals, &options);
+  }
+  // When translating ahead of time, the program runs from the object
+  // file instead.
+  if (options.object_file)
+    return 0;
 
   struct startup_info info;
   info.cleanup_func = NULL;
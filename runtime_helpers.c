@@ -9,6 +9,24 @@
 
 #include "runtime_helpers.h"
 
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// The number of bits set in each byte value, for generating ctpop on
+// CPUs without the popcnt instruction.
+#define POPCOUNT2(n) n, n + 1, n + 1, n + 2
+#define POPCOUNT4(n) \
+    POPCOUNT2(n), POPCOUNT2(n + 1), POPCOUNT2(n + 1), POPCOUNT2(n + 2)
+#define POPCOUNT6(n) \
+    POPCOUNT4(n), POPCOUNT4(n + 1), POPCOUNT4(n + 1), POPCOUNT4(n + 2)
+const uint8_t runtime_popcount_table[256] = {
+  POPCOUNT6(0), POPCOUNT6(1), POPCOUNT6(1), POPCOUNT6(2)
+};
+#undef POPCOUNT2
+#undef POPCOUNT4
+#undef POPCOUNT6
+
 static __thread void *tls_thread_ptr;
 
 int runtime_tls_init(void *thread_ptr) {
@@ -20,94 +38,70 @@ void *runtime_tls_get(void) {
   return tls_thread_ptr;
 }
 
-void runtime_i64_Add(uint64_t *result, uint64_t *arg1, uint64_t *arg2) {
-  *result = *arg1 + *arg2;
-}
-
-void runtime_i64_Sub(uint64_t *result, uint64_t *arg1, uint64_t *arg2) {
-  *result = *arg1 - *arg2;
-}
-
-void runtime_i64_Mul(uint64_t *result, uint64_t *arg1, uint64_t *arg2) {
-  *result = *arg1 * *arg2;
-}
-
-void runtime_i64_UDiv(uint64_t *result, uint64_t *arg1, uint64_t *arg2) {
-  *result = *arg1 / *arg2;
-}
-
-void runtime_i64_URem(uint64_t *result, uint64_t *arg1, uint64_t *arg2) {
-  *result = *arg1 % *arg2;
-}
-
-void runtime_i64_SDiv(int64_t *result, int64_t *arg1, int64_t *arg2) {
-  *result = *arg1 / *arg2;
-}
-
-void runtime_i64_SRem(int64_t *result, int64_t *arg1, int64_t *arg2) {
-  *result = *arg1 % *arg2;
-}
-
-void runtime_i64_And(uint64_t *result, uint64_t *arg1, uint64_t *arg2) {
-  *result = *arg1 & *arg2;
-}
-
-void runtime_i64_Or(uint64_t *result, uint64_t *arg1, uint64_t *arg2) {
-  *result = *arg1 | *arg2;
-}
-
-void runtime_i64_Xor(uint64_t *result, uint64_t *arg1, uint64_t *arg2) {
-  *result = *arg1 ^ *arg2;
+void runtime_log(const char *msg) {
+  fprintf(stderr, "%s\n", msg);
 }
 
-void runtime_i64_Shl(uint64_t *result, uint64_t *arg1, uint64_t *arg2) {
-  *result = *arg1 << *arg2;
+void runtime_unhandled(const char *desc) {
+  fprintf(stderr, "Runtime fatal error: case not handled: %s\n", desc);
+  abort();
 }
 
-void runtime_i64_LShr(uint64_t *result, uint64_t *arg1, uint64_t *arg2) {
-  *result = *arg1 >> *arg2;
+uint64_t runtime_i64_UDiv(uint64_t arg1, uint64_t arg2) {
+  return arg1 / arg2;
 }
 
-void runtime_i64_AShr(int64_t *result, int64_t *arg1, int64_t *arg2) {
-  *result = *arg1 >> *arg2;
+uint64_t runtime_i64_URem(uint64_t arg1, uint64_t arg2) {
+  return arg1 % arg2;
 }
 
-int runtime_i64_ICMP_EQ(uint64_t *arg1, uint64_t *arg2) {
-  return *arg1 == *arg2;
+int64_t runtime_i64_SDiv(int64_t arg1, int64_t arg2) {
+  return arg1 / arg2;
 }
 
-int runtime_i64_ICMP_NE(uint64_t *arg1, uint64_t *arg2) {
-  return *arg1 != *arg2;
+int64_t runtime_i64_SRem(int64_t arg1, int64_t arg2) {
+  return arg1 % arg2;
 }
 
-int runtime_i64_ICMP_UGT(uint64_t *arg1, uint64_t *arg2) {
-  return *arg1 > *arg2;
+uint64_t runtime_i64_UMulOverflow(uint64_t arg1, uint64_t arg2,
+                                  uint8_t *overflow) {
+  uint64_t result = arg1 * arg2;
+  *overflow = arg1 != 0 && result / arg1 != arg2;
+  return result;
 }
 
-int runtime_i64_ICMP_UGE(uint64_t *arg1, uint64_t *arg2) {
-  return *arg1 >= *arg2;
+int64_t runtime_i64_SMulOverflow(int64_t arg1, int64_t arg2,
+                                 uint8_t *overflow) {
+  // Multiply as unsigned, since signed overflow is undefined.
+  int64_t result = (int64_t) ((uint64_t) arg1 * (uint64_t) arg2);
+  // INT64_MIN / -1 would trap.
+  if (arg1 == -1)
+    *overflow = arg2 == INT64_MIN;
+  else
+    *overflow = arg1 != 0 && result / arg1 != arg2;
+  return result;
 }
 
-int runtime_i64_ICMP_ULT(uint64_t *arg1, uint64_t *arg2) {
-  return *arg1 < *arg2;
+double runtime_f64_FRem(double arg1, double arg2) {
+  return fmod(arg1, arg2);
 }
 
-int runtime_i64_ICMP_ULE(uint64_t *arg1, uint64_t *arg2) {
-  return *arg1 <= *arg2;
+float runtime_f32_FRem(float arg1, float arg2) {
+  return fmodf(arg1, arg2);
 }
 
-int runtime_i64_ICMP_SGT(int64_t *arg1, int64_t *arg2) {
-  return *arg1 > *arg2;
+double runtime_u64_to_f64(uint64_t arg) {
+  return arg;
 }
 
-int runtime_i64_ICMP_SGE(int64_t *arg1, int64_t *arg2) {
-  return *arg1 >= *arg2;
+float runtime_u64_to_f32(uint64_t arg) {
+  return arg;
 }
 
-int runtime_i64_ICMP_SLT(int64_t *arg1, int64_t *arg2) {
-  return *arg1 < *arg2;
+uint64_t runtime_f64_to_u64(double arg) {
+  return arg;
 }
 
-int runtime_i64_ICMP_SLE(int64_t *arg1, int64_t *arg2) {
-  return *arg1 <= *arg2;
+uint64_t runtime_f32_to_u64(float arg) {
+  return arg;
 }
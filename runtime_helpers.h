@@ -19,31 +19,39 @@ extern "C" {
 int runtime_tls_init(void *thread_ptr);
 void *runtime_tls_get(void);
 
-void runtime_i64_Add(uint64_t *result, uint64_t *arg1, uint64_t *arg2);
-void runtime_i64_Sub(uint64_t *result, uint64_t *arg1, uint64_t *arg2);
-void runtime_i64_Mul(uint64_t *result, uint64_t *arg1, uint64_t *arg2);
-void runtime_i64_UDiv(uint64_t *result, uint64_t *arg1, uint64_t *arg2);
-void runtime_i64_URem(uint64_t *result, uint64_t *arg1, uint64_t *arg2);
-void runtime_i64_SDiv(int64_t *result, int64_t *arg1, int64_t *arg2);
-void runtime_i64_SRem(int64_t *result, int64_t *arg1, int64_t *arg2);
-
-void runtime_i64_And(uint64_t *result, uint64_t *arg1, uint64_t *arg2);
-void runtime_i64_Or(uint64_t *result, uint64_t *arg1, uint64_t *arg2);
-void runtime_i64_Xor(uint64_t *result, uint64_t *arg1, uint64_t *arg2);
-void runtime_i64_Shl(uint64_t *result, uint64_t *arg1, uint64_t *arg2);
-void runtime_i64_LShr(uint64_t *result, uint64_t *arg1, uint64_t *arg2);
-void runtime_i64_AShr(int64_t *result, int64_t *arg1, int64_t *arg2);
-
-int runtime_i64_ICMP_EQ(uint64_t *arg1, uint64_t *arg2);
-int runtime_i64_ICMP_NE(uint64_t *arg1, uint64_t *arg2);
-int runtime_i64_ICMP_UGT(uint64_t *arg1, uint64_t *arg2);
-int runtime_i64_ICMP_UGE(uint64_t *arg1, uint64_t *arg2);
-int runtime_i64_ICMP_ULT(uint64_t *arg1, uint64_t *arg2);
-int runtime_i64_ICMP_ULE(uint64_t *arg1, uint64_t *arg2);
-int runtime_i64_ICMP_SGT(int64_t *arg1, int64_t *arg2);
-int runtime_i64_ICMP_SGE(int64_t *arg1, int64_t *arg2);
-int runtime_i64_ICMP_SLT(int64_t *arg1, int64_t *arg2);
-int runtime_i64_ICMP_SLE(int64_t *arg1, int64_t *arg2);
+// These are called from generated code to print log messages and to
+// report cases that the code generator does not handle.
+void runtime_log(const char *msg);
+void runtime_unhandled(const char *desc);
+
+// Used by generated code to count bits on CPUs without popcnt.
+extern const uint8_t runtime_popcount_table[256];
+
+// These 64-bit division helpers are called directly from generated
+// code.  The first argument is passed in %edx:%eax and the second on
+// the stack, and the result is returned in %edx:%eax.
+#define RUNTIME_REGPARM __attribute__((regparm(3)))
+
+RUNTIME_REGPARM uint64_t runtime_i64_UDiv(uint64_t arg1, uint64_t arg2);
+RUNTIME_REGPARM uint64_t runtime_i64_URem(uint64_t arg1, uint64_t arg2);
+RUNTIME_REGPARM int64_t runtime_i64_SDiv(int64_t arg1, int64_t arg2);
+RUNTIME_REGPARM int64_t runtime_i64_SRem(int64_t arg1, int64_t arg2);
+// These also take the address of the overflow flag on the stack, after
+// the second argument.
+RUNTIME_REGPARM uint64_t runtime_i64_UMulOverflow(uint64_t arg1, uint64_t arg2,
+                                                  uint8_t *overflow);
+RUNTIME_REGPARM int64_t runtime_i64_SMulOverflow(int64_t arg1, int64_t arg2,
+                                                 uint8_t *overflow);
+
+// These FP helpers are also called directly from generated code.  They
+// use the normal calling convention: arguments on the stack, and FP
+// results on the x87 stack.
+double runtime_f64_FRem(double arg1, double arg2);
+float runtime_f32_FRem(float arg1, float arg2);
+double runtime_u64_to_f64(uint64_t arg);
+float runtime_u64_to_f32(uint64_t arg);
+uint64_t runtime_f64_to_u64(double arg);
+uint64_t runtime_f32_to_u64(float arg);
 
 #ifdef __cplusplus
 }
@@ -73,6 +73,15 @@ define void @test_store_int8(i8* %ptr, i8 %value) {
   ret void
 }
 
+define void @test_store_constants(i64* %ptr64, i32* %ptr32, i16* %ptr16,
+                                  i8* %ptr8) {
+  store i64 81985529216486895, i64* %ptr64 ; 0x0123456789abcdef
+  store i32 -2, i32* %ptr32
+  store i16 4660, i16* %ptr16 ; 0x1234
+  store i8 -86, i8* %ptr8 ; 0xaa
+  ret void
+}
+
 define i32* @test_load_ptr(i32** %ptr) {
   %1 = load i32** %ptr
   ret i32* %1
@@ -132,6 +141,58 @@ default:
   ret i32 %ret999
 }
 
+; This is dense enough to be generated as a jump table.
+define i32 @test_switch_dense(i32 %arg) {
+entry:
+  switch i32 %arg, label %default [
+    i32 10, label %match10
+    i32 11, label %match11
+    i32 12, label %match12
+    i32 14, label %match14
+  ]
+match10:
+  ret i32 100
+match11:
+  ret i32 110
+match12:
+  %ret12 = phi i32 [ 120, %entry ]
+  ret i32 %ret12
+match14:
+  ret i32 140
+default:
+  %ret999 = phi i32 [ 999, %entry ]
+  ret i32 %ret999
+}
+
+; This is sparse, so it is generated as a binary search.
+define i32 @test_switch_sparse(i32 %arg) {
+entry:
+  switch i32 %arg, label %default [
+    i32 1000, label %match1000
+    i32 1, label %match1
+    i32 -1, label %match_minus1
+    i32 100, label %match100
+    i32 -2147483648, label %match_min
+    i32 5000, label %match5000
+  ]
+match1:
+  ret i32 10
+match100:
+  ret i32 1000
+match1000:
+  %ret1000 = phi i32 [ 10000, %entry ]
+  ret i32 %ret1000
+match5000:
+  ret i32 50000
+match_min:
+  ret i32 -10
+match_minus1:
+  ret i32 -20
+default:
+  %ret999 = phi i32 [ 999, %entry ]
+  ret i32 %ret999
+}
+
 define i32 @test_phi(i32 %arg) {
   %1 = icmp eq i32 %arg, 99
   br i1 %1, label %iftrue, label %iffalse
@@ -156,12 +217,112 @@ return:
   ret i64 %2
 }
 
+; The phi nodes here swap their values on each iteration, so they
+; must be assigned in parallel.
+define i32 @test_phi_swap(i32 %n) {
+entry:
+  br label %loop
+loop:
+  %a = phi i32 [ 1, %entry ], [ %b, %loop ]
+  %b = phi i32 [ 2, %entry ], [ %a, %loop ]
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %i.next = add i32 %i, 1
+  %done = icmp eq i32 %i.next, %n
+  br i1 %done, label %exit, label %loop
+exit:
+  %result1 = mul i32 %a, 10
+  %result2 = add i32 %result1, %b
+  ret i32 %result2
+}
+
+; The phi node %x must only be assigned on the edge from %body to
+; %loop, because %exit2 uses its old value.
+define i32 @test_phi_edge_only(i32 %arg) {
+entry:
+  br label %loop
+loop:
+  %x = phi i32 [ %arg, %entry ], [ %x.next, %body ]
+  %cmp = icmp ult i32 %x, 100
+  br i1 %cmp, label %body, label %exit
+body:
+  %x.next = add i32 %x, 30
+  %again = icmp ult i32 %x.next, 100
+  br i1 %again, label %loop, label %exit2
+exit:
+  ret i32 0
+exit2:
+  ret i32 %x
+}
+
+; The true block follows the branch, so the branch is inverted to jump
+; to %exit, and the jump needs a 32-bit offset to get past %body.
+define i32 @test_branch_distances(i32 %n) {
+entry:
+  %cmp = icmp ne i32 %n, 0
+  br i1 %cmp, label %body, label %exit
+body:
+  %a1 = add i32 %n, %n
+  %a2 = add i32 %a1, %n
+  %a3 = add i32 %a2, %n
+  %a4 = add i32 %a3, %n
+  %a5 = add i32 %a4, %n
+  %a6 = add i32 %a5, %n
+  %a7 = add i32 %a6, %n
+  %a8 = add i32 %a7, %n
+  %a9 = add i32 %a8, %n
+  %a10 = add i32 %a9, %n
+  %a11 = add i32 %a10, %n
+  %a12 = add i32 %a11, %n
+  %a13 = add i32 %a12, %n
+  %a14 = add i32 %a13, %n
+  %a15 = add i32 %a14, %n
+  %a16 = add i32 %a15, %n
+  %a17 = add i32 %a16, %n
+  %a18 = add i32 %a17, %n
+  %a19 = add i32 %a18, %n
+  %a20 = add i32 %a19, %n
+  ret i32 %a20
+exit:
+  ret i32 7
+}
+
 define i32 @test_select(i32 %arg) {
   %1 = icmp eq i32 %arg, 99
   %2 = select i1 %1, i32 123, i32 456
   ret i32 %2
 }
 
+; The comparison here uses a phi node of the block that it branches
+; to, so it must be evaluated before the phi node is assigned.
+define i32 @test_fused_compare_phi(i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %i.next = add i32 %i, 1
+  %cmp = icmp ult i32 %i, %n
+  br i1 %cmp, label %loop, label %exit
+exit:
+  ret i32 %i
+}
+
+; The constants must be extended in the same way as %arg.
+define i32 @test_icmp_constant(i8 %arg) {
+  %1 = icmp ugt i8 %arg, 200
+  %2 = icmp slt i8 %arg, -100
+  %3 = zext i1 %1 to i32
+  %4 = zext i1 %2 to i32
+  %5 = shl i32 %4, 1
+  %6 = or i32 %3, %5
+  ret i32 %6
+}
+
+define i32 @test_select_i64_compare(i64 %arg) {
+  %1 = icmp sgt i64 %arg, -5
+  %2 = select i1 %1, i32 123, i32 456
+  ret i32 %2
+}
+
 define i32 @test_call(i32 (i32, i32)* %func, i32 %arg1, i32 %arg2) {
   %1 = call i32 %func(i32 %arg1, i32 %arg2)
   %2 = add i32 %1, 1000
@@ -180,11 +341,54 @@ define i64 @test_call_i64(i64 (i64, i64)* %func, i64 %arg1, i64 %arg2) {
   ret i64 %1
 }
 
+; This has more simultaneously-live values than the register
+; allocator has registers, and keeps them live across a loop and a
+; call.
+define i32 @test_register_pressure(i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %a = phi i32 [ 1, %entry ], [ %a.next, %loop ]
+  %b = phi i32 [ 2, %entry ], [ %b.next, %loop ]
+  %c = phi i32 [ 3, %entry ], [ %c.next, %loop ]
+  %a.next = add i32 %a, %i
+  %b.next = add i32 %b, %a
+  %r = call i32 @test_return(i32 0)
+  %c.next = add i32 %c, %r
+  %i.next = add i32 %i, 1
+  %done = icmp eq i32 %i.next, %n
+  br i1 %done, label %exit, label %loop
+exit:
+  %sum1 = add i32 %a.next, %b.next
+  %sum2 = add i32 %sum1, %c.next
+  ret i32 %sum2
+}
+
 define i32 @test_direct_call() {
   %1 = call i32 @test_return(i32 0)
   ret i32 %1
 }
 
+; This calls a function that is generated later, including via a cast.
+define i32 @test_direct_call_forward(i32 %arg) {
+  %1 = call i32 @direct_call_target(i32 %arg)
+  %2 = call i32 bitcast (i32 (i32)* @direct_call_target
+                         to i32 (i32, i32)*)(i32 %1, i32 0)
+  ret i32 %2
+}
+
+define i32 @direct_call_target(i32 %arg) {
+  %1 = mul i32 %arg, 3
+  ret i32 %1
+}
+
+; The address of a function should be the same whether it is taken
+; before or after the function is called.
+define i32 (i32)* @get_direct_call_target() {
+  ret i32 (i32)* @direct_call_target
+}
+
 @global1 = global i32 124
 
 define i32* @get_global() {
@@ -217,6 +421,15 @@ define i8* @get_global_string() {
 
 @global_i64 = global i64 1234100100100
 
+; A global that is bigger than a chunk of the data segment, followed
+; by one that refers to it.
+@big_global = global [1572864 x i8] zeroinitializer
+@big_global_end = global i8* getelementptr ([1572864 x i8]* @big_global, i32 0, i32 1572863)
+
+define i8* @get_big_global_end() {
+  ret i8* getelementptr ([1572864 x i8]* @big_global, i32 0, i32 1572863)
+}
+
 ; TODO: Disallow extern_weak global variables instead.
 @__ehdr_start = extern_weak global i8
 
@@ -244,6 +457,71 @@ define i32 @test_alloca2() {
   ret i32 %1
 }
 
+; These allocas get fixed places in the frame.  The result includes
+; 1000 if %b is not 16-byte aligned.
+define i32 @test_alloca_static() {
+  %a = alloca i8
+  %b = alloca i32, align 16
+  %c = alloca i64
+  %d = alloca i32, i32 4
+  store i8 1, i8* %a
+  store i32 2, i32* %b
+  store i64 3, i64* %c
+  %d3 = getelementptr i32* %d, i32 3
+  store i32 4, i32* %d3
+  call void @func_with_args(i32 98, i32 99)
+  %a.val = load i8* %a
+  %b.val = load i32* %b
+  %c.val = load i64* %c
+  %d3.val = load i32* %d3
+  %a.ext = zext i8 %a.val to i32
+  %c.trunc = trunc i64 %c.val to i32
+  %sum1 = add i32 %a.ext, %b.val
+  %sum2 = add i32 %sum1, %c.trunc
+  %sum3 = add i32 %sum2, %d3.val
+  %b.int = ptrtoint i32* %b to i32
+  %misalign = and i32 %b.int, 15
+  %misalign.flag = icmp ne i32 %misalign, 0
+  %penalty = select i1 %misalign.flag, i32 1000, i32 0
+  %result = add i32 %sum3, %penalty
+  ret i32 %result
+}
+
+; An alloca outside the entry block is allocated when it is executed.
+define i32 @test_alloca_dynamic(i32 %arg) {
+entry:
+  br label %block
+block:
+  %addr = alloca i32
+  store i32 %arg, i32* %addr
+  call void @func_with_args(i32 98, i32 99)
+  %1 = load i32* %addr
+  ret i32 %1
+}
+
+; An alloca that needs more alignment than the stack has is allocated
+; when it is executed, even in the entry block.
+define i8* @test_alloca_overaligned() {
+  %a = alloca i8
+  %b = alloca i32, align 64
+  store i8 1, i8* %a
+  store i32 2, i32* %b
+  call void @func_with_args(i32 98, i32 99)
+  %ptr = bitcast i32* %b to i8*
+  ret i8* %ptr
+}
+
+define i8* @test_alloca_dynamic_aligned() {
+entry:
+  br label %block
+block:
+  %addr = alloca double, align 8
+  store double 1.0, double* %addr
+  call void @func_with_args(i32 98, i32 99)
+  %ptr = bitcast double* %addr to i8*
+  ret i8* %ptr
+}
+
 declare void @llvm.lifetime.start(i64, i8* nocapture) nounwind
 declare void @llvm.lifetime.end(i64, i8* nocapture) nounwind
 
@@ -337,6 +615,42 @@ define i16* @test_getelementptr_constantexpr() {
   ret i16* getelementptr ([3 x [2 x i16]]* @array, i32 0, i32 2, i32 1)
 }
 
+; The address computations in these functions are folded into the
+; memory operands of the loads and stores that use them.
+
+define i32 @test_folded_address_gep(%MyStruct* %ptr, i32 %index) {
+  %field1 = getelementptr %MyStruct* %ptr, i32 %index, i32 1
+  %val = load i32* %field1
+  %field2 = getelementptr %MyStruct* %ptr, i32 %index, i32 2
+  store i8 99, i8* %field2
+  ret i32 %val
+}
+
+define i32 @test_folded_address_global(i32 %index) {
+  %base = ptrtoint [3 x [2 x i16]]* @array to i32
+  %offset = mul i32 %index, 4
+  %addr1 = add i32 %base, %offset
+  %addr2 = add i32 %addr1, 2
+  %ptr = inttoptr i32 %addr2 to i16*
+  %val = load i16* %ptr
+  %ext = zext i16 %val to i32
+  ret i32 %ext
+}
+
+define i32 @test_folded_address_terms(i32 %i, i32 %j) {
+  %buf = alloca [16 x i32]
+  %buf.int = ptrtoint [16 x i32]* %buf to i32
+  %i.scaled = shl i32 %i, 3
+  %j.scaled = mul i32 %j, 4
+  %sum = add i32 %buf.int, %i.scaled
+  %addr = add i32 %sum, %j.scaled
+  %ptr = inttoptr i32 %addr to i32*
+  store i32 1234, i32* %ptr
+  %elt = getelementptr [16 x i32]* %buf, i32 0, i32 5
+  %val = load i32* %elt
+  ret i32 %val
+}
+
 define i8* @test_bitcast_constantexpr() {
   ret i8* bitcast ([3 x [2 x i16]]* @array to i8*)
 }
@@ -439,6 +753,80 @@ define void @test_memset_i64_size(i8* %dest, i8 %val, i32 %size) {
   ret void
 }
 
+; Memory intrinsics with constant lengths are generated inline, using
+; different methods depending on the length.
+
+define void @test_memcpy_7(i8* %dest, i8* %src) {
+  call void @llvm.memcpy.p0i8.p0i8.i32(i8* %dest, i8* %src, i32 7,
+                                       i32 1, i1 false)
+  ret void
+}
+
+define void @test_memcpy_23(i8* %dest, i8* %src) {
+  call void @llvm.memcpy.p0i8.p0i8.i32(i8* %dest, i8* %src, i32 23,
+                                       i32 1, i1 false)
+  ret void
+}
+
+define void @test_memcpy_100(i8* %dest, i8* %src) {
+  call void @llvm.memcpy.p0i8.p0i8.i32(i8* %dest, i8* %src, i32 100,
+                                       i32 1, i1 false)
+  ret void
+}
+
+define void @test_memcpy_1000(i8* %dest, i8* %src) {
+  call void @llvm.memcpy.p0i8.p0i8.i32(i8* %dest, i8* %src, i32 1000,
+                                       i32 1, i1 false)
+  ret void
+}
+
+define void @test_memcpy_5000(i8* %dest, i8* %src) {
+  call void @llvm.memcpy.p0i8.p0i8.i32(i8* %dest, i8* %src, i32 5000,
+                                       i32 1, i1 false)
+  ret void
+}
+
+define void @test_memmove_6(i8* %dest, i8* %src) {
+  call void @llvm.memmove.p0i8.p0i8.i32(i8* %dest, i8* %src, i32 6,
+                                        i32 1, i1 false)
+  ret void
+}
+
+define void @test_memmove_20(i8* %dest, i8* %src) {
+  call void @llvm.memmove.p0i8.p0i8.i32(i8* %dest, i8* %src, i32 20,
+                                        i32 1, i1 false)
+  ret void
+}
+
+define void @test_memmove_100(i8* %dest, i8* %src) {
+  call void @llvm.memmove.p0i8.p0i8.i32(i8* %dest, i8* %src, i32 100,
+                                        i32 1, i1 false)
+  ret void
+}
+
+define void @test_memset_7(i8* %dest, i8 %val) {
+  call void @llvm.memset.p0i8.i64(i8* %dest, i8 %val, i64 7,
+                                  i32 1, i1 false)
+  ret void
+}
+
+define void @test_memset_40(i8* %dest, i8 %val) {
+  call void @llvm.memset.p0i8.i64(i8* %dest, i8 %val, i64 40,
+                                  i32 1, i1 false)
+  ret void
+}
+
+define void @test_memset_1000(i8* %dest, i8 %val) {
+  call void @llvm.memset.p0i8.i64(i8* %dest, i8 %val, i64 1000,
+                                  i32 1, i1 false)
+  ret void
+}
+
+define void @test_memset_constant_value(i8* %dest) {
+  call void @llvm.memset.p0i8.i32(i8* %dest, i8 -86, i32 19, i32 1, i1 false)
+  ret void
+}
+
 declare i8* @llvm.nacl.read.tp()
 
 define i8* @test_nacl_read_tp() {
@@ -459,6 +847,1248 @@ define i32 @test_atomicrmw_i32_add(i32* %ptr, i32 %val) {
   ret i32 %1
 }
 
+; These test each atomicrmw operation at each size, returning the old
+; value.  The first argument selects the operation, so that the test
+; can loop over them.
+
+define i8 @test_atomicrmw_i8(i32 %op, i8* %ptr, i8 %val) {
+entry:
+  switch i32 %op, label %unknown [
+    i32 0, label %xchg
+    i32 1, label %add
+    i32 2, label %sub
+    i32 3, label %and
+    i32 4, label %nand
+    i32 5, label %or
+    i32 6, label %xor
+    i32 7, label %max
+    i32 8, label %min
+    i32 9, label %umax
+    i32 10, label %umin]
+xchg:
+  %xchg.result = atomicrmw xchg i8* %ptr, i8 %val seq_cst
+  ret i8 %xchg.result
+add:
+  %add.result = atomicrmw add i8* %ptr, i8 %val seq_cst
+  ret i8 %add.result
+sub:
+  %sub.result = atomicrmw sub i8* %ptr, i8 %val seq_cst
+  ret i8 %sub.result
+and:
+  %and.result = atomicrmw and i8* %ptr, i8 %val seq_cst
+  ret i8 %and.result
+nand:
+  %nand.result = atomicrmw nand i8* %ptr, i8 %val seq_cst
+  ret i8 %nand.result
+or:
+  %or.result = atomicrmw or i8* %ptr, i8 %val seq_cst
+  ret i8 %or.result
+xor:
+  %xor.result = atomicrmw xor i8* %ptr, i8 %val seq_cst
+  ret i8 %xor.result
+max:
+  %max.result = atomicrmw max i8* %ptr, i8 %val seq_cst
+  ret i8 %max.result
+min:
+  %min.result = atomicrmw min i8* %ptr, i8 %val seq_cst
+  ret i8 %min.result
+umax:
+  %umax.result = atomicrmw umax i8* %ptr, i8 %val seq_cst
+  ret i8 %umax.result
+umin:
+  %umin.result = atomicrmw umin i8* %ptr, i8 %val seq_cst
+  ret i8 %umin.result
+unknown:
+  unreachable
+}
+
+define i16 @test_atomicrmw_i16(i32 %op, i16* %ptr, i16 %val) {
+entry:
+  switch i32 %op, label %unknown [
+    i32 0, label %xchg
+    i32 1, label %add
+    i32 2, label %sub
+    i32 3, label %and
+    i32 4, label %nand
+    i32 5, label %or
+    i32 6, label %xor
+    i32 7, label %max
+    i32 8, label %min
+    i32 9, label %umax
+    i32 10, label %umin]
+xchg:
+  %xchg.result = atomicrmw xchg i16* %ptr, i16 %val seq_cst
+  ret i16 %xchg.result
+add:
+  %add.result = atomicrmw add i16* %ptr, i16 %val seq_cst
+  ret i16 %add.result
+sub:
+  %sub.result = atomicrmw sub i16* %ptr, i16 %val seq_cst
+  ret i16 %sub.result
+and:
+  %and.result = atomicrmw and i16* %ptr, i16 %val seq_cst
+  ret i16 %and.result
+nand:
+  %nand.result = atomicrmw nand i16* %ptr, i16 %val seq_cst
+  ret i16 %nand.result
+or:
+  %or.result = atomicrmw or i16* %ptr, i16 %val seq_cst
+  ret i16 %or.result
+xor:
+  %xor.result = atomicrmw xor i16* %ptr, i16 %val seq_cst
+  ret i16 %xor.result
+max:
+  %max.result = atomicrmw max i16* %ptr, i16 %val seq_cst
+  ret i16 %max.result
+min:
+  %min.result = atomicrmw min i16* %ptr, i16 %val seq_cst
+  ret i16 %min.result
+umax:
+  %umax.result = atomicrmw umax i16* %ptr, i16 %val seq_cst
+  ret i16 %umax.result
+umin:
+  %umin.result = atomicrmw umin i16* %ptr, i16 %val seq_cst
+  ret i16 %umin.result
+unknown:
+  unreachable
+}
+
+define i32 @test_atomicrmw_i32(i32 %op, i32* %ptr, i32 %val) {
+entry:
+  switch i32 %op, label %unknown [
+    i32 0, label %xchg
+    i32 1, label %add
+    i32 2, label %sub
+    i32 3, label %and
+    i32 4, label %nand
+    i32 5, label %or
+    i32 6, label %xor
+    i32 7, label %max
+    i32 8, label %min
+    i32 9, label %umax
+    i32 10, label %umin]
+xchg:
+  %xchg.result = atomicrmw xchg i32* %ptr, i32 %val seq_cst
+  ret i32 %xchg.result
+add:
+  %add.result = atomicrmw add i32* %ptr, i32 %val seq_cst
+  ret i32 %add.result
+sub:
+  %sub.result = atomicrmw sub i32* %ptr, i32 %val seq_cst
+  ret i32 %sub.result
+and:
+  %and.result = atomicrmw and i32* %ptr, i32 %val seq_cst
+  ret i32 %and.result
+nand:
+  %nand.result = atomicrmw nand i32* %ptr, i32 %val seq_cst
+  ret i32 %nand.result
+or:
+  %or.result = atomicrmw or i32* %ptr, i32 %val seq_cst
+  ret i32 %or.result
+xor:
+  %xor.result = atomicrmw xor i32* %ptr, i32 %val seq_cst
+  ret i32 %xor.result
+max:
+  %max.result = atomicrmw max i32* %ptr, i32 %val seq_cst
+  ret i32 %max.result
+min:
+  %min.result = atomicrmw min i32* %ptr, i32 %val seq_cst
+  ret i32 %min.result
+umax:
+  %umax.result = atomicrmw umax i32* %ptr, i32 %val seq_cst
+  ret i32 %umax.result
+umin:
+  %umin.result = atomicrmw umin i32* %ptr, i32 %val seq_cst
+  ret i32 %umin.result
+unknown:
+  unreachable
+}
+
+define i64 @test_atomicrmw_i64(i32 %op, i64* %ptr, i64 %val) {
+entry:
+  switch i32 %op, label %unknown [
+    i32 0, label %xchg
+    i32 1, label %add
+    i32 2, label %sub
+    i32 3, label %and
+    i32 4, label %nand
+    i32 5, label %or
+    i32 6, label %xor
+    i32 7, label %max
+    i32 8, label %min
+    i32 9, label %umax
+    i32 10, label %umin]
+xchg:
+  %xchg.result = atomicrmw xchg i64* %ptr, i64 %val seq_cst
+  ret i64 %xchg.result
+add:
+  %add.result = atomicrmw add i64* %ptr, i64 %val seq_cst
+  ret i64 %add.result
+sub:
+  %sub.result = atomicrmw sub i64* %ptr, i64 %val seq_cst
+  ret i64 %sub.result
+and:
+  %and.result = atomicrmw and i64* %ptr, i64 %val seq_cst
+  ret i64 %and.result
+nand:
+  %nand.result = atomicrmw nand i64* %ptr, i64 %val seq_cst
+  ret i64 %nand.result
+or:
+  %or.result = atomicrmw or i64* %ptr, i64 %val seq_cst
+  ret i64 %or.result
+xor:
+  %xor.result = atomicrmw xor i64* %ptr, i64 %val seq_cst
+  ret i64 %xor.result
+max:
+  %max.result = atomicrmw max i64* %ptr, i64 %val seq_cst
+  ret i64 %max.result
+min:
+  %min.result = atomicrmw min i64* %ptr, i64 %val seq_cst
+  ret i64 %min.result
+umax:
+  %umax.result = atomicrmw umax i64* %ptr, i64 %val seq_cst
+  ret i64 %umax.result
+umin:
+  %umin.result = atomicrmw umin i64* %ptr, i64 %val seq_cst
+  ret i64 %umin.result
+unknown:
+  unreachable
+}
+
+define void @test_atomicrmw_unused_result(i16* %ptr16, i32* %ptr32) {
+  %1 = atomicrmw add i16* %ptr16, i16 3 seq_cst
+  %2 = atomicrmw sub i32* %ptr32, i32 1 seq_cst
+  %3 = atomicrmw or i32* %ptr32, i32 256 seq_cst
+  ret void
+}
+
+define i8 @test_cmpxchg_i8(i8* %ptr, i8 %cmp, i8 %new) {
+  %1 = cmpxchg i8* %ptr, i8 %cmp, i8 %new seq_cst
+  ret i8 %1
+}
+
+define i32 @test_cmpxchg_i32(i32* %ptr, i32 %cmp, i32 %new) {
+  %1 = cmpxchg i32* %ptr, i32 %cmp, i32 %new seq_cst
+  ret i32 %1
+}
+
+define i64 @test_cmpxchg_i64(i64* %ptr, i64 %cmp, i64 %new) {
+  %1 = cmpxchg i64* %ptr, i64 %cmp, i64 %new seq_cst
+  ret i64 %1
+}
+
+define i32 @test_fence(i32* %ptr) {
+  store i32 1, i32* %ptr
+  fence seq_cst
+  fence acquire
+  %1 = load i32* %ptr
+  ret i32 %1
+}
+
+; Each of these selects an FP operation with its first argument, so
+; that the test can loop over them.
+
+define double @test_fp_arith_double(i32 %op, double %a, double %b) {
+entry:
+  switch i32 %op, label %unknown [
+    i32 0, label %fadd
+    i32 1, label %fsub
+    i32 2, label %fmul
+    i32 3, label %fdiv
+    i32 4, label %frem
+  ]
+fadd:
+  %fadd.result = fadd double %a, %b
+  ret double %fadd.result
+fsub:
+  %fsub.result = fsub double %a, %b
+  ret double %fsub.result
+fmul:
+  %fmul.result = fmul double %a, %b
+  ret double %fmul.result
+fdiv:
+  %fdiv.result = fdiv double %a, %b
+  ret double %fdiv.result
+frem:
+  %frem.result = frem double %a, %b
+  ret double %frem.result
+unknown:
+  unreachable
+}
+
+define float @test_fp_arith_float(i32 %op, float %a, float %b) {
+entry:
+  switch i32 %op, label %unknown [
+    i32 0, label %fadd
+    i32 1, label %fsub
+    i32 2, label %fmul
+    i32 3, label %fdiv
+    i32 4, label %frem
+  ]
+fadd:
+  %fadd.result = fadd float %a, %b
+  ret float %fadd.result
+fsub:
+  %fsub.result = fsub float %a, %b
+  ret float %fsub.result
+fmul:
+  %fmul.result = fmul float %a, %b
+  ret float %fmul.result
+fdiv:
+  %fdiv.result = fdiv float %a, %b
+  ret float %fdiv.result
+frem:
+  %frem.result = frem float %a, %b
+  ret float %frem.result
+unknown:
+  unreachable
+}
+
+; Returns the result of FP comparison number %pred, in LLVM's order.
+define i32 @test_fcmp(i32 %pred, double %a, double %b) {
+entry:
+  switch i32 %pred, label %unknown [
+    i32 0, label %false
+    i32 1, label %oeq
+    i32 2, label %ogt
+    i32 3, label %oge
+    i32 4, label %olt
+    i32 5, label %ole
+    i32 6, label %one
+    i32 7, label %ord
+    i32 8, label %uno
+    i32 9, label %ueq
+    i32 10, label %ugt
+    i32 11, label %uge
+    i32 12, label %ult
+    i32 13, label %ule
+    i32 14, label %une
+    i32 15, label %true
+  ]
+false:
+  %false.cmp = fcmp false double %a, %b
+  %false.result = zext i1 %false.cmp to i32
+  ret i32 %false.result
+oeq:
+  %oeq.cmp = fcmp oeq double %a, %b
+  %oeq.result = zext i1 %oeq.cmp to i32
+  ret i32 %oeq.result
+ogt:
+  %ogt.cmp = fcmp ogt double %a, %b
+  %ogt.result = zext i1 %ogt.cmp to i32
+  ret i32 %ogt.result
+oge:
+  %oge.cmp = fcmp oge double %a, %b
+  %oge.result = zext i1 %oge.cmp to i32
+  ret i32 %oge.result
+olt:
+  %olt.cmp = fcmp olt double %a, %b
+  %olt.result = zext i1 %olt.cmp to i32
+  ret i32 %olt.result
+ole:
+  %ole.cmp = fcmp ole double %a, %b
+  %ole.result = zext i1 %ole.cmp to i32
+  ret i32 %ole.result
+one:
+  %one.cmp = fcmp one double %a, %b
+  %one.result = zext i1 %one.cmp to i32
+  ret i32 %one.result
+ord:
+  %ord.cmp = fcmp ord double %a, %b
+  %ord.result = zext i1 %ord.cmp to i32
+  ret i32 %ord.result
+uno:
+  %uno.cmp = fcmp uno double %a, %b
+  %uno.result = zext i1 %uno.cmp to i32
+  ret i32 %uno.result
+ueq:
+  %ueq.cmp = fcmp ueq double %a, %b
+  %ueq.result = zext i1 %ueq.cmp to i32
+  ret i32 %ueq.result
+ugt:
+  %ugt.cmp = fcmp ugt double %a, %b
+  %ugt.result = zext i1 %ugt.cmp to i32
+  ret i32 %ugt.result
+uge:
+  %uge.cmp = fcmp uge double %a, %b
+  %uge.result = zext i1 %uge.cmp to i32
+  ret i32 %uge.result
+ult:
+  %ult.cmp = fcmp ult double %a, %b
+  %ult.result = zext i1 %ult.cmp to i32
+  ret i32 %ult.result
+ule:
+  %ule.cmp = fcmp ule double %a, %b
+  %ule.result = zext i1 %ule.cmp to i32
+  ret i32 %ule.result
+une:
+  %une.cmp = fcmp une double %a, %b
+  %une.result = zext i1 %une.cmp to i32
+  ret i32 %une.result
+true:
+  %true.cmp = fcmp true double %a, %b
+  %true.result = zext i1 %true.cmp to i32
+  ret i32 %true.result
+unknown:
+  unreachable
+}
+
+define i32 @test_fcmp_branch(float %a, float %b) {
+  %cmp = fcmp ult float %a, %b
+  br i1 %cmp, label %iftrue, label %iffalse
+iftrue:
+  ret i32 1
+iffalse:
+  ret i32 0
+}
+
+define double @test_fcmp_select(double %a, double %b) {
+  %cmp = fcmp olt double %a, %b
+  %min = select i1 %cmp, double %a, double %b
+  ret double %min
+}
+
+define double @test_fp_constant(double %a) {
+  %1 = fmul double %a, 2.5
+  %2 = fadd double %1, 2.5
+  %3 = fsub double 1.0, %2
+  ret double %3
+}
+
+define float @test_fp_constant_float(float %a) {
+  %1 = fmul float %a, 2.5
+  ret float %1
+}
+
+define void @test_fp_load_store(double* %src, double* %dest,
+                                float* %src_f, float* %dest_f) {
+  %1 = load double* %src
+  store double %1, double* %dest
+  %2 = load float* %src_f
+  store float %2, float* %dest_f
+  ret void
+}
+
+define void @test_fp_store_constant(double* %dest) {
+  store double 0.5, double* %dest
+  ret void
+}
+
+define float @test_fp_bitcast_from_i32(i32 %bits) {
+  %f = bitcast i32 %bits to float
+  %result = fadd float %f, 1.0
+  ret float %result
+}
+
+define i32 @test_fp_bitcast_to_i32(float %f) {
+  %bits = bitcast float %f to i32
+  ret i32 %bits
+}
+
+; Sums 1.0 + 2.0 + ... + %n.
+define double @test_fp_phi(i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [ 1, %entry ], [ %i.next, %loop ]
+  %sum = phi double [ 0.0, %entry ], [ %sum.next, %loop ]
+  %i.fp = sitofp i32 %i to double
+  %sum.next = fadd double %sum, %i.fp
+  %i.next = add i32 %i, 1
+  %done = icmp sgt i32 %i.next, %n
+  br i1 %done, label %exit, label %loop
+exit:
+  ret double %sum.next
+}
+
+define double @test_fp_call(double %a, double %b) {
+  %1 = call double @test_fp_arith_double(i32 2, double %a, double %b)
+  %2 = call float @test_fp_arith_float(i32 0, float 1.5, float 2.0)
+  %3 = fpext float %2 to double
+  %4 = fadd double %1, %3
+  ret double %4
+}
+
+define double @test_sitofp_i8(i8 %a) {
+  %1 = sitofp i8 %a to double
+  ret double %1
+}
+
+define double @test_sitofp_i32(i32 %a) {
+  %1 = sitofp i32 %a to double
+  ret double %1
+}
+
+define double @test_sitofp_i64(i64 %a) {
+  %1 = sitofp i64 %a to double
+  ret double %1
+}
+
+define double @test_uitofp_i8(i8 %a) {
+  %1 = uitofp i8 %a to double
+  ret double %1
+}
+
+define double @test_uitofp_i32(i32 %a) {
+  %1 = uitofp i32 %a to double
+  ret double %1
+}
+
+define double @test_uitofp_i64(i64 %a) {
+  %1 = uitofp i64 %a to double
+  ret double %1
+}
+
+define float @test_sitofp_i64_float(i64 %a) {
+  %1 = sitofp i64 %a to float
+  ret float %1
+}
+
+define float @test_uitofp_i64_float(i64 %a) {
+  %1 = uitofp i64 %a to float
+  ret float %1
+}
+
+define i32 @test_fptosi_i16(double %a) {
+  %1 = fptosi double %a to i16
+  %2 = sext i16 %1 to i32
+  ret i32 %2
+}
+
+define i32 @test_fptosi_i32(double %a) {
+  %1 = fptosi double %a to i32
+  ret i32 %1
+}
+
+define i64 @test_fptosi_i64(double %a) {
+  %1 = fptosi double %a to i64
+  ret i64 %1
+}
+
+define i32 @test_fptoui_i32(double %a) {
+  %1 = fptoui double %a to i32
+  ret i32 %1
+}
+
+define i64 @test_fptoui_i64(double %a) {
+  %1 = fptoui double %a to i64
+  ret i64 %1
+}
+
+define i32 @test_fptosi_float_i32(float %a) {
+  %1 = fptosi float %a to i32
+  ret i32 %1
+}
+
+define i64 @test_fptoui_float_i64(float %a) {
+  %1 = fptoui float %a to i64
+  ret i64 %1
+}
+
+define double @test_fpext(float %a) {
+  %1 = fpext float %a to double
+  ret double %1
+}
+
+define float @test_fptrunc(double %a) {
+  %1 = fptrunc double %a to float
+  ret float %1
+}
+
+; These apply a bit manipulation intrinsic selected by the first
+; argument: ctpop, ctlz, cttz, bswap, and then ctlz and cttz with
+; undefined results for zero.
+
+define i8 @test_bit_intrinsics_i8(i32 %op, i8 %a) {
+entry:
+  switch i32 %op, label %unknown [
+    i32 0, label %ctpop
+    i32 1, label %ctlz
+    i32 2, label %cttz
+    i32 4, label %ctlz_zero_undef
+    i32 5, label %cttz_zero_undef
+  ]
+ctpop:
+  %ctpop.result = call i8 @llvm.ctpop.i8(i8 %a)
+  ret i8 %ctpop.result
+ctlz:
+  %ctlz.result = call i8 @llvm.ctlz.i8(i8 %a, i1 false)
+  ret i8 %ctlz.result
+cttz:
+  %cttz.result = call i8 @llvm.cttz.i8(i8 %a, i1 false)
+  ret i8 %cttz.result
+ctlz_zero_undef:
+  %ctlz_zero_undef.result = call i8 @llvm.ctlz.i8(i8 %a, i1 true)
+  ret i8 %ctlz_zero_undef.result
+cttz_zero_undef:
+  %cttz_zero_undef.result = call i8 @llvm.cttz.i8(i8 %a, i1 true)
+  ret i8 %cttz_zero_undef.result
+unknown:
+  unreachable
+}
+
+define i16 @test_bit_intrinsics_i16(i32 %op, i16 %a) {
+entry:
+  switch i32 %op, label %unknown [
+    i32 0, label %ctpop
+    i32 1, label %ctlz
+    i32 2, label %cttz
+    i32 3, label %bswap
+    i32 4, label %ctlz_zero_undef
+    i32 5, label %cttz_zero_undef
+  ]
+ctpop:
+  %ctpop.result = call i16 @llvm.ctpop.i16(i16 %a)
+  ret i16 %ctpop.result
+ctlz:
+  %ctlz.result = call i16 @llvm.ctlz.i16(i16 %a, i1 false)
+  ret i16 %ctlz.result
+cttz:
+  %cttz.result = call i16 @llvm.cttz.i16(i16 %a, i1 false)
+  ret i16 %cttz.result
+bswap:
+  %bswap.result = call i16 @llvm.bswap.i16(i16 %a)
+  ret i16 %bswap.result
+ctlz_zero_undef:
+  %ctlz_zero_undef.result = call i16 @llvm.ctlz.i16(i16 %a, i1 true)
+  ret i16 %ctlz_zero_undef.result
+cttz_zero_undef:
+  %cttz_zero_undef.result = call i16 @llvm.cttz.i16(i16 %a, i1 true)
+  ret i16 %cttz_zero_undef.result
+unknown:
+  unreachable
+}
+
+define i32 @test_bit_intrinsics_i32(i32 %op, i32 %a) {
+entry:
+  switch i32 %op, label %unknown [
+    i32 0, label %ctpop
+    i32 1, label %ctlz
+    i32 2, label %cttz
+    i32 3, label %bswap
+    i32 4, label %ctlz_zero_undef
+    i32 5, label %cttz_zero_undef
+  ]
+ctpop:
+  %ctpop.result = call i32 @llvm.ctpop.i32(i32 %a)
+  ret i32 %ctpop.result
+ctlz:
+  %ctlz.result = call i32 @llvm.ctlz.i32(i32 %a, i1 false)
+  ret i32 %ctlz.result
+cttz:
+  %cttz.result = call i32 @llvm.cttz.i32(i32 %a, i1 false)
+  ret i32 %cttz.result
+bswap:
+  %bswap.result = call i32 @llvm.bswap.i32(i32 %a)
+  ret i32 %bswap.result
+ctlz_zero_undef:
+  %ctlz_zero_undef.result = call i32 @llvm.ctlz.i32(i32 %a, i1 true)
+  ret i32 %ctlz_zero_undef.result
+cttz_zero_undef:
+  %cttz_zero_undef.result = call i32 @llvm.cttz.i32(i32 %a, i1 true)
+  ret i32 %cttz_zero_undef.result
+unknown:
+  unreachable
+}
+
+define i64 @test_bit_intrinsics_i64(i32 %op, i64 %a) {
+entry:
+  switch i32 %op, label %unknown [
+    i32 0, label %ctpop
+    i32 1, label %ctlz
+    i32 2, label %cttz
+    i32 3, label %bswap
+    i32 4, label %ctlz_zero_undef
+    i32 5, label %cttz_zero_undef
+  ]
+ctpop:
+  %ctpop.result = call i64 @llvm.ctpop.i64(i64 %a)
+  ret i64 %ctpop.result
+ctlz:
+  %ctlz.result = call i64 @llvm.ctlz.i64(i64 %a, i1 false)
+  ret i64 %ctlz.result
+cttz:
+  %cttz.result = call i64 @llvm.cttz.i64(i64 %a, i1 false)
+  ret i64 %cttz.result
+bswap:
+  %bswap.result = call i64 @llvm.bswap.i64(i64 %a)
+  ret i64 %bswap.result
+ctlz_zero_undef:
+  %ctlz_zero_undef.result = call i64 @llvm.ctlz.i64(i64 %a, i1 true)
+  ret i64 %ctlz_zero_undef.result
+cttz_zero_undef:
+  %cttz_zero_undef.result = call i64 @llvm.cttz.i64(i64 %a, i1 true)
+  ret i64 %cttz_zero_undef.result
+unknown:
+  unreachable
+}
+
+declare i8 @llvm.ctpop.i8(i8)
+declare i8 @llvm.ctlz.i8(i8, i1)
+declare i8 @llvm.cttz.i8(i8, i1)
+declare i16 @llvm.ctpop.i16(i16)
+declare i16 @llvm.ctlz.i16(i16, i1)
+declare i16 @llvm.cttz.i16(i16, i1)
+declare i16 @llvm.bswap.i16(i16)
+declare i32 @llvm.ctpop.i32(i32)
+declare i32 @llvm.ctlz.i32(i32, i1)
+declare i32 @llvm.cttz.i32(i32, i1)
+declare i32 @llvm.bswap.i32(i32)
+declare i64 @llvm.ctpop.i64(i64)
+declare i64 @llvm.ctlz.i64(i64, i1)
+declare i64 @llvm.cttz.i64(i64, i1)
+declare i64 @llvm.bswap.i64(i64)
+
+; These apply an arithmetic-with-overflow intrinsic selected by the
+; first argument: sadd, uadd, ssub, usub, smul and umul.  They store
+; the result and return the overflow flag.
+
+define i32 @test_overflow_i8(i32 %op, i8 %a, i8 %b, i8* %result) {
+entry:
+  switch i32 %op, label %unknown [
+    i32 0, label %sadd
+    i32 1, label %uadd
+    i32 2, label %ssub
+    i32 3, label %usub
+    i32 4, label %smul
+    i32 5, label %umul
+  ]
+sadd:
+  %sadd.pair = call {i8, i1} @llvm.sadd.with.overflow.i8(i8 %a, i8 %b)
+  %sadd.value = extractvalue {i8, i1} %sadd.pair, 0
+  store i8 %sadd.value, i8* %result
+  %sadd.overflow = extractvalue {i8, i1} %sadd.pair, 1
+  %sadd.result = zext i1 %sadd.overflow to i32
+  ret i32 %sadd.result
+uadd:
+  %uadd.pair = call {i8, i1} @llvm.uadd.with.overflow.i8(i8 %a, i8 %b)
+  %uadd.value = extractvalue {i8, i1} %uadd.pair, 0
+  store i8 %uadd.value, i8* %result
+  %uadd.overflow = extractvalue {i8, i1} %uadd.pair, 1
+  %uadd.result = zext i1 %uadd.overflow to i32
+  ret i32 %uadd.result
+ssub:
+  %ssub.pair = call {i8, i1} @llvm.ssub.with.overflow.i8(i8 %a, i8 %b)
+  %ssub.value = extractvalue {i8, i1} %ssub.pair, 0
+  store i8 %ssub.value, i8* %result
+  %ssub.overflow = extractvalue {i8, i1} %ssub.pair, 1
+  %ssub.result = zext i1 %ssub.overflow to i32
+  ret i32 %ssub.result
+usub:
+  %usub.pair = call {i8, i1} @llvm.usub.with.overflow.i8(i8 %a, i8 %b)
+  %usub.value = extractvalue {i8, i1} %usub.pair, 0
+  store i8 %usub.value, i8* %result
+  %usub.overflow = extractvalue {i8, i1} %usub.pair, 1
+  %usub.result = zext i1 %usub.overflow to i32
+  ret i32 %usub.result
+smul:
+  %smul.pair = call {i8, i1} @llvm.smul.with.overflow.i8(i8 %a, i8 %b)
+  %smul.value = extractvalue {i8, i1} %smul.pair, 0
+  store i8 %smul.value, i8* %result
+  %smul.overflow = extractvalue {i8, i1} %smul.pair, 1
+  %smul.result = zext i1 %smul.overflow to i32
+  ret i32 %smul.result
+umul:
+  %umul.pair = call {i8, i1} @llvm.umul.with.overflow.i8(i8 %a, i8 %b)
+  %umul.value = extractvalue {i8, i1} %umul.pair, 0
+  store i8 %umul.value, i8* %result
+  %umul.overflow = extractvalue {i8, i1} %umul.pair, 1
+  %umul.result = zext i1 %umul.overflow to i32
+  ret i32 %umul.result
+unknown:
+  unreachable
+}
+
+define i32 @test_overflow_i16(i32 %op, i16 %a, i16 %b, i16* %result) {
+entry:
+  switch i32 %op, label %unknown [
+    i32 0, label %sadd
+    i32 1, label %uadd
+    i32 2, label %ssub
+    i32 3, label %usub
+    i32 4, label %smul
+    i32 5, label %umul
+  ]
+sadd:
+  %sadd.pair = call {i16, i1} @llvm.sadd.with.overflow.i16(i16 %a, i16 %b)
+  %sadd.value = extractvalue {i16, i1} %sadd.pair, 0
+  store i16 %sadd.value, i16* %result
+  %sadd.overflow = extractvalue {i16, i1} %sadd.pair, 1
+  %sadd.result = zext i1 %sadd.overflow to i32
+  ret i32 %sadd.result
+uadd:
+  %uadd.pair = call {i16, i1} @llvm.uadd.with.overflow.i16(i16 %a, i16 %b)
+  %uadd.value = extractvalue {i16, i1} %uadd.pair, 0
+  store i16 %uadd.value, i16* %result
+  %uadd.overflow = extractvalue {i16, i1} %uadd.pair, 1
+  %uadd.result = zext i1 %uadd.overflow to i32
+  ret i32 %uadd.result
+ssub:
+  %ssub.pair = call {i16, i1} @llvm.ssub.with.overflow.i16(i16 %a, i16 %b)
+  %ssub.value = extractvalue {i16, i1} %ssub.pair, 0
+  store i16 %ssub.value, i16* %result
+  %ssub.overflow = extractvalue {i16, i1} %ssub.pair, 1
+  %ssub.result = zext i1 %ssub.overflow to i32
+  ret i32 %ssub.result
+usub:
+  %usub.pair = call {i16, i1} @llvm.usub.with.overflow.i16(i16 %a, i16 %b)
+  %usub.value = extractvalue {i16, i1} %usub.pair, 0
+  store i16 %usub.value, i16* %result
+  %usub.overflow = extractvalue {i16, i1} %usub.pair, 1
+  %usub.result = zext i1 %usub.overflow to i32
+  ret i32 %usub.result
+smul:
+  %smul.pair = call {i16, i1} @llvm.smul.with.overflow.i16(i16 %a, i16 %b)
+  %smul.value = extractvalue {i16, i1} %smul.pair, 0
+  store i16 %smul.value, i16* %result
+  %smul.overflow = extractvalue {i16, i1} %smul.pair, 1
+  %smul.result = zext i1 %smul.overflow to i32
+  ret i32 %smul.result
+umul:
+  %umul.pair = call {i16, i1} @llvm.umul.with.overflow.i16(i16 %a, i16 %b)
+  %umul.value = extractvalue {i16, i1} %umul.pair, 0
+  store i16 %umul.value, i16* %result
+  %umul.overflow = extractvalue {i16, i1} %umul.pair, 1
+  %umul.result = zext i1 %umul.overflow to i32
+  ret i32 %umul.result
+unknown:
+  unreachable
+}
+
+define i32 @test_overflow_i32(i32 %op, i32 %a, i32 %b, i32* %result) {
+entry:
+  switch i32 %op, label %unknown [
+    i32 0, label %sadd
+    i32 1, label %uadd
+    i32 2, label %ssub
+    i32 3, label %usub
+    i32 4, label %smul
+    i32 5, label %umul
+  ]
+sadd:
+  %sadd.pair = call {i32, i1} @llvm.sadd.with.overflow.i32(i32 %a, i32 %b)
+  %sadd.value = extractvalue {i32, i1} %sadd.pair, 0
+  store i32 %sadd.value, i32* %result
+  %sadd.overflow = extractvalue {i32, i1} %sadd.pair, 1
+  %sadd.result = zext i1 %sadd.overflow to i32
+  ret i32 %sadd.result
+uadd:
+  %uadd.pair = call {i32, i1} @llvm.uadd.with.overflow.i32(i32 %a, i32 %b)
+  %uadd.value = extractvalue {i32, i1} %uadd.pair, 0
+  store i32 %uadd.value, i32* %result
+  %uadd.overflow = extractvalue {i32, i1} %uadd.pair, 1
+  %uadd.result = zext i1 %uadd.overflow to i32
+  ret i32 %uadd.result
+ssub:
+  %ssub.pair = call {i32, i1} @llvm.ssub.with.overflow.i32(i32 %a, i32 %b)
+  %ssub.value = extractvalue {i32, i1} %ssub.pair, 0
+  store i32 %ssub.value, i32* %result
+  %ssub.overflow = extractvalue {i32, i1} %ssub.pair, 1
+  %ssub.result = zext i1 %ssub.overflow to i32
+  ret i32 %ssub.result
+usub:
+  %usub.pair = call {i32, i1} @llvm.usub.with.overflow.i32(i32 %a, i32 %b)
+  %usub.value = extractvalue {i32, i1} %usub.pair, 0
+  store i32 %usub.value, i32* %result
+  %usub.overflow = extractvalue {i32, i1} %usub.pair, 1
+  %usub.result = zext i1 %usub.overflow to i32
+  ret i32 %usub.result
+smul:
+  %smul.pair = call {i32, i1} @llvm.smul.with.overflow.i32(i32 %a, i32 %b)
+  %smul.value = extractvalue {i32, i1} %smul.pair, 0
+  store i32 %smul.value, i32* %result
+  %smul.overflow = extractvalue {i32, i1} %smul.pair, 1
+  %smul.result = zext i1 %smul.overflow to i32
+  ret i32 %smul.result
+umul:
+  %umul.pair = call {i32, i1} @llvm.umul.with.overflow.i32(i32 %a, i32 %b)
+  %umul.value = extractvalue {i32, i1} %umul.pair, 0
+  store i32 %umul.value, i32* %result
+  %umul.overflow = extractvalue {i32, i1} %umul.pair, 1
+  %umul.result = zext i1 %umul.overflow to i32
+  ret i32 %umul.result
+unknown:
+  unreachable
+}
+
+define i32 @test_overflow_i64(i32 %op, i64 %a, i64 %b, i64* %result) {
+entry:
+  switch i32 %op, label %unknown [
+    i32 0, label %sadd
+    i32 1, label %uadd
+    i32 2, label %ssub
+    i32 3, label %usub
+    i32 4, label %smul
+    i32 5, label %umul
+  ]
+sadd:
+  %sadd.pair = call {i64, i1} @llvm.sadd.with.overflow.i64(i64 %a, i64 %b)
+  %sadd.value = extractvalue {i64, i1} %sadd.pair, 0
+  store i64 %sadd.value, i64* %result
+  %sadd.overflow = extractvalue {i64, i1} %sadd.pair, 1
+  %sadd.result = zext i1 %sadd.overflow to i32
+  ret i32 %sadd.result
+uadd:
+  %uadd.pair = call {i64, i1} @llvm.uadd.with.overflow.i64(i64 %a, i64 %b)
+  %uadd.value = extractvalue {i64, i1} %uadd.pair, 0
+  store i64 %uadd.value, i64* %result
+  %uadd.overflow = extractvalue {i64, i1} %uadd.pair, 1
+  %uadd.result = zext i1 %uadd.overflow to i32
+  ret i32 %uadd.result
+ssub:
+  %ssub.pair = call {i64, i1} @llvm.ssub.with.overflow.i64(i64 %a, i64 %b)
+  %ssub.value = extractvalue {i64, i1} %ssub.pair, 0
+  store i64 %ssub.value, i64* %result
+  %ssub.overflow = extractvalue {i64, i1} %ssub.pair, 1
+  %ssub.result = zext i1 %ssub.overflow to i32
+  ret i32 %ssub.result
+usub:
+  %usub.pair = call {i64, i1} @llvm.usub.with.overflow.i64(i64 %a, i64 %b)
+  %usub.value = extractvalue {i64, i1} %usub.pair, 0
+  store i64 %usub.value, i64* %result
+  %usub.overflow = extractvalue {i64, i1} %usub.pair, 1
+  %usub.result = zext i1 %usub.overflow to i32
+  ret i32 %usub.result
+smul:
+  %smul.pair = call {i64, i1} @llvm.smul.with.overflow.i64(i64 %a, i64 %b)
+  %smul.value = extractvalue {i64, i1} %smul.pair, 0
+  store i64 %smul.value, i64* %result
+  %smul.overflow = extractvalue {i64, i1} %smul.pair, 1
+  %smul.result = zext i1 %smul.overflow to i32
+  ret i32 %smul.result
+umul:
+  %umul.pair = call {i64, i1} @llvm.umul.with.overflow.i64(i64 %a, i64 %b)
+  %umul.value = extractvalue {i64, i1} %umul.pair, 0
+  store i64 %umul.value, i64* %result
+  %umul.overflow = extractvalue {i64, i1} %umul.pair, 1
+  %umul.result = zext i1 %umul.overflow to i32
+  ret i32 %umul.result
+unknown:
+  unreachable
+}
+
+declare {i8, i1} @llvm.sadd.with.overflow.i8(i8, i8)
+declare {i8, i1} @llvm.uadd.with.overflow.i8(i8, i8)
+declare {i8, i1} @llvm.ssub.with.overflow.i8(i8, i8)
+declare {i8, i1} @llvm.usub.with.overflow.i8(i8, i8)
+declare {i8, i1} @llvm.smul.with.overflow.i8(i8, i8)
+declare {i8, i1} @llvm.umul.with.overflow.i8(i8, i8)
+declare {i16, i1} @llvm.sadd.with.overflow.i16(i16, i16)
+declare {i16, i1} @llvm.uadd.with.overflow.i16(i16, i16)
+declare {i16, i1} @llvm.ssub.with.overflow.i16(i16, i16)
+declare {i16, i1} @llvm.usub.with.overflow.i16(i16, i16)
+declare {i16, i1} @llvm.smul.with.overflow.i16(i16, i16)
+declare {i16, i1} @llvm.umul.with.overflow.i16(i16, i16)
+declare {i32, i1} @llvm.sadd.with.overflow.i32(i32, i32)
+declare {i32, i1} @llvm.uadd.with.overflow.i32(i32, i32)
+declare {i32, i1} @llvm.ssub.with.overflow.i32(i32, i32)
+declare {i32, i1} @llvm.usub.with.overflow.i32(i32, i32)
+declare {i32, i1} @llvm.smul.with.overflow.i32(i32, i32)
+declare {i32, i1} @llvm.umul.with.overflow.i32(i32, i32)
+declare {i64, i1} @llvm.sadd.with.overflow.i64(i64, i64)
+declare {i64, i1} @llvm.uadd.with.overflow.i64(i64, i64)
+declare {i64, i1} @llvm.ssub.with.overflow.i64(i64, i64)
+declare {i64, i1} @llvm.usub.with.overflow.i64(i64, i64)
+declare {i64, i1} @llvm.smul.with.overflow.i64(i64, i64)
+declare {i64, i1} @llvm.umul.with.overflow.i64(i64, i64)
+
+; These repeat computations within a block, which reuse the earlier
+; results where that is safe.
+
+define i32 @test_redundant_arith(i32 %a, i32 %b) {
+  %sum1 = add i32 %a, %b
+  %sum2 = add i32 %b, %a
+  %diff1 = sub i32 %a, %b
+  %diff2 = sub i32 %b, %a
+  %x = mul i32 %sum1, %diff1
+  %y = mul i32 %sum2, %diff2
+  %result = sub i32 %x, %y
+  ret i32 %result
+}
+
+define i32 @test_redundant_across_blocks(i32 %a, i32 %cond) {
+entry:
+  %x1 = mul i32 %a, 3
+  %x2 = mul i32 %a, 3
+  %cmp = icmp ne i32 %cond, 0
+  br i1 %cmp, label %then, label %exit
+then:
+  %y = add i32 %x2, 1
+  br label %exit
+exit:
+  %phi = phi i32 [ %x2, %entry ], [ %y, %then ]
+  %result = add i32 %phi, %x1
+  ret i32 %result
+}
+
+; %elt2 reuses %elt1, so %elt1 must be computed rather than folded
+; into the load's memory operand.
+define i32 @test_redundant_address(i32* %ptr) {
+  %addr1 = ptrtoint i32* %ptr to i32
+  %elt1 = add i32 %addr1, 4
+  %ptr1 = inttoptr i32 %elt1 to i32*
+  %val = load i32* %ptr1
+  %addr2 = ptrtoint i32* %ptr to i32
+  %elt2 = add i32 %addr2, 4
+  %sum = add i32 %val, %elt2
+  %result = sub i32 %sum, %addr1
+  ret i32 %result
+}
+
+define void @write_to_ptr(i32* %ptr, i32 %val) {
+  store i32 %val, i32* %ptr
+  ret void
+}
+
+; The second load can reuse the first, but the store and the call
+; might change the value, so the later loads cannot.
+define i32 @test_redundant_loads(i32* %ptr, i32* %other) {
+  %a = load i32* %ptr
+  %b = load i32* %ptr
+  store i32 100, i32* %other
+  %c = load i32* %ptr
+  call void @write_to_ptr(i32* %ptr, i32 1000)
+  %d = load i32* %ptr
+  %sum1 = add i32 %a, %b
+  %sum2 = add i32 %sum1, %c
+  %sum3 = add i32 %sum2, %d
+  ret i32 %sum3
+}
+
+; The loads of %ptr after an atomic or volatile load can't reuse the
+; load before it.  codegen_test changes *%ptr when %flag is read.
+define i32 @test_load_after_atomic_load(i32* %ptr, i32* %flag) {
+  %a = load i32* %ptr
+  %f = load atomic i32* %flag acquire, align 4
+  %b = load i32* %ptr
+  %b10 = mul i32 %b, 10
+  %sum1 = add i32 %a, %b10
+  %sum = add i32 %sum1, %f
+  ret i32 %sum
+}
+
+define i32 @test_load_after_volatile_load(i32* %ptr, i32* %flag) {
+  %a = load i32* %ptr
+  %f = load volatile i32* %flag
+  %b = load i32* %ptr
+  %b10 = mul i32 %b, 10
+  %sum1 = add i32 %a, %b10
+  %sum = add i32 %sum1, %f
+  ret i32 %sum
+}
+
+; The short-lived values in the loop can share stack slots with each
+; other, but not with the values that are live across the loop.
+define i64 @test_stack_slot_sharing(i64 %a, i32 %n) {
+entry:
+  %a2 = mul i64 %a, 2
+  %f = sitofp i32 %n to double
+  br label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %acc = phi i64 [ %a, %entry ], [ %acc.next, %loop ]
+  %t1 = add i64 %acc, 1
+  %t2 = mul i64 %t1, 3
+  %t3 = sub i64 %t2, %acc
+  %t4 = sitofp i64 %t3 to double
+  %t5 = fmul double %t4, 0.5
+  %t6 = fptosi double %t5 to i64
+  %acc.next = add i64 %t6, %t1
+  %i.next = add i32 %i, 1
+  %done = icmp eq i32 %i.next, %n
+  br i1 %done, label %exit, label %loop
+exit:
+  %fi = fptosi double %f to i64
+  %sum = add i64 %acc.next, %a2
+  %result = add i64 %sum, %fi
+  ret i64 %result
+}
+
+; This has the values of test_stack_slot_sharing, but the values in
+; the loop are all used after it, so they can't share stack slots.
+define i64 @test_stack_slot_no_sharing(i64 %a, i32 %n) {
+entry:
+  %a2 = mul i64 %a, 2
+  %f = sitofp i32 %n to double
+  br label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %acc = phi i64 [ %a, %entry ], [ %acc.next, %loop ]
+  %t1 = add i64 %acc, 1
+  %t2 = mul i64 %t1, 3
+  %t3 = sub i64 %t2, %acc
+  %t4 = sitofp i64 %t3 to double
+  %t5 = fmul double %t4, 0.5
+  %t6 = fptosi double %t5 to i64
+  %acc.next = add i64 %t6, %t1
+  %i.next = add i32 %i, 1
+  %done = icmp eq i32 %i.next, %n
+  br i1 %done, label %exit, label %loop
+exit:
+  %fi = fptosi double %f to i64
+  %sum = add i64 %acc.next, %a2
+  %sum2 = add i64 %sum, %fi
+  %u1 = add i64 %t2, %t3
+  %u2 = fadd double %t4, %t5
+  %u3 = fptosi double %u2 to i64
+  %u4 = add i64 %u1, %u3
+  %u5 = add i64 %u4, %t6
+  %result = add i64 %sum2, %u5
+  ret i64 %result
+}
+
+; The unused values here, including the cycle of phi nodes, generate
+; no code.
+define i32 @test_dead_values(i32* %ptr, i32 %n) {
+entry:
+  %unused1 = add i32 %n, 1
+  %unused2 = load i32* %ptr
+  %unused3 = zext i32 %unused2 to i64
+  br label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %dead = phi i64 [ 0, %entry ], [ %dead.next, %loop ]
+  %dead.next = add i64 %dead, 7
+  %i.next = add i32 %i, 1
+  store i32 %i.next, i32* %ptr
+  %done = icmp eq i32 %i.next, %n
+  br i1 %done, label %exit, label %loop
+exit:
+  %unused4 = call i32 @llvm.ctpop.i32(i32 %n)
+  ret i32 %i.next
+}
+
+; test_dead_values without the unused values, which should get the
+; same frame.
+define i32 @test_dead_values_removed(i32* %ptr, i32 %n) {
+entry:
+  br label %loop
+loop:
+  %i = phi i32 [ 0, %entry ], [ %i.next, %loop ]
+  %i.next = add i32 %i, 1
+  store i32 %i.next, i32* %ptr
+  %done = icmp eq i32 %i.next, %n
+  br i1 %done, label %exit, label %loop
+exit:
+  ret i32 %i.next
+}
+
+; The byte loads are zero-extended as they are loaded, so the
+; comparisons and the zext need no extension of their own.
+define i32 @test_parse_decimal(i8* %str) {
+entry:
+  br label %loop
+loop:
+  %ptr = phi i8* [ %str, %entry ], [ %ptr.next, %digit ]
+  %acc = phi i32 [ 0, %entry ], [ %acc.next, %digit ]
+  %c = load i8* %ptr
+  %below = icmp ult i8 %c, 48
+  br i1 %below, label %exit, label %check
+check:
+  %above = icmp ugt i8 %c, 57
+  br i1 %above, label %exit, label %digit
+digit:
+  %c32 = zext i8 %c to i32
+  %d = sub i32 %c32, 48
+  %acc10 = mul i32 %acc, 10
+  %acc.next = add i32 %acc10, %d
+  %ptr.next = getelementptr i8* %ptr, i32 1
+  br label %loop
+exit:
+  ret i32 %acc
+}
+
+; Known zero extension is kept through udiv, or and lshr.
+define i32 @test_narrow_load_unsigned(i8* %a, i16* %b) {
+  %x = load i8* %a
+  %y = load i16* %b
+  %q = udiv i16 %y, 3
+  %x16 = zext i8 %x to i16
+  %s = or i16 %x16, %q
+  %r = lshr i16 %s, 1
+  %r32 = zext i16 %r to i32
+  ret i32 %r32
+}
+
+; The i8 load is only used by a sext, so it is sign-extended as it
+; is loaded, and the phi node of sign-extended values is too.
+define i32 @test_narrow_load_signed(i8* %a, i16* %b, i32 %cond) {
+entry:
+  %x = load i8* %a
+  %y = load i16* %b
+  %x16 = sext i8 %x to i16
+  %c = icmp ne i32 %cond, 0
+  %v = select i1 %c, i16 %x16, i16 %y
+  %neg = icmp slt i16 %v, 0
+  br i1 %neg, label %negative, label %exit
+negative:
+  %half = sdiv i16 %v, 2
+  br label %exit
+exit:
+  %r = phi i16 [ %v, %entry ], [ %half, %negative ]
+  %r32 = sext i16 %r to i32
+  ret i32 %r32
+}
+
+; Internal functions whose address is never taken get their first
+; three 32-bit arguments in registers.  The i64 and double arguments
+; and the fourth 32-bit argument are passed on the stack.
+define internal i64 @register_args_callee(i32 %a, i64 %b, i8 %c, double %d,
+                                          i32* %e, i32 %f) {
+  %a1000 = mul i32 %a, 1000
+  %c32 = zext i8 %c to i32
+  %c100 = mul i32 %c32, 100
+  %e.val = load i32* %e
+  %e10 = mul i32 %e.val, 10
+  %d32 = fptosi double %d to i32
+  %s1 = add i32 %a1000, %c100
+  %s2 = add i32 %s1, %e10
+  %s3 = add i32 %s2, %f
+  %s4 = add i32 %s3, %d32
+  %s64 = sext i32 %s4 to i64
+  %result = add i64 %s64, %b
+  ret i64 %result
+}
+
+define i64 @test_register_args(i32 %a, i64 %b, i32 %e.val, i32 %f) {
+  %e = alloca i32
+  store i32 %e.val, i32* %e
+  %result = call i64 @register_args_callee(i32 %a, i64 %b, i8 7,
+                                           double 2.5, i32* %e, i32 %f)
+  ret i64 %result
+}
+
+define internal i32 @register_args_sum(i32 %n, i32 %acc) {
+entry:
+  %done = icmp eq i32 %n, 0
+  br i1 %done, label %exit, label %recurse
+recurse:
+  %n.next = sub i32 %n, 1
+  %acc.next = add i32 %acc, %n
+  %result = call i32 @register_args_sum(i32 %n.next, i32 %acc.next)
+  ret i32 %result
+exit:
+  ret i32 %acc
+}
+
+define i32 @test_register_args_recursive(i32 %n) {
+  %result = call i32 @register_args_sum(i32 %n, i32 0)
+  ret i32 %result
+}
+
+; Calling a function through a bitcast that passes more arguments
+; than the function takes is allowed.  The extra argument is ignored.
+define internal i32 @bitcast_arity_callee(i32 %a, i32 %b) {
+  %result = sub i32 %a, %b
+  ret i32 %result
+}
+
+define i32 @test_call_bitcast_arity(i32 %a, i32 %b) {
+  %result = call i32 bitcast (i32 (i32, i32)* @bitcast_arity_callee
+                              to i32 (i32, i32, i32)*)(i32 %a, i32 %b,
+                                                       i32 99)
+  ret i32 %result
+}
 
 declare void @llvm.va_start(i8*)
 declare void @llvm.va_end(i8*)
@@ -48,6 +48,13 @@ C_OPERATORS = [
   ]
 
 
+# Operators from C_OPERATORS that also apply to FP types.
+C_FP_OPERATORS = [
+  'add', 'sub', 'mul', 'div',
+  'eq', 'ne', 'gt', 'ge', 'lt', 'le',
+  ]
+
+
 # TODO: Test comparisons too
 LLVM_OPERATORS = [
   'add', 'sub', 'mul',
@@ -85,6 +92,25 @@ void func_%(op_name)s_%(ty)s(void *arg1, void *arg2, void *result) {
         print code
         func_list.append('  { "%(func_name)s", %(func_name)s },\n'
                          % {'func_name': func_name})
+  # The FP tests convert their integer arguments to FP and the result
+  # back to an integer, which tests the conversions too.
+  for ty in ('double', 'float'):
+    for op_name, op in C_OPERATORS:
+      if op_name not in C_FP_OPERATORS:
+        continue
+      func_name = 'func_%s_%s' % (op_name, ty)
+      args = {'ty': ty,
+              'op_name': op_name,
+              'op': op}
+      code = """\
+void func_%(op_name)s_%(ty)s(void *arg1, void *arg2, void *result) {
+  *(int64_t *) result =
+      (%(ty)s) *(int64_t *) arg1 %(op)s (%(ty)s) *(int64_t *) arg2;
+}
+""" % args
+      print code
+      func_list.append('  { "%(func_name)s", %(func_name)s },\n'
+                       % {'func_name': func_name})
 
   print 'struct TestFunc test_funcs_c[] = {'
   print ''.join(func_list),
@@ -92,6 +118,23 @@ void func_%(op_name)s_%(ty)s(void *arg1, void *arg2, void *result) {
   print '};'
 
 
+def get_constant_operands(op_name, int_size):
+  # Constants to use as the second operand, to test the code generated
+  # for operations with a constant operand.
+  if int_size == 1:
+    return []
+  if op_name in ('shl', 'lshr', 'ashr'):
+    return [1, int_size - 1]
+  constants = [3, -7, 4, -16]
+  if int_size >= 16:
+    constants.append(1000)
+  if int_size >= 32:
+    constants.append(100000)
+  if int_size == 64:
+    constants.append(0x500000003)
+  return constants
+
+
 def generate_ll():
   # Generating LLVM textual assembly is rather clumsy because the type
   # names are duplicated so often.  It might be cleaner to do this
@@ -101,9 +144,7 @@ def generate_ll():
   print 'target triple = "i386-pc-linux-gnu"\n'
   print 'target datalayout = "p:32:32:32"'
   func_names = []
-  # TODO: Test i64 too.  Testing i64 requires omitting the trunc/zext
-  # operations below.
-  for int_size in (32, 16, 8, 1):
+  for int_size in (64, 32, 16, 8, 1):
     for op_name in LLVM_OPERATORS:
       if int_size == 1 and op_name not in ('and', 'or', 'xor'):
         # Operations other than logic operations on i1 are somewhat
@@ -112,25 +153,50 @@ def generate_ll():
         # shifting) or division-by-zero.
         continue
       ty = 'i%i' % int_size
-      func_name = 'func_%s_%s' % (op_name, ty)
-      print '@name_%s = constant [%i x i8] c"%s\\00"' % (
-          func_name, len(func_name) + 1, func_name)
-      template = """\
+      # The second operand is either the second argument, or a
+      # constant, in which case the second argument is ignored.
+      operands = [(None, '%arg2')]
+      for constant in get_constant_operands(op_name, int_size):
+        if constant < 0:
+          suffix = 'constm%i' % -constant
+        else:
+          suffix = 'const%i' % constant
+        operands.append((suffix, str(constant)))
+      for suffix, operand in operands:
+        func_name = 'func_%s_%s' % (op_name, ty)
+        if suffix is not None:
+          func_name += '_' + suffix
+        print '@name_%s = constant [%i x i8] c"%s\\00"' % (
+            func_name, len(func_name) + 1, func_name)
+        if int_size == 64:
+          # No trunc/zext is needed in this case.
+          template = """\
+define void @%(func)s(i64* %%argptr1, i64* %%argptr2, i64* %%resultptr) {
+  %%val1 = load i64* %%argptr1
+  %%arg2 = load i64* %%argptr2
+  %%result = %(op_name)s %(ty)s %%val1, %(operand)s
+  store i64 %%result, i64* %%resultptr
+  ret void
+}
+"""
+        else:
+          template = """\
 define void @%(func)s(i64* %%argptr1, i64* %%argptr2, i64* %%resultptr) {
   %%val1 = load i64* %%argptr1
   %%val2 = load i64* %%argptr2
   %%trunc1 = trunc i64 %%val1 to %(ty)s
-  %%trunc2 = trunc i64 %%val2 to %(ty)s
-  %%result = %(op_name)s %(ty)s %%trunc1, %%trunc2
+  %%arg2 = trunc i64 %%val2 to %(ty)s
+  %%result = %(op_name)s %(ty)s %%trunc1, %(operand)s
   %%ext = zext %(ty)s %%result to i64
   store i64 %%ext, i64* %%resultptr
   ret void
 }
 """
-      print template % {'ty': ty,
-                        'op_name': op_name,
-                        'func': func_name}
-      func_names.append(func_name)
+        print template % {'ty': ty,
+                          'op_name': op_name,
+                          'operand': operand,
+                          'func': func_name}
+        func_names.append(func_name)
 
   print '%TestFunc = type { i8*, i8* }'
   print '@test_funcs_ll = constant [%i x %%TestFunc] [' % (len(func_names) + 1)